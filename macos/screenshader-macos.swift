@@ -16,6 +16,26 @@ import CoreMedia
 
 // MARK: - GLSL → MSL Converter
 
+/// Shaders without a #version line are written against shaders/prelude.glsl,
+/// found next to the shader or in ../shaders beside this binary. Metal gets
+/// the prelude's SS_PORTABLE path: alpha does not carry luma here.
+func applyPrelude(_ glsl: String, shaderPath: String) -> String {
+    let hasVersion = glsl.components(separatedBy: "\n").contains {
+        $0.trimmingCharacters(in: .whitespaces).hasPrefix("#version")
+    }
+    if hasVersion { return glsl }
+    let shaderDir = (shaderPath as NSString).deletingLastPathComponent
+    let exeDir = ((CommandLine.arguments[0] as NSString).resolvingSymlinksInPath as NSString)
+        .deletingLastPathComponent
+    for dir in [shaderDir, exeDir + "/../shaders"] {
+        if let prelude = try? String(contentsOfFile: dir + "/prelude.glsl", encoding: .utf8) {
+            return "#define SS_PORTABLE 1\n" + prelude + "\n" + glsl
+        }
+    }
+    fputs("screenshader-macos: \(shaderPath) has no #version line and no prelude.glsl was found\n", stderr)
+    return glsl
+}
+
 /// Converts our limited GLSL 330 core fragment shaders to Metal Shading Language.
 /// Handles the specific subset used by screenshaders: texture sampling, uniforms,
 /// helper functions, and main() body.
@@ -39,6 +59,8 @@ func convertGLSLtoMSL(_ glsl: String) -> String {
     lines = lines.filter { line in
         let t = line.trimmingCharacters(in: .whitespaces)
         if t.hasPrefix("#version") { return false }
+        if t.hasPrefix("#extension") || t.hasPrefix("#line") { return false }
+        if t.hasPrefix("#pragma screenshader") { return false }
         if t == "in vec2 v_texcoord;" { return false }
         if t == "out vec4 frag_color;" { return false }
         if t.hasPrefix("uniform ") { return false }
@@ -52,6 +74,8 @@ func convertGLSLtoMSL(_ glsl: String) -> String {
     body = body.replacingOccurrences(of: "vec3", with: "float3")
     body = body.replacingOccurrences(of: "vec4", with: "float4")
     body = body.replacingOccurrences(of: "mat2", with: "float2x2")
+    body = body.replacingOccurrences(of: "mat3", with: "float3x3")
+    body = body.replacingOccurrences(of: "mat4", with: "float4x4")
     body = body.replacingOccurrences(of: "ivec2", with: "int2")
     body = body.replacingOccurrences(of: "ivec3", with: "int3")
     body = body.replacingOccurrences(of: "sampler2D", with: "texture2d<float>")
@@ -60,6 +84,9 @@ func convertGLSLtoMSL(_ glsl: String) -> String {
     body = body.replacingOccurrences(of: "fract(", with: "fract(")  // same in MSL
     body = body.replacingOccurrences(of: "mix(", with: "mix(")      // same in MSL
 
+    // No frame feedback here: the previous frame is the current one
+    body = body.replacingOccurrences(of: "u_prev", with: "u_screen")
+
     // texture() → u_screen.sample(samp, ...)
     // Pattern: texture(u_screen, expr) → u_screen.sample(samp, expr)
     body = convertTextureCalls(body)
@@ -275,90 +302,108 @@ func extractMainBody(_ code: String) -> (helpers: String, mainBody: String) {
 }
 
 /// Convert helper functions — add extra parameters for globals they reference
-/// (texture/sampler for u_screen, and u_resolution/u_time as needed)
+/// (texture/sampler for u_screen, and u_resolution/u_time as needed), directly
+/// or through other helpers they call (the prelude's helpers build on each other)
 func convertHelperFunctions(_ helpers: String) -> (code: String, fixups: [(name: String, extraArgs: [String])]) {
-    let lines = helpers.components(separatedBy: "\n")
-    var output: [String] = []
-    var inFunction = false
-    var funcLines: [String] = []
-    var funcName = ""
-    var funcUsesTexture = false
-    var funcUsesResolution = false
-    var funcUsesTime = false
+    // Split into top-level lines and function definitions
+    struct HelperFunc {
+        var name: String
+        var lines: [String]
+        var usesTexture = false
+        var usesResolution = false
+        var usesTime = false
+    }
+    enum Item { case line(String), function(Int) }
+
+    var items: [Item] = []
+    var funcs: [HelperFunc] = []
+    var current: HelperFunc? = nil
     var braceDepth = 0
 
-    // Track which functions need extra params so we can fix call sites
-    var funcsNeedingTexture: Set<String> = []
-    var funcsNeedingResolution: Set<String> = []
-    var funcsNeedingTime: Set<String> = []
+    func noteGlobals(_ f: inout HelperFunc, _ line: String) {
+        if line.contains("u_screen") || line.contains(".sample(samp,") { f.usesTexture = true }
+        if line.contains("u_resolution") { f.usesResolution = true }
+        if line.contains("u_time") { f.usesTime = true }
+    }
 
-    for line in lines {
-        if !inFunction {
+    for line in helpers.components(separatedBy: "\n") {
+        guard var f = current else {
             let trimmed = line.trimmingCharacters(in: .whitespaces)
             if isFunctionDefinition(trimmed) && !trimmed.hasPrefix("void main") {
-                inFunction = true
-                funcLines = [line]
-                funcName = extractFuncName(trimmed)
-                funcUsesTexture = line.contains("u_screen") || line.contains(".sample(samp,")
-                funcUsesResolution = line.contains("u_resolution")
-                funcUsesTime = line.contains("u_time")
+                var f = HelperFunc(name: extractFuncName(trimmed), lines: [line])
+                noteGlobals(&f, line)
+                current = f
                 braceDepth = countBraces(line)
                 if braceDepth == 0 && trimmed.hasSuffix("{") {
                     braceDepth = 1
                 }
-                continue
+            } else {
+                items.append(.line(line))
             }
-            output.append(line)
+            continue
+        }
+        f.lines.append(line)
+        noteGlobals(&f, line)
+        braceDepth += countBraces(line)
+        if braceDepth <= 0 {
+            // Function ended
+            items.append(.function(funcs.count))
+            funcs.append(f)
+            current = nil
         } else {
-            funcLines.append(line)
-            if line.contains("u_screen") || line.contains(".sample(samp,") { funcUsesTexture = true }
-            if line.contains("u_resolution") { funcUsesResolution = true }
-            if line.contains("u_time") { funcUsesTime = true }
-            braceDepth += countBraces(line)
-            if braceDepth <= 0 {
-                // Function ended — add extra params as needed
-                if funcUsesTexture || funcUsesResolution || funcUsesTime {
-                    var extraParams: [String] = []
-                    if funcUsesTexture {
-                        extraParams.append("texture2d<float> u_screen")
-                        extraParams.append("sampler samp")
-                        funcsNeedingTexture.insert(funcName)
-                    }
-                    if funcUsesResolution {
-                        extraParams.append("float2 u_resolution")
-                        funcsNeedingResolution.insert(funcName)
-                    }
-                    if funcUsesTime {
-                        extraParams.append("float u_time")
-                        funcsNeedingTime.insert(funcName)
-                    }
-                    funcLines = addExtraParams(funcLines, extraParams)
-                }
-                output.append(contentsOf: funcLines)
-                inFunction = false
-                funcLines = []
+            current = f
+        }
+    }
+
+    // A helper that calls another helper needs that helper's globals too
+    var changed = true
+    while changed {
+        changed = false
+        for i in funcs.indices {
+            let body = funcs[i].lines.dropFirst().joined(separator: "\n")
+            for callee in funcs where callee.name != funcs[i].name && body.contains(callee.name + "(") {
+                if callee.usesTexture && !funcs[i].usesTexture { funcs[i].usesTexture = true; changed = true }
+                if callee.usesResolution && !funcs[i].usesResolution { funcs[i].usesResolution = true; changed = true }
+                if callee.usesTime && !funcs[i].usesTime { funcs[i].usesTime = true; changed = true }
             }
         }
     }
 
-    if !funcLines.isEmpty {
-        output.append(contentsOf: funcLines)
+    var output: [String] = []
+    for item in items {
+        switch item {
+        case .line(let line):
+            output.append(line)
+        case .function(let i):
+            var extraParams: [String] = []
+            if funcs[i].usesTexture {
+                extraParams.append("texture2d<float> u_screen")
+                extraParams.append("sampler samp")
+            }
+            if funcs[i].usesResolution { extraParams.append("float2 u_resolution") }
+            if funcs[i].usesTime { extraParams.append("float u_time") }
+            output.append(contentsOf: extraParams.isEmpty ? funcs[i].lines
+                                                          : addExtraParams(funcs[i].lines, extraParams))
+        }
+    }
+    if let unfinished = current {
+        output.append(contentsOf: unfinished.lines)
     }
 
     var result = output.joined(separator: "\n")
 
     // Build fixups list for fixing call sites (both in helpers and in mainBody)
     var fixups: [(name: String, extraArgs: [String])] = []
-    for name in funcsNeedingTexture.union(funcsNeedingResolution).union(funcsNeedingTime) {
+    for f in funcs where f.usesTexture || f.usesResolution || f.usesTime {
         var extraArgs: [String] = []
-        if funcsNeedingTexture.contains(name) {
+        if f.usesTexture {
             extraArgs.append("u_screen")
             extraArgs.append("samp")
         }
-        if funcsNeedingResolution.contains(name) { extraArgs.append("u_resolution") }
-        if funcsNeedingTime.contains(name) { extraArgs.append("u_time") }
-        result = addExtraArgsToCallSites(result, funcName: name, extraArgs: extraArgs)
-        fixups.append((name: name, extraArgs: extraArgs))
+        if f.usesResolution { extraArgs.append("u_resolution") }
+        if f.usesTime { extraArgs.append("u_time") }
+        result = addExtraArgsToCallSites(result, funcName: f.name, extraArgs: extraArgs)
+        fixups.append((name: f.name, extraArgs: extraArgs))
     }
 
     return (code: result, fixups: fixups)
@@ -589,7 +634,7 @@ class ShaderRenderer: NSObject, MTKViewDelegate, SCStreamOutput {
     func loadShader() {
         do {
             let glslSource = try String(contentsOfFile: shaderPath, encoding: .utf8)
-            let mslSource = convertGLSLtoMSL(glslSource)
+            let mslSource = convertGLSLtoMSL(applyPrelude(glslSource, shaderPath: shaderPath))
 
             // Vertex shader is always the same simple passthrough
             let vertexMSL = """
@@ -1,14 +1,45 @@
 /*
  * screenshader-preview - Shader preview renderer
  *
- * Two modes:
+ * Three modes:
  *   Single-shot: capture screen → apply shader → write PPM to stdout
+ *   Batch:       image sequence → apply shader → image sequence
  *   Live:        open a window with continuous screen capture + shader at ~5fps
  *
+ * In live mode the screen is grabbed once, then only where XDamage on the
+ * root reports changes, with MIT-SHM sub-image grabs uploaded by
+ * glTexSubImage2D. The area under the preview window itself is never
+ * regrabbed (R moves the window away and grabs everything). Without
+ * XDamage it falls back to a full grab every 2 seconds. When a compositor
+ * runs with --feed composited (or both), live mode reads its frames from
+ * shared memory instead and grabs nothing, until that compositor exits or
+ * stops publishing; --no-feed turns that off.
+ *
  * Usage:
  *   screenshader-preview <shader.frag>                          # single PPM
+ *   screenshader-preview <shader.frag> --batch DIR > out.ppm    # sequence
  *   screenshader-preview <shader.frag> --live [--fps N]         # live window
  *   screenshader-preview --screenshot-only                      # raw screenshot
+ *
+ * Single-shot mode with --input-ppm never needs the screen, so it renders
+ * headless through EGL: Mesa's surfaceless platform (the GPU behind a
+ * render node, or llvmpipe without one), else the EGL device platform,
+ * into an FBO, with no X server involved. If neither is available, or
+ * with --glx, it uses a GLX pbuffer on $DISPLAY as screen captures do.
+ * Built without HAVE_EGL (no libegl), it always uses GLX.
+ *
+ * Batch mode (--batch DIR|FILE|-) shades an image sequence: a directory of
+ * PPMs, concatenated PPMs or Y4M, written to stdout in the same format or
+ * to --out DIR as PPMs. It renders headless like --input-ppm, with one
+ * program for every frame and u_time advancing by 1 / --rate per frame.
+ * Decode, draw and encode run on their own threads over triple-buffered
+ * PBOs; frames per second are printed to stderr as "batch_fps <value>".
+ *
+ * Single-shot mode takes --time T to fix u_time (default 0.5) and
+ * --bench N to time N extra draws with GL timer queries; the median is
+ * printed to stderr as "render_ms <value>" (used by tests/golden.py).
+ * Shaders that declare a kernel radius run on the compute tile path when
+ * GL 4.3 is available; --no-compute forces the fragment path.
  */
 
 #define _POSIX_C_SOURCE 200809L
@@ -21,15 +52,32 @@
 #include <signal.h>
 #include <time.h>
 #include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#include <X11/extensions/XShm.h>
 
 #define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 #include <GL/glx.h>
 #include <GL/glext.h>
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "shaderlib.h"
 
 static volatile sig_atomic_t g_running = 1;
 
@@ -94,9 +142,10 @@ static GLuint compile_shader(GLenum type, const char *src, const char *name) {
     return shader;
 }
 
+/* vert is 0 when linking a lone compute shader */
 static GLuint link_program(GLuint vert, GLuint frag) {
     GLuint prog = glCreateProgram();
-    glAttachShader(prog, vert);
+    if (vert) glAttachShader(prog, vert);
     glAttachShader(prog, frag);
     glLinkProgram(prog);
     GLint ok;
@@ -115,31 +164,51 @@ static GLuint link_program(GLuint vert, GLuint frag) {
 /* Screen capture (BGRA XImage → texture upload)                              */
 /* ========================================================================== */
 
-/* Capture root window into GL texture. */
-static int capture_to_texture(Display *dpy, GLuint tex, int scr_w, int scr_h) {
-    Window root = DefaultRootWindow(dpy);
-    XImage *img = XGetImage(dpy, root, 0, 0, scr_w, scr_h, AllPlanes, ZPixmap);
-    if (!img) return -1;
+/* Rec. 601 luma of an 8-bit pixel, rounded like the compositor's RGBA8
+ * FBO stores it. The screen texture carries it in alpha for the prelude's
+ * gather helpers. */
+static inline unsigned char luma8(unsigned r, unsigned g, unsigned b) {
+    return (unsigned char)((299 * r + 587 * g + 114 * b + 500) / 1000);
+}
 
+/* Upload img (all of it) to tex at x, y, with luma in alpha */
+static void upload_image(GLuint tex, XImage *img, int x0, int y0) {
+    int w = img->width, h = img->height;
     glBindTexture(GL_TEXTURE_2D, tex);
     if (img->bits_per_pixel == 32) {
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, scr_w, scr_h,
+        for (int y = 0; y < h; y++) {
+            unsigned char *p = (unsigned char *)img->data + y * img->bytes_per_line;
+            for (int x = 0; x < w; x++, p += 4)
+                p[3] = luma8(p[2], p[1], p[0]);
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, img->bytes_per_line / 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, w, h,
                         GL_BGRA, GL_UNSIGNED_BYTE, img->data);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
     } else {
-        unsigned char *rgb = malloc(scr_w * scr_h * 3);
-        for (int y = 0; y < scr_h; y++)
-            for (int x = 0; x < scr_w; x++) {
+        unsigned char *rgba = malloc((size_t)w * h * 4);
+        if (!rgba) return;
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++) {
                 unsigned long p = XGetPixel(img, x, y);
-                int i = (y * scr_w + x) * 3;
-                rgb[i+0] = (p >> 16) & 0xFF;
-                rgb[i+1] = (p >> 8) & 0xFF;
-                rgb[i+2] = p & 0xFF;
+                int i = (y * w + x) * 4;
+                rgba[i+0] = (p >> 16) & 0xFF;
+                rgba[i+1] = (p >> 8) & 0xFF;
+                rgba[i+2] = p & 0xFF;
+                rgba[i+3] = luma8(rgba[i+0], rgba[i+1], rgba[i+2]);
             }
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, scr_w, scr_h,
-                        GL_RGB, GL_UNSIGNED_BYTE, rgb);
-        free(rgb);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, w, h,
+                        GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+        free(rgba);
     }
+}
 
+/* Capture root window into GL texture. */
+static int capture_to_texture(Display *dpy, GLuint tex, int scr_w, int scr_h) {
+    Window root = DefaultRootWindow(dpy);
+    XImage *img = XGetImage(dpy, root, 0, 0, scr_w, scr_h, AllPlanes, ZPixmap);
+    if (!img) return -1;
+    upload_image(tex, img, 0, 0);
     XDestroyImage(img);
     return 0;
 }
@@ -219,32 +288,106 @@ static void write_ppm_stdout(const unsigned char *rgb, int w, int h) {
     fflush(stdout);
 }
 
-static unsigned char *read_ppm_stdin(int *out_w, int *out_h) {
-    char magic[3];
-    if (fscanf(stdin, "%2s", magic) != 1 || strcmp(magic, "P6") != 0) {
-        fprintf(stderr, "Invalid PPM: expected P6 magic\n"); return NULL;
+/* ========================================================================== */
+/* Offscreen context (single-shot mode): headless EGL, or a GLX pbuffer       */
+/* ========================================================================== */
+
+typedef struct {
+    /* GLX: a pbuffer on the X server */
+    Display    *dpy;
+    GLXContext  glx_ctx;
+    GLXPbuffer  pbuf;
+#ifdef HAVE_EGL
+    /* EGL: no surface at all; rendering goes to fbo */
+    EGLDisplay  egl_dpy;
+    EGLContext  egl_ctx;
+#endif
+    GLuint      fbo, rb;
+} Offscreen;
+
+#ifdef HAVE_EGL
+static bool egl_has_extension(const char *list, const char *name) {
+    size_t n = strlen(name);
+    for (const char *p = list; p && (p = strstr(p, name)); p += n)
+        if ((p == list || p[-1] == ' ') && (p[n] == ' ' || p[n] == '\0')) return true;
+    return false;
+}
+
+/* Surfaceless Mesa first, then the first EGL device */
+static EGLDisplay egl_headless_display(void) {
+    const char *client = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+        eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (!client || !get_display) return EGL_NO_DISPLAY;
+
+    if (egl_has_extension(client, "EGL_MESA_platform_surfaceless")) {
+        EGLDisplay d = get_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (d != EGL_NO_DISPLAY && eglInitialize(d, NULL, NULL)) return d;
     }
-    int c;
-    while ((c = fgetc(stdin)) != EOF) {
-        if (c == '#') { while ((c = fgetc(stdin)) != EOF && c != '\n'); }
-        else if (c > ' ') { ungetc(c, stdin); break; }
-    }
-    int w, h, maxval;
-    if (fscanf(stdin, "%d %d %d", &w, &h, &maxval) != 3) {
-        fprintf(stderr, "Invalid PPM header\n"); return NULL;
-    }
-    fgetc(stdin);
-    unsigned char *rgb = malloc(w * h * 3);
-    if (!rgb) return NULL;
-    size_t n = fread(rgb, 1, w * h * 3, stdin);
-    if ((int)n != w * h * 3) { free(rgb); return NULL; }
-    *out_w = w; *out_h = h;
-    return rgb;
+    PFNEGLQUERYDEVICESEXTPROC query_devices = (PFNEGLQUERYDEVICESEXTPROC)
+        eglGetProcAddress("eglQueryDevicesEXT");
+    if (egl_has_extension(client, "EGL_EXT_platform_device") && query_devices) {
+        EGLDeviceEXT devices[8];
+        EGLint n = 0;
+        if (query_devices(8, devices, &n)) {
+            for (EGLint i = 0; i < n; i++) {
+                EGLDisplay d = get_display(EGL_PLATFORM_DEVICE_EXT, devices[i], NULL);
+                if (d != EGL_NO_DISPLAY && eglInitialize(d, NULL, NULL)) return d;
+            }
+        }
+    }
+    return EGL_NO_DISPLAY;
 }
 
-/* ========================================================================== */
-/* GLX pbuffer (for single-shot mode)                                         */
-/* ========================================================================== */
+/* A current GL 4.3 core context (3.3 if that is all there is) with an
+ * RGBA8 FBO of w x h bound; -1 if EGL cannot do it without a display */
+static int create_egl_context(Offscreen *o, int w, int h) {
+    o->egl_dpy = egl_headless_display();
+    if (o->egl_dpy == EGL_NO_DISPLAY) return -1;
+    const char *ext = eglQueryString(o->egl_dpy, EGL_EXTENSIONS);
+    if (!egl_has_extension(ext, "EGL_KHR_surfaceless_context") ||
+        !eglBindAPI(EGL_OPENGL_API)) {
+        eglTerminate(o->egl_dpy);
+        o->egl_dpy = EGL_NO_DISPLAY;
+        return -1;
+    }
+
+    EGLConfig config = EGL_NO_CONFIG_KHR;
+    if (!egl_has_extension(ext, "EGL_KHR_no_config_context")) {
+        const EGLint attrs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        EGLint n = 0;
+        if (!eglChooseConfig(o->egl_dpy, attrs, &config, 1, &n) || n == 0)
+            config = EGL_NO_CONFIG_KHR;
+    }
+    static const EGLint versions[][2] = { { 4, 3 }, { 3, 3 } };
+    for (int i = 0; i < 2 && o->egl_ctx == EGL_NO_CONTEXT; i++) {
+        const EGLint attrs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, versions[i][0],
+            EGL_CONTEXT_MINOR_VERSION, versions[i][1],
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        o->egl_ctx = eglCreateContext(o->egl_dpy, config, EGL_NO_CONTEXT, attrs);
+    }
+    if (o->egl_ctx == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(o->egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, o->egl_ctx)) {
+        if (o->egl_ctx != EGL_NO_CONTEXT) eglDestroyContext(o->egl_dpy, o->egl_ctx);
+        eglTerminate(o->egl_dpy);
+        o->egl_dpy = EGL_NO_DISPLAY;
+        o->egl_ctx = EGL_NO_CONTEXT;
+        return -1;
+    }
+
+    /* No default framebuffer: everything the pbuffer would get goes here */
+    glGenRenderbuffers(1, &o->rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, o->rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+    glGenFramebuffers(1, &o->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, o->fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, o->rb);
+    return 0;
+}
+#endif /* HAVE_EGL */
 
 static int create_pbuffer_context(Display *dpy, int w, int h,
                                   GLXContext *ctx_out, GLXPbuffer *pbuf_out) {
@@ -268,19 +411,68 @@ static int create_pbuffer_context(Display *dpy, int w, int h,
     return 0;
 }
 
+/* Headless when allowed and possible, else a pbuffer on $DISPLAY */
+static int create_offscreen(Offscreen *o, int w, int h, bool headless) {
+    memset(o, 0, sizeof(*o));
+#ifdef HAVE_EGL
+    o->egl_dpy = EGL_NO_DISPLAY;
+    o->egl_ctx = EGL_NO_CONTEXT;
+    if (headless) {
+        if (create_egl_context(o, w, h) == 0) {
+            fprintf(stderr, "Offscreen: EGL, %s\n", glGetString(GL_RENDERER));
+            return 0;
+        }
+        fprintf(stderr, "Headless EGL unavailable, using GLX\n");
+    }
+#else
+    (void)headless;
+#endif
+    o->dpy = XOpenDisplay(NULL);
+    if (!o->dpy) { fprintf(stderr, "Cannot open display\n"); return -1; }
+    if (create_pbuffer_context(o->dpy, w, h, &o->glx_ctx, &o->pbuf) < 0) return -1;
+    return 0;
+}
+
+/* Also fine after a failed create_offscreen */
+static void destroy_offscreen(Offscreen *o) {
+#ifdef HAVE_EGL
+    if (o->egl_ctx != EGL_NO_CONTEXT) {
+        if (o->fbo) glDeleteFramebuffers(1, &o->fbo);
+        if (o->rb) glDeleteRenderbuffers(1, &o->rb);
+        eglMakeCurrent(o->egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(o->egl_dpy, o->egl_ctx);
+    }
+    if (o->egl_dpy != EGL_NO_DISPLAY) eglTerminate(o->egl_dpy);
+#endif
+    if (o->dpy) {
+        glXMakeCurrent(o->dpy, None, NULL);
+        if (o->pbuf) glXDestroyPbuffer(o->dpy, o->pbuf);
+        if (o->glx_ctx) glXDestroyContext(o->dpy, o->glx_ctx);
+        XCloseDisplay(o->dpy);
+    }
+    memset(o, 0, sizeof(*o));
+}
+
+/* Where single-shot output goes: the pbuffer, or the headless FBO */
+static GLuint offscreen_target(const Offscreen *o) {
+    return o->fbo;
+}
+
 /* ========================================================================== */
 /* Shared: setup fullscreen quad + compile shader program                     */
 /* ========================================================================== */
 
-static void setup_quad(GLuint *vao, GLuint *vbo) {
+static void setup_quad(GLuint *vao, GLuint *vbo, bool flip) {
     /* Texcoords flipped: v=1 at bottom, v=0 at top.
      * XGetImage stores row 0 at top, GL texcoord 0 is bottom,
-     * so we flip to get the correct orientation. */
+     * so we flip to get the correct orientation. Unflipped, an output
+     * texel lands where it was sampled from, which u_prev relies on. */
+    float v0 = flip ? 1.0f : 0.0f, v1 = 1.0f - v0;
     float quad[] = {
-        -1, -1,  0, 1,
-         1, -1,  1, 1,
-        -1,  1,  0, 0,
-         1,  1,  1, 0,
+        -1, -1,  0, v0,
+         1, -1,  1, v0,
+        -1,  1,  0, v1,
+         1,  1,  1, v1,
     };
     glGenVertexArrays(1, vao);
     glGenBuffers(1, vbo);
@@ -293,17 +485,82 @@ static void setup_quad(GLuint *vao, GLuint *vbo) {
     glEnableVertexAttribArray(1);
 }
 
-static GLuint build_program(const char *shader_path) {
-    GLuint vert = compile_shader(GL_VERTEX_SHADER, QUAD_VERT_SRC, "quad.vert");
-    if (!vert) return 0;
-    char *frag_src = load_file(shader_path);
+/* Bake a shader's colour LUT stage into `lut`. The preview has no params
+ * file, so this happens once. Returns -1 if the stage is to be evaluated
+ * per pixel instead. */
+static int bake_lut(SsLut *lut, const char *bake_src, const char *shader_path, int size) {
+    GLuint vert = compile_shader(GL_VERTEX_SHADER, SS_LUT_VERT_SRC, "lut.vert");
+    GLuint frag = vert ? compile_shader(GL_FRAGMENT_SHADER, bake_src, shader_path) : 0;
+    lut->prog = frag ? link_program(vert, frag) : 0;
+    if (vert) glDeleteShader(vert);
+    if (frag) glDeleteShader(frag);
+    if (!lut->prog || ss_lut_resize(lut, size) < 0) return -1;
+    glUseProgram(lut->prog);
+    ss_lut_bake(lut);
+    return 0;
+}
+
+/* With allow_compute, shaders that declare a kernel radius are built as
+ * the compute tile variant when GL 4.3 is available (see shaderlib.h).
+ * Auxiliary textures the shader declares are bound from `aux`, and a
+ * colour LUT stage is baked into `lut`. */
+static GLuint build_program(const char *shader_path, bool allow_compute,
+                            SsAuxCache *aux, SsLut *lut, bool *compute) {
+    char *user_src = load_file(shader_path);
+    if (!user_src) return 0;
+    char *prelude_path = ss_prelude_path(shader_path);
+    char *prelude = prelude_path ? load_file(prelude_path) : NULL;
+    free(prelude_path);
+    char *frag_src = ss_apply_prelude(user_src, prelude, shader_path);
+    free(prelude);
+    free(user_src);
     if (!frag_src) return 0;
+
+    ShaderDirectives dir;
+    ss_parse_directives(frag_src, &dir);
+    char *bake_src, *apply_src;
+    if (dir.lut_func[0] && ss_build_lut_sources(frag_src, &dir, &bake_src, &apply_src) == 0) {
+        if (bake_lut(lut, bake_src, shader_path, dir.lut_size) == 0) {
+            free(frag_src);
+            frag_src = apply_src;
+        } else {
+            fprintf(stderr, "Colour LUT unavailable, evaluating %s per pixel\n",
+                    dir.lut_func);
+            free(apply_src);
+        }
+        free(bake_src);
+    }
+    *compute = false;
+    if (allow_compute && dir.kernel_radius > 0 && ss_gl_has_compute()) {
+        char *cs_src = ss_build_compute_source(frag_src, dir.kernel_radius);
+        GLuint cs = cs_src ? compile_shader(GL_COMPUTE_SHADER, cs_src, shader_path) : 0;
+        free(cs_src);
+        GLuint prog = cs ? link_program(0, cs) : 0;
+        if (cs) glDeleteShader(cs);
+        if (prog) {
+            free(frag_src);
+            ss_resolve_aux_textures(aux, prog, &dir, shader_path, NULL);
+            GLint loc = glGetUniformLocation(prog, "ss_lut");
+            if (loc >= 0) ss_lut_bind(lut, loc);
+            *compute = true;
+            return prog;
+        }
+        fprintf(stderr, "Compute tile path unavailable, using fragment shader\n");
+    }
+
+    GLuint vert = compile_shader(GL_VERTEX_SHADER, QUAD_VERT_SRC, "quad.vert");
+    if (!vert) { free(frag_src); return 0; }
     GLuint frag = compile_shader(GL_FRAGMENT_SHADER, frag_src, shader_path);
     free(frag_src);
-    if (!frag) return 0;
+    if (!frag) { glDeleteShader(vert); return 0; }
     GLuint prog = link_program(vert, frag);
     glDeleteShader(vert);
     glDeleteShader(frag);
+    if (prog) {
+        ss_resolve_aux_textures(aux, prog, &dir, shader_path, NULL);
+        GLint loc = glGetUniformLocation(prog, "ss_lut");
+        if (loc >= 0) ss_lut_bind(lut, loc);
+    }
     return prog;
 }
 
@@ -311,13 +568,68 @@ static GLuint build_program(const char *shader_path) {
 /* Single-shot render (pbuffer → PPM stdout)                                  */
 /* ========================================================================== */
 
-static unsigned char *render_single(Display *dpy, const char *shader_path,
-                                    const unsigned char *input_rgb, int w, int h) {
-    GLXContext ctx; GLXPbuffer pbuf;
-    if (create_pbuffer_context(dpy, w, h, &ctx, &pbuf) < 0) return NULL;
+static int cmp_u64(const void *a, const void *b) {
+    GLuint64 x = *(const GLuint64 *)a, y = *(const GLuint64 *)b;
+    return (x > y) - (x < y);
+}
+
+/* One full-screen pass of the bound program: a quad draw, or for the
+ * compute tile path a dispatch into the image bound at unit 0 */
+static void run_pass(bool compute, int w, int h) {
+    if (compute) {
+        glDispatchCompute((GLuint)(w + SS_TILE - 1) / SS_TILE,
+                          (GLuint)(h + SS_TILE - 1) / SS_TILE, 1);
+        glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+    } else {
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+}
+
+/* Time `runs` passes of the bound program, one GL_TIME_ELAPSED query each,
+ * and report the median. The first pass (shader compile, texture upload)
+ * has already happened and is not counted. */
+static void bench_draws(int runs, bool compute, int w, int h) {
+    GLuint64 *ns = malloc(sizeof(GLuint64) * runs);
+    GLuint query;
+    if (!ns) return;
+    glGenQueries(1, &query);
+    for (int i = 0; i < runs; i++) {
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        run_pass(compute, w, h);
+        glEndQuery(GL_TIME_ELAPSED);
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns[i]);
+    }
+    glDeleteQueries(1, &query);
+    qsort(ns, runs, sizeof(GLuint64), cmp_u64);
+    fprintf(stderr, "render_ms %.4f\n", (double)ns[runs / 2] / 1e6);
+    fprintf(stderr, "render_ms_min %.4f\n", (double)ns[0] / 1e6);
+    free(ns);
+}
 
-    GLuint prog = build_program(shader_path);
+/* Uniforms of the bound program for an offscreen render of the input in
+ * texture unit 0 */
+static void set_uniforms(GLuint prog, int w, int h, float time) {
+    GLint loc;
+    if ((loc = glGetUniformLocation(prog, "u_screen")) >= 0) glUniform1i(loc, 0);
+    if ((loc = glGetUniformLocation(prog, "u_resolution")) >= 0)
+        glUniform2f(loc, (float)w, (float)h);
+    if ((loc = glGetUniformLocation(prog, "u_time")) >= 0) glUniform1f(loc, time);
+    /* Offscreen renders keep no history: u_prev is the input */
+    if ((loc = glGetUniformLocation(prog, "u_prev")) >= 0) glUniform1i(loc, 0);
+    /* Our quad has v = 0 at the top; the compute path must match it */
+    if ((loc = glGetUniformLocation(prog, "ss_flip_y")) >= 0) glUniform1i(loc, 1);
+}
+
+/* Render with the offscreen context current (see create_offscreen) */
+static unsigned char *render_single(const Offscreen *off, const char *shader_path,
+                                    const unsigned char *input_rgb, int w, int h,
+                                    float time, int bench_runs, bool allow_compute) {
+    bool compute;
+    SsAuxCache aux = {0};
+    SsLut lut = {0};
+    GLuint prog = build_program(shader_path, allow_compute, &aux, &lut, &compute);
     if (!prog) return NULL;
+    if (compute) fprintf(stderr, "Post-process: compute tile path\n");
 
     GLuint tex;
     glGenTextures(1, &tex);
@@ -326,25 +638,43 @@ static unsigned char *render_single(Display *dpy, const char *shader_path,
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, input_rgb);
+    unsigned char *rgba = malloc((size_t)w * h * 4);
+    if (!rgba) return NULL;
+    for (int i = 0; i < w * h; i++) {
+        const unsigned char *p = input_rgb + i * 3;
+        memcpy(rgba + i * 4, p, 3);
+        rgba[i * 4 + 3] = luma8(p[0], p[1], p[2]);
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    free(rgba);
 
     GLuint vao, vbo;
-    setup_quad(&vao, &vbo);
+    setup_quad(&vao, &vbo, true);
+
+    /* The compute path writes an image; read it back through an FBO */
+    GLuint out_tex = 0, out_fbo = 0;
+    if (compute) {
+        glGenTextures(1, &out_tex);
+        glBindTexture(GL_TEXTURE_2D, out_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindImageTexture(0, out_tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        glGenFramebuffers(1, &out_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, out_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, out_tex, 0);
+    }
 
     glViewport(0, 0, w, h);
     glClear(GL_COLOR_BUFFER_BIT);
     glUseProgram(prog);
-
-    GLint loc;
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, tex);
-    if ((loc = glGetUniformLocation(prog, "u_screen")) >= 0) glUniform1i(loc, 0);
-    if ((loc = glGetUniformLocation(prog, "u_resolution")) >= 0)
-        glUniform2f(loc, (float)w, (float)h);
-    if ((loc = glGetUniformLocation(prog, "u_time")) >= 0) glUniform1f(loc, 0.5f);
+    set_uniforms(prog, w, h, time);
 
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    run_pass(compute, w, h);
     glFinish();
+    if (bench_runs > 0) bench_draws(bench_runs, compute, w, h);
+    if (!compute) glBindFramebuffer(GL_FRAMEBUFFER, offscreen_target(off));
 
     unsigned char *pixels = malloc(w * h * 3);
     glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, pixels);
@@ -358,21 +688,719 @@ static unsigned char *render_single(Display *dpy, const char *shader_path,
     }
     free(tmp);
 
+    if (out_fbo) glDeleteFramebuffers(1, &out_fbo);
+    if (out_tex) glDeleteTextures(1, &out_tex);
     glDeleteTextures(1, &tex);
     glDeleteBuffers(1, &vbo);
     glDeleteVertexArrays(1, &vao);
     glDeleteProgram(prog);
-    glXMakeCurrent(dpy, None, NULL);
-    glXDestroyPbuffer(dpy, pbuf);
-    glXDestroyContext(dpy, ctx);
+    ss_aux_cache_free(&aux);
+    ss_lut_free(&lut);
     return pixels;
 }
 
+/* ========================================================================== */
+/* Batch mode (image sequence → shader → image sequence)                      */
+/* ========================================================================== */
+
+/*
+ * One context and one compile for the whole sequence. Frames go through
+ * BATCH_SLOTS slots per stage:
+ *
+ *   decode thread   reads a frame straight into a mapped unpack PBO
+ *   GL thread       PBO → texture, draw, glReadPixels into a pack PBO
+ *                   with a fence; the previous frame's fence is waited
+ *                   for and its PBO mapped for the encoder
+ *   encode thread   writes from the mapped pack PBO
+ *
+ * so decoding frame n+1, drawing frame n and encoding frame n-1 overlap.
+ * Slot indices travel between the threads on BatchQueues; the GL thread
+ * does all mapping and unmapping, the other two only touch the memory.
+ */
+
+#define BATCH_SLOTS 3
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             items[BATCH_SLOTS + 1];   /* every slot, plus the end */
+    int             head, count;
+} BatchQueue;
+
+static void bq_init(BatchQueue *q) {
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    q->head = q->count = 0;
+}
+
+static void bq_destroy(BatchQueue *q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->cond);
+}
+
+/* Never blocks: a queue only ever holds the slots and one end marker */
+static void bq_push(BatchQueue *q, int item) {
+    pthread_mutex_lock(&q->lock);
+    q->items[(q->head + q->count++) % (BATCH_SLOTS + 1)] = item;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static int bq_pop(BatchQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) pthread_cond_wait(&q->cond, &q->lock);
+    int item = q->items[q->head];
+    q->head = (q->head + 1) % (BATCH_SLOTS + 1);
+    q->count--;
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+typedef enum { BATCH_PPM, BATCH_Y4M } BatchFormat;
+
+typedef struct {
+    /* Source: a PPM stream, a Y4M stream, or the .ppm files of a directory */
+    BatchFormat     format;
+    FILE           *in;
+    const char     *dir;
+    char          **files;
+    int             nfiles, next_file;
+    bool            header_read;     /* the first frame's, read by batch_open */
+    int             w, h;
+    bool            chroma444;       /* Y4M: else 4:2:0 */
+    char            y4m_header[256];
+    double          rate;            /* frames per second of u_time */
+    unsigned char  *dec_rgb, *dec_planes;   /* decode thread's */
+
+    /* Sink: stdout in the source's format, or PPM files in out_dir */
+    const char     *out_dir;
+    unsigned char  *enc_rgb, *enc_planes;   /* encode thread's */
+
+    /* Pipeline */
+    unsigned char  *in_ptr[BATCH_SLOTS];    /* mapped unpack PBOs */
+    unsigned char  *out_ptr[BATCH_SLOTS];   /* mapped pack PBOs */
+    int             out_frame[BATCH_SLOTS];
+    BatchQueue      in_free, in_full, out_full, out_free;
+    bool            decode_failed, encode_failed, gl_failed;
+    double          decode_s, encode_s;     /* busy time of each thread */
+} Batch;
+
+static double batch_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* P6 header of the next frame: 0, 1 at a clean end of stream, -1 */
+static int batch_ppm_header(FILE *f, int *w, int *h) {
+    int c;
+    while ((c = fgetc(f)) != EOF && c <= ' ');
+    if (c == EOF) return 1;
+    int maxval;
+    if (c != 'P' || fgetc(f) != '6') {
+        fprintf(stderr, "Invalid PPM: expected P6 magic\n"); return -1;
+    }
+    while ((c = fgetc(f)) != EOF) {
+        if (c == '#') { while ((c = fgetc(f)) != EOF && c != '\n'); }
+        else if (c > ' ') { ungetc(c, f); break; }
+    }
+    if (fscanf(f, "%d %d %d", w, h, &maxval) != 3 || *w <= 0 || *h <= 0 || maxval != 255) {
+        fprintf(stderr, "Invalid PPM header\n"); return -1;
+    }
+    fgetc(f);
+    return 0;
+}
+
+static int batch_y4m_header(Batch *b) {
+    if (!fgets(b->y4m_header, sizeof(b->y4m_header), b->in) ||
+        strncmp(b->y4m_header, "YUV4MPEG2 ", 10) != 0 ||
+        !strchr(b->y4m_header, '\n')) {
+        fprintf(stderr, "Invalid Y4M header\n"); return -1;
+    }
+    char line[sizeof(b->y4m_header)];
+    strcpy(line, b->y4m_header);
+    for (char *tok = strtok(line + 10, " \n"); tok; tok = strtok(NULL, " \n")) {
+        if (tok[0] == 'W') b->w = atoi(tok + 1);
+        else if (tok[0] == 'H') b->h = atoi(tok + 1);
+        else if (tok[0] == 'F') {
+            int num = 0, den = 0;
+            if (sscanf(tok + 1, "%d:%d", &num, &den) == 2 && num > 0 && den > 0)
+                b->rate = (double)num / den;
+        } else if (tok[0] == 'C') {
+            /* 8-bit only: the 4:2:0 variants differ in chroma siting alone */
+            if (strcmp(tok, "C444") == 0) b->chroma444 = true;
+            else if (strcmp(tok, "C420") != 0 && strcmp(tok, "C420jpeg") != 0 &&
+                     strcmp(tok, "C420paldv") != 0 && strcmp(tok, "C420mpeg2") != 0) {
+                fprintf(stderr, "Y4M: unsupported colourspace %s (420 or 444)\n", tok);
+                return -1;
+            }
+        }
+    }
+    if (b->w <= 0 || b->h <= 0) { fprintf(stderr, "Y4M: missing W or H\n"); return -1; }
+    return 0;
+}
+
+static int cmp_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int batch_list_dir(Batch *b) {
+    DIR *d = opendir(b->dir);
+    if (!d) { fprintf(stderr, "Cannot open %s: %s\n", b->dir, strerror(errno)); return -1; }
+    int cap = 0;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        size_t len = strlen(e->d_name);
+        if (len < 5 || strcmp(e->d_name + len - 4, ".ppm") != 0) continue;
+        if (b->nfiles == cap) {
+            cap = cap ? cap * 2 : 64;
+            char **files = realloc(b->files, sizeof(char *) * cap);
+            if (!files) break;
+            b->files = files;
+        }
+        b->files[b->nfiles++] = strdup(e->d_name);
+    }
+    closedir(d);
+    if (b->nfiles == 0) { fprintf(stderr, "%s: no .ppm files\n", b->dir); return -1; }
+    qsort(b->files, b->nfiles, sizeof(char *), cmp_names);
+    return 0;
+}
+
+/* Next file of a directory source, with its header read */
+static int batch_next_file(Batch *b, int *w, int *h) {
+    if (b->in) { fclose(b->in); b->in = NULL; }
+    if (b->next_file == b->nfiles) return 1;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", b->dir, b->files[b->next_file++]);
+    b->in = fopen(path, "rb");
+    if (!b->in) { fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno)); return -1; }
+    int r = batch_ppm_header(b->in, w, h);
+    if (r == 1) fprintf(stderr, "%s: empty\n", path);
+    return r ? -1 : 0;
+}
+
+/* Open `src` ("-" for stdin) and read the first frame's header, so the
+ * size is known before any GL state exists */
+static int batch_open(Batch *b, const char *src) {
+    struct stat st;
+    b->rate = 30.0;
+    if (strcmp(src, "-") != 0 && stat(src, &st) == 0 && S_ISDIR(st.st_mode)) {
+        b->dir = src;
+        b->format = BATCH_PPM;
+        if (batch_list_dir(b) < 0 || batch_next_file(b, &b->w, &b->h) < 0) return -1;
+    } else {
+        b->in = strcmp(src, "-") == 0 ? stdin : fopen(src, "rb");
+        if (!b->in) { fprintf(stderr, "Cannot open %s: %s\n", src, strerror(errno)); return -1; }
+        int c = fgetc(b->in);
+        ungetc(c, b->in);
+        if (c == 'Y') {
+            b->format = BATCH_Y4M;
+            if (batch_y4m_header(b) < 0) return -1;
+        } else {
+            b->format = BATCH_PPM;
+            if (batch_ppm_header(b->in, &b->w, &b->h) != 0) {
+                fprintf(stderr, "%s: not a PPM or Y4M stream\n", src); return -1;
+            }
+        }
+    }
+    b->header_read = true;
+    /* Y4M planes fit in as much as packed RGB: 4:4:4 is 3 bytes a pixel */
+    size_t frame = (size_t)b->w * b->h * 3;
+    b->dec_rgb = malloc(frame);
+    b->dec_planes = malloc(frame);
+    b->enc_rgb = malloc(frame);
+    b->enc_planes = malloc(frame);
+    return b->dec_rgb && b->dec_planes && b->enc_rgb && b->enc_planes ? 0 : -1;
+}
+
+static void batch_close(Batch *b) {
+    if (b->in && b->in != stdin) fclose(b->in);
+    for (int i = 0; i < b->nfiles; i++) free(b->files[i]);
+    free(b->files);
+    free(b->dec_rgb);
+    free(b->dec_planes);
+    free(b->enc_rgb);
+    free(b->enc_planes);
+}
+
+static inline unsigned char clamp8(int v) {
+    return (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+/* BT.601 studio range, which is what Y4M streams carry */
+static void yuv_to_rgb(int y, int u, int v, unsigned char *rgb) {
+    int c = 298 * (y - 16), d = u - 128, e = v - 128;
+    rgb[0] = clamp8((c + 409 * e + 128) >> 8);
+    rgb[1] = clamp8((c - 100 * d - 208 * e + 128) >> 8);
+    rgb[2] = clamp8((c + 516 * d + 128) >> 8);
+}
+
+/* Next frame as packed RGB in dec_rgb: 0, 1 at the end, -1 */
+static int batch_read_frame(Batch *b) {
+    int w = b->w, h = b->h;
+    if (b->format == BATCH_PPM) {
+        int r = 0, fw = w, fh = h;
+        if (!b->header_read)
+            r = b->dir ? batch_next_file(b, &fw, &fh) : batch_ppm_header(b->in, &fw, &fh);
+        b->header_read = false;
+        if (r) return r;
+        if (fw != w || fh != h) {
+            fprintf(stderr, "Frame is %dx%d, the sequence %dx%d\n", fw, fh, w, h);
+            return -1;
+        }
+        if (fread(b->dec_rgb, 1, (size_t)w * h * 3, b->in) != (size_t)w * h * 3) {
+            fprintf(stderr, "Truncated PPM frame\n"); return -1;
+        }
+        return 0;
+    }
+
+    char tag[128];
+    if (!fgets(tag, sizeof(tag), b->in)) return 1;
+    if (strncmp(tag, "FRAME", 5) != 0) { fprintf(stderr, "Y4M: expected FRAME\n"); return -1; }
+    int cw = b->chroma444 ? w : (w + 1) / 2, ch = b->chroma444 ? h : (h + 1) / 2;
+    size_t luma = (size_t)w * h, chroma = (size_t)cw * ch;
+    unsigned char *yp = b->dec_planes, *up = yp + luma, *vp = up + chroma;
+    if (fread(yp, 1, luma + 2 * chroma, b->in) != luma + 2 * chroma) {
+        fprintf(stderr, "Truncated Y4M frame\n"); return -1;
+    }
+    for (int y = 0; y < h; y++) {
+        int cy = b->chroma444 ? y : y / 2;
+        for (int x = 0; x < w; x++) {
+            int cx = b->chroma444 ? x : x / 2;
+            yuv_to_rgb(yp[(size_t)y * w + x], up[(size_t)cy * cw + cx],
+                       vp[(size_t)cy * cw + cx], b->dec_rgb + ((size_t)y * w + x) * 3);
+        }
+    }
+    return 0;
+}
+
+static void *batch_decode_thread(void *arg) {
+    Batch *b = arg;
+    size_t pixels = (size_t)b->w * b->h;
+    while (g_running) {
+        int s = bq_pop(&b->in_free);
+        if (s < 0) break;                 /* the GL thread stopped */
+        double t = batch_now();
+        int r = batch_read_frame(b);
+        if (r) { b->decode_failed = r < 0; break; }
+        /* RGB → the screen texture's layout: RGBA with luma in alpha */
+        const unsigned char *src = b->dec_rgb;
+        unsigned char *dst = b->in_ptr[s];
+        for (size_t i = 0; i < pixels; i++, src += 3, dst += 4) {
+            memcpy(dst, src, 3);
+            dst[3] = luma8(src[0], src[1], src[2]);
+        }
+        b->decode_s += batch_now() - t;
+        bq_push(&b->in_full, s);
+    }
+    bq_push(&b->in_full, -1);
+    return NULL;
+}
+
+/* RGBA from glReadPixels (bottom-up) → packed top-down RGB in enc_rgb */
+static void batch_unpack(Batch *b, const unsigned char *rgba) {
+    int w = b->w, h = b->h;
+    for (int y = 0; y < h; y++) {
+        const unsigned char *src = rgba + (size_t)(h - 1 - y) * w * 4;
+        unsigned char *dst = b->enc_rgb + (size_t)y * w * 3;
+        for (int x = 0; x < w; x++, src += 4, dst += 3) memcpy(dst, src, 3);
+    }
+}
+
+static int batch_write_y4m(Batch *b, FILE *f) {
+    int w = b->w, h = b->h;
+    int cw = b->chroma444 ? w : (w + 1) / 2, ch = b->chroma444 ? h : (h + 1) / 2;
+    const unsigned char *rgb = b->enc_rgb;
+    unsigned char *plane = b->enc_planes;
+    fputs("FRAME\n", f);
+    for (size_t i = 0; i < (size_t)w * h; i++, rgb += 3)
+        plane[i] = (unsigned char)(((66 * rgb[0] + 129 * rgb[1] + 25 * rgb[2] + 128) >> 8) + 16);
+    if (fwrite(plane, 1, (size_t)w * h, f) != (size_t)w * h) return -1;
+    unsigned char *u = plane, *v = plane + (size_t)cw * ch;
+    for (int cy = 0; cy < ch; cy++) {
+        for (int cx = 0; cx < cw; cx++) {
+            /* Average the pixels this chroma sample covers */
+            int r = 0, g = 0, bl = 0, n = 0;
+            int step = b->chroma444 ? 1 : 2;
+            for (int y = cy * step; y < cy * step + step && y < h; y++)
+                for (int x = cx * step; x < cx * step + step && x < w; x++, n++) {
+                    const unsigned char *p = b->enc_rgb + ((size_t)y * w + x) * 3;
+                    r += p[0]; g += p[1]; bl += p[2];
+                }
+            r /= n; g /= n; bl /= n;
+            u[(size_t)cy * cw + cx] = clamp8(((-38 * r - 74 * g + 112 * bl + 128) >> 8) + 128);
+            v[(size_t)cy * cw + cx] = clamp8(((112 * r - 94 * g - 18 * bl + 128) >> 8) + 128);
+        }
+    }
+    return fwrite(plane, 1, (size_t)cw * ch * 2, f) == (size_t)cw * ch * 2 ? 0 : -1;
+}
+
+static int batch_write_frame(Batch *b, int frame) {
+    if (!b->out_dir) {
+        if (b->format == BATCH_Y4M) {
+            if (frame == 0) fputs(b->y4m_header, stdout);
+            return batch_write_y4m(b, stdout);
+        }
+        fprintf(stdout, "P6\n%d %d\n255\n", b->w, b->h);
+        size_t n = (size_t)b->w * b->h * 3;
+        return fwrite(b->enc_rgb, 1, n, stdout) == n ? 0 : -1;
+    }
+    char path[4096];
+    if (b->dir) snprintf(path, sizeof(path), "%s/%s", b->out_dir, b->files[frame]);
+    else snprintf(path, sizeof(path), "%s/frame-%06d.ppm", b->out_dir, frame);
+    FILE *f = fopen(path, "wb");
+    if (!f) { fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno)); return -1; }
+    fprintf(f, "P6\n%d %d\n255\n", b->w, b->h);
+    size_t n = (size_t)b->w * b->h * 3;
+    bool ok = fwrite(b->enc_rgb, 1, n, f) == n;
+    return fclose(f) == 0 && ok ? 0 : -1;
+}
+
+static void *batch_encode_thread(void *arg) {
+    Batch *b = arg;
+    for (;;) {
+        int p = bq_pop(&b->out_full);
+        if (p < 0) break;
+        if (!b->encode_failed) {
+            double t = batch_now();
+            batch_unpack(b, b->out_ptr[p]);
+            if (batch_write_frame(b, b->out_frame[p]) < 0) {
+                fprintf(stderr, "Output error: %s\n", strerror(errno));
+                b->encode_failed = true;
+            }
+            b->encode_s += batch_now() - t;
+        }
+        bq_push(&b->out_free, p);
+    }
+    fflush(stdout);
+    return NULL;
+}
+
+/* Map one unpack PBO and give it to the decoder; orphaning it leaves an
+ * upload still reading the old storage alone. False, with gl_failed set,
+ * if it cannot be mapped. */
+static bool batch_map_input(Batch *b, GLuint pbo, int s) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    b->in_ptr[s] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)b->w * b->h * 4,
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!b->in_ptr[s]) {
+        fprintf(stderr, "Cannot map an upload buffer (GL error 0x%x)\n", glGetError());
+        b->gl_failed = true;
+        return false;
+    }
+    bq_push(&b->in_free, s);
+    return true;
+}
+
+/* Wait for the readback in pack slot p and hand it to the encoder. False,
+ * with gl_failed set, if it cannot be mapped. */
+static bool batch_retire(Batch *b, GLuint pbo, GLsync *fence, int p) {
+    glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+    glDeleteSync(*fence);
+    *fence = NULL;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    b->out_ptr[p] = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)b->w * b->h * 4,
+                                     GL_MAP_READ_BIT);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!b->out_ptr[p]) {
+        fprintf(stderr, "Cannot map a readback buffer (GL error 0x%x)\n", glGetError());
+        b->gl_failed = true;
+        return false;
+    }
+    bq_push(&b->out_full, p);
+    return true;
+}
+
+/* Shade every frame of an opened source, with the offscreen context
+ * current. u_time is t0 at the first frame and advances 1 / rate a frame. */
+static int run_batch(const Offscreen *off, Batch *b, const char *shader_path,
+                     float t0, bool allow_compute) {
+    int w = b->w, h = b->h;
+    bool compute;
+    SsAuxCache aux = {0};
+    SsLut lut = {0};
+    GLuint prog = build_program(shader_path, allow_compute, &aux, &lut, &compute);
+    if (!prog) return 1;
+    if (compute) fprintf(stderr, "Post-process: compute tile path\n");
+
+    GLuint tex[BATCH_SLOTS], unpack[BATCH_SLOTS], pack[BATCH_SLOTS];
+    GLsync fence[BATCH_SLOTS] = {0};
+    bool encoding[BATCH_SLOTS] = {0};
+    glGenTextures(BATCH_SLOTS, tex);
+    glGenBuffers(BATCH_SLOTS, unpack);
+    glGenBuffers(BATCH_SLOTS, pack);
+    for (int i = 0; i < BATCH_SLOTS; i++) {
+        glBindTexture(GL_TEXTURE_2D, tex[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpack[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)w * h * 4, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pack[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)w * h * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    GLuint vao, vbo;
+    setup_quad(&vao, &vbo, true);
+
+    /* The compute path writes an image; read it back through an FBO */
+    GLuint out_tex = 0, out_fbo = 0;
+    if (compute) {
+        glGenTextures(1, &out_tex);
+        glBindTexture(GL_TEXTURE_2D, out_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindImageTexture(0, out_tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        glGenFramebuffers(1, &out_fbo);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, compute ? out_fbo : offscreen_target(off));
+    if (compute)
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, out_tex, 0);
+    glViewport(0, 0, w, h);
+    glUseProgram(prog);
+    set_uniforms(prog, w, h, t0);
+    GLint time_loc = glGetUniformLocation(prog, "u_time");
+    glActiveTexture(GL_TEXTURE0);
+
+    bq_init(&b->in_free);
+    bq_init(&b->in_full);
+    bq_init(&b->out_full);
+    bq_init(&b->out_free);
+    for (int s = 0; s < BATCH_SLOTS && batch_map_input(b, unpack[s], s); s++) {}
+    double start = batch_now();
+    pthread_t decoder, encoder;
+    pthread_create(&decoder, NULL, batch_decode_thread, b);
+    pthread_create(&encoder, NULL, batch_encode_thread, b);
+
+    /* A buffer that cannot be mapped stops the pipeline: the loop ends,
+     * and the decoder is told to stop with an end marker of its own */
+    int frames = 0;
+    for (int s; !b->gl_failed && (s = bq_pop(&b->in_full)) >= 0; frames++) {
+        /* Upload, then give the slot straight back to the decoder */
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpack[s]);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindTexture(GL_TEXTURE_2D, tex[s]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        if (!batch_map_input(b, unpack[s], s)) break;
+
+        if (time_loc >= 0) glUniform1f(time_loc, t0 + (float)(frames / b->rate));
+        run_pass(compute, w, h);
+
+        /* Frames are retired in order, so the slot coming back from the
+         * encoder is the one about to be reused */
+        int p = frames % BATCH_SLOTS;
+        if (encoding[p]) {
+            bq_pop(&b->out_free);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pack[p]);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            encoding[p] = false;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pack[p]);
+        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        fence[p] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        b->out_frame[p] = frames;
+
+        /* The previous frame has had this one's draw to finish in */
+        int q = (p + BATCH_SLOTS - 1) % BATCH_SLOTS;
+        if (fence[q]) {
+            if (!batch_retire(b, pack[q], &fence[q], q)) break;
+            encoding[q] = true;
+        }
+    }
+    if (frames > 0 && !b->gl_failed) {
+        int p = (frames - 1) % BATCH_SLOTS;
+        encoding[p] = batch_retire(b, pack[p], &fence[p], p);
+    }
+    bq_push(&b->in_free, -1);
+    bq_push(&b->out_full, -1);
+    pthread_join(decoder, NULL);
+    pthread_join(encoder, NULL);
+    double elapsed = batch_now() - start;
+
+    for (int i = 0; i < BATCH_SLOTS; i++) {
+        if (fence[i]) glDeleteSync(fence[i]);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpack[i]);
+        if (b->in_ptr[i]) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pack[i]);
+        if (encoding[i]) glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    bq_destroy(&b->in_free);
+    bq_destroy(&b->in_full);
+    bq_destroy(&b->out_full);
+    bq_destroy(&b->out_free);
+
+    if (out_fbo) glDeleteFramebuffers(1, &out_fbo);
+    if (out_tex) glDeleteTextures(1, &out_tex);
+    glDeleteTextures(BATCH_SLOTS, tex);
+    glDeleteBuffers(BATCH_SLOTS, unpack);
+    glDeleteBuffers(BATCH_SLOTS, pack);
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(prog);
+    ss_aux_cache_free(&aux);
+    ss_lut_free(&lut);
+
+    fprintf(stderr, "batch_frames %d\n", frames);
+    fprintf(stderr, "batch_fps %.2f\n", elapsed > 0 ? frames / elapsed : 0.0);
+    if (frames > 0) {
+        fprintf(stderr, "batch_decode_ms %.3f\n", b->decode_s * 1e3 / frames);
+        fprintf(stderr, "batch_encode_ms %.3f\n", b->encode_s * 1e3 / frames);
+    }
+    return b->decode_failed || b->encode_failed || b->gl_failed ? 1 : 0;
+}
+
+/* ========================================================================== */
+/* Live capture (XDamage on the root, MIT-SHM sub-image grabs)                */
+/* ========================================================================== */
+
+#define MAX_CAPTURE_RECTS 64   /* more than this, grab their bounding box */
+
+typedef struct {
+    Display        *dpy;
+    Window          root;
+    int             width, height;
+    Damage          damage;          /* 0 without XDamage */
+    int             damage_event;
+    XserverRegion   region;          /* what was damaged, minus the preview */
+    XShmSegmentInfo shm;
+    XImage         *shm_img;         /* screen-sized; NULL without MIT-SHM */
+    uint64_t        grabs, rects, pixels;
+} LiveCapture;
+
+static int g_xerror = 0;
+
+static int on_xerror(Display *dpy, XErrorEvent *e) {
+    (void)dpy;
+    g_xerror = e->error_code;
+    return 0;
+}
+
+/* A segment big enough for the whole screen; sub-rectangles are grabbed
+ * into its start by narrowing the image header */
+static void live_capture_shm(LiveCapture *lc) {
+    int screen = DefaultScreen(lc->dpy);
+    if (!XShmQueryExtension(lc->dpy)) return;
+    XImage *img = XShmCreateImage(lc->dpy, DefaultVisual(lc->dpy, screen),
+                                  DefaultDepth(lc->dpy, screen), ZPixmap, NULL,
+                                  &lc->shm, lc->width, lc->height);
+    if (!img) return;
+    if (img->bits_per_pixel != 32) { XDestroyImage(img); return; }
+    lc->shm.shmid = shmget(IPC_PRIVATE, (size_t)img->bytes_per_line * lc->height,
+                           IPC_CREAT | 0600);
+    if (lc->shm.shmid < 0) { XDestroyImage(img); return; }
+    lc->shm.shmaddr = img->data = shmat(lc->shm.shmid, NULL, 0);
+    lc->shm.readOnly = False;
+    shmctl(lc->shm.shmid, IPC_RMID, NULL);   /* freed once both sides detach */
+    if (lc->shm.shmaddr == (char *)-1) { img->data = NULL; XDestroyImage(img); return; }
+
+    /* A remote server accepts the request and then fails it */
+    int (*old)(Display *, XErrorEvent *) = XSetErrorHandler(on_xerror);
+    g_xerror = 0;
+    XShmAttach(lc->dpy, &lc->shm);
+    XSync(lc->dpy, False);
+    XSetErrorHandler(old);
+    if (g_xerror) {
+        shmdt(lc->shm.shmaddr);
+        img->data = NULL;
+        XDestroyImage(img);
+        return;
+    }
+    lc->shm_img = img;
+}
+
+static void live_capture_init(LiveCapture *lc, Display *dpy, int width, int height) {
+    memset(lc, 0, sizeof(*lc));
+    lc->dpy = dpy;
+    lc->root = DefaultRootWindow(dpy);
+    lc->width = width;
+    lc->height = height;
+
+    int err_base;
+    if (XDamageQueryExtension(dpy, &lc->damage_event, &err_base)) {
+        lc->damage = XDamageCreate(dpy, lc->root, XDamageReportNonEmpty);
+        lc->region = XFixesCreateRegion(dpy, NULL, 0);
+    }
+    live_capture_shm(lc);
+    fprintf(stderr, "Live capture: %s%s\n",
+            lc->damage ? "damaged areas" : "whole screen every 2s (no XDamage)",
+            lc->shm_img ? " over MIT-SHM" : "");
+}
+
+static void live_capture_free(LiveCapture *lc) {
+    if (lc->shm_img) {
+        XShmDetach(lc->dpy, &lc->shm);
+        XDestroyImage(lc->shm_img);
+        shmdt(lc->shm.shmaddr);
+    }
+    if (lc->region) XFixesDestroyRegion(lc->dpy, lc->region);
+    if (lc->damage) XDamageDestroy(lc->dpy, lc->damage);
+    fprintf(stderr, "Live capture: %" PRIu64 " grabs, %" PRIu64 " rectangles, "
+            "%.1f screens' worth of pixels\n", lc->grabs, lc->rects,
+            (double)lc->pixels / ((double)lc->width * lc->height));
+}
+
+static void grab_rect(LiveCapture *lc, GLuint tex, int x, int y, int w, int h) {
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > lc->width) w = lc->width - x;
+    if (y + h > lc->height) h = lc->height - y;
+    if (w <= 0 || h <= 0) return;
+
+    XImage *img = lc->shm_img;
+    if (img) {
+        int full_w = img->width, full_h = img->height, full_bpl = img->bytes_per_line;
+        img->width = w;
+        img->height = h;
+        img->bytes_per_line = w * 4;
+        if (XShmGetImage(lc->dpy, lc->root, img, x, y, AllPlanes))
+            upload_image(tex, img, x, y);
+        img->width = full_w;
+        img->height = full_h;
+        img->bytes_per_line = full_bpl;
+    } else {
+        img = XGetImage(lc->dpy, lc->root, x, y, (unsigned)w, (unsigned)h, AllPlanes, ZPixmap);
+        if (!img) return;
+        upload_image(tex, img, x, y);
+        XDestroyImage(img);
+    }
+    lc->rects++;
+    lc->pixels += (uint64_t)w * h;
+}
+
+/* Grab what changed since the last call, except `skip` (the preview
+ * window, which would otherwise capture itself) */
+static void live_capture_damage(LiveCapture *lc, GLuint tex, const XRectangle *skip) {
+    XDamageSubtract(lc->dpy, lc->damage, None, lc->region);
+    if (skip) {
+        XserverRegion own = XFixesCreateRegion(lc->dpy, (XRectangle *)skip, 1);
+        XFixesSubtractRegion(lc->dpy, lc->region, lc->region, own);
+        XFixesDestroyRegion(lc->dpy, own);
+    }
+    int n = 0;
+    XRectangle bounds;
+    XRectangle *r = XFixesFetchRegionAndBounds(lc->dpy, lc->region, &n, &bounds);
+    if (n > MAX_CAPTURE_RECTS) {
+        grab_rect(lc, tex, bounds.x, bounds.y, bounds.width, bounds.height);
+    } else {
+        for (int i = 0; i < n; i++)
+            grab_rect(lc, tex, r[i].x, r[i].y, r[i].width, r[i].height);
+    }
+    if (r) XFree(r);
+    if (n > 0) lc->grabs++;
+}
+
 /* ========================================================================== */
 /* Live preview window                                                        */
 /* ========================================================================== */
 
-static int run_live(Display *dpy, const char *shader_path, int fps) {
+static int run_live(Display *dpy, const char *shader_path, int fps, bool use_feed) {
     int screen = DefaultScreen(dpy);
     int scr_w = DisplayWidth(dpy, screen);
     int scr_h = DisplayHeight(dpy, screen);
@@ -428,9 +1456,34 @@ static int run_live(Display *dpy, const char *shader_path, int fps) {
     glXMakeCurrent(dpy, win, ctx);
 
     /* Compile shader */
-    GLuint prog = build_program(shader_path);
+    bool compute;
+    SsAuxCache aux = {0};
+    SsLut lut = {0};
+    GLuint prog = build_program(shader_path, false, &aux, &lut, &compute);
     if (!prog) return 1;
 
+    /* A compositor's frame feed replaces grabbing the screen; the
+     * texture is then the feed's size */
+    size_t feed_size = 0;
+    char feed_name[SS_FEED_NAME_MAX];
+    ss_feed_name(feed_name, sizeof(feed_name), DisplayString(dpy));
+    const SsFeedHeader *feed = use_feed ? ss_feed_attach(feed_name, &feed_size) : NULL;
+    if (feed && !(feed->images & SS_FEED_COMPOSITED)) {
+        fprintf(stderr, "Frame feed has no composited image, grabbing the screen\n");
+        munmap((void *)feed, feed_size);
+        feed = NULL;
+    } else if (feed && !ss_feed_writer_alive(feed)) {
+        fprintf(stderr, "Frame feed is left from a compositor that exited, "
+                "grabbing the screen\n");
+        munmap((void *)feed, feed_size);
+        feed = NULL;
+    }
+    int tex_w = feed ? (int)feed->width : scr_w;
+    int tex_h = feed ? (int)feed->height : scr_h;
+    uint64_t feed_seq = 0;
+    if (feed)
+        fprintf(stderr, "Live capture: compositor frame feed, %dx%d\n", tex_w, tex_h);
+
     /* Screen capture texture — capture ONCE before showing the window */
     GLuint tex;
     glGenTextures(1, &tex);
@@ -439,34 +1492,55 @@ static int run_live(Display *dpy, const char *shader_path, int fps) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, scr_w, scr_h, 0,
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex_w, tex_h, 0,
                  GL_BGRA, GL_UNSIGNED_BYTE, NULL);
 
-    /* Capture desktop BEFORE showing window (so it can't capture itself) */
-    capture_to_texture(dpy, tex, scr_w, scr_h);
+    /* Capture desktop BEFORE showing window (so it can't capture itself);
+     * from then on, only what changes */
+    LiveCapture lc;
+    memset(&lc, 0, sizeof(lc));
+    if (!feed) {
+        live_capture_init(&lc, dpy, scr_w, scr_h);
+        capture_to_texture(dpy, tex, scr_w, scr_h);
+        if (lc.damage) XDamageSubtract(dpy, lc.damage, None, None);
+    }
 
     /* Now show the window */
     XMapWindow(dpy, win);
     XSync(dpy, False);
 
-    /* Track window position for move-based re-capture */
+    /* Track window position for move-based re-capture, and where it is
+     * on the root (under a reparenting WM, win_x/y are frame-relative) */
     int win_x = scr_w / 4, win_y = scr_h / 4;
+    XRectangle own = { (short)win_x, (short)win_y, (unsigned short)win_w, (unsigned short)win_h };
 
     /* Fullscreen quad */
     GLuint vao, vbo;
-    setup_quad(&vao, &vbo);
+    setup_quad(&vao, &vbo, true);
 
     /* Uniform locations */
     GLint u_screen_loc = glGetUniformLocation(prog, "u_screen");
     GLint u_res_loc = glGetUniformLocation(prog, "u_resolution");
     GLint u_time_loc = glGetUniformLocation(prog, "u_time");
+    GLint u_prev_loc = glGetUniformLocation(prog, "u_prev");
+
+    /* Feedback shaders render unflipped at screen size into the pair,
+     * which is then flipped and scaled into the window */
+    SsFeedback fb = {0};
+    GLuint fb_vao = 0, fb_vbo = 0;
+    if (u_prev_loc >= 0 && ss_feedback_resize(&fb, tex_w, tex_h) < 0) {
+        fprintf(stderr, "Frame feedback unavailable, u_prev is the screen\n");
+        u_prev_loc = -1;
+    }
+    if (u_prev_loc >= 0) setup_quad(&fb_vao, &fb_vbo, false);
 
     struct timespec start_ts;
     clock_gettime(CLOCK_MONOTONIC, &start_ts);
 
     long render_ns = 1000000000L / fps;      /* render at full fps */
-    long capture_ns = 2000000000L;            /* re-capture every 2s */
+    long capture_ns = 2000000000L;            /* re-capture every 2s without XDamage */
     struct timespec last_capture = start_ts;
+    struct timespec next_frame = start_ts;
 
     fprintf(stderr, "Live preview: %s @ %d fps (R=refresh, Q/Esc=quit)\n",
             shader_path, fps);
@@ -474,6 +1548,7 @@ static int run_live(Display *dpy, const char *shader_path, int fps) {
     while (g_running) {
         /* Handle X events */
         int do_refresh = 0;
+        bool damaged = false;
         while (XPending(dpy)) {
             XEvent ev;
             XNextEvent(dpy, &ev);
@@ -491,6 +1566,13 @@ static int run_live(Display *dpy, const char *shader_path, int fps) {
                 win_y = ev.xconfigure.y;
                 win_w = ev.xconfigure.width;
                 win_h = ev.xconfigure.height;
+                int rx, ry;
+                Window child;
+                XTranslateCoordinates(dpy, win, DefaultRootWindow(dpy), 0, 0, &rx, &ry, &child);
+                own = (XRectangle){ (short)rx, (short)ry,
+                                    (unsigned short)win_w, (unsigned short)win_h };
+            } else if (lc.damage && ev.type == lc.damage_event + XDamageNotify) {
+                damaged = true;
             }
         }
         if (!g_running) break;
@@ -502,7 +1584,37 @@ static int run_live(Display *dpy, const char *shader_path, int fps) {
         clock_gettime(CLOCK_MONOTONIC, &now);
         long since_capture = (now.tv_sec - last_capture.tv_sec) * 1000000000L
                            + (now.tv_nsec - last_capture.tv_nsec);
-        if (do_refresh || since_capture >= capture_ns) {
+        /* A compositor that exits or stops publishing leaves its last
+         * frame behind: grab the screen instead, at its full size */
+        if (feed && (!ss_feed_writer_alive(feed) ||
+                     ss_feed_stale(feed, (uint64_t)now.tv_sec * 1000000000u +
+                                         (uint64_t)now.tv_nsec))) {
+            fprintf(stderr, "Frame feed stopped, grabbing the screen\n");
+            munmap((void *)feed, feed_size);
+            feed = NULL;
+            tex_w = scr_w;
+            tex_h = scr_h;
+            glBindTexture(GL_TEXTURE_2D, tex);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex_w, tex_h, 0,
+                         GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+            if (u_prev_loc >= 0 && ss_feedback_resize(&fb, tex_w, tex_h) < 0) {
+                fprintf(stderr, "Frame feedback unavailable, u_prev is the screen\n");
+                u_prev_loc = -1;
+            }
+            live_capture_init(&lc, dpy, scr_w, scr_h);
+            do_refresh = 1;
+        }
+        if (feed) {
+            /* A frame overwritten while it was uploaded is taken again */
+            uint64_t seq = feed_seq;
+            const unsigned char *px = ss_feed_latest(feed, SS_FEED_COMPOSITED, &seq);
+            if (px) {
+                glBindTexture(GL_TEXTURE_2D, tex);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tex_w, tex_h,
+                                GL_RGBA, GL_UNSIGNED_BYTE, px);
+                if (ss_feed_unchanged(feed, seq)) feed_seq = seq;
+            }
+        } else if (do_refresh || (!lc.damage && since_capture >= capture_ns)) {
             XMoveWindow(dpy, win, -10000, -10000);
             XSync(dpy, False);
             struct timespec wait = { 0, 50000000L }; /* 50ms for compositor */
@@ -511,37 +1623,71 @@ static int run_live(Display *dpy, const char *shader_path, int fps) {
             XMoveWindow(dpy, win, win_x, win_y);
             XSync(dpy, False);
             last_capture = now;
+            if (lc.damage) XDamageSubtract(dpy, lc.damage, None, None);
+        } else if (damaged) {
+            live_capture_damage(&lc, tex, &own);
+        }
+
+        /* Wait for the next frame, or for damage to grab before it */
+        long until_frame = (next_frame.tv_sec - now.tv_sec) * 1000000000L
+                         + (next_frame.tv_nsec - now.tv_nsec);
+        if (until_frame > 0) {
+            if (XEventsQueued(dpy, QueuedAlready) == 0) {
+                struct pollfd pfd = { ConnectionNumber(dpy), POLLIN, 0 };
+                poll(&pfd, 1, (int)((until_frame + 999999) / 1000000));
+            }
+            continue;
         }
+        next_frame.tv_nsec += render_ns;
+        next_frame.tv_sec += next_frame.tv_nsec / 1000000000L;
+        next_frame.tv_nsec %= 1000000000L;
+        if (until_frame < -render_ns) next_frame = now;   /* behind: no burst */
 
         /* Render shader with animated u_time */
-        glViewport(0, 0, win_w, win_h);
-        glClear(GL_COLOR_BUFFER_BIT);
         glUseProgram(prog);
+        if (u_prev_loc >= 0) {
+            ss_feedback_bind(&fb, u_prev_loc, tex);
+            glBindFramebuffer(GL_FRAMEBUFFER, fb.fbo[!fb.cur]);
+            glViewport(0, 0, tex_w, tex_h);
+        } else {
+            glViewport(0, 0, win_w, win_h);
+        }
+        glClear(GL_COLOR_BUFFER_BIT);
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, tex);
         if (u_screen_loc >= 0) glUniform1i(u_screen_loc, 0);
-        if (u_res_loc >= 0) glUniform2f(u_res_loc, (float)scr_w, (float)scr_h);
+        if (u_res_loc >= 0) glUniform2f(u_res_loc, (float)tex_w, (float)tex_h);
         if (u_time_loc >= 0) {
             float t = (float)(now.tv_sec - start_ts.tv_sec)
                     + (float)(now.tv_nsec - start_ts.tv_nsec) / 1e9f;
             glUniform1f(u_time_loc, t);
         }
 
-        glBindVertexArray(vao);
+        glBindVertexArray(u_prev_loc >= 0 ? fb_vao : vao);
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        if (u_prev_loc >= 0) {
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+            glBlitFramebuffer(0, 0, tex_w, tex_h, 0, win_h, win_w, 0,
+                              GL_COLOR_BUFFER_BIT, GL_LINEAR);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            ss_feedback_advance(&fb);
+        }
         glXSwapBuffers(dpy, win);
-
-        /* Frame rate limiter */
-        struct timespec sleep_ts = { 0, render_ns };
-        nanosleep(&sleep_ts, NULL);
     }
 
     /* Cleanup */
+    if (feed) munmap((void *)feed, feed_size);
+    else live_capture_free(&lc);
+    ss_feedback_free(&fb);
+    if (fb_vbo) glDeleteBuffers(1, &fb_vbo);
+    if (fb_vao) glDeleteVertexArrays(1, &fb_vao);
     glDeleteTextures(1, &tex);
     glDeleteBuffers(1, &vbo);
     glDeleteVertexArrays(1, &vao);
     glDeleteProgram(prog);
+    ss_aux_cache_free(&aux);
+    ss_lut_free(&lut);
     glXMakeCurrent(dpy, None, NULL);
     glXDestroyContext(dpy, ctx);
     XDestroyWindow(dpy, win);
@@ -557,9 +1703,12 @@ static void usage(const char *prog) {
     fprintf(stderr,
         "Usage:\n"
         "  %s <shader.frag> [--width W] [--height H] [--input-ppm]\n"
-        "  %s <shader.frag> --live [--fps N]\n"
+        "      [--time T] [--bench N] [--no-compute] [--glx]\n"
+        "  %s <shader.frag> --batch DIR|FILE|- [--out DIR] [--rate FPS]\n"
+        "      [--time T] [--no-compute] [--glx]\n"
+        "  %s <shader.frag> --live [--fps N] [--no-feed]\n"
         "  %s --screenshot-only [--width W] [--height H]\n",
-        prog, prog, prog);
+        prog, prog, prog, prog);
 }
 
 int main(int argc, char *argv[]) {
@@ -568,15 +1717,34 @@ int main(int argc, char *argv[]) {
     bool screenshot_only = false;
     bool input_ppm = false;
     bool live = false;
+    bool use_feed = true;
     int fps = 30;
+    float fixed_time = 0.5f;
+    bool time_set = false;
+    const char *batch_src = NULL, *batch_out = NULL;
+    double batch_rate = 0;
+    int bench_runs = 0;
+    bool allow_compute = true;
+    bool force_glx = false;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--screenshot-only") == 0) screenshot_only = true;
         else if (strcmp(argv[i], "--input-ppm") == 0) input_ppm = true;
         else if (strcmp(argv[i], "--live") == 0) live = true;
+        else if (strcmp(argv[i], "--no-feed") == 0) use_feed = false;
         else if (strcmp(argv[i], "--fps") == 0 && i+1 < argc) fps = atoi(argv[++i]);
         else if (strcmp(argv[i], "--width") == 0 && i+1 < argc) target_w = atoi(argv[++i]);
         else if (strcmp(argv[i], "--height") == 0 && i+1 < argc) target_h = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--time") == 0 && i+1 < argc) {
+            fixed_time = strtof(argv[++i], NULL);
+            time_set = true;
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i+1 < argc) batch_src = argv[++i];
+        else if (strcmp(argv[i], "--out") == 0 && i+1 < argc) batch_out = argv[++i];
+        else if (strcmp(argv[i], "--rate") == 0 && i+1 < argc) batch_rate = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--bench") == 0 && i+1 < argc) bench_runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--no-compute") == 0) allow_compute = false;
+        else if (strcmp(argv[i], "--glx") == 0) force_glx = true;
         else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
             usage(argv[0]); return 0;
         } else if (argv[i][0] != '-' && !shader_path) shader_path = argv[i];
@@ -598,17 +1766,34 @@ int main(int argc, char *argv[]) {
     if (live) {
         Display *dpy = XOpenDisplay(NULL);
         if (!dpy) { fprintf(stderr, "Cannot open display\n"); return 1; }
-        int ret = run_live(dpy, shader_path, fps);
+        int ret = run_live(dpy, shader_path, fps, use_feed);
         XCloseDisplay(dpy);
         return ret;
     }
 
+    /* ---- Batch mode: never needs the screen ---- */
+    if (batch_src) {
+        Batch batch = {0};
+        batch.out_dir = batch_out;
+        Offscreen off;
+        int ret = 1;
+        if (batch_open(&batch, batch_src) == 0) {
+            if (batch_rate > 0) batch.rate = batch_rate;
+            if (create_offscreen(&off, batch.w, batch.h, !force_glx) == 0)
+                ret = run_batch(&off, &batch, shader_path, time_set ? fixed_time : 0.0f,
+                                allow_compute);
+            destroy_offscreen(&off);
+        }
+        batch_close(&batch);
+        return ret;
+    }
+
     /* ---- Single-shot mode ---- */
     unsigned char *rgb = NULL;
     int img_w = 0, img_h = 0;
 
     if (input_ppm) {
-        rgb = read_ppm_stdin(&img_w, &img_h);
+        rgb = ss_read_ppm(stdin, &img_w, &img_h);
         if (!rgb) return 1;
     } else {
         Display *dpy = XOpenDisplay(NULL);
@@ -636,11 +1821,14 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    Display *dpy = XOpenDisplay(NULL);
-    if (!dpy) { fprintf(stderr, "Cannot open display\n"); free(rgb); return 1; }
-    unsigned char *result = render_single(dpy, shader_path, rgb, img_w, img_h);
+    /* Nothing left to capture: no display needed unless asked for */
+    Offscreen off;
+    unsigned char *result = NULL;
+    if (create_offscreen(&off, img_w, img_h, input_ppm && !force_glx) == 0)
+        result = render_single(&off, shader_path, rgb, img_w, img_h,
+                               fixed_time, bench_runs, allow_compute);
+    destroy_offscreen(&off);
     free(rgb);
-    XCloseDisplay(dpy);
     if (!result) return 1;
 
     write_ppm_stdout(result, img_w, img_h);
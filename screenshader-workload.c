@@ -0,0 +1,478 @@
+/*
+ * screenshader-workload - Synthetic X11 window workload for compositor benchmarks
+ *
+ * Creates top-level and override-redirect windows and keeps them busy at
+ * fixed rates: content updates (damage), moves, resizes, restacking and
+ * map/unmap churn. Every choice comes from a seeded PRNG, so a scenario
+ * sends the same requests on every run. Meant to run under Xvfb next to
+ * screenshader; tests/run-workload.sh drives both and collects the
+ * compositor's stats.
+ *
+ * Usage: screenshader-workload [options]   (see usage())
+ *
+ * Rates are totals per second over all windows. Operations are spread
+ * over 1 ms ticks, and the server is synced once per tick, so a rate the
+ * server cannot keep up with shows as lag in the report instead of as an
+ * ever-growing request queue. A `ready` line on stdout marks the end of
+ * window setup; the report follows as `key value` lines, like the
+ * compositor's stats file, before the windows are destroyed.
+ *
+ * --latency-probe X,Y adds a marker square centred at X,Y, kept above the
+ * other windows, that flips between black and white every 100-200 ms.
+ * After each flip has reached the server, its sequence number, colour
+ * and CLOCK_MONOTONIC time go to PROBE_FILE, where `screenshader
+ * --latency X,Y` matches them with the frames that show the change.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#define PROBE_FILE  "/tmp/screenshader.probe"
+#define PROBE_SIZE  32
+
+/* ========================================================================== */
+/* Data structures                                                            */
+/* ========================================================================== */
+
+typedef struct {
+    Window          id;
+    GC              gc;
+    Colormap        colormap;        /* ARGB windows only */
+    int             x, y;
+    int             width, height;
+    int             depth;
+    bool            override_redirect;
+    bool            mapped;
+} TestWin;
+
+typedef struct {
+    int             windows;         /* top-level, managed */
+    int             override;        /* override-redirect */
+    int             max_width, max_height;
+    int             argb_percent;
+    double          damage_hz;
+    double          move_hz;
+    double          resize_hz;
+    double          restack_hz;
+    double          churn_hz;
+    double          duration;
+    uint64_t        seed;
+    bool            probe;           /* --latency-probe X,Y */
+    int             probe_x, probe_y;
+} Options;
+
+enum { OP_DAMAGE, OP_MOVE, OP_RESIZE, OP_RESTACK, OP_CHURN, OP_COUNT };
+
+static const char *op_names[OP_COUNT] = {
+    "damage", "moves", "resizes", "restacks", "churn",
+};
+
+typedef struct {
+    Display        *dpy;
+    int             screen;
+    Window          root;
+    int             root_width, root_height;
+    Visual         *argb_visual;     /* NULL if the server has none */
+
+    TestWin        *wins;
+    int             count;
+
+    uint64_t        rng;
+    uint64_t        done[OP_COUNT];
+    double          max_lag_ms;      /* longest a tick fell behind */
+    uint64_t        ticks;
+
+    /* Latency probe; its own PRNG keeps the workload's sequence unchanged */
+    Window          marker;
+    GC              marker_gc;
+    uint64_t        probe_rng;
+    uint64_t        flips;
+    double          next_flip;
+} Workload;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    g_stop = 1;
+}
+
+/* ========================================================================== */
+/* Helpers                                                                    */
+/* ========================================================================== */
+
+/* xorshift64*: fast, and the same sequence for the same seed everywhere */
+static uint32_t xorshift64s(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static uint32_t rng_next(Workload *wl) {
+    return xorshift64s(&wl->rng);
+}
+
+/* Uniform in [lo, hi] */
+static int rng_range(Workload *wl, int lo, int hi) {
+    if (hi <= lo) return lo;
+    return lo + (int)(rng_next(wl) % (uint32_t)(hi - lo + 1));
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void random_size(Workload *wl, const Options *opts, int *w, int *h) {
+    *w = rng_range(wl, opts->max_width / 4 > 0 ? opts->max_width / 4 : 1, opts->max_width);
+    *h = rng_range(wl, opts->max_height / 4 > 0 ? opts->max_height / 4 : 1, opts->max_height);
+}
+
+static void random_position(Workload *wl, const TestWin *t, int *x, int *y) {
+    *x = rng_range(wl, 0, wl->root_width > t->width ? wl->root_width - t->width : 0);
+    *y = rng_range(wl, 0, wl->root_height > t->height ? wl->root_height - t->height : 0);
+}
+
+/* ========================================================================== */
+/* Windows                                                                    */
+/* ========================================================================== */
+
+static int create_window(Workload *wl, const Options *opts, TestWin *t, bool override) {
+    bool argb = wl->argb_visual && rng_range(wl, 1, 100) <= opts->argb_percent;
+    random_size(wl, opts, &t->width, &t->height);
+    random_position(wl, t, &t->x, &t->y);
+    t->override_redirect = override;
+
+    XSetWindowAttributes attrs;
+    memset(&attrs, 0, sizeof(attrs));
+    unsigned long mask = CWOverrideRedirect | CWBackPixel | CWBorderPixel;
+    attrs.override_redirect = override ? True : False;
+    attrs.background_pixel = argb ? 0 : BlackPixel(wl->dpy, wl->screen);
+    attrs.border_pixel = 0;
+
+    Visual *visual = CopyFromParent;
+    t->depth = DefaultDepth(wl->dpy, wl->screen);
+    if (argb) {
+        visual = wl->argb_visual;
+        t->depth = 32;
+        t->colormap = XCreateColormap(wl->dpy, wl->root, visual, AllocNone);
+        attrs.colormap = t->colormap;
+        mask |= CWColormap;
+    }
+
+    t->id = XCreateWindow(wl->dpy, wl->root, t->x, t->y,
+                          (unsigned)t->width, (unsigned)t->height, 0, t->depth,
+                          InputOutput, visual, mask, &attrs);
+    if (!t->id) return -1;
+    XStoreName(wl->dpy, t->id, "screenshader-workload");
+    t->gc = XCreateGC(wl->dpy, t->id, 0, NULL);
+    XMapWindow(wl->dpy, t->id);
+    t->mapped = true;
+    return 0;
+}
+
+static void destroy_windows(Workload *wl) {
+    for (int i = 0; i < wl->count; i++) {
+        TestWin *t = &wl->wins[i];
+        if (t->gc) XFreeGC(wl->dpy, t->gc);
+        if (t->id) XDestroyWindow(wl->dpy, t->id);
+        if (t->colormap) XFreeColormap(wl->dpy, t->colormap);
+    }
+    XSync(wl->dpy, False);
+    free(wl->wins);
+    wl->wins = NULL;
+    wl->count = 0;
+}
+
+/* ========================================================================== */
+/* Latency probe                                                              */
+/* ========================================================================== */
+
+static int create_marker(Workload *wl, const Options *opts) {
+    XSetWindowAttributes attrs;
+    memset(&attrs, 0, sizeof(attrs));
+    attrs.override_redirect = True;
+    attrs.background_pixel = BlackPixel(wl->dpy, wl->screen);
+    wl->marker = XCreateWindow(wl->dpy, wl->root,
+                               opts->probe_x - PROBE_SIZE / 2, opts->probe_y - PROBE_SIZE / 2,
+                               PROBE_SIZE, PROBE_SIZE, 0, CopyFromParent, InputOutput,
+                               CopyFromParent, CWOverrideRedirect | CWBackPixel, &attrs);
+    if (!wl->marker) return -1;
+    XStoreName(wl->dpy, wl->marker, "screenshader-workload probe");
+    wl->marker_gc = XCreateGC(wl->dpy, wl->marker, 0, NULL);
+    XMapRaised(wl->dpy, wl->marker);
+    wl->probe_rng = opts->seed ^ 0x9E3779B97F4A7C15ULL;
+    return 0;
+}
+
+/* Record a flip the server has drawn; written whole, then renamed, so
+ * the compositor never reads half a line */
+static void write_probe(uint64_t seq, int bright) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+
+    FILE *f = fopen(PROBE_FILE ".tmp", "w");
+    if (!f) return;
+    fprintf(f, "%" PRIu64 " %d %" PRIu64 "\n", seq, bright, ns);
+    fclose(f);
+    rename(PROBE_FILE ".tmp", PROBE_FILE);
+}
+
+/* Flip the marker if it is due; the caller syncs right after */
+static bool probe_due(Workload *wl, double elapsed) {
+    if (!wl->marker || elapsed < wl->next_flip) return false;
+    int bright = (int)(++wl->flips & 1);
+    XSetForeground(wl->dpy, wl->marker_gc,
+                   bright ? WhitePixel(wl->dpy, wl->screen) : BlackPixel(wl->dpy, wl->screen));
+    XFillRectangle(wl->dpy, wl->marker, wl->marker_gc, 0, 0, PROBE_SIZE, PROBE_SIZE);
+    wl->next_flip = elapsed + (100 + xorshift64s(&wl->probe_rng) % 101) / 1000.0;
+    return true;
+}
+
+/* ========================================================================== */
+/* Operations                                                                 */
+/* ========================================================================== */
+
+static void do_op(Workload *wl, const Options *opts, int op) {
+    TestWin *t = &wl->wins[rng_range(wl, 0, wl->count - 1)];
+    switch (op) {
+    case OP_DAMAGE: {
+        /* A random opaque rectangle of up to a quarter of the window */
+        int w = rng_range(wl, 1, t->width / 2 > 0 ? t->width / 2 : 1);
+        int h = rng_range(wl, 1, t->height / 2 > 0 ? t->height / 2 : 1);
+        int x = rng_range(wl, 0, t->width - w);
+        int y = rng_range(wl, 0, t->height - h);
+        unsigned long pixel = rng_next(wl) & 0xffffff;
+        if (t->depth == 32) pixel |= 0xff000000ul;
+        XSetForeground(wl->dpy, t->gc, pixel);
+        XFillRectangle(wl->dpy, t->id, t->gc, x, y, (unsigned)w, (unsigned)h);
+        break;
+    }
+    case OP_MOVE:
+        random_position(wl, t, &t->x, &t->y);
+        XMoveWindow(wl->dpy, t->id, t->x, t->y);
+        break;
+    case OP_RESIZE:
+        random_size(wl, opts, &t->width, &t->height);
+        XResizeWindow(wl->dpy, t->id, (unsigned)t->width, (unsigned)t->height);
+        break;
+    case OP_RESTACK:
+        if (rng_next(wl) & 1) XRaiseWindow(wl->dpy, t->id);
+        else XLowerWindow(wl->dpy, t->id);
+        if (wl->marker) XRaiseWindow(wl->dpy, wl->marker);
+        break;
+    case OP_CHURN:
+        if (t->mapped) XUnmapWindow(wl->dpy, t->id);
+        else XMapWindow(wl->dpy, t->id);
+        t->mapped = !t->mapped;
+        if (wl->marker) XRaiseWindow(wl->dpy, wl->marker);
+        break;
+    }
+    wl->done[op]++;
+}
+
+/* Issue every operation that is due by `elapsed` seconds */
+static void run_due(Workload *wl, const Options *opts, double elapsed) {
+    const double rates[OP_COUNT] = {
+        opts->damage_hz, opts->move_hz, opts->resize_hz, opts->restack_hz, opts->churn_hz,
+    };
+    if (wl->count == 0) return;
+    for (int op = 0; op < OP_COUNT; op++) {
+        uint64_t due = (uint64_t)(rates[op] * elapsed);
+        while (wl->done[op] < due) do_op(wl, opts, op);
+    }
+}
+
+static void run(Workload *wl, const Options *opts) {
+    const double tick = 0.001;
+    double start = now_seconds();
+    double next = start;
+    while (!g_stop) {
+        double now = now_seconds();
+        double elapsed = now - start;
+        if (elapsed >= opts->duration) break;
+
+        double lag = (now - next) * 1e3;
+        if (lag > wl->max_lag_ms) wl->max_lag_ms = lag;
+
+        run_due(wl, opts, elapsed);
+        bool flipped = probe_due(wl, elapsed);
+        XSync(wl->dpy, False);
+        if (flipped) write_probe(wl->flips, (int)(wl->flips & 1));
+        wl->ticks++;
+
+        next += tick;
+        now = now_seconds();
+        if (next > now) {
+            double wait = next - now;
+            struct timespec ts = { 0, (long)(wait * 1e9) };
+            nanosleep(&ts, NULL);
+        } else {
+            next = now;   /* behind: don't try to catch up in a burst */
+        }
+    }
+}
+
+/* ========================================================================== */
+/* Main                                                                       */
+/* ========================================================================== */
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --windows N       Top-level windows (default 10)\n"
+        "  --override N      Override-redirect windows (default 0)\n"
+        "  --size WxH        Largest window size (default 320x240); windows get\n"
+        "                    a random size from a quarter of it up\n"
+        "  --argb PCT        Percentage of windows with a 32-bit ARGB visual (0)\n"
+        "  --damage HZ       Content updates per second, over all windows (0)\n"
+        "  --move HZ         Window moves per second (0)\n"
+        "  --resize HZ       Window resizes per second (0)\n"
+        "  --restack HZ      Raises/lowers per second (0)\n"
+        "  --churn HZ        Map/unmap toggles per second (0)\n"
+        "  --duration S      Seconds to run after the windows are up (default 10)\n"
+        "  --seed N          PRNG seed (default 1)\n"
+        "  --latency-probe X,Y\n"
+        "                    Flip a black/white marker centred at X,Y for\n"
+        "                    screenshader --latency X,Y\n"
+        "  Prints `ready` once the windows are up, then what it did as\n"
+        "  `key value` lines.\n",
+        argv0);
+}
+
+int main(int argc, char *argv[]) {
+    Options opts = {
+        .windows = 10, .max_width = 320, .max_height = 240,
+        .duration = 10.0, .seed = 1,
+    };
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *v = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(a, "-h") == 0 || strcmp(a, "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        }
+        if (!v) {
+            fprintf(stderr, "Missing value or unknown option: %s\n", a);
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+        if (strcmp(a, "--windows") == 0) opts.windows = atoi(v);
+        else if (strcmp(a, "--override") == 0) opts.override = atoi(v);
+        else if (strcmp(a, "--argb") == 0) opts.argb_percent = atoi(v);
+        else if (strcmp(a, "--damage") == 0) opts.damage_hz = atof(v);
+        else if (strcmp(a, "--move") == 0) opts.move_hz = atof(v);
+        else if (strcmp(a, "--resize") == 0) opts.resize_hz = atof(v);
+        else if (strcmp(a, "--restack") == 0) opts.restack_hz = atof(v);
+        else if (strcmp(a, "--churn") == 0) opts.churn_hz = atof(v);
+        else if (strcmp(a, "--duration") == 0) opts.duration = atof(v);
+        else if (strcmp(a, "--seed") == 0) opts.seed = strtoull(v, NULL, 0);
+        else if (strcmp(a, "--latency-probe") == 0) {
+            if (sscanf(v, "%d,%d", &opts.probe_x, &opts.probe_y) != 2) {
+                fprintf(stderr, "Bad probe position (want X,Y): %s\n", v);
+                return 1;
+            }
+            opts.probe = true;
+        } else if (strcmp(a, "--size") == 0) {
+            if (sscanf(v, "%dx%d", &opts.max_width, &opts.max_height) != 2 ||
+                opts.max_width <= 0 || opts.max_height <= 0) {
+                fprintf(stderr, "Bad size (want WxH): %s\n", v);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", a);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opts.windows < 0 || opts.override < 0 ||
+        (opts.windows + opts.override == 0 && !opts.probe)) {
+        fprintf(stderr, "Need at least one window\n");
+        return 1;
+    }
+
+    Workload wl;
+    memset(&wl, 0, sizeof(wl));
+    wl.rng = opts.seed ? opts.seed : 1;
+    wl.dpy = XOpenDisplay(NULL);
+    if (!wl.dpy) {
+        fprintf(stderr, "Cannot open X display\n");
+        return 1;
+    }
+    wl.screen = DefaultScreen(wl.dpy);
+    wl.root = RootWindow(wl.dpy, wl.screen);
+    wl.root_width = DisplayWidth(wl.dpy, wl.screen);
+    wl.root_height = DisplayHeight(wl.dpy, wl.screen);
+
+    XVisualInfo vinfo;
+    if (XMatchVisualInfo(wl.dpy, wl.screen, 32, TrueColor, &vinfo)) wl.argb_visual = vinfo.visual;
+    else if (opts.argb_percent > 0) fprintf(stderr, "No 32-bit visual, all windows are opaque\n");
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    wl.wins = calloc((size_t)(opts.windows + opts.override), sizeof(TestWin));
+    if (!wl.wins) return 1;
+    double setup_start = now_seconds();
+    for (int i = 0; i < opts.windows + opts.override; i++) {
+        if (create_window(&wl, &opts, &wl.wins[wl.count], i >= opts.windows) < 0) {
+            fprintf(stderr, "Cannot create window %d\n", i);
+            break;
+        }
+        wl.count++;
+    }
+    if (opts.probe && create_marker(&wl, &opts) < 0) {
+        fprintf(stderr, "Cannot create the probe marker\n");
+        opts.probe = false;
+    }
+    XSync(wl.dpy, False);
+    double setup = now_seconds() - setup_start;
+
+    /* Lets a driver snapshot the compositor between setup and the run */
+    printf("ready\n");
+    fflush(stdout);
+
+    double start = now_seconds();
+    if (wl.count > 0 || wl.marker) run(&wl, &opts);
+    double ran = now_seconds() - start;
+
+    printf("windows %d\n", opts.windows);
+    printf("override_redirect %d\n", opts.override);
+    printf("created %d\n", wl.count);
+    printf("setup_s %.3f\n", setup);
+    printf("duration_s %.3f\n", ran);
+    for (int op = 0; op < OP_COUNT; op++)
+        printf("%s %" PRIu64 "\n", op_names[op], wl.done[op]);
+    if (wl.marker) printf("probe_flips %" PRIu64 "\n", wl.flips);
+    printf("ticks %" PRIu64 "\n", wl.ticks);
+    printf("max_lag_ms %.2f\n", wl.max_lag_ms);
+    fflush(stdout);
+
+    if (wl.marker) {
+        XFreeGC(wl.dpy, wl.marker_gc);
+        XDestroyWindow(wl.dpy, wl.marker);
+        unlink(PROBE_FILE);
+    }
+
+    destroy_windows(&wl);
+    XCloseDisplay(wl.dpy);
+    return 0;
+}
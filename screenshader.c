@@ -5,10 +5,42 @@
  * then applies a post-processing fragment shader before displaying to the
  * XComposite overlay window.
  *
- * Usage: screenshader [path/to/shader.frag]
- *        Defaults to shaders/crt.frag if no argument given.
+ * Usage: screenshader [--software] [--exclude-class NAME ...] [path/to/shader.frag ...]
+ *        Defaults to shaders/crt.frag if no argument given. Several
+ *        shaders form an effect stack, applied in order.
+ *        --exclude-class/-window/-rect leave windows or screen areas
+ *        unshaded, --window-class/-title shade single windows with a
+ *        shader of their own (see usage()).
+ *        --software forces the CPU renderer (also used automatically when
+ *        GLX texture_from_pixmap is unavailable). It ignores the params
+ *        file and shader hot-reload.
+ *        --frames-in-flight N bounds the frames queued on the GPU (default 1).
+ *        --feed publishes downscaled frames in shared memory for previews.
+ *        --profile picks speed/quality defaults for the renderer; by
+ *        default a startup benchmark, cached per renderer, chooses.
  *        Send SIGUSR1 to hot-reload the shader file.
+ *        Send SIGUSR2 to dump stats to /tmp/screenshader.stats (and with
+ *        --trace, a Chrome trace of the last frames to
+ *        /tmp/screenshader.trace.json).
+ *        --latency X,Y times the flips of screenshader-workload's
+ *        --latency-probe marker at X,Y from X server to swap.
  *        Send SIGINT/SIGTERM to stop.
+ *
+ * The main loop is a single epoll set over the X connection, a signalfd,
+ * a frame timerfd (armed only while the shader animates) and an inotify
+ * watch on the params file, so an idle desktop with a static shader
+ * causes no wakeups at all.
+ *
+ * X events are handled on a separate thread with its own X connection. It
+ * turns them into compact WinDelta records and hands them to the render
+ * thread through a lock-free single-producer/single-consumer ring; the
+ * render thread applies them at frame start. All GL/GLX calls stay on the
+ * render (main) thread.
+ *
+ * Without GLX texture_from_pixmap the compositor falls back to a software
+ * path: windows are read back over MIT-SHM, composited and shaded on the
+ * CPU by native ports of the bundled shaders, and put on the overlay.
+ * The ports take no params, and editing a .frag does not change them.
  */
 
 #define _POSIX_C_SOURCE 200809L
@@ -16,16 +48,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
 #include <signal.h>
 #include <time.h>
-#include <poll.h>
 #include <unistd.h>
 #include <math.h>
 #include <libgen.h>
 #include <limits.h>
 #include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -35,6 +81,8 @@
 #include <X11/extensions/Xfixes.h>
 #include <X11/extensions/Xrender.h>
 #include <X11/extensions/shape.h>
+#include <X11/extensions/sync.h>
+#include <X11/extensions/XShm.h>
 
 #define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
@@ -42,6 +90,8 @@
 #include <GL/glext.h>
 #include <GL/glxext.h>
 
+#include "shaderlib.h"
+
 /* ========================================================================== */
 /* Data structures                                                            */
 /* ========================================================================== */
@@ -51,19 +101,246 @@ typedef struct WinEntry {
     Pixmap          pixmap;
     GLXPixmap       glx_pixmap;
     GLuint          texture;
-    Damage          damage;
     int             x, y;
     int             width, height;
     int             border_width;
+    int             depth;
     bool            mapped;
     bool            override_redirect;
     bool            damaged;
     bool            pixmap_valid;
+    bool            needs_bind;  /* (re)bind pixmap once the delta batch is applied */
+    bool            excluded;    /* matches an exclusion rule: left unshaded */
+    int             shader;      /* per-window shader rule + 1, 0 = none */
+    GLuint          shade_tex;   /* its input: window-sized copy of the pixmap */
+    GLuint          shade_fbo;
+    int             shade_w, shade_h;
+    bool            shade_stale; /* pixmap changed since the copy */
+    XImage         *sw_image;    /* software backend: CPU copy of the pixmap */
+    XShmSegmentInfo sw_shm;
     struct WinEntry *next; /* above (toward viewer) */
     struct WinEntry *prev; /* below */
 } WinEntry;
 
+/* Screen area whose composite changed since the last frame (X coordinates) */
+typedef struct {
+    int x, y, width, height;
+} DamageRect;
+
+#define MAX_DAMAGE_RECTS 16
+
+/* Areas left unshaded, where the raw composite shows through: windows
+ * matched by WM_CLASS (instance or class name) or id, and fixed screen
+ * rectangles. Set from the command line before the event thread starts,
+ * read-only afterwards. */
+#define MAX_EXCLUDE 16
+
+typedef struct {
+    const char     *classes[MAX_EXCLUDE];
+    int             class_count;
+    Window          windows[MAX_EXCLUDE];
+    int             window_count;
+    DamageRect      rects[MAX_EXCLUDE];   /* X coordinates */
+    int             rect_count;
+} ExcludeRules;
+
+/* Shaders applied to single windows as they are composited, matched by
+ * WM_CLASS (instance or class name) or a substring of the title when the
+ * window is mapped. The first matching rule wins. */
+#define MAX_WIN_SHADERS 8
+
+typedef struct {
+    const char     *match;
+    bool            by_title;
+    char           *shader;          /* resolved path */
+} WinShaderRule;
+
+typedef struct {
+    WinShaderRule   rules[MAX_WIN_SHADERS];
+    int             count;
+    bool            any_title;
+} WinShaderRules;
+
+/* Window-state change produced by the X event thread */
+enum {
+    WD_MAP = 1,     /* geometry, depth, override-redirect; adds if unknown */
+    WD_UNMAP,
+    WD_DESTROY,     /* also used for reparent away from root */
+    WD_CONFIGURE,   /* geometry + sibling it is stacked above */
+    WD_CIRCULATE,
+    WD_DAMAGE,      /* x, y, width, height inside the border; width 0 = all */
+    WD_ROOT_SIZE,
+    WD_RULES,       /* title changed: flags (WDF_EXCLUDED) and shader again */
+};
+
+#define WDF_OVERRIDE_REDIRECT  0x01
+#define WDF_PLACE_ON_TOP       0x02
+#define WDF_EXCLUDED           0x04
+
+typedef struct {
+    uint8_t         type;
+    uint8_t         depth;
+    uint8_t         flags;
+    uint8_t         shader;          /* WD_MAP, WD_RULES: shader rule + 1 */
+    Window          xid;
+    Window          above;
+    short           x, y;
+    unsigned short  width, height, border_width;
+} WinDelta;
+
+/* Lock-free SPSC ring: the event thread only writes tail, the render thread
+ * only writes head. Indices run freely and are masked on access. */
+#define DELTA_QUEUE_SIZE 4096 /* power of two */
+
+typedef struct {
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    _Alignas(64) WinDelta      slots[DELTA_QUEUE_SIZE];
+} DeltaQueue;
+
+/* X fence shared with GL (GL_EXT_x11_sync_object). Triggered by the server
+ * once all rendering queued before it has landed; GL waits on it on the
+ * GPU timeline, so rebinding a damaged window never blocks the CPU. */
+#define SYNC_RING_SIZE 4
+
+typedef struct {
+    XSyncFence      xfence;
+    GLsync          gl_sync;         /* xfence imported into GL (once) */
+    GLsync          gpu_done;        /* GL has passed the wait; safe to reset */
+} XGLFence;
+
+/* X protocol traffic of one connection, kept by the thread that owns it
+ * and read by the render thread for the stats */
+typedef struct {
+    atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t round_trips;
+    unsigned long   first_request;   /* sequence number when counting began */
+} XTraffic;
+
+/* Damage objects live on the event thread's connection */
+typedef struct DamageRec {
+    Window           xid;
+    Window           client;     /* titled window watched for renames, or 0 */
+    Damage           damage;
+    struct DamageRec *next;
+} DamageRec;
+
+typedef struct {
+    pthread_t       thread;
+    bool            started;
+    Display        *dpy;             /* owned by the event thread once started */
+    Window          root;
+    Window          overlay;
+    int             damage_event;
+    DamageRec      *damages;
+    XserverRegion   damage_parts;    /* scratch for XDamageSubtract */
+    atomic_bool     damage_rects;    /* send damaged rectangles, not windows */
+    DeltaQueue     *queue;
+    const ExcludeRules *exclude;
+    const WinShaderRules *win_rules;
+    Atom            net_wm_name;     /* interned when a rule matches titles */
+    Atom            utf8_string;
+    int             wake_fd;         /* eventfd: event thread -> render thread */
+    int             quit_fd;         /* eventfd: render thread -> event thread */
+    bool            pending_wake;
+    atomic_uint_fast64_t x_events;
+    atomic_uint_fast64_t queue_full; /* times the producer had to wait */
+    XTraffic        traffic;
+} EventThread;
+
+/* Software backend: CPU ports of the bundled shaders. rows() shades
+ * [y0, y1) of the composited frame into the output image; scratch is
+ * per-thread memory for neighbourhood rows. */
+typedef struct SoftState SoftState;
+
+typedef struct {
+    const char *name;       /* shader basename without .frag */
+    bool        animated;
+    void      (*setup)(SoftState *sw);  /* size-dependent tables */
+    void      (*frame)(SoftState *sw);  /* per-frame state, may be NULL */
+    void      (*rows)(SoftState *sw, int y0, int y1, float *scratch);
+} SoftKernel;
+
+/* An earlier pass of an effect stack: one or more stages fused into a
+ * fragment program whose output is the next pass's u_screen */
 typedef struct {
+    GLuint           prog;
+    GLint            u_screen;
+    GLint            u_resolution;
+    GLint            u_time;
+    int              margin;          /* texels it reads around a pixel */
+    int              first_stage;     /* for messages and image paths */
+    ShaderDirectives dir;
+    SsAuxBinding     aux;             /* re-bound every frame */
+} StackPass;
+
+/* Defaults for the knobs that trade quality for speed, by renderer class */
+typedef struct {
+    const char     *name;
+    int             interleave;      /* for static shaders that declare none */
+    int             frame_hz;        /* frame timer of animated shaders */
+    GLenum          fbo_format;      /* pass 1 and effect stack targets */
+    bool            mipmaps;         /* on image textures shaders declare */
+} TuneProfile;
+
+/* Program of a per-window shader rule */
+typedef struct {
+    GLuint           prog;            /* 0 = not built, window drawn plainly */
+    GLint            u_resolution;
+    GLint            u_time;
+    GLint            u_screen;
+    GLint            u_window_tex;
+    GLint            u_rect;
+    bool             animated;        /* reads u_time */
+    SsAuxBinding     aux;
+} WinProgram;
+
+typedef struct Compositor Compositor;
+typedef void (*SoftBandFn)(Compositor *comp, int band, int worker);
+
+#define SW_MAX_THREADS 16
+
+/* Fixed worker pool; each dispatch hands out row bands through an
+ * atomic counter and the caller works alongside the workers. */
+typedef struct {
+    pthread_t       threads[SW_MAX_THREADS];
+    int             nthreads;
+    bool            initialized;
+    pthread_mutex_t lock;
+    pthread_cond_t  start_cv;
+    pthread_cond_t  done_cv;
+    unsigned        generation;
+    int             pending;
+    bool            quit;
+    SoftBandFn      fn;
+    Compositor     *comp;
+    int             nbands;
+    atomic_int      next_band;
+} SoftPool;
+
+struct SoftState {
+    const SoftKernel *kernel;
+    SoftPool        pool;
+    bool            use_shm;
+    Visual         *visual;          /* overlay visual/depth for output */
+    int             depth;
+    GC              gc;
+    XImage         *out;
+    XShmSegmentInfo out_shm;
+    int             width, height;
+    uint32_t       *frame;           /* composited 0x00RRGGBB, padded rows */
+    int             frame_stride;
+    float          *col_a, *col_b;   /* per-column / per-row kernel tables */
+    float          *row_a, *row_b;
+    float          *scratch;
+    size_t          scratch_stride;
+    float          *noise;
+    int             noise_ox, noise_oy;
+    float           flicker;
+    float           time;
+};
+
+struct Compositor {
     /* X11 core */
     Display        *dpy;
     int             screen;
@@ -74,6 +351,9 @@ typedef struct {
     /* Extension event bases */
     int             damage_event, damage_error;
 
+    /* X event thread and its delta queue */
+    EventThread     events;
+
     /* GLX */
     GLXContext      glx_ctx;
     GLXWindow       glx_win;
@@ -89,25 +369,98 @@ typedef struct {
     PFNGLXBINDTEXIMAGEEXTPROC    glXBindTexImageEXT;
     PFNGLXRELEASETEXIMAGEEXTPROC glXReleaseTexImageEXT;
 
+    /* X -> GL synchronization (XSync fences + GL_EXT_x11_sync_object) */
+    PFNGLIMPORTSYNCEXTPROC       glImportSyncEXT;
+    bool            use_xsync;
+    XGLFence        fences[SYNC_RING_SIZE];
+    int             fence_next;
+
+    /* Frames swapped but not finished on the GPU, oldest first */
+    #define MAX_FRAMES_IN_FLIGHT 4
+    GLsync          frame_fences[MAX_FRAMES_IN_FLIGHT];
+    int             frames_queued;
+    int             max_frames;      /* --frames-in-flight */
+
     /* OpenGL objects */
     GLuint          fbo;
     GLuint          fbo_texture;
+    GLuint          cs_fbo;          /* offscreen output (compute, interleave), blitted */
+    GLuint          cs_texture;
+    SsFeedback      feedback;        /* previous output for u_prev */
     GLuint          vao;
     GLuint          vbo;
+    GLuint          band_vao;        /* interleaved shading: row bands */
+    GLuint          band_vbo;
+    int             band_height;     /* root height and interleave the bands */
+    int             band_phases;     /* were built for */
 
     /* Shader programs */
     GLuint          vert_shader;     /* kept alive for hot-reload */
     GLuint          composite_prog;
     GLuint          postproc_prog;
+    bool            postproc_compute; /* postproc_prog is the compute tile variant */
+    bool            postproc_single; /* ... or composites windows itself (pointwise) */
+    bool            compute_available; /* GL 4.3 */
+    SsAuxCache      aux_cache;       /* textures declared by shaders */
+    SsLut           lut;             /* baked colour stage, prog 0 = none */
+    bool            lut_dirty;       /* re-bake before the next frame */
+
+    /* Effect stack: each stage shades the output of the one before. Runs
+     * of stages that only read their own pixel share a pass; the last pass
+     * is postproc_prog, the others render into the stack textures. */
+    StackPass       stack[SS_MAX_STAGES - 1];
+    int             stack_passes;    /* passes before postproc_prog */
+    int             postproc_stage;  /* first stage in postproc_prog */
+    SsAuxBinding    postproc_aux;    /* re-bound after stack passes and window shaders */
+    GLuint          stack_fbo[2];    /* ping-pong between the passes */
+    GLuint          stack_tex[2];
 
     /* Post-process uniform locations */
     GLint           u_screen_tex;
     GLint           u_resolution;
     GLint           u_time;
+    GLint           u_prev;          /* >= 0: shader wants frame feedback */
+    GLint           u_lut;
+    GLint           u_window_tex;    /* single pass only */
+    GLint           u_window_rect;
+    GLint           u_interleave;    /* compute tile path only */
+    GLint           u_phase;
+    GLint           u_tile_offset;
+
+    /* Interleaved shading: 1/N of the screen per frame, plus the damage */
+    int             interleave;      /* N, 1 = off */
+    int             interleave_opt;  /* --interleave, -1 = as the shader declares */
+    const TuneProfile *profile;
+    const char     *profile_opt;     /* --profile, NULL = auto */
+    double          tune_fill;       /* benchmark, Gpixel/s (0 = from cache) */
+    double          tune_fetch;      /* benchmark, Gtexel/s */
+    GLenum          fbo_format;      /* what the profile asked for, if renderable */
+    int             phase;
+    int             settle_frames;   /* frames until every pixel is current */
+    bool            output_valid;    /* cs_texture holds a complete frame */
+    int             damage_margin;   /* texels a shaded pixel depends on */
+    DamageRect      damage[MAX_DAMAGE_RECTS];
+    int             damage_count;
+    bool            damage_full;
 
     /* Composite uniform locations */
     GLint           uc_texture;
 
+    /* Exclusion masks: a stencil on the pass 2 target keeps the shader off
+     * excluded areas, and the composite is copied into them instead */
+    ExcludeRules    exclude;
+    GLuint          mask_rb;         /* depth-stencil, root size */
+    bool            mask_failed;     /* no complete target with a stencil */
+    GLuint          copy_prog;
+    GLint           ucopy_texture;
+
+    /* Per-window shaders, drawn in pass 1. Without a global shader there
+     * is no pass 2 and windows go straight to the overlay. */
+    WinShaderRules  win_rules;
+    WinProgram      win_progs[MAX_WIN_SHADERS];
+    bool            global_effect;   /* a global shader runs in pass 2 */
+    bool            win_animated;    /* some window program reads u_time */
+
     /* Window list (doubly-linked, bottom-to-top) */
     WinEntry       *win_head;
     WinEntry       *win_tail;
@@ -118,55 +471,344 @@ typedef struct {
         char  name[64];
         float value;
         GLint location;
+        GLint stack_location[SS_MAX_STAGES - 1];
+        GLint win_location[MAX_WIN_SHADERS];
     } params[MAX_PARAMS];
     int             param_count;
-    time_t          param_mtime;     /* last modification time of params file */
-    int             param_check_ctr; /* frame counter for periodic check */
+    struct timespec param_mtime;     /* last modification time of params file */
+
+    /* Event loop (epoll over X, signalfd, frame timerfd, inotify) */
+    int             epoll_fd;
+    int             signal_fd;
+    int             timer_fd;
+    int             inotify_fd;
+    long            frame_interval_ns;
+    bool            timer_armed;
+    bool            animated;        /* postproc_prog reads u_time or u_prev */
+
+    /* Counters, dumped to STATS_FILE on SIGUSR2 and at exit */
+    struct {
+        uint64_t    frames;
+        uint64_t    deltas;
+        uint64_t    wakeups_x;
+        uint64_t    wakeups_deltas;
+        uint64_t    wakeups_signal;
+        uint64_t    wakeups_timer;
+        uint64_t    wakeups_inotify;
+        uint64_t    timer_overruns;  /* expirations missed while rendering */
+        uint64_t    fence_syncs;     /* frames whose rebinds waited on a fence */
+        uint64_t    fence_busy;      /* ring slot still in use -> implicit sync */
+        uint64_t    sw_captures;     /* software: window readbacks */
+        uint64_t    sw_composites;   /* software: frames that re-composited */
+        uint64_t    masked_frames;   /* frames with excluded areas */
+        uint64_t    window_shades;   /* windows drawn through their own shader */
+        uint64_t    window_preps;    /* ... whose input copy had to be redone */
+        uint64_t    queue_depth_sum; /* frames in flight at each frame start */
+        int         queue_depth_max;
+        uint64_t    queue_waits;     /* frames that waited for an older one */
+        uint64_t    queue_wait_ns;
+    } stats;
+
+    /* X traffic of the render connection; per frame, both connections
+     * from the end of one frame to the end of the next */
+    XTraffic        xtraffic;
+    struct {
+        uint64_t    requests, round_trips, events;
+    } x_frame, x_frame_max, x_frame_end;
+
+    /* Damage-to-photon latency (--latency): a few pixels of each frame
+     * are read back through a ring of PBOs and checked for the probe's
+     * marker once the copy has landed */
+    #define LATENCY_SLOTS   3
+    #define LATENCY_SAMPLES 4096
+    #define LATENCY_SIZE    4        /* pixels read back, square */
+    struct {
+        bool        on;
+        int         x, y;            /* marker centre, X coordinates */
+        GLuint      pbo[LATENCY_SLOTS];
+        GLsync      fence[LATENCY_SLOTS];   /* NULL = slot free */
+        uint64_t    swap_ns[LATENCY_SLOTS]; /* when its frame was swapped */
+        int         next;
+        int         state;           /* marker last seen: -1 unknown, 0 dark, 1 bright */
+        uint64_t    last_seq;        /* probe flip already measured */
+        float       samples_ms[LATENCY_SAMPLES];
+        uint64_t    count;
+        uint64_t    unmatched;       /* changes seen with no matching flip */
+    } latency;
+
+    /* Frame feed (--feed): downscaled frames published in shared memory
+     * under ss_feed_name() for this display.
+     * The GPU scales them into small targets, a PBO ring reads them back
+     * and a fence says when a copy can be published without waiting. */
+    #define FEED_PBOS 3
+    struct {
+        uint32_t    images;          /* SS_FEED_* to publish, 0 = off */
+        int         width, height;
+        long        interval_ns;
+        uint64_t    next_ns;         /* earliest next capture */
+        bool        stale;           /* a frame went out without a capture */
+        char        name[SS_FEED_NAME_MAX];
+        SsFeedHeader *shm;
+        size_t      shm_size;
+        GLuint      tex[2], fbo[2];  /* one target per image */
+        GLuint      pbo[FEED_PBOS];  /* every image of one capture */
+        GLsync      fence[FEED_PBOS];
+        uint64_t    time_ns[FEED_PBOS];
+        int         next;
+        uint64_t    published;       /* also the feed's sequence number */
+        uint64_t    dropped;         /* captures skipped, readback ring full */
+    } feed;
+
+    /* GPU timestamps for the trace, read back a few frames later so the
+     * CPU never waits for them */
+    #define TRACE_GPU_SLOTS 4
+    struct {
+        GLuint      queries[TRACE_GPU_SLOTS][2]; /* begin, end; 0 = off */
+        const char *name[TRACE_GPU_SLOTS];
+        bool        pending[TRACE_GPU_SLOTS];
+        int         next;
+        bool        active;          /* between trace_gpu_begin and _end */
+        int64_t     offset_ns;       /* CPU monotonic clock minus GPU clock */
+    } gpu_trace;
 
     /* Runtime state */
     bool            running;
     bool            needs_redraw;
     bool            shader_reload;
-    char           *shader_path;
+    char           *shader_path;     /* stage_paths[0] */
+    char           *stage_paths[SS_MAX_STAGES];
+    int             stage_count;
     char           *shader_dir;      /* directory containing the executable */
     struct timespec start_time;
-} Compositor;
 
-#define PARAM_FILE "/tmp/screenshader.params"
+    /* Software backend (no GLX texture_from_pixmap, or --software) */
+    bool            software;
+    bool            scene_changed;   /* window list/geometry changed */
+    SoftState       sw;
+};
+
+typedef struct {
+    const char     *shaders[SS_MAX_STAGES];
+    int             shader_count;
+    bool            software;
+    int             interleave;      /* -1 = as the shader declares */
+    int             max_frames;      /* frames in flight */
+    uint32_t        feed;            /* --feed, SS_FEED_* bits */
+    int             feed_width, feed_height;
+    int             feed_hz;
+    bool            trace;
+    const char     *profile;         /* --profile NAME, NULL = auto */
+    bool            latency;         /* --latency X,Y */
+    int             latency_x, latency_y;
+    ExcludeRules    exclude;
+    WinShaderRules  win_rules;
+} Options;
+
+#define PARAM_DIR   "/tmp"
+#define PARAM_NAME  "screenshader.params"
+#define PARAM_FILE  PARAM_DIR "/" PARAM_NAME
+#define STATS_FILE  "/tmp/screenshader.stats"
+#define STATS_TMP   STATS_FILE ".tmp"   /* renamed over STATS_FILE when complete */
+#define TRACE_FILE  "/tmp/screenshader.trace.json"
+#define PROBE_FILE  "/tmp/screenshader.probe"   /* latency probe's last flip */
+
+/* epoll data tags: every wakeup is attributed to exactly one of these */
+enum {
+    SRC_X = 1,
+    SRC_DELTAS,
+    SRC_SIGNAL,
+    SRC_TIMER,
+    SRC_INOTIFY,
+};
 
 /* ========================================================================== */
-/* Globals (for signal handlers)                                              */
+/* Tracing                                                                    */
 /* ========================================================================== */
 
-static volatile sig_atomic_t g_running = 1;
-static volatile sig_atomic_t g_reload  = 0;
+/*
+ * Opt-in timeline (--trace), written as Chrome trace JSON (chrome://tracing,
+ * Perfetto) next to the stats. The render and X event threads record spans
+ * into one ring without locks: a writer claims a slot with an atomic
+ * increment and publishes it by storing its sequence number last, and the
+ * dump skips slots that are being rewritten. The ring keeps the latest
+ * TRACE_RING_SIZE spans. Disabled, a trace point costs one branch.
+ */
+#define TRACE_RING_SIZE 32768 /* power of two */
+
+enum { TRACE_RENDER = 1, TRACE_EVENTS, TRACE_GPU };   /* timeline rows */
 
-/* ========================================================================== */
-/* Signal handlers                                                            */
-/* ========================================================================== */
+typedef struct {
+    atomic_uint_fast64_t seq;        /* claim index + 1 once complete */
+    const char     *name;            /* static strings only */
+    const char     *arg_name;        /* "window" is printed in hex; NULL = none */
+    uint64_t        arg;
+    uint64_t        start_ns, dur_ns;
+    uint8_t         tid;
+} TraceSpan;
+
+static struct {
+    bool            on;
+    TraceSpan      *ring;
+    atomic_uint_fast64_t next;
+} g_trace;
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void trace_record(uint8_t tid, const char *name, uint64_t start_ns, uint64_t dur_ns,
+                         const char *arg_name, uint64_t arg) {
+    uint64_t i = atomic_fetch_add_explicit(&g_trace.next, 1, memory_order_relaxed);
+    TraceSpan *s = &g_trace.ring[i & (TRACE_RING_SIZE - 1)];
+    atomic_store_explicit(&s->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    s->name = name;
+    s->arg_name = arg_name;
+    s->arg = arg;
+    s->start_ns = start_ns;
+    s->dur_ns = dur_ns;
+    s->tid = tid;
+    atomic_store_explicit(&s->seq, i + 1, memory_order_release);
+}
 
-static void handle_signal(int sig) {
-    (void)sig;
-    g_running = 0;
+/* Start of a span, 0 when tracing is off */
+static inline uint64_t trace_begin(void) {
+    return g_trace.on ? mono_ns() : 0;
 }
 
-static void handle_sigusr1(int sig) {
-    (void)sig;
-    g_reload = 1;
+static inline void trace_end(uint8_t tid, const char *name, uint64_t start_ns,
+                             const char *arg_name, uint64_t arg) {
+    if (g_trace.on) trace_record(tid, name, start_ns, mono_ns() - start_ns, arg_name, arg);
+}
+
+/* Write the ring as Chrome trace JSON, timestamps relative to start */
+static void write_trace(const struct timespec *start) {
+    if (!g_trace.on) return;
+    FILE *f = fopen(TRACE_FILE, "w");
+    if (!f) {
+        fprintf(stderr, "Cannot write %s: %s\n", TRACE_FILE, strerror(errno));
+        return;
+    }
+    static const char *rows[] = { NULL, "render", "X events", "GPU" };
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int t = TRACE_RENDER; t <= TRACE_GPU; t++) {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}", t == TRACE_RENDER ? "" : ",\n", t, rows[t]);
+    }
+
+    uint64_t base = (uint64_t)start->tv_sec * 1000000000u + (uint64_t)start->tv_nsec;
+    uint64_t end = atomic_load_explicit(&g_trace.next, memory_order_acquire);
+    uint64_t first = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+    int written = 0;
+    for (uint64_t i = first; i < end; i++) {
+        TraceSpan *slot = &g_trace.ring[i & (TRACE_RING_SIZE - 1)];
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        TraceSpan s;
+        s.name = slot->name;
+        s.arg_name = slot->arg_name;
+        s.arg = slot->arg;
+        s.start_ns = slot->start_ns;
+        s.dur_ns = slot->dur_ns;
+        s.tid = slot->tid;
+        atomic_thread_fence(memory_order_acquire);
+        if (seq != i + 1 || atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq)
+            continue;
+        if (s.start_ns < base) continue;
+
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f", s.name, s.tid,
+                (double)(s.start_ns - base) / 1e3, (double)s.dur_ns / 1e3);
+        if (s.arg_name && strcmp(s.arg_name, "window") == 0)
+            fprintf(f, ",\"args\":{\"window\":\"0x%" PRIx64 "\"}", s.arg);
+        else if (s.arg_name)
+            fprintf(f, ",\"args\":{\"%s\":%" PRIu64 "}", s.arg_name, s.arg);
+        fputc('}', f);
+        written++;
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    fprintf(stderr, "Wrote %d trace spans to %s\n", written, TRACE_FILE);
 }
 
 /* ========================================================================== */
 /* X error handler                                                            */
 /* ========================================================================== */
 
-static volatile int g_last_xerror = 0;
+/* Each thread talks to the server over its own Display, and Xlib runs the
+ * error handler on the thread that reads the error, so keep it per thread. */
+static _Thread_local volatile int g_last_xerror = 0;
+
+/* Failed requests by major opcode, both connections */
+static atomic_uint_fast64_t g_x_errors_by_opcode[256];
 
 static int x_error_handler(Display *dpy, XErrorEvent *ev) {
     g_last_xerror = ev->error_code;
+    atomic_fetch_add_explicit(&g_x_errors_by_opcode[ev->request_code], 1,
+                              memory_order_relaxed);
     (void)dpy;
     return 0;
 }
 
+/* ========================================================================== */
+/* X protocol traffic                                                         */
+/* ========================================================================== */
+
+/* Requests are read off Xlib's sequence numbers by the thread that owns
+ * the connection. Blocking round trips cannot be seen from outside Xlib,
+ * so x_round_trip() is called after each call made while running that
+ * waits for a reply, and counts on the calling thread's connection. */
+static _Thread_local XTraffic *t_xtraffic;
+
+/* Received events by type, both connections */
+static atomic_uint_fast64_t g_x_events_by_type[128];
+
+static void x_traffic_attach(XTraffic *t, Display *dpy) {
+    t->first_request = NextRequest(dpy);
+    t_xtraffic = t;
+}
+
+static inline void x_round_trip(void) {
+    if (t_xtraffic)
+        atomic_fetch_add_explicit(&t_xtraffic->round_trips, 1, memory_order_relaxed);
+}
+
+static void x_traffic_update(XTraffic *t, Display *dpy) {
+    atomic_store_explicit(&t->requests, NextRequest(dpy) - t->first_request,
+                          memory_order_relaxed);
+}
+
+static inline void x_count_event(const XEvent *ev) {
+    atomic_fetch_add_explicit(&g_x_events_by_type[ev->type & 0x7f], 1, memory_order_relaxed);
+}
+
+static const char *x_event_type_name(int type, int damage_event) {
+    static const char *names[] = {
+        [KeyPress] = "KeyPress", [KeyRelease] = "KeyRelease",
+        [ButtonPress] = "ButtonPress", [ButtonRelease] = "ButtonRelease",
+        [MotionNotify] = "MotionNotify", [EnterNotify] = "EnterNotify",
+        [LeaveNotify] = "LeaveNotify", [FocusIn] = "FocusIn", [FocusOut] = "FocusOut",
+        [KeymapNotify] = "KeymapNotify", [Expose] = "Expose",
+        [GraphicsExpose] = "GraphicsExpose", [NoExpose] = "NoExpose",
+        [VisibilityNotify] = "VisibilityNotify", [CreateNotify] = "CreateNotify",
+        [DestroyNotify] = "DestroyNotify", [UnmapNotify] = "UnmapNotify",
+        [MapNotify] = "MapNotify", [MapRequest] = "MapRequest",
+        [ReparentNotify] = "ReparentNotify", [ConfigureNotify] = "ConfigureNotify",
+        [ConfigureRequest] = "ConfigureRequest", [GravityNotify] = "GravityNotify",
+        [ResizeRequest] = "ResizeRequest", [CirculateNotify] = "CirculateNotify",
+        [CirculateRequest] = "CirculateRequest", [PropertyNotify] = "PropertyNotify",
+        [SelectionClear] = "SelectionClear", [SelectionRequest] = "SelectionRequest",
+        [SelectionNotify] = "SelectionNotify", [ColormapNotify] = "ColormapNotify",
+        [ClientMessage] = "ClientMessage", [MappingNotify] = "MappingNotify",
+        [GenericEvent] = "GenericEvent",
+    };
+    if (type == damage_event + XDamageNotify) return "DamageNotify";
+    if (type >= 0 && type < (int)(sizeof(names) / sizeof(names[0])) && names[type])
+        return names[type];
+    return NULL;
+}
+
 /* ========================================================================== */
 /* Utility: load file to string                                               */
 /* ========================================================================== */
@@ -214,9 +856,10 @@ static GLuint compile_shader(GLenum type, const char *src, const char *name) {
     return shader;
 }
 
+/* vert is 0 when linking a lone compute shader */
 static GLuint link_program(GLuint vert, GLuint frag) {
     GLuint prog = glCreateProgram();
-    glAttachShader(prog, vert);
+    if (vert) glAttachShader(prog, vert);
     glAttachShader(prog, frag);
     glLinkProgram(prog);
 
@@ -236,7 +879,15 @@ static GLuint link_program(GLuint vert, GLuint frag) {
 /* Window pixmap management                                                   */
 /* ========================================================================== */
 
+static void sw_bind_window(Compositor *comp, WinEntry *w);
+static void sw_unbind_window(Compositor *comp, WinEntry *w);
+static int sw_resize(Compositor *comp);
+
 static void unbind_window_pixmap(Compositor *comp, WinEntry *w) {
+    if (comp->software) {
+        sw_unbind_window(comp, w);
+        return;
+    }
     if (!w->pixmap_valid) return;
 
     glBindTexture(GL_TEXTURE_2D, w->texture);
@@ -255,23 +906,25 @@ static void unbind_window_pixmap(Compositor *comp, WinEntry *w) {
 }
 
 static void bind_window_pixmap(Compositor *comp, WinEntry *w) {
+    if (comp->software) {
+        sw_bind_window(comp, w);
+        return;
+    }
     if (w->pixmap_valid) unbind_window_pixmap(comp, w);
     if (!w->mapped || w->width <= 0 || w->height <= 0) return;
 
-    /* Get window attributes to determine depth */
-    XWindowAttributes attr;
-    if (!XGetWindowAttributes(comp->dpy, w->xid, &attr)) return;
-    if (attr.map_state != IsViewable) return;
-
-    /* Look up FBConfig by window depth */
-    int depth = attr.depth;
+    /* Look up FBConfig by window depth (reported by the event thread) */
+    int depth = w->depth;
     if (depth <= 0 || depth >= MAX_DEPTH || !comp->tfp_available[depth]) {
         return; /* no matching FBConfig for this depth */
     }
     GLXFBConfig fbcfg = comp->tfp_config[depth];
     int tex_fmt = comp->tfp_format[depth];
 
-    /* Get composite pixmap */
+    /* Get composite pixmap. The window may already be gone or unmapped
+     * again by the time this delta is applied; that shows up as an X
+     * error after the XSync below. */
+    g_last_xerror = 0;
     w->pixmap = XCompositeNameWindowPixmap(comp->dpy, w->xid);
     if (!w->pixmap) return;
 
@@ -285,9 +938,13 @@ static void bind_window_pixmap(Compositor *comp, WinEntry *w) {
 
     /* XSync to catch errors from the above calls */
     XSync(comp->dpy, False);
-    if (!w->glx_pixmap) {
+    x_round_trip();
+    if (!w->glx_pixmap || g_last_xerror) {
+        if (w->glx_pixmap) glXDestroyPixmap(comp->dpy, w->glx_pixmap);
+        w->glx_pixmap = 0;
         XFreePixmap(comp->dpy, w->pixmap);
         w->pixmap = 0;
+        g_last_xerror = 0;
         return;
     }
 
@@ -305,6 +962,89 @@ static void bind_window_pixmap(Compositor *comp, WinEntry *w) {
     w->damaged = true;
 }
 
+/* ========================================================================== */
+/* X -> GL synchronization                                                    */
+/* ========================================================================== */
+
+static bool has_gl_extension(const char *name) {
+    GLint n = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+    for (GLint i = 0; i < n; i++) {
+        const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if (ext && strcmp(ext, name) == 0) return true;
+    }
+    return false;
+}
+
+static void init_xsync(Compositor *comp) {
+    int ev_base, err_base, major = 0, minor = 0;
+    if (!XSyncQueryExtension(comp->dpy, &ev_base, &err_base) ||
+        !XSyncInitialize(comp->dpy, &major, &minor) ||
+        (major < 3 || (major == 3 && minor < 1))) {
+        fprintf(stderr, "X->GL sync: XSync fences unavailable, using implicit sync\n");
+        return;
+    }
+    if (!has_gl_extension("GL_EXT_x11_sync_object")) {
+        fprintf(stderr, "X->GL sync: GL_EXT_x11_sync_object unavailable, using implicit sync\n");
+        return;
+    }
+    comp->glImportSyncEXT = (PFNGLIMPORTSYNCEXTPROC)
+        glXGetProcAddress((const GLubyte *)"glImportSyncEXT");
+    if (!comp->glImportSyncEXT) return;
+
+    for (int i = 0; i < SYNC_RING_SIZE; i++) {
+        XGLFence *f = &comp->fences[i];
+        f->xfence = XSyncCreateFence(comp->dpy, comp->root, False);
+        if (!f->xfence) return;
+        f->gl_sync = comp->glImportSyncEXT(GL_SYNC_X11_FENCE_EXT,
+                                           (GLintptr)f->xfence, 0);
+        if (!f->gl_sync) return;
+    }
+    comp->use_xsync = true;
+    fprintf(stderr, "X->GL sync: using XSync fences\n");
+}
+
+static void cleanup_xsync(Compositor *comp) {
+    for (int i = 0; i < SYNC_RING_SIZE; i++) {
+        XGLFence *f = &comp->fences[i];
+        if (f->gpu_done) glDeleteSync(f->gpu_done);
+        if (f->gl_sync) glDeleteSync(f->gl_sync);
+        if (f->xfence) XSyncDestroyFence(comp->dpy, f->xfence);
+        memset(f, 0, sizeof(*f));
+    }
+    comp->use_xsync = false;
+}
+
+/* Make GL wait (on the GPU) for all X rendering issued so far. Returns
+ * false when no fence slot is free yet; the caller then rebinds with the
+ * driver's implicit synchronization as before. */
+static bool sync_x_to_gl(Compositor *comp) {
+    if (!comp->use_xsync) return false;
+
+    XGLFence *f = &comp->fences[comp->fence_next];
+    if (f->gpu_done) {
+        /* The X fence can only be reset once GL has consumed the last
+         * trigger; never wait for that here. */
+        GLenum st = glClientWaitSync(f->gpu_done, 0, 0);
+        if (st != GL_ALREADY_SIGNALED && st != GL_CONDITION_SATISFIED) {
+            comp->stats.fence_busy++;
+            return false;
+        }
+        glDeleteSync(f->gpu_done);
+        f->gpu_done = NULL;
+        XSyncResetFence(comp->dpy, f->xfence);
+    }
+
+    XSyncTriggerFence(comp->dpy, f->xfence);
+    XFlush(comp->dpy); /* the server must see the trigger before GL waits */
+    glWaitSync(f->gl_sync, 0, GL_TIMEOUT_IGNORED);
+    f->gpu_done = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    comp->fence_next = (comp->fence_next + 1) % SYNC_RING_SIZE;
+    comp->stats.fence_syncs++;
+    return true;
+}
+
 /* ========================================================================== */
 /* Window list management                                                     */
 /* ========================================================================== */
@@ -335,14 +1075,20 @@ static WinEntry *add_win(Compositor *comp, Window xid) {
     return w;
 }
 
+/* Per-window shader input, if the window ever had one */
+static void free_window_shade(WinEntry *w) {
+    if (!w->shade_tex) return;
+    glDeleteFramebuffers(1, &w->shade_fbo);
+    glDeleteTextures(1, &w->shade_tex);
+    w->shade_fbo = w->shade_tex = 0;
+    w->shade_w = w->shade_h = 0;
+}
+
 static void remove_win(Compositor *comp, WinEntry *w) {
     if (!w) return;
 
-    if (w->damage) {
-        XDamageDestroy(comp->dpy, w->damage);
-        w->damage = 0;
-    }
     unbind_window_pixmap(comp, w);
+    free_window_shade(w);
 
     /* Unlink */
     if (w->prev) w->prev->next = w->next;
@@ -391,283 +1137,2981 @@ static void restack_win(Compositor *comp, WinEntry *w, Window above_xid) {
 }
 
 /* ========================================================================== */
-/* Event handlers                                                             */
+/* Delta queue (lock-free SPSC)                                               */
 /* ========================================================================== */
 
-static void handle_map(Compositor *comp, XMapEvent *ev) {
-    WinEntry *w = find_win(comp, ev->window);
-    if (!w) {
-        w = add_win(comp, ev->window);
-        if (!w) return;
+static bool delta_queue_push(DeltaQueue *q, const WinDelta *d) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail - head == DELTA_QUEUE_SIZE) return false;
+    q->slots[tail & (DELTA_QUEUE_SIZE - 1)] = *d;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static bool delta_queue_pop(DeltaQueue *q, WinDelta *d) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head == tail) return false;
+    *d = q->slots[head & (DELTA_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return true;
+}
+
+/* ========================================================================== */
+/* X event thread: X events -> WinDelta                                       */
+/* ========================================================================== */
+
+static void et_wake(EventThread *et) {
+    uint64_t one = 1;
+    if (write(et->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "event thread: wake: %s\n", strerror(errno));
     }
+    et->pending_wake = false;
+}
 
-    XWindowAttributes attr;
-    if (!XGetWindowAttributes(comp->dpy, ev->window, &attr)) {
-        remove_win(comp, w);
-        return;
+static void et_push(EventThread *et, const WinDelta *d) {
+    if (!delta_queue_push(et->queue, d)) {
+        /* Ring full: the render thread is behind (e.g. blocked in a swap).
+         * Make sure it is awake and back off until there is room. */
+        atomic_fetch_add_explicit(&et->queue_full, 1, memory_order_relaxed);
+        do {
+            et_wake(et);
+            struct timespec ts = { 0, 200000L };
+            nanosleep(&ts, NULL);
+        } while (!delta_queue_push(et->queue, d));
     }
+    et->pending_wake = true;
+}
 
-    w->x = attr.x;
-    w->y = attr.y;
-    w->width = attr.width;
-    w->height = attr.height;
-    w->border_width = attr.border_width;
-    w->override_redirect = attr.override_redirect;
-    w->mapped = true;
+static DamageRec *et_find_damage(EventThread *et, Window xid) {
+    for (DamageRec *r = et->damages; r; r = r->next) {
+        if (r->xid == xid) return r;
+    }
+    return NULL;
+}
+
+static void et_track_damage(EventThread *et, Window xid) {
+    if (et_find_damage(et, xid)) return;
 
-    /* Create damage tracking */
-    if (!w->damage) {
+    g_last_xerror = 0;
+    Damage damage = XDamageCreate(et->dpy, xid, XDamageReportNonEmpty);
+    XSync(et->dpy, False);
+    x_round_trip();
+    if (g_last_xerror) {
         g_last_xerror = 0;
-        w->damage = XDamageCreate(comp->dpy, w->xid, XDamageReportNonEmpty);
-        XSync(comp->dpy, False);
-        if (g_last_xerror) {
-            w->damage = 0;
-            g_last_xerror = 0;
-        }
+        return;
     }
 
-    bind_window_pixmap(comp, w);
-    comp->needs_redraw = true;
+    DamageRec *r = calloc(1, sizeof(DamageRec));
+    if (!r) { XDamageDestroy(et->dpy, damage); return; }
+    r->xid = xid;
+    r->damage = damage;
+    r->next = et->damages;
+    et->damages = r;
 }
 
-static void handle_unmap(Compositor *comp, XUnmapEvent *ev) {
-    WinEntry *w = find_win(comp, ev->window);
-    if (!w) return;
-    w->mapped = false;
-    unbind_window_pixmap(comp, w);
-    if (w->damage) {
-        XDamageDestroy(comp->dpy, w->damage);
-        w->damage = 0;
+static void et_untrack_damage(EventThread *et, Window xid, bool destroyed) {
+    for (DamageRec **pp = &et->damages; *pp; pp = &(*pp)->next) {
+        if ((*pp)->xid != xid) continue;
+        DamageRec *r = *pp;
+        /* The server frees the damage along with a destroyed window */
+        if (!destroyed) XDamageDestroy(et->dpy, r->damage);
+        *pp = r->next;
+        free(r);
+        return;
     }
-    comp->needs_redraw = true;
 }
 
-static void handle_destroy(Compositor *comp, XDestroyWindowEvent *ev) {
-    WinEntry *w = find_win(comp, ev->window);
-    if (w) {
-        remove_win(comp, w);
-        comp->needs_redraw = true;
+/* Report a window's damage and reset it. Interleaved shading reshades
+ * damaged areas in full, so it gets the rectangles (one round trip);
+ * more than the render thread keeps apart go as their bounds. Otherwise
+ * the window is enough. */
+static void et_push_damage(EventThread *et, const XDamageNotifyEvent *dev) {
+    WinDelta d;
+    memset(&d, 0, sizeof(d));
+    d.type = WD_DAMAGE;
+    d.xid = dev->drawable;
+    if (!atomic_load_explicit(&et->damage_rects, memory_order_relaxed)) {
+        XDamageSubtract(et->dpy, dev->damage, None, None);
+        et_push(et, &d);
+        return;
     }
-}
 
-static void handle_configure(Compositor *comp, XConfigureEvent *ev) {
-    /* Root window resize (e.g. xrandr) */
-    if (ev->window == comp->root) {
-        if (ev->width != comp->root_width || ev->height != comp->root_height) {
-            comp->root_width = ev->width;
-            comp->root_height = ev->height;
-
-            /* Resize FBO texture */
-            glBindTexture(GL_TEXTURE_2D, comp->fbo_texture);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
-                         comp->root_width, comp->root_height, 0,
-                         GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
-        comp->needs_redraw = true;
+    XDamageSubtract(et->dpy, dev->damage, None, et->damage_parts);
+    int n = 0;
+    XRectangle *rects = XFixesFetchRegion(et->dpy, et->damage_parts, &n);
+    x_round_trip();
+    if (!rects || n == 0) {
+        if (rects) XFree(rects);
+        et_push(et, &d);
         return;
     }
+    if (n > MAX_DAMAGE_RECTS) {
+        int x0 = rects[0].x, y0 = rects[0].y;
+        int x1 = x0 + rects[0].width, y1 = y0 + rects[0].height;
+        for (int i = 1; i < n; i++) {
+            if (rects[i].x < x0) x0 = rects[i].x;
+            if (rects[i].y < y0) y0 = rects[i].y;
+            if (rects[i].x + rects[i].width > x1) x1 = rects[i].x + rects[i].width;
+            if (rects[i].y + rects[i].height > y1) y1 = rects[i].y + rects[i].height;
+        }
+        rects[0] = (XRectangle){ (short)x0, (short)y0,
+                                 (unsigned short)(x1 - x0), (unsigned short)(y1 - y0) };
+        n = 1;
+    }
+    for (int i = 0; i < n; i++) {
+        d.x = rects[i].x;
+        d.y = rects[i].y;
+        d.width = rects[i].width;
+        d.height = rects[i].height;
+        et_push(et, &d);
+    }
+    XFree(rects);
+}
 
-    WinEntry *w = find_win(comp, ev->window);
-    if (!w) return;
-
-    bool resized = (w->width != ev->width || w->height != ev->height);
-    w->x = ev->x;
-    w->y = ev->y;
-    w->width = ev->width;
-    w->height = ev->height;
-    w->border_width = ev->border_width;
+/* WM_CLASS of a top-level window or, under a reparenting window manager,
+ * of the client window inside its frame (searched `levels` deep, topmost
+ * child first). *client is the window that carries it. */
+static bool et_class_hint(Display *dpy, Window xid, int levels,
+                          XClassHint *hint, Window *client) {
+    bool found = XGetClassHint(dpy, xid, hint);
+    x_round_trip();
+    if (found) {
+        *client = xid;
+        return true;
+    }
+    if (levels == 0) return false;
 
-    /* Handle restacking */
-    restack_win(comp, w, ev->above);
+    Window root_ret, parent_ret;
+    Window *children = NULL;
+    unsigned int n = 0;
+    bool ok = XQueryTree(dpy, xid, &root_ret, &parent_ret, &children, &n);
+    x_round_trip();
+    if (!ok) return false;
+    for (unsigned int i = n; i-- > 0 && !found; )
+        found = et_class_hint(dpy, children[i], levels - 1, hint, client);
+    if (children) XFree(children);
+    return found;
+}
 
-    /* Rebind pixmap if resized */
-    if (resized && w->mapped) {
-        bind_window_pixmap(comp, w);
+/* Title of a window, _NET_WM_NAME if set, else WM_NAME. Caller frees. */
+static char *et_window_title(EventThread *et, Window xid) {
+    Atom type;
+    int format;
+    unsigned long n, after;
+    unsigned char *data = NULL;
+    char *title = NULL;
+    int status = XGetWindowProperty(et->dpy, xid, et->net_wm_name, 0, 1024, False,
+                                    et->utf8_string, &type, &format, &n, &after, &data);
+    x_round_trip();
+    if (status == Success && data) {
+        if (type == et->utf8_string && format == 8) title = strdup((const char *)data);
+        XFree(data);
     }
-
-    comp->needs_redraw = true;
+    char *name = NULL;
+    if (!title) {
+        Status got = XFetchName(et->dpy, xid, &name);
+        x_round_trip();
+        if (got && name) title = strdup(name);
+        if (name) XFree(name);
+    }
+    return title;
 }
 
-static void handle_reparent(Compositor *comp, XReparentEvent *ev) {
-    if (ev->parent == comp->root) {
-        /* Window reparented into root -- treat like map if visible */
-        XWindowAttributes attr;
-        if (XGetWindowAttributes(comp->dpy, ev->window, &attr) &&
-            attr.map_state == IsViewable) {
-            XMapEvent fake = { .window = ev->window };
-            handle_map(comp, &fake);
-        }
-    } else {
-        /* Window reparented away from root -- remove */
-        WinEntry *w = find_win(comp, ev->window);
-        if (w) {
-            remove_win(comp, w);
-            comp->needs_redraw = true;
-        }
+/* Match a top-level against the exclusion and per-window shader rules.
+ * Returns its WDF_EXCLUDED flag and sets *shader to the first matching
+ * shader rule + 1 (0 = none) and *client to the window carrying its class
+ * and title. Costs round trips only when there are class, window or
+ * shader rules. */
+static uint8_t et_match_rules(EventThread *et, Window xid, uint8_t *shader,
+                              Window *client_out) {
+    const ExcludeRules *r = et->exclude;
+    const WinShaderRules *wr = et->win_rules;
+    *shader = 0;
+    *client_out = xid;
+    if (r->class_count == 0 && r->window_count == 0 && wr->count == 0) return 0;
+
+    XClassHint hint = { NULL, NULL };
+    Window client = xid;
+    bool excluded = false;
+    g_last_xerror = 0;
+    bool has_class = et_class_hint(et->dpy, xid, 2, &hint, &client);
+    *client_out = client;
+    char *title = wr->any_title ? et_window_title(et, client) : NULL;
+    g_last_xerror = 0;   /* the window may be gone already */
+
+    #define CLASS_IS(name) ((hint.res_name && strcasecmp(hint.res_name, (name)) == 0) || \
+                            (hint.res_class && strcasecmp(hint.res_class, (name)) == 0))
+    if (has_class) {
+        for (int i = 0; i < r->class_count && !excluded; i++)
+            excluded = CLASS_IS(r->classes[i]);
+    }
+    for (int i = 0; i < r->window_count && !excluded; i++)
+        excluded = r->windows[i] == xid || r->windows[i] == client;
+    for (int i = 0; i < wr->count && *shader == 0; i++) {
+        const WinShaderRule *rule = &wr->rules[i];
+        bool match = rule->by_title ? title && strstr(title, rule->match)
+                                    : has_class && CLASS_IS(rule->match);
+        if (match) *shader = (uint8_t)(i + 1);
     }
+    #undef CLASS_IS
+
+    if (hint.res_name) XFree(hint.res_name);
+    if (hint.res_class) XFree(hint.res_class);
+    free(title);
+    return excluded ? WDF_EXCLUDED : 0;
 }
 
-static void handle_circulate(Compositor *comp, XCirculateEvent *ev) {
-    WinEntry *w = find_win(comp, ev->window);
-    if (!w) return;
+/* Query a window and publish it as mapped; used for MapNotify, reparenting
+ * into the root and the initial window enumeration. */
+static void et_publish_map(EventThread *et, Window xid) {
+    if (xid == et->overlay || xid == et->root) return;
 
-    /* Unlink */
-    if (w->prev) w->prev->next = w->next;
-    else comp->win_head = w->next;
-    if (w->next) w->next->prev = w->prev;
-    else comp->win_tail = w->prev;
-    w->prev = w->next = NULL;
+    XWindowAttributes attr;
+    Status ok = XGetWindowAttributes(et->dpy, xid, &attr);
+    x_round_trip();   /* two: GetWindowAttributes and GetGeometry */
+    x_round_trip();
+    if (!ok) return;
+    if (attr.map_state != IsViewable) return;
 
-    if (ev->place == PlaceOnTop) {
-        w->prev = comp->win_tail;
-        if (comp->win_tail) comp->win_tail->next = w;
-        else comp->win_head = w;
-        comp->win_tail = w;
-    } else {
-        w->next = comp->win_head;
-        if (comp->win_head) comp->win_head->prev = w;
-        else comp->win_tail = w;
-        comp->win_head = w;
-    }
+    et_track_damage(et, xid);
 
-    comp->needs_redraw = true;
+    uint8_t shader;
+    Window client;
+    uint8_t flags = et_match_rules(et, xid, &shader, &client);
+    DamageRec *rec = et_find_damage(et, xid);
+    if (et->win_rules->any_title && rec && rec->client != client) {
+        /* Title rules follow renames (e.g. a browser switching tabs) */
+        XSelectInput(et->dpy, client, PropertyChangeMask);
+        rec->client = client;
+    }
+    WinDelta d = {
+        .type = WD_MAP,
+        .depth = (uint8_t)attr.depth,
+        .flags = (attr.override_redirect ? WDF_OVERRIDE_REDIRECT : 0) | flags,
+        .shader = shader,
+        .xid = xid,
+        .x = (short)attr.x, .y = (short)attr.y,
+        .width = (unsigned short)attr.width, .height = (unsigned short)attr.height,
+        .border_width = (unsigned short)attr.border_width,
+    };
+    et_push(et, &d);
 }
 
-static void handle_event(Compositor *comp, XEvent *ev) {
+static void et_handle_event(EventThread *et, XEvent *ev) {
+    WinDelta d;
+    memset(&d, 0, sizeof(d));
+
     if (ev->type == MapNotify) {
-        handle_map(comp, &ev->xmap);
+        et_publish_map(et, ev->xmap.window);
     } else if (ev->type == UnmapNotify) {
-        handle_unmap(comp, &ev->xunmap);
+        et_untrack_damage(et, ev->xunmap.window, false);
+        d.type = WD_UNMAP;
+        d.xid = ev->xunmap.window;
+        et_push(et, &d);
     } else if (ev->type == DestroyNotify) {
-        handle_destroy(comp, &ev->xdestroywindow);
+        et_untrack_damage(et, ev->xdestroywindow.window, true);
+        d.type = WD_DESTROY;
+        d.xid = ev->xdestroywindow.window;
+        et_push(et, &d);
     } else if (ev->type == ConfigureNotify) {
-        handle_configure(comp, &ev->xconfigure);
+        XConfigureEvent *ce = &ev->xconfigure;
+        d.type = ce->window == et->root ? WD_ROOT_SIZE : WD_CONFIGURE;
+        d.xid = ce->window;
+        d.above = ce->above;
+        d.x = (short)ce->x;
+        d.y = (short)ce->y;
+        d.width = (unsigned short)ce->width;
+        d.height = (unsigned short)ce->height;
+        d.border_width = (unsigned short)ce->border_width;
+        et_push(et, &d);
     } else if (ev->type == ReparentNotify) {
-        handle_reparent(comp, &ev->xreparent);
+        if (ev->xreparent.parent == et->root) {
+            /* Window reparented into root -- treat like map if visible */
+            et_publish_map(et, ev->xreparent.window);
+        } else {
+            /* Window reparented away from root -- remove */
+            et_untrack_damage(et, ev->xreparent.window, false);
+            d.type = WD_DESTROY;
+            d.xid = ev->xreparent.window;
+            et_push(et, &d);
+        }
     } else if (ev->type == CirculateNotify) {
-        handle_circulate(comp, &ev->xcirculate);
-    } else if (ev->type == comp->damage_event + XDamageNotify) {
-        XDamageNotifyEvent *dev = (XDamageNotifyEvent *)ev;
-        WinEntry *w = find_win(comp, dev->drawable);
-        if (w && w->damage) {
-            w->damaged = true;
-            XDamageSubtract(comp->dpy, w->damage, None, None);
-            comp->needs_redraw = true;
+        d.type = WD_CIRCULATE;
+        d.xid = ev->xcirculate.window;
+        d.flags = ev->xcirculate.place == PlaceOnTop ? WDF_PLACE_ON_TOP : 0;
+        et_push(et, &d);
+    } else if (ev->type == et->damage_event + XDamageNotify) {
+        et_push_damage(et, (XDamageNotifyEvent *)ev);
+    } else if (ev->type == PropertyNotify) {
+        XPropertyEvent *pe = &ev->xproperty;
+        if (pe->atom != XA_WM_NAME && pe->atom != et->net_wm_name) return;
+        for (DamageRec *r = et->damages; r; r = r->next) {
+            if (r->client != pe->window) continue;
+            Window client;
+            d.type = WD_RULES;
+            d.xid = r->xid;
+            d.flags = et_match_rules(et, r->xid, &d.shader, &client);
+            et_push(et, &d);
+            break;
         }
     }
 }
 
-/* Forward declarations */
-static void apply_params(Compositor *comp);
+/* Trace name of an event and the window it is about */
+static const char *et_event_name(const EventThread *et, const XEvent *ev, Window *xid) {
+    switch (ev->type) {
+    case MapNotify:       *xid = ev->xmap.window;           break;
+    case UnmapNotify:     *xid = ev->xunmap.window;         break;
+    case DestroyNotify:   *xid = ev->xdestroywindow.window; break;
+    case ConfigureNotify: *xid = ev->xconfigure.window;     break;
+    case ReparentNotify:  *xid = ev->xreparent.window;      break;
+    case CirculateNotify: *xid = ev->xcirculate.window;     break;
+    default:
+        *xid = ev->type == et->damage_event + XDamageNotify ?
+               ((const XDamageNotifyEvent *)ev)->drawable : ev->xany.window;
+    }
+    const char *name = x_event_type_name(ev->type, et->damage_event);
+    return name ? name : "other event";
+}
 
-/* ========================================================================== */
-/* Rendering                                                                  */
-/* ========================================================================== */
+static void *event_thread_main(void *arg) {
+    EventThread *et = arg;
+    Display *dpy = et->dpy;
+    x_traffic_attach(&et->traffic, dpy);
 
-static void render_frame(Compositor *comp) {
-    /* --- Pass 1: Composite all windows into FBO --- */
-    glBindFramebuffer(GL_FRAMEBUFFER, comp->fbo);
-    glViewport(0, 0, comp->root_width, comp->root_height);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
+    /* Registers the Damage wire-to-event converter on this connection */
+    int damage_error;
+    XDamageQueryExtension(dpy, &et->damage_event, &damage_error);
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    XSelectInput(dpy, et->root, SubstructureNotifyMask | StructureNotifyMask);
+    et->damage_parts = XFixesCreateRegion(dpy, NULL, 0);
 
-    glUseProgram(comp->composite_prog);
+    if (et->win_rules->any_title) {
+        et->net_wm_name = XInternAtom(dpy, "_NET_WM_NAME", False);
+        et->utf8_string = XInternAtom(dpy, "UTF8_STRING", False);
+        x_round_trip();
+        x_round_trip();
+    }
 
-    for (WinEntry *w = comp->win_head; w; w = w->next) {
-        if (!w->mapped || !w->pixmap_valid) continue;
-        if (w->width <= 0 || w->height <= 0) continue;
+    /* --- Enumerate existing windows (after selecting input, so nothing
+     * mapped in between is missed) --- */
+    Window root_ret, parent_ret;
+    Window *children = NULL;
+    unsigned int nchildren = 0;
+    bool listed = XQueryTree(dpy, et->root, &root_ret, &parent_ret, &children, &nchildren);
+    x_round_trip();
+    if (listed) {
+        for (unsigned int i = 0; i < nchildren; i++) {
+            et_publish_map(et, children[i]);
+        }
+        if (children) XFree(children);
+    }
+    x_traffic_update(&et->traffic, dpy);
+    et_wake(et);
 
-        /* Re-bind texture if window content changed */
-        if (w->damaged) {
-            glBindTexture(GL_TEXTURE_2D, w->texture);
-            comp->glXReleaseTexImageEXT(comp->dpy, w->glx_pixmap,
-                                        GLX_FRONT_LEFT_EXT);
-            comp->glXBindTexImageEXT(comp->dpy, w->glx_pixmap,
-                                     GLX_FRONT_LEFT_EXT, NULL);
-            w->damaged = false;
+    struct pollfd pfd[2] = {
+        { .fd = ConnectionNumber(dpy), .events = POLLIN },
+        { .fd = et->quit_fd,           .events = POLLIN },
+    };
+    for (;;) {
+        uint64_t batch_start = trace_begin();
+        uint64_t batch = 0;
+        while (XPending(dpy) > 0) {
+            XEvent ev;
+            XNextEvent(dpy, &ev);
+            x_count_event(&ev);
+            uint64_t t = trace_begin();
+            et_handle_event(et, &ev);
+            if (g_trace.on) {
+                Window xid;
+                const char *name = et_event_name(et, &ev, &xid);
+                trace_end(TRACE_EVENTS, name, t, "window", xid);
+            }
+            atomic_fetch_add_explicit(&et->x_events, 1, memory_order_relaxed);
+            batch++;
         }
+        if (batch > 0) trace_end(TRACE_EVENTS, "X event batch", batch_start, "events", batch);
+        x_traffic_update(&et->traffic, dpy);
+        if (et->pending_wake) et_wake(et);
 
-        /* Use glViewport to position this window within the FBO */
-        int wy = comp->root_height - w->y - w->height;
-        glViewport(w->x, wy, w->width, w->height);
+        if (poll(pfd, 2, -1) < 0 && errno != EINTR) {
+            fprintf(stderr, "event thread: poll: %s\n", strerror(errno));
+            break;
+        }
+        if (pfd[1].revents & POLLIN) break;
+    }
+
+    while (et->damages) et_untrack_damage(et, et->damages->xid, false);
+    XFixesDestroyRegion(dpy, et->damage_parts);
+    XCloseDisplay(dpy);
+    et->dpy = NULL;
+    return NULL;
+}
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, w->texture);
-        glUniform1i(comp->uc_texture, 0);
+static int start_event_thread(Compositor *comp) {
+    EventThread *et = &comp->events;
 
-        glBindVertexArray(comp->vao);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    et->dpy = XOpenDisplay(DisplayString(comp->dpy));
+    if (!et->dpy) {
+        fprintf(stderr, "Cannot open X display for event thread\n");
+        return -1;
     }
+    XSetErrorHandler(x_error_handler);
 
-    glDisable(GL_BLEND);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    void *mem = NULL;
+    if (posix_memalign(&mem, 64, sizeof(DeltaQueue)) != 0) return -1;
+    et->queue = mem;
+    atomic_init(&et->queue->head, 0);
+    atomic_init(&et->queue->tail, 0);
+
+    et->root = comp->root;
+    et->overlay = comp->overlay;
+    et->damage_event = comp->damage_event;
+    et->exclude = &comp->exclude;
+    et->win_rules = &comp->win_rules;
+    et->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    et->quit_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (et->wake_fd < 0 || et->quit_fd < 0) {
+        fprintf(stderr, "eventfd: %s\n", strerror(errno));
+        return -1;
+    }
 
-    /* --- Pass 2: Post-process FBO to overlay --- */
-    glViewport(0, 0, comp->root_width, comp->root_height);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    if (pthread_create(&et->thread, NULL, event_thread_main, et) != 0) {
+        fprintf(stderr, "Failed to start X event thread\n");
+        return -1;
+    }
+    et->started = true;
+    return 0;
+}
+
+static void stop_event_thread(Compositor *comp) {
+    EventThread *et = &comp->events;
+    if (et->started) {
+        uint64_t one = 1;
+        if (write(et->quit_fd, &one, sizeof(one)) < 0) {
+            fprintf(stderr, "event thread: quit: %s\n", strerror(errno));
+        }
+        pthread_join(et->thread, NULL);
+        et->started = false;
+    }
+    if (et->dpy) XCloseDisplay(et->dpy); /* thread never started */
+    et->dpy = NULL;
+    if (et->wake_fd >= 0) close(et->wake_fd);
+    if (et->quit_fd >= 0) close(et->quit_fd);
+    et->wake_fd = et->quit_fd = -1;
+    free(et->queue);
+    et->queue = NULL;
+}
+
+/* ========================================================================== */
+/* Applying deltas (render thread)                                            */
+/* ========================================================================== */
+
+/* Record a changed screen area for interleaved shading, which shades it in
+ * full next frame. Past MAX_DAMAGE_RECTS, areas merge into the last one. */
+static void add_damage(Compositor *comp, int x, int y, int width, int height) {
+    if (comp->interleave < 2 || comp->damage_full) return;
+    if (comp->damage_count == MAX_DAMAGE_RECTS) {
+        DamageRect *last = &comp->damage[MAX_DAMAGE_RECTS - 1];
+        int x1 = last->x + last->width, y1 = last->y + last->height;
+        if (x + width > x1) x1 = x + width;
+        if (y + height > y1) y1 = y + height;
+        if (x < last->x) last->x = x;
+        if (y < last->y) last->y = y;
+        last->width = x1 - last->x;
+        last->height = y1 - last->y;
+        return;
+    }
+    comp->damage[comp->damage_count++] = (DamageRect){ x, y, width, height };
+}
+
+static void add_win_damage(Compositor *comp, WinEntry *w) {
+    if (!w->mapped) return;
+    add_damage(comp, w->x, w->y, w->width + 2 * w->border_width,
+               w->height + 2 * w->border_width);
+}
+
+static void apply_map(Compositor *comp, const WinDelta *d) {
+    WinEntry *w = find_win(comp, d->xid);
+    if (!w) {
+        w = add_win(comp, d->xid);
+        if (!w) return;
+    }
+
+    w->x = d->x;
+    w->y = d->y;
+    w->width = d->width;
+    w->height = d->height;
+    w->border_width = d->border_width;
+    w->depth = d->depth;
+    w->override_redirect = (d->flags & WDF_OVERRIDE_REDIRECT) != 0;
+    w->excluded = (d->flags & WDF_EXCLUDED) != 0;
+    w->shader = d->shader;
+    w->shade_stale = true;
+    w->mapped = true;
+    w->needs_bind = true;
+    add_win_damage(comp, w);
+}
+
+static void apply_unmap(Compositor *comp, const WinDelta *d) {
+    WinEntry *w = find_win(comp, d->xid);
+    if (!w) return;
+    add_win_damage(comp, w);
+    w->mapped = false;
+    w->needs_bind = false;
+    unbind_window_pixmap(comp, w);
+}
+
+static void apply_root_size(Compositor *comp, const WinDelta *d) {
+    /* Root window resize (e.g. xrandr) */
+    if (d->width == comp->root_width && d->height == comp->root_height) return;
+    comp->root_width = d->width;
+    comp->root_height = d->height;
+    comp->output_valid = false;
+
+    if (comp->software) {
+        if (sw_resize(comp) < 0) comp->running = false;
+        return;
+    }
+
+    /* Resize FBO textures */
+    glBindTexture(GL_TEXTURE_2D, comp->fbo_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, comp->fbo_format,
+                 comp->root_width, comp->root_height, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    if (comp->cs_texture) {
+        glBindTexture(GL_TEXTURE_2D, comp->cs_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
+                     comp->root_width, comp->root_height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    for (int i = 0; i < 2 && comp->stack_tex[i]; i++) {
+        glBindTexture(GL_TEXTURE_2D, comp->stack_tex[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, comp->fbo_format,
+                     comp->root_width, comp->root_height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (comp->mask_rb) {
+        glBindRenderbuffer(GL_RENDERBUFFER, comp->mask_rb);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8,
+                              comp->root_width, comp->root_height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    }
+    if (comp->feedback.tex[0] &&
+        ss_feedback_resize(&comp->feedback, comp->root_width, comp->root_height) < 0)
+        comp->u_prev = -1;
+}
+
+static void apply_configure(Compositor *comp, const WinDelta *d) {
+    WinEntry *w = find_win(comp, d->xid);
+    if (!w) return;
+
+    bool resized = (w->width != d->width || w->height != d->height);
+    add_win_damage(comp, w);
+    w->x = d->x;
+    w->y = d->y;
+    w->width = d->width;
+    w->height = d->height;
+    w->border_width = d->border_width;
+    add_win_damage(comp, w);
+
+    /* Handle restacking */
+    restack_win(comp, w, d->above);
+
+    /* Rebind pixmap if resized; a burst of resizes binds only once */
+    if (resized && w->mapped) w->needs_bind = true;
+}
+
+static void apply_circulate(Compositor *comp, const WinDelta *d) {
+    WinEntry *w = find_win(comp, d->xid);
+    if (!w) return;
+    add_win_damage(comp, w);
+
+    /* Unlink */
+    if (w->prev) w->prev->next = w->next;
+    else comp->win_head = w->next;
+    if (w->next) w->next->prev = w->prev;
+    else comp->win_tail = w->prev;
+    w->prev = w->next = NULL;
+
+    if (d->flags & WDF_PLACE_ON_TOP) {
+        w->prev = comp->win_tail;
+        if (comp->win_tail) comp->win_tail->next = w;
+        else comp->win_head = w;
+        comp->win_tail = w;
+    } else {
+        w->next = comp->win_head;
+        if (comp->win_head) comp->win_head->prev = w;
+        else comp->win_tail = w;
+        comp->win_head = w;
+    }
+}
+
+static void apply_delta(Compositor *comp, const WinDelta *d) {
+    switch (d->type) {
+    case WD_MAP:       apply_map(comp, d); break;
+    case WD_UNMAP:     apply_unmap(comp, d); break;
+    case WD_DESTROY: {
+        WinEntry *w = find_win(comp, d->xid);
+        if (w) add_win_damage(comp, w);
+        remove_win(comp, w);
+        break;
+    }
+    case WD_CONFIGURE: apply_configure(comp, d); break;
+    case WD_CIRCULATE: apply_circulate(comp, d); break;
+    case WD_ROOT_SIZE: apply_root_size(comp, d); break;
+    case WD_RULES: {
+        WinEntry *w = find_win(comp, d->xid);
+        bool excluded = (d->flags & WDF_EXCLUDED) != 0;
+        if (!w || (w->shader == d->shader && w->excluded == excluded)) break;
+        w->excluded = excluded;
+        w->shader = d->shader;
+        w->shade_stale = true;
+        if (w->mapped) add_win_damage(comp, w);
+        break;
+    }
+    case WD_DAMAGE: {
+        WinEntry *w = find_win(comp, d->xid);
+        if (!w) break;
+        w->damaged = true;
+        if (d->width == 0) add_win_damage(comp, w);
+        else if (w->mapped)
+            add_damage(comp, w->x + w->border_width + d->x, w->y + w->border_width + d->y,
+                       d->width, d->height);
+        break;
+    }
+    }
+}
+
+/* Drain the delta queue, then bind pixmaps for windows that were mapped
+ * or resized. Returns the number of deltas applied. */
+static int apply_deltas(Compositor *comp) {
+    int n = 0;
+    WinDelta d;
+    while (delta_queue_pop(comp->events.queue, &d)) {
+        apply_delta(comp, &d);
+        n++;
+    }
+    if (n == 0) return 0;
+    comp->scene_changed = true;
+
+    for (WinEntry *w = comp->win_head; w; w = w->next) {
+        if (!w->needs_bind) continue;
+        w->needs_bind = false;
+        uint64_t t = trace_begin();
+        bind_window_pixmap(comp, w);
+        trace_end(TRACE_RENDER, "bind_window_pixmap", t, "window", w->xid);
+    }
+    comp->stats.deltas += n;
+    return n;
+}
+
+/* Forward declarations */
+static void apply_params(Compositor *comp);
+static void bake_lut(Compositor *comp);
+
+/* Seconds since startup, for u_time */
+static float elapsed_seconds(const Compositor *comp) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (float)(now.tv_sec - comp->start_time.tv_sec)
+         + (float)(now.tv_nsec - comp->start_time.tv_nsec) / 1e9f;
+}
+
+/* ========================================================================== */
+/* Rendering                                                                  */
+/* ========================================================================== */
+
+/*
+ * Interleaved shading. With N > 1 each frame shades 1/N of the screen and
+ * keeps the rest from earlier frames, so a steady frame costs 1/N of a full
+ * one. Areas whose composite changed (the damage) are shaded in full on
+ * the frame they change. The fragment path takes turns in bands of
+ * BAND_ROWS rows: two rows are one row of the 2x2 quads fragments are
+ * shaded in, where a finer pattern such as a pixel checkerboard would leave
+ * every quad half used and save nothing. The compute path takes turns by
+ * tile (see shaderlib.h).
+ */
+#define BAND_ROWS 2
+
+static int band_count(const Compositor *comp) {
+    return (comp->root_height + BAND_ROWS - 1) / BAND_ROWS;
+}
+
+/* Band b is drawn on frames whose phase is b mod N. The bands of each
+ * phase are contiguous in band_vbo, two triangles apiece. */
+static int build_interleave_bands(Compositor *comp) {
+    int n = comp->interleave, h = comp->root_height, bands = band_count(comp);
+    float *verts = malloc(sizeof(float) * 24 * (size_t)bands);
+    if (!verts) return -1;
+
+    float *v = verts;
+    for (int phase = 0; phase < n; phase++) {
+        for (int b = phase; b < bands; b += n) {
+            float t0 = (float)(b * BAND_ROWS) / (float)h;
+            float t1 = fminf((float)((b + 1) * BAND_ROWS) / (float)h, 1.0f);
+            float y0 = t0 * 2.0f - 1.0f, y1 = t1 * 2.0f - 1.0f;
+            float quad[24] = {
+                /* pos x,y      texcoord u,v */
+                -1.0f, y0,      0.0f, t0,
+                 1.0f, y0,      1.0f, t0,
+                -1.0f, y1,      0.0f, t1,
+                -1.0f, y1,      0.0f, t1,
+                 1.0f, y0,      1.0f, t0,
+                 1.0f, y1,      1.0f, t1,
+            };
+            memcpy(v, quad, sizeof(quad));
+            v += 24;
+        }
+    }
+
+    if (!comp->band_vao) {
+        glGenVertexArrays(1, &comp->band_vao);
+        glGenBuffers(1, &comp->band_vbo);
+    }
+    glBindVertexArray(comp->band_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, comp->band_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 24 * (size_t)bands, verts, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float),
+                          (void *)(2 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    free(verts);
+
+    comp->band_height = h;
+    comp->band_phases = n;
+    return 0;
+}
+
+/* Damage rectangle i, grown by how far the shader reads and clipped to the
+ * screen, in GL coordinates (origin bottom-left). False if it is empty. */
+static bool damage_rect_gl(const Compositor *comp, int i,
+                           int *x0, int *y0, int *x1, int *y1) {
+    const DamageRect *d = &comp->damage[i];
+    int m = comp->damage_margin;
+    *x0 = d->x - m;
+    *x1 = d->x + d->width + m;
+    *y0 = comp->root_height - (d->y + d->height) - m;
+    *y1 = comp->root_height - d->y + m;
+    if (*x0 < 0) *x0 = 0;
+    if (*y0 < 0) *y0 = 0;
+    if (*x1 > comp->root_width) *x1 = comp->root_width;
+    if (*y1 > comp->root_height) *y1 = comp->root_height;
+    return *x0 < *x1 && *y0 < *y1;
+}
+
+static void draw_postproc(Compositor *comp, bool partial) {
+    if (partial && (comp->band_height != comp->root_height ||
+                    comp->band_phases != comp->interleave) &&
+        build_interleave_bands(comp) < 0)
+        partial = false;
+
+    if (!partial) {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glBindVertexArray(comp->vao);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        return;
+    }
+
+    int n = comp->interleave, bands = band_count(comp), first = 0;
+    for (int p = 0; p < comp->phase; p++) first += (bands - p + n - 1) / n;
+    glBindVertexArray(comp->band_vao);
+    glDrawArrays(GL_TRIANGLES, first * 6, (bands - comp->phase + n - 1) / n * 6);
+
+    glBindVertexArray(comp->vao);
+    glEnable(GL_SCISSOR_TEST);
+    for (int i = 0; i < comp->damage_count; i++) {
+        int x0, y0, x1, y1;
+        if (!damage_rect_gl(comp, i, &x0, &y0, &x1, &y1)) continue;
+        glScissor(x0, y0, x1 - x0, y1 - y0);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    glDisable(GL_SCISSOR_TEST);
+}
+
+static void dispatch_postproc(Compositor *comp, bool partial) {
+    glUniform1i(comp->u_interleave, partial ? comp->interleave : 1);
+    glUniform1i(comp->u_phase, comp->phase);
+    glUniform2i(comp->u_tile_offset, 0, 0);
+    glDispatchCompute((GLuint)(comp->root_width + SS_TILE - 1) / SS_TILE,
+                      (GLuint)(comp->root_height + SS_TILE - 1) / SS_TILE, 1);
+    if (!partial) return;
+
+    /* Every tile the damage touches */
+    glUniform1i(comp->u_interleave, 1);
+    for (int i = 0; i < comp->damage_count; i++) {
+        int x0, y0, x1, y1;
+        if (!damage_rect_gl(comp, i, &x0, &y0, &x1, &y1)) continue;
+        int tx = x0 / SS_TILE, ty = y0 / SS_TILE;
+        glUniform2i(comp->u_tile_offset, tx, ty);
+        glDispatchCompute((GLuint)((x1 - 1) / SS_TILE - tx + 1),
+                          (GLuint)((y1 - 1) / SS_TILE - ty + 1), 1);
+    }
+}
+
+/* GPU side of a trace span: timestamps around the commands issued
+ * between trace_gpu_begin() and trace_gpu_end(). A slot is reused once
+ * its result has been collected; while all are in flight, frames go
+ * untimed. */
+static void trace_gpu_collect(Compositor *comp) {
+    for (int i = 0; i < TRACE_GPU_SLOTS; i++) {
+        if (!comp->gpu_trace.pending[i]) continue;
+        GLuint available = 0;
+        glGetQueryObjectuiv(comp->gpu_trace.queries[i][1], GL_QUERY_RESULT_AVAILABLE,
+                            &available);
+        if (!available) continue;
+        GLuint64 t0 = 0, t1 = 0;
+        glGetQueryObjectui64v(comp->gpu_trace.queries[i][0], GL_QUERY_RESULT, &t0);
+        glGetQueryObjectui64v(comp->gpu_trace.queries[i][1], GL_QUERY_RESULT, &t1);
+        trace_record(TRACE_GPU, comp->gpu_trace.name[i],
+                     (uint64_t)((int64_t)t0 + comp->gpu_trace.offset_ns),
+                     t1 > t0 ? t1 - t0 : 0, NULL, 0);
+        comp->gpu_trace.pending[i] = false;
+    }
+}
+
+static void trace_gpu_begin(Compositor *comp, const char *name) {
+    if (!g_trace.on || !comp->gpu_trace.queries[0][0]) return;
+    trace_gpu_collect(comp);
+    int i = comp->gpu_trace.next;
+    if (comp->gpu_trace.pending[i]) return;
+    glQueryCounter(comp->gpu_trace.queries[i][0], GL_TIMESTAMP);
+    comp->gpu_trace.name[i] = name;
+    comp->gpu_trace.active = true;
+}
+
+static void trace_gpu_end(Compositor *comp) {
+    if (!comp->gpu_trace.active) return;
+    int i = comp->gpu_trace.next;
+    glQueryCounter(comp->gpu_trace.queries[i][1], GL_TIMESTAMP);
+    comp->gpu_trace.pending[i] = true;
+    comp->gpu_trace.next = (i + 1) % TRACE_GPU_SLOTS;
+    comp->gpu_trace.active = false;
+}
+
+/* Bring the input of w's shader up to date: the window drawn with
+ * composite.frag into a texture of its own size. Redone only after the
+ * pixmap changed. False if the target cannot be made. */
+static bool prepare_window_shade(Compositor *comp, WinEntry *w) {
+    if (w->shade_w != w->width || w->shade_h != w->height) {
+        if (!w->shade_tex) {
+            glGenTextures(1, &w->shade_tex);
+            glGenFramebuffers(1, &w->shade_fbo);
+        }
+        glBindTexture(GL_TEXTURE_2D, w->shade_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w->width, w->height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindFramebuffer(GL_FRAMEBUFFER, w->shade_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, w->shade_tex, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            w->shade_w = w->shade_h = 0;
+            return false;
+        }
+        w->shade_w = w->width;
+        w->shade_h = w->height;
+        w->shade_stale = true;
+    }
+    if (!w->shade_stale) return true;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, w->shade_fbo);
+    glViewport(0, 0, w->width, w->height);
+    glDisable(GL_BLEND);
+    glUseProgram(comp->composite_prog);
+    glUniform1i(comp->uc_texture, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, w->texture);
+    glBindVertexArray(comp->vao);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glEnable(GL_BLEND);
+    w->shade_stale = false;
+    comp->stats.window_preps++;
+    return true;
+}
+
+/* Use w's shader program for drawing it at (x, wy) */
+static void use_window_program(Compositor *comp, const WinEntry *w, int wy, float time) {
+    int i = w->shader - 1;
+    const WinProgram *wp = &comp->win_progs[i];
+    glUseProgram(wp->prog);
+    ss_bind_aux(&wp->aux);
+    glUniform2f(wp->u_resolution, (float)w->width, (float)w->height);
+    glUniform1f(wp->u_time, time);
+    glUniform4f(wp->u_rect, (float)w->x, (float)wy, (float)w->width, (float)w->height);
+    for (int j = 0; j < comp->param_count; j++) {
+        if (comp->params[j].win_location[i] >= 0)
+            glUniform1f(comp->params[j].win_location[i], comp->params[j].value);
+    }
+    glActiveTexture(GL_TEXTURE0 + SS_WINDOW_UNIT);
+    glBindTexture(GL_TEXTURE_2D, w->texture);
+    glUniform1i(wp->u_window_tex, SS_WINDOW_UNIT);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, w->shade_tex);
+    glUniform1i(wp->u_screen, 0);
+}
+
+/* Draw every mapped window, bottom to top, into target with prog and the
+ * blending the caller set up. u_rect >= 0 receives the viewport of each
+ * window. With raw_excluded, excluded windows are drawn with the plain
+ * composite program instead. Windows with a shader of their own are drawn
+ * through it; returns how many were. */
+static int draw_windows(Compositor *comp, GLuint target, GLuint prog, GLint u_rect,
+                        bool raw_excluded) {
+    /* One fence covers every window damaged since the last frame */
+    for (WinEntry *w = comp->win_head; w; w = w->next) {
+        if (w->damaged && w->pixmap_valid) {
+            sync_x_to_gl(comp);
+            break;
+        }
+    }
+
+    float time = elapsed_seconds(comp);
+    GLuint bound = 0;
+    int shaded = 0;
+    for (WinEntry *w = comp->win_head; w; w = w->next) {
+        if (!w->mapped || !w->pixmap_valid) continue;
+        if (w->width <= 0 || w->height <= 0) continue;
+
+        /* Re-bind texture if window content changed */
+        if (w->damaged) {
+            uint64_t t = trace_begin();
+            glBindTexture(GL_TEXTURE_2D, w->texture);
+            comp->glXReleaseTexImageEXT(comp->dpy, w->glx_pixmap,
+                                        GLX_FRONT_LEFT_EXT);
+            comp->glXBindTexImageEXT(comp->dpy, w->glx_pixmap,
+                                     GLX_FRONT_LEFT_EXT, NULL);
+            trace_end(TRACE_RENDER, "TFP rebind", t, "window", w->xid);
+            w->damaged = false;
+            w->shade_stale = true;
+        }
+
+        /* Use glViewport to position this window within the target */
+        int wy = comp->root_height - w->y - w->height;
+        if (w->shader > 0 && comp->win_progs[w->shader - 1].prog &&
+            prepare_window_shade(comp, w)) {
+            glBindFramebuffer(GL_FRAMEBUFFER, target);
+            use_window_program(comp, w, wy, time);
+            bound = comp->win_progs[w->shader - 1].prog;
+            shaded++;
+        } else {
+            bool raw = raw_excluded && w->excluded;
+            GLuint want = raw ? comp->composite_prog : prog;
+            if (want != bound) glUseProgram(want);
+            bound = want;
+            if (u_rect >= 0 && !raw)
+                glUniform4f(u_rect, (float)w->x, (float)wy, (float)w->width, (float)w->height);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, w->texture);
+        }
+        glViewport(w->x, wy, w->width, w->height);
+
+        glBindVertexArray(comp->vao);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    comp->stats.window_shades += (uint64_t)shaded;
+    return shaded;
+}
+
+/*
+ * Exclusion masks. Pass 2 renders offscreen into a target that carries
+ * mask_rb as its stencil. The stencil is set to 1 over each excluded
+ * window (minus what is stacked above it) and each excluded rectangle, by
+ * scissored clears, so no geometry is drawn for it. The fragment path then
+ * skips those pixels in the stencil test, and they are filled with the
+ * composite. The compute path writes images, which the stencil does not
+ * stop, so there the copy only restores the excluded pixels.
+ */
+
+/* True if any part of the screen is excluded this frame */
+static bool mask_active(const Compositor *comp) {
+    if (comp->mask_failed) return false;
+    if (comp->exclude.rect_count > 0) return true;
+    for (WinEntry *w = comp->win_head; w; w = w->next)
+        if (w->excluded && w->mapped && w->pixmap_valid) return true;
+    return false;
+}
+
+/* Build the mask in out_fbo's stencil and leave the stencil test on,
+ * passing where the shader may run */
+static void build_mask(Compositor *comp, GLuint out_fbo) {
+    glBindFramebuffer(GL_FRAMEBUFFER, out_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, comp->mask_rb);
+    glClearStencil(0);
+    glClear(GL_STENCIL_BUFFER_BIT);
+
+    glEnable(GL_SCISSOR_TEST);
+    bool above = false;   /* above an excluded window */
+    for (WinEntry *w = comp->win_head; w; w = w->next) {
+        if (!w->mapped || !w->pixmap_valid || w->width <= 0 || w->height <= 0) continue;
+        if (!w->excluded && !above) continue;
+        above = true;
+        glScissor(w->x, comp->root_height - w->y - w->height, w->width, w->height);
+        glClearStencil(w->excluded ? 1 : 0);
+        glClear(GL_STENCIL_BUFFER_BIT);
+    }
+    glClearStencil(1);
+    for (int i = 0; i < comp->exclude.rect_count; i++) {
+        const DamageRect *r = &comp->exclude.rects[i];
+        glScissor(r->x, comp->root_height - r->y - r->height, r->width, r->height);
+        glClear(GL_STENCIL_BUFFER_BIT);
+    }
+    glClearStencil(0);
+    glDisable(GL_SCISSOR_TEST);
+
+    glEnable(GL_STENCIL_TEST);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glStencilFunc(GL_EQUAL, 0, 0xff);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/* Fill the excluded pixels of out_fbo with the composite, then turn the
+ * stencil test off */
+static void copy_excluded(Compositor *comp, GLuint out_fbo) {
+    glBindFramebuffer(GL_FRAMEBUFFER, out_fbo);
+    glViewport(0, 0, comp->root_width, comp->root_height);
+    glStencilFunc(GL_EQUAL, 1, 0xff);
+    glUseProgram(comp->copy_prog);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, comp->fbo_texture);
+    glUniform1i(comp->ucopy_texture, 0);
+    glBindVertexArray(comp->vao);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glDisable(GL_STENCIL_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/* Pointwise shaders: each window goes through the effect as it is blended
+ * into the overlay, so there is no FBO and no second pass */
+static void render_single_pass(Compositor *comp) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, comp->root_width, comp->root_height);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if (comp->lut_dirty) bake_lut(comp);
+    glUseProgram(comp->postproc_prog);
+    glUniform2f(comp->u_resolution,
+                (float)comp->root_width, (float)comp->root_height);
+    glUniform1f(comp->u_time, elapsed_seconds(comp));
+    apply_params(comp);
+    glUniform1i(comp->u_window_tex, 0);
+    if (comp->u_lut >= 0) ss_lut_bind(&comp->lut, comp->u_lut);
+
+    /* Excluded windows skip the effect (there are no excluded rectangles
+     * in this mode) */
+    bool mask = mask_active(comp);
+    if (mask) comp->stats.masked_frames++;
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC1_ALPHA);
+    draw_windows(comp, 0, comp->postproc_prog, comp->u_window_rect, mask);
+    glDisable(GL_BLEND);
+}
+
+/* No global shader: windows go straight to the overlay, those with a
+ * shader of their own through it */
+static void render_windows_only(Compositor *comp) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, comp->root_width, comp->root_height);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC1_ALPHA);
+    glUseProgram(comp->composite_prog);
+    glUniform1i(comp->uc_texture, 0);
+    draw_windows(comp, 0, comp->composite_prog, -1, false);
+    glDisable(GL_BLEND);
+}
+
+/* Run the passes of an effect stack before the last one over the
+ * composite. Returns the texture the last pass reads as u_screen. */
+static GLuint render_stack(Compositor *comp) {
+    if (comp->stack_passes == 0) return comp->fbo_texture;
+
+    GLuint screen = comp->fbo_texture;
+    float time = elapsed_seconds(comp);
+    glViewport(0, 0, comp->root_width, comp->root_height);
+    for (int i = 0; i < comp->stack_passes; i++) {
+        StackPass *pass = &comp->stack[i];
+        /* Texture units are shared, so each pass binds its own */
+        glUseProgram(pass->prog);
+        ss_bind_aux(&pass->aux);
+        glUniform2f(pass->u_resolution,
+                    (float)comp->root_width, (float)comp->root_height);
+        glUniform1f(pass->u_time, time);
+        for (int j = 0; j < comp->param_count; j++) {
+            if (comp->params[j].stack_location[i] >= 0)
+                glUniform1f(comp->params[j].stack_location[i], comp->params[j].value);
+        }
+        glBindTexture(GL_TEXTURE_2D, screen);
+        glUniform1i(pass->u_screen, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, comp->stack_fbo[i & 1]);
+        glBindVertexArray(comp->vao);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        screen = comp->stack_tex[i & 1];
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    ss_bind_aux(&comp->postproc_aux);
+    return screen;
+}
+
+static void render_frame(Compositor *comp) {
+    if (!comp->global_effect || comp->postproc_single) {
+        const char *name = comp->postproc_single ? "single pass" : "composite";
+        uint64_t t = trace_begin();
+        trace_gpu_begin(comp, name);
+        if (comp->postproc_single) render_single_pass(comp);
+        else render_windows_only(comp);
+        trace_gpu_end(comp);
+        trace_end(TRACE_RENDER, name, t, NULL, 0);
+        return;
+    }
+
+    /* --- Pass 1: Composite all windows into FBO --- */
+    uint64_t t = trace_begin();
+    glBindFramebuffer(GL_FRAMEBUFFER, comp->fbo);
+    glViewport(0, 0, comp->root_width, comp->root_height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);   /* alpha holds luma: black */
     glClear(GL_COLOR_BUFFER_BIT);
 
-    glUseProgram(comp->postproc_prog);
+    /* Windows are premultiplied; coverage comes from the second output of
+     * composite.frag so alpha can accumulate luma (see the prelude) */
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC1_ALPHA);
+
+    glUseProgram(comp->composite_prog);
+    glUniform1i(comp->uc_texture, 0);
+    int shaded = draw_windows(comp, comp->fbo, comp->composite_prog, -1, false);
+
+    glDisable(GL_BLEND);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    /* Window shaders bound their own textures; render_stack restores
+     * pass 2's when there are stack passes */
+    if (shaded > 0 && comp->stack_passes == 0) ss_bind_aux(&comp->postproc_aux);
+    trace_end(TRACE_RENDER, "pass 1", t, NULL, 0);
+    t = trace_begin();
+    trace_gpu_begin(comp, "pass 2");
+
+    /* --- Earlier stages of an effect stack --- */
+    GLuint screen = render_stack(comp);
+
+    /* --- Pass 2: Post-process FBO to overlay --- */
+    glViewport(0, 0, comp->root_width, comp->root_height);
+    if (comp->lut_dirty) bake_lut(comp);
+    glUseProgram(comp->postproc_prog);
+
+    glUniform2f(comp->u_resolution,
+                (float)comp->root_width, (float)comp->root_height);
+    glUniform1f(comp->u_time, elapsed_seconds(comp));
+
+    /* Apply user-controlled shader parameters */
+    apply_params(comp);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, screen);
+    glUniform1i(comp->u_screen_tex, 0);
+    if (comp->u_lut >= 0) ss_lut_bind(&comp->lut, comp->u_lut);
+
+    /* The output goes offscreen, then to the overlay: for feedback into the
+     * spare texture of the pair (u_prev next frame), for the compute path
+     * into an image, and for interleaving into cs_texture, which keeps the
+     * pixels this frame does not shade */
+    SsFeedback *fb = &comp->feedback;
+    bool feedback = comp->u_prev >= 0;
+    bool mask = mask_active(comp);
+    GLuint out_fbo = 0, out_tex = 0;
+    if (feedback) {
+        ss_feedback_bind(fb, comp->u_prev, screen);
+        out_fbo = fb->fbo[!fb->cur];
+        out_tex = fb->tex[!fb->cur];
+    } else if (comp->postproc_compute || comp->interleave > 1 || mask) {
+        out_fbo = comp->cs_fbo;
+        out_tex = comp->cs_texture;
+    }
+    if (mask) {
+        build_mask(comp, out_fbo);
+        comp->stats.masked_frames++;
+    }
+
+    bool partial = comp->interleave > 1 && comp->output_valid && !comp->damage_full;
+    if (comp->postproc_compute) {
+        glBindImageTexture(0, out_tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        dispatch_postproc(comp, partial);
+        glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    } else {
+        if (out_fbo) glBindFramebuffer(GL_FRAMEBUFFER, out_fbo);
+        draw_postproc(comp, partial);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    if (mask) copy_excluded(comp, out_fbo);
+
+    if (out_fbo) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, out_fbo);
+        glBlitFramebuffer(0, 0, comp->root_width, comp->root_height,
+                          0, 0, comp->root_width, comp->root_height,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    }
+    if (feedback) ss_feedback_advance(fb);
+    trace_gpu_end(comp);
+    trace_end(TRACE_RENDER, "pass 2", t, "passes", (uint64_t)comp->stack_passes + 1);
+
+    if (comp->interleave > 1) {
+        /* After a change, pixels outside the damage that depend on it are
+         * stale until every phase has come round once more */
+        bool changed = comp->damage_count > 0 || comp->damage_full;
+        if (!partial) comp->settle_frames = 0;
+        else if (changed) comp->settle_frames = comp->interleave - 1;
+        else if (comp->settle_frames > 0) comp->settle_frames--;
+        comp->phase = (comp->phase + 1) % comp->interleave;
+        comp->output_valid = true;
+        comp->damage_count = 0;
+        comp->damage_full = false;
+    }
+}
+
+/* ========================================================================== */
+/* Frames in flight                                                           */
+/* ========================================================================== */
+
+/*
+ * glXSwapBuffers returns as soon as the swap is queued, so without a
+ * limit the driver lets two or three frames pile up, each one a frame
+ * of delay between a change on screen and its shaded version. A fence
+ * after every swap tracks them; before rendering, the oldest is waited
+ * for until fewer than max_frames are left.
+ */
+
+static void retire_frames(Compositor *comp, int keep, bool block) {
+    while (comp->frames_queued > keep) {
+        GLenum st = glClientWaitSync(comp->frame_fences[0], GL_SYNC_FLUSH_COMMANDS_BIT,
+                                     block ? 100000000ull : 0);
+        /* Blocking, a frame still busy after 100 ms is dropped from the
+         * count rather than stalling the compositor on a hung GPU */
+        if (st == GL_TIMEOUT_EXPIRED && !block) return;
+        glDeleteSync(comp->frame_fences[0]);
+        comp->frames_queued--;
+        memmove(comp->frame_fences, comp->frame_fences + 1,
+                sizeof(GLsync) * (size_t)comp->frames_queued);
+    }
+}
+
+/* Call before starting a frame */
+static void wait_frames_in_flight(Compositor *comp) {
+    retire_frames(comp, 0, false);
+    int depth = comp->frames_queued;
+    comp->stats.queue_depth_sum += (uint64_t)depth;
+    if (depth > comp->stats.queue_depth_max) comp->stats.queue_depth_max = depth;
+    if (depth < comp->max_frames) return;
+
+    uint64_t t = mono_ns();
+    retire_frames(comp, comp->max_frames - 1, true);
+    uint64_t waited = mono_ns() - t;
+    comp->stats.queue_waits++;
+    comp->stats.queue_wait_ns += waited;
+    if (g_trace.on) trace_end(TRACE_RENDER, "wait frames in flight", t, "depth", (uint64_t)depth);
+}
+
+/* Call after the swap */
+static void queue_frame(Compositor *comp) {
+    if (comp->frames_queued == MAX_FRAMES_IN_FLIGHT) retire_frames(comp, MAX_FRAMES_IN_FLIGHT - 1, true);
+    comp->frame_fences[comp->frames_queued++] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/* ========================================================================== */
+/* Frame feed                                                                 */
+/* ========================================================================== */
+
+/*
+ * Readers of the preview kind need the desktop, not a copy of the
+ * compositor's work redone: at most feed_hz times a second, pass 1's
+ * composite and/or the shaded frame are scaled down on the GPU, read
+ * back asynchronously, and copied into the next slot of the display's
+ * feed object once the copy has landed. See shaderlib.h for the layout.
+ */
+
+/* An object already under our name is ours to replace only if we own it
+ * and the compositor that wrote it is gone; a live feed is left alone. */
+static bool feed_reclaim(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return errno == ENOENT;
+    struct stat st;
+    bool alive = false;
+    if (fstat(fd, &st) < 0 || st.st_uid != getuid()) {
+        fprintf(stderr, "Frame feed: %s belongs to another user\n", name);
+        close(fd);
+        return false;
+    }
+    if ((size_t)st.st_size >= sizeof(SsFeedHeader)) {
+        SsFeedHeader *h = mmap(NULL, sizeof(*h), PROT_READ, MAP_SHARED, fd, 0);
+        if (h != MAP_FAILED) {
+            alive = h->magic == SS_FEED_MAGIC && ss_feed_writer_alive(h);
+            munmap(h, sizeof(*h));
+        }
+    }
+    close(fd);
+    if (alive) {
+        fprintf(stderr, "Frame feed: another compositor publishes %s\n", name);
+        return false;
+    }
+    shm_unlink(name);
+    return true;
+}
+
+static int init_feed(Compositor *comp) {
+    uint32_t w = (uint32_t)comp->feed.width, h = (uint32_t)comp->feed.height;
+    int n = ss_feed_image_count(comp->feed.images);
+    size_t size = ss_feed_size(w, h, comp->feed.images);
+    const char *name = comp->feed.name;
+
+    ss_feed_name(comp->feed.name, sizeof(comp->feed.name), DisplayString(comp->dpy));
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        if (!feed_reclaim(name)) return -1;
+        fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "Frame feed: shm_open %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0)
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Frame feed: cannot map %zu bytes: %s\n", size, strerror(errno));
+        shm_unlink(name);
+        return -1;
+    }
+    SsFeedHeader *hdr = p;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->version = SS_FEED_VERSION;
+    hdr->width = w;
+    hdr->height = h;
+    hdr->screen_width = (uint32_t)comp->root_width;
+    hdr->screen_height = (uint32_t)comp->root_height;
+    hdr->images = comp->feed.images;
+    hdr->data_offset = (uint32_t)((sizeof(SsFeedHeader) + 63) & ~(size_t)63);
+    hdr->pid = (int32_t)getpid();
+    hdr->interval_ns = (uint64_t)comp->feed.interval_ns;
+    atomic_thread_fence(memory_order_release);
+    hdr->magic = SS_FEED_MAGIC;
+    comp->feed.shm = hdr;
+    comp->feed.shm_size = size;
+
+    glGenTextures(n, comp->feed.tex);
+    glGenFramebuffers(n, comp->feed.fbo);
+    for (int i = 0; i < n; i++) {
+        glBindTexture(GL_TEXTURE_2D, comp->feed.tex[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, (GLsizei)w, (GLsizei)h, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindFramebuffer(GL_FRAMEBUFFER, comp->feed.fbo[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, comp->feed.tex[i], 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenBuffers(FEED_PBOS, comp->feed.pbo);
+    for (int i = 0; i < FEED_PBOS; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, comp->feed.pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)(n * ss_feed_image_size(w, h)),
+                     NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    fprintf(stderr, "Frame feed: %s%s%s at %ux%u, %d Hz in %s\n",
+            comp->feed.images & SS_FEED_COMPOSITED ? "composited" : "",
+            n > 1 ? " and " : "",
+            comp->feed.images & SS_FEED_SHADED ? "shaded" : "",
+            w, h, (int)(1000000000L / comp->feed.interval_ns), name);
+    return 0;
+}
+
+static void free_feed(Compositor *comp) {
+    int n = ss_feed_image_count(comp->feed.images);
+    for (int i = 0; i < FEED_PBOS; i++)
+        if (comp->feed.fence[i]) glDeleteSync(comp->feed.fence[i]);
+    if (comp->feed.pbo[0]) glDeleteBuffers(FEED_PBOS, comp->feed.pbo);
+    if (comp->feed.fbo[0]) glDeleteFramebuffers(n, comp->feed.fbo);
+    if (comp->feed.tex[0]) glDeleteTextures(n, comp->feed.tex);
+    if (comp->feed.shm) {
+        munmap(comp->feed.shm, comp->feed.shm_size);
+        shm_unlink(comp->feed.name);
+    }
+    memset(&comp->feed, 0, sizeof(comp->feed));
+}
+
+/* Copy readbacks that have landed into the feed, oldest first */
+static void feed_publish(Compositor *comp) {
+    SsFeedHeader *hdr = comp->feed.shm;
+    size_t size = ss_feed_image_size(hdr->width, hdr->height);
+    int n = ss_feed_image_count(hdr->images);
+    for (int k = 0; k < FEED_PBOS; k++) {
+        int i = (comp->feed.next + k) % FEED_PBOS;
+        GLsync fence = comp->feed.fence[i];
+        if (!fence) continue;
+        GLenum st = glClientWaitSync(fence, 0, 0);
+        if (st != GL_ALREADY_SIGNALED && st != GL_CONDITION_SATISFIED) break;
+        glDeleteSync(fence);
+        comp->feed.fence[i] = NULL;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, comp->feed.pbo[i]);
+        const unsigned char *px = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                                   (GLsizeiptr)(n * size), GL_MAP_READ_BIT);
+        if (!px) continue;
+        /* Readers skip a slot whose number is 0 or changes under them */
+        uint64_t seq = ++comp->feed.published;
+        int slot = (int)(seq % SS_FEED_SLOTS);
+        atomic_store_explicit(&hdr->slot[slot].seq, 0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        memcpy(ss_feed_image(hdr, slot, hdr->images & SS_FEED_COMPOSITED ?
+                             SS_FEED_COMPOSITED : SS_FEED_SHADED), px, n * size);
+        hdr->slot[slot].time_ns = comp->feed.time_ns[i];
+        atomic_store_explicit(&hdr->slot[slot].seq, seq, memory_order_release);
+        atomic_store_explicit(&hdr->seq, seq, memory_order_release);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+/* Scale this frame's images down and start reading them back; call after
+ * render_frame, before the swap */
+static void feed_capture(Compositor *comp) {
+    feed_publish(comp);
+    uint64_t now = mono_ns();
+    if (atomic_load_explicit(&comp->feed.shm->busy_ns, memory_order_relaxed) == 0)
+        atomic_store_explicit(&comp->feed.shm->busy_ns, now, memory_order_release);
+    int i = comp->feed.next;
+    if (now < comp->feed.next_ns || comp->feed.fence[i]) {
+        if (now >= comp->feed.next_ns) comp->feed.dropped++;
+        comp->feed.stale = true;
+        return;
+    }
+    comp->feed.next_ns = now + (uint64_t)comp->feed.interval_ns;
+    comp->feed.stale = false;
+
+    uint64_t t = trace_begin();
+    SsFeedHeader *hdr = comp->feed.shm;
+    hdr->screen_width = (uint32_t)comp->root_width;
+    hdr->screen_height = (uint32_t)comp->root_height;
+    int w = comp->feed.width, h = comp->feed.height;
+    size_t size = ss_feed_image_size((uint32_t)w, (uint32_t)h);
+
+    /* The composite is pass 1's FBO when there is a global shader (single
+     * pass is off with a feed), the screen otherwise */
+    const uint32_t order[2] = { SS_FEED_COMPOSITED, SS_FEED_SHADED };
+    int k = 0;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, comp->feed.pbo[i]);
+    for (int j = 0; j < 2; j++) {
+        if (!(comp->feed.images & order[j])) continue;
+        GLuint src = order[j] == SS_FEED_COMPOSITED && comp->global_effect ? comp->fbo : 0;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, src);
+        if (!src) glReadBuffer(GL_BACK);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, comp->feed.fbo[k]);
+        /* Flipped: rows go out top-down, like X images */
+        glBlitFramebuffer(0, 0, comp->root_width, comp->root_height, 0, h, w, 0,
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, comp->feed.fbo[k]);
+        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, (void *)(k * size));
+        k++;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    comp->feed.fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    comp->feed.time_ns[i] = now;
+    comp->feed.next = (i + 1) % FEED_PBOS;
+    trace_end(TRACE_RENDER, "feed capture", t, "frame", comp->stats.frames);
+}
+
+/* The feed is behind the screen: a frame was not captured, or a capture
+ * has not been published. The frame timer keeps running until it is not. */
+static bool feed_pending(const Compositor *comp) {
+    if (!comp->feed.shm) return false;
+    if (comp->feed.stale) return true;
+    for (int i = 0; i < FEED_PBOS; i++)
+        if (comp->feed.fence[i]) return true;
+    return false;
+}
+
+/* ========================================================================== */
+/* Latency probe                                                              */
+/* ========================================================================== */
+
+/*
+ * Damage-to-photon latency. `screenshader-workload --latency-probe` flips
+ * a marker square between black and white and writes each flip's
+ * sequence number, colour and CLOCK_MONOTONIC time (taken once the
+ * server has drawn it) to PROBE_FILE. Every frame, the compositor copies
+ * the pixels at the marker's centre into a PBO; once the copy has landed,
+ * a change between dark and bright is matched with the probe's latest
+ * flip, and the latency is the time from that flip to the swap of the
+ * frame that showed it. Display scanout after the swap is not included.
+ */
+
+static int init_latency(Compositor *comp) {
+    glGenBuffers(LATENCY_SLOTS, comp->latency.pbo);
+    for (int i = 0; i < LATENCY_SLOTS; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, comp->latency.pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, LATENCY_SIZE * LATENCY_SIZE * 4, NULL,
+                     GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    comp->latency.state = -1;
+    fprintf(stderr, "Latency probe: watching %d,%d for flips in %s\n",
+            comp->latency.x, comp->latency.y, PROBE_FILE);
+    return 0;
+}
+
+/* The probe's latest flip; false if there is none yet */
+static bool read_probe(uint64_t *seq, int *bright, uint64_t *flip_ns) {
+    FILE *f = fopen(PROBE_FILE, "r");
+    if (!f) return false;
+    bool ok = fscanf(f, "%" SCNu64 " %d %" SCNu64, seq, bright, flip_ns) == 3;
+    fclose(f);
+    return ok;
+}
+
+static void latency_check(Compositor *comp, const uint8_t *px, uint64_t swap_ns) {
+    float luma = 0.0f;
+    for (int i = 0; i < LATENCY_SIZE * LATENCY_SIZE; i++)
+        luma += 0.2126f * px[4 * i] + 0.7152f * px[4 * i + 1] + 0.0722f * px[4 * i + 2];
+    luma /= 255.0f * LATENCY_SIZE * LATENCY_SIZE;
+
+    /* In between is a shader's doing (or a half-drawn marker): no change */
+    int state = luma > 0.6f ? 1 : luma < 0.4f ? 0 : -1;
+    if (state < 0 || state == comp->latency.state) return;
+    bool known = comp->latency.state >= 0;
+    comp->latency.state = state;
+    if (!known) return;
+
+    uint64_t seq, flip_ns;
+    int bright;
+    if (!read_probe(&seq, &bright, &flip_ns) || bright != state ||
+        seq == comp->latency.last_seq || flip_ns > swap_ns) {
+        comp->latency.unmatched++;
+        return;
+    }
+    comp->latency.last_seq = seq;
+    comp->latency.samples_ms[comp->latency.count++ % LATENCY_SAMPLES] =
+        (float)(swap_ns - flip_ns) / 1e6f;
+}
+
+/* Check the copies that have landed, oldest first */
+static void latency_collect(Compositor *comp) {
+    for (int k = 0; k < LATENCY_SLOTS; k++) {
+        int i = (comp->latency.next + k) % LATENCY_SLOTS;
+        GLsync fence = comp->latency.fence[i];
+        if (!fence) continue;
+        GLenum st = glClientWaitSync(fence, 0, 0);
+        if (st != GL_ALREADY_SIGNALED && st != GL_CONDITION_SATISFIED) break;
+        glDeleteSync(fence);
+        comp->latency.fence[i] = NULL;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, comp->latency.pbo[i]);
+        const uint8_t *px = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                             LATENCY_SIZE * LATENCY_SIZE * 4,
+                                             GL_MAP_READ_BIT);
+        if (px) {
+            latency_check(comp, px, comp->latency.swap_ns[i]);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+/* Copy the marker area of the frame just rendered, before the swap. A
+ * frame whose slot is still busy goes unread. */
+static void latency_readback(Compositor *comp) {
+    latency_collect(comp);
+    int i = comp->latency.next;
+    if (comp->latency.fence[i]) return;
+
+    int x = comp->latency.x - LATENCY_SIZE / 2;
+    int y = comp->root_height - comp->latency.y - LATENCY_SIZE / 2;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glReadBuffer(GL_BACK);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, comp->latency.pbo[i]);
+    glReadPixels(x, y, LATENCY_SIZE, LATENCY_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    comp->latency.fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    comp->latency.swap_ns[i] = 0;
+}
+
+/* Stamp the frame read back last with its swap time */
+static void latency_swapped(Compositor *comp) {
+    int i = comp->latency.next;
+    if (!comp->latency.fence[i] || comp->latency.swap_ns[i]) return;
+    comp->latency.swap_ns[i] = mono_ns();
+    comp->latency.next = (i + 1) % LATENCY_SLOTS;
+}
+
+static int cmp_float(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+/* Distribution of the latest samples */
+static void write_latency_stats(Compositor *comp, FILE *f) {
+    int n = comp->latency.count < LATENCY_SAMPLES ? (int)comp->latency.count : LATENCY_SAMPLES;
+    fprintf(f, "latency_samples %" PRIu64 "\n", comp->latency.count);
+    fprintf(f, "latency_unmatched %" PRIu64 "\n", comp->latency.unmatched);
+    if (n == 0) return;
+    float *sorted = malloc(sizeof(float) * (size_t)n);
+    if (!sorted) return;
+    memcpy(sorted, comp->latency.samples_ms, sizeof(float) * (size_t)n);
+    qsort(sorted, (size_t)n, sizeof(float), cmp_float);
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) sum += sorted[i];
+    fprintf(f, "latency_ms_min %.2f\n", sorted[0]);
+    fprintf(f, "latency_ms_mean %.2f\n", sum / n);
+    fprintf(f, "latency_ms_p50 %.2f\n", sorted[n / 2]);
+    fprintf(f, "latency_ms_p90 %.2f\n", sorted[(n * 9) / 10]);
+    fprintf(f, "latency_ms_p99 %.2f\n", sorted[(n * 99) / 100]);
+    fprintf(f, "latency_ms_max %.2f\n", sorted[n - 1]);
+    free(sorted);
+}
+
+/* ========================================================================== */
+/* Software backend                                                           */
+/* ========================================================================== */
+
+/*
+ * Used when GLX has no texture_from_pixmap (VMs, remote X, minimal servers)
+ * or with --software. Window contents are captured with XShmGetImage (plain
+ * XGetImage without MIT-SHM), composited into a CPU frame, shaded by a
+ * native C version of the selected shader, and presented with XShmPutImage.
+ * Compositing and shading are split into row bands across a worker pool;
+ * the kernels are written with GCC vector extensions so every operation
+ * runs on four pixels at a time.
+ */
+
+#define SW_BAND_ROWS 16
+
+typedef float    v4f __attribute__((vector_size(16)));
+typedef int32_t  v4i __attribute__((vector_size(16)));
+typedef uint32_t v4u __attribute__((vector_size(16)));
+
+typedef struct { v4f r, g, b; } RGB4;
+
+static inline v4f v4f_set1(float x) { return (v4f){ x, x, x, x }; }
+
+static inline v4f v4f_load(const float *p) {
+    v4f v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline v4f v4f_select(v4i mask, v4f a, v4f b) {
+    return (v4f)((mask & (v4i)a) | (~mask & (v4i)b));
+}
+
+static inline v4f v4f_min(v4f a, v4f b) { return v4f_select(a < b, a, b); }
+static inline v4f v4f_max(v4f a, v4f b) { return v4f_select(a > b, a, b); }
+
+static inline v4f v4f_clamp01(v4f x) {
+    return v4f_min(v4f_max(x, v4f_set1(0.0f)), v4f_set1(1.0f));
+}
+
+static inline v4f v4f_smoothstep(float e0, float e1, v4f x) {
+    v4f t = v4f_clamp01((x - e0) * (1.0f / (e1 - e0)));
+    return t * t * (3.0f - 2.0f * t);
+}
+
+static inline v4f v4f_abs(v4f x) {
+    return (v4f)((v4i)x & 0x7fffffff);
+}
+
+/* Four 0x00RRGGBB pixels -> normalized float channels */
+static inline RGB4 rgb4_load(const uint32_t *p) {
+    v4u px;
+    memcpy(&px, p, sizeof(px));
+    RGB4 c;
+    c.r = __builtin_convertvector((v4i)((px >> 16) & 0xff), v4f) * (1.0f / 255.0f);
+    c.g = __builtin_convertvector((v4i)((px >> 8) & 0xff), v4f) * (1.0f / 255.0f);
+    c.b = __builtin_convertvector((v4i)(px & 0xff), v4f) * (1.0f / 255.0f);
+    return c;
+}
+
+/* Store up to four pixels (n < 4 at the right edge of a row) */
+static inline void rgb4_store(uint32_t *p, RGB4 c, int n) {
+    v4i r = __builtin_convertvector(v4f_clamp01(c.r) * 255.0f + 0.5f, v4i);
+    v4i g = __builtin_convertvector(v4f_clamp01(c.g) * 255.0f + 0.5f, v4i);
+    v4i b = __builtin_convertvector(v4f_clamp01(c.b) * 255.0f + 0.5f, v4i);
+    v4u px = (v4u)((r << 16) | (g << 8) | b) | 0xff000000u;
+    memcpy(p, &px, (size_t)(n < 4 ? n : 4) * sizeof(uint32_t));
+}
+
+/* Destination row in the output image */
+static inline uint32_t *sw_out_row(SoftState *sw, int y) {
+    return (uint32_t *)(sw->out->data + (size_t)y * sw->out->bytes_per_line);
+}
+
+static inline v4f luma709(RGB4 c) {
+    return c.r * 0.2126f + c.g * 0.7152f + c.b * 0.0722f;
+}
+
+/* --- Worker pool ----------------------------------------------------------- */
+
+static void *sw_worker_main(void *arg);
+
+static void sw_pool_run(SoftPool *pool, SoftBandFn fn, Compositor *comp, int nbands) {
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->comp = comp;
+    pool->nbands = nbands;
+    atomic_store(&pool->next_band, 0);
+    pool->pending = pool->nthreads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    /* The render thread takes bands too (worker index nthreads) */
+    int band;
+    while ((band = atomic_fetch_add(&pool->next_band, 1)) < nbands) {
+        fn(comp, band, pool->nthreads);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) pthread_cond_wait(&pool->done_cv, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+typedef struct {
+    SoftPool *pool;
+    int       index;
+} SoftWorkerArg;
+
+static SoftWorkerArg sw_worker_args[SW_MAX_THREADS];
+
+static void *sw_worker_main(void *arg) {
+    SoftWorkerArg *wa = arg;
+    SoftPool *pool = wa->pool;
+    unsigned seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->quit)
+            pthread_cond_wait(&pool->start_cv, &pool->lock);
+        if (pool->quit) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        SoftBandFn fn = pool->fn;
+        Compositor *comp = pool->comp;
+        int nbands = pool->nbands;
+        pthread_mutex_unlock(&pool->lock);
+
+        int band;
+        while ((band = atomic_fetch_add(&pool->next_band, 1)) < nbands) {
+            fn(comp, band, wa->index);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) pthread_cond_signal(&pool->done_cv);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static int sw_pool_start(SoftPool *pool, int nthreads) {
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+    pool->initialized = true;
+    for (int i = 0; i < nthreads; i++) {
+        sw_worker_args[i].pool = pool;
+        sw_worker_args[i].index = i;
+        if (pthread_create(&pool->threads[i], NULL, sw_worker_main,
+                           &sw_worker_args[i]) != 0) {
+            fprintf(stderr, "Failed to start software worker %d\n", i);
+            return -1;
+        }
+        pool->nthreads++;
+    }
+    return 0;
+}
+
+static void sw_pool_stop(SoftPool *pool) {
+    if (!pool->initialized) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start_cv);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->nthreads; i++) pthread_join(pool->threads[i], NULL);
+    pool->nthreads = 0;
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start_cv);
+    pthread_cond_destroy(&pool->done_cv);
+    pool->initialized = false;
+}
+
+/* --- Shared tables --------------------------------------------------------- */
+
+/* Texture coordinates of pixel centres; row 0 is the top of the screen,
+ * which is v = 1 in the GL shaders. */
+static inline float sw_u(const SoftState *sw, int x) {
+    return ((float)x + 0.5f) / (float)sw->width;
+}
+
+static inline float sw_v(const SoftState *sw, int y) {
+    return 1.0f - ((float)y + 0.5f) / (float)sw->height;
+}
+
+/* vignette = clamp(pow(15 * u(1-u) * v(1-v), e), 0, 1) factors into a
+ * column term and a row term, each computed once per size. */
+static void sw_vignette_tables(SoftState *sw, float e) {
+    for (int x = 0; x < sw->width + 4; x++) {
+        float u = sw_u(sw, x < sw->width ? x : sw->width - 1);
+        sw->col_a[x] = powf(15.0f * u * (1.0f - u), e);
+    }
+    for (int y = 0; y < sw->height; y++) {
+        float v = sw_v(sw, y);
+        sw->row_a[y] = powf(v * (1.0f - v), e);
+    }
+}
+
+/* Scanline weight per row: mix(1, pow(sin(v * h * PI) * 0.5 + 0.5, e), amount) */
+static void sw_scanline_table(SoftState *sw, float e, float amount) {
+    for (int y = 0; y < sw->height; y++) {
+        float s = sinf(sw_v(sw, y) * (float)sw->height * 3.14159265359f) * 0.5f + 0.5f;
+        sw->row_b[y] = 1.0f + (powf(s, e) - 1.0f) * amount;
+    }
+}
+
+/* Luminance of one source row into out[1..width], edge-clamped into
+ * out[0] and out[width+1] so neighbour loads need no bounds checks. */
+static void sw_luma_row(const SoftState *sw, int y, const float w[3], float *out) {
+    if (y < 0) y = 0;
+    if (y >= sw->height) y = sw->height - 1;
+    const uint32_t *src = sw->frame + (size_t)y * sw->frame_stride;
+    for (int x = 0; x < sw->width; x += 4) {
+        RGB4 c = rgb4_load(src + x);
+        v4f l = c.r * w[0] + c.g * w[1] + c.b * w[2];
+        memcpy(out + 1 + x, &l, sizeof(l));
+    }
+    out[0] = out[1];
+    out[sw->width + 1] = out[sw->width];
+}
+
+static const float LUMA_709[3] = { 0.2126f, 0.7152f, 0.0722f };
+static const float LUMA_601[3] = { 0.299f, 0.587f, 0.114f };
+
+/* --- Kernels --------------------------------------------------------------- */
+
+static void sw_setup_none(SoftState *sw) { (void)sw; }
+
+/* nightlight.frag: warm shift */
+static void sw_rows_nightlight(SoftState *sw, int y0, int y1, float *scratch) {
+    (void)scratch;
+    for (int y = y0; y < y1; y++) {
+        const uint32_t *src = sw->frame + (size_t)y * sw->frame_stride;
+        uint32_t *dst = sw_out_row(sw, y);
+        for (int x = 0; x < sw->width; x += 4) {
+            RGB4 c = rgb4_load(src + x);
+            c.b *= 0.5f;
+            c.r *= 1.05f;
+            c.g *= 0.97f;
+            rgb4_store(dst + x, c, sw->width - x);
+        }
+    }
+}
+
+/* amber.frag / green.frag: luminance tint, scanlines, vignette */
+static void sw_setup_amber(SoftState *sw) {
+    sw_vignette_tables(sw, 0.3f);
+    sw_scanline_table(sw, 1.5f, 0.08f);
+}
+
+static void sw_rows_amber(SoftState *sw, int y0, int y1, float *scratch) {
+    (void)scratch;
+    for (int y = y0; y < y1; y++) {
+        const uint32_t *src = sw->frame + (size_t)y * sw->frame_stride;
+        uint32_t *dst = sw_out_row(sw, y);
+        float vy = sw->row_a[y], scan = sw->row_b[y] * 1.3f;
+        for (int x = 0; x < sw->width; x += 4) {
+            v4f lum = luma709(rgb4_load(src + x));
+            v4f vig = v4f_min(v4f_load(sw->col_a + x) * vy, v4f_set1(1.0f));
+            v4f k = lum * scan * (0.65f + 0.35f * vig);
+            RGB4 o = { k, k * 0.7f, v4f_set1(0.0f) };
+            rgb4_store(dst + x, o, sw->width - x);
+        }
+    }
+}
+
+static void sw_setup_green(SoftState *sw) {
+    sw_vignette_tables(sw, 0.3f);
+    sw_scanline_table(sw, 1.8f, 0.18f);
+}
+
+static void sw_rows_green(SoftState *sw, int y0, int y1, float *scratch) {
+    /* Three luminance rows (above, current, below) for the bloom taps */
+    int stride = sw->width + 8;
+    float *rows[3] = { scratch, scratch + stride, scratch + 2 * stride };
+    sw_luma_row(sw, y0 - 1, LUMA_709, rows[0]);
+    sw_luma_row(sw, y0, LUMA_709, rows[1]);
+
+    for (int y = y0; y < y1; y++) {
+        sw_luma_row(sw, y + 1, LUMA_709, rows[2]);
+        uint32_t *dst = sw_out_row(sw, y);
+        float vy = sw->row_a[y], scan = sw->row_b[y] * 1.3f;
+        for (int x = 0; x < sw->width; x += 4) {
+            v4f lum = v4f_load(rows[1] + 1 + x);
+            v4f bloom = (v4f_load(rows[1] + x) + v4f_load(rows[1] + 2 + x) +
+                         v4f_load(rows[0] + 1 + x) + v4f_load(rows[2] + 1 + x)) * 0.25f;
+            v4f vig = v4f_min(v4f_load(sw->col_a + x) * vy, v4f_set1(1.0f));
+            v4f k = scan * (0.6f + 0.4f * vig);
+            RGB4 o = {
+                v4f_set1(0.0f),
+                (lum + 0.15f * bloom) * k,
+                (0.3f * lum + 0.05f * bloom) * k,
+            };
+            rgb4_store(dst + x, o, sw->width - x);
+        }
+        float *t = rows[0]; rows[0] = rows[1]; rows[1] = rows[2]; rows[2] = t;
+    }
+}
+
+/* pixelate.frag: 8px blocks, saturation boost, grid, text preservation */
+#define SW_PIXEL_BLOCK 8
+
+static void sw_setup_pixelate(SoftState *sw) {
+    /* grid = smoothstep(0, 0.06, fract(uv * blocks)) per axis */
+    for (int x = 0; x < sw->width + 4; x++) {
+        float f = fmodf(((float)x + 0.5f) / SW_PIXEL_BLOCK, 1.0f);
+        float t = fminf(f / 0.06f, 1.0f);
+        sw->col_a[x] = t * t * (3.0f - 2.0f * t);
+    }
+    for (int y = 0; y < sw->height; y++) {
+        float f = fmodf(((float)(sw->height - 1 - y) + 0.5f) / SW_PIXEL_BLOCK, 1.0f);
+        float t = fminf(f / 0.06f, 1.0f);
+        sw->row_a[y] = t * t * (3.0f - 2.0f * t);
+    }
+}
+
+static uint32_t sw_pixel_at(const SoftState *sw, int x, int y) {
+    if (x < 0) x = 0;
+    if (x >= sw->width) x = sw->width - 1;
+    if (y < 0) y = 0;
+    if (y >= sw->height) y = sw->height - 1;
+    return sw->frame[(size_t)y * sw->frame_stride + x];
+}
+
+static void sw_rows_pixelate(SoftState *sw, int y0, int y1, float *scratch) {
+    int stride = sw->width + 8;
+    float *rows[3] = { scratch, scratch + stride, scratch + 2 * stride };
+    /* Boosted block colours for the current block row, one entry per column */
+    float *block[3] = { scratch + 3 * stride, scratch + 4 * stride, scratch + 5 * stride };
+    int cached_by = -1;
+
+    sw_luma_row(sw, y0 - 1, LUMA_601, rows[0]);
+    sw_luma_row(sw, y0, LUMA_601, rows[1]);
+
+    for (int y = y0; y < y1; y++) {
+        sw_luma_row(sw, y + 1, LUMA_601, rows[2]);
+
+        /* Blocks are aligned to the bottom edge, as in GL. The shader
+         * samples the block centre, which falls between texels 3 and 4
+         * on both axes; bilinear filtering averages those four. */
+        int gy = sw->height - 1 - y;
+        int by = gy / SW_PIXEL_BLOCK;
+        if (by != cached_by) {
+            cached_by = by;
+            int cy = sw->height - 1 - (by * SW_PIXEL_BLOCK + SW_PIXEL_BLOCK / 2);
+            for (int bx = 0; bx * SW_PIXEL_BLOCK < sw->width; bx++) {
+                int cx = bx * SW_PIXEL_BLOCK + SW_PIXEL_BLOCK / 2 - 1;
+                uint32_t p[4] = {
+                    sw_pixel_at(sw, cx, cy), sw_pixel_at(sw, cx + 1, cy),
+                    sw_pixel_at(sw, cx, cy + 1), sw_pixel_at(sw, cx + 1, cy + 1),
+                };
+                float r = 0, g = 0, b = 0;
+                for (int i = 0; i < 4; i++) {
+                    r += (float)((p[i] >> 16) & 0xff);
+                    g += (float)((p[i] >> 8) & 0xff);
+                    b += (float)(p[i] & 0xff);
+                }
+                r /= 4.0f * 255.0f; g /= 4.0f * 255.0f; b /= 4.0f * 255.0f;
+                float lum = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+                for (int i = 0; i < SW_PIXEL_BLOCK; i++) {
+                    int x = bx * SW_PIXEL_BLOCK + i;
+                    block[0][x] = lum + (r - lum) * 1.3f;
+                    block[1][x] = lum + (g - lum) * 1.3f;
+                    block[2][x] = lum + (b - lum) * 1.3f;
+                }
+            }
+        }
+
+        const uint32_t *src = sw->frame + (size_t)y * sw->frame_stride;
+        uint32_t *dst = sw_out_row(sw, y);
+        float gy_grid = sw->row_a[y];
+        for (int x = 0; x < sw->width; x += 4) {
+            RGB4 orig = rgb4_load(src + x);
+            v4f grid = v4f_load(sw->col_a + x) * gy_grid;
+            v4f shade = 0.85f + 0.15f * grid;
+            RGB4 c = {
+                v4f_load(block[0] + x) * shade,
+                v4f_load(block[1] + x) * shade,
+                v4f_load(block[2] + x) * shade,
+            };
+
+            /* textDetect(): luminance differences to six neighbours. GL's
+             * -y is the row below in screen order. */
+            v4f l = v4f_load(rows[1] + 1 + x);
+            v4f e = v4f_abs(l - v4f_load(rows[1] + x))
+                  + v4f_abs(l - v4f_load(rows[1] + 2 + x))
+                  + v4f_abs(l - v4f_load(rows[2] + 1 + x))
+                  + v4f_abs(l - v4f_load(rows[0] + 1 + x))
+                  + v4f_abs(l - v4f_load(rows[2] + x))
+                  + v4f_abs(l - v4f_load(rows[0] + 2 + x));
+            v4f detail = v4f_smoothstep(0.15f, 0.6f, e) * 0.85f;
+
+            c.r += (orig.r - c.r) * detail;
+            c.g += (orig.g - c.g) * detail;
+            c.b += (orig.b - c.b) * detail;
+            rgb4_store(dst + x, c, sw->width - x);
+        }
+        float *t = rows[0]; rows[0] = rows[1]; rows[1] = rows[2]; rows[2] = t;
+    }
+}
+
+/* filmgrain.frag: desaturate, vintage grade, grain, scratches, flicker */
+#define SW_NOISE_SIZE 256
+
+static uint32_t sw_hash(uint32_t x) {
+    x ^= x >> 16; x *= 0x7feb352dU;
+    x ^= x >> 15; x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static float sw_hash01(uint32_t x) {
+    return (float)(sw_hash(x) >> 8) / 16777216.0f;
+}
+
+static void sw_setup_filmgrain(SoftState *sw) {
+    sw_vignette_tables(sw, 0.35f);
+    /* The GLSL hash is a per-pixel sin() hash; a fixed white-noise tile
+     * with a per-frame offset gives the same look at a table lookup. */
+    if (!sw->noise) {
+        sw->noise = malloc(SW_NOISE_SIZE * SW_NOISE_SIZE * sizeof(float));
+        if (!sw->noise) return;
+        for (int i = 0; i < SW_NOISE_SIZE * SW_NOISE_SIZE; i++) {
+            sw->noise[i] = (sw_hash01((uint32_t)i * 2654435761U) * 2.0f - 1.0f) * 0.08f;
+        }
+    }
+}
+
+static void sw_frame_filmgrain(SoftState *sw) {
+    uint32_t frame24 = (uint32_t)floorf(sw->time * 24.0f);
+    uint32_t frame = (uint32_t)floorf(sw->time * 60.0f);
+    sw->noise_ox = (int)(sw_hash(frame * 3 + 1) % SW_NOISE_SIZE);
+    sw->noise_oy = (int)(sw_hash(frame * 3 + 2) % SW_NOISE_SIZE);
+    sw->flicker = 1.0f + (sw_hash01(frame24 * 4 + 2) - 0.5f) * 0.03f;
+
+    /* Scratch: a thin vertical line on ~8% of film frames */
+    float scratch_x = sw_hash01(frame24 * 4);
+    bool visible = sw_hash01(frame24 * 4 + 1) >= 0.92f;
+    for (int x = 0; x < sw->width + 4; x++) {
+        float d = fabsf(sw_u(sw, x) - scratch_x);
+        float t = visible ? fminf(fmaxf((0.001f - d) / 0.001f, 0.0f), 1.0f) : 0.0f;
+        sw->col_b[x] = t * t * (3.0f - 2.0f * t) * 0.15f;
+    }
+}
+
+static void sw_rows_filmgrain(SoftState *sw, int y0, int y1, float *scratch) {
+    (void)scratch;
+    if (!sw->noise) return;
+    float flicker = sw->flicker;
+    for (int y = y0; y < y1; y++) {
+        const uint32_t *src = sw->frame + (size_t)y * sw->frame_stride;
+        uint32_t *dst = sw_out_row(sw, y);
+        const float *noise = sw->noise +
+            (size_t)((y + sw->noise_oy) % SW_NOISE_SIZE) * SW_NOISE_SIZE;
+        float vy = sw->row_a[y];
+        for (int x = 0; x < sw->width; x += 4) {
+            RGB4 c = rgb4_load(src + x);
+            v4f lum = luma709(c);
+
+            c.r = (lum + (c.r - lum) * 0.7f) * 1.08f * 0.85f + 0.06f;
+            c.g = (lum + (c.g - lum) * 0.7f) * 1.02f * 0.85f + 0.06f;
+            c.b = (lum + (c.b - lum) * 0.7f) * 0.88f * 0.85f + 0.06f;
+
+            int nx = (x + sw->noise_ox) % SW_NOISE_SIZE;
+            v4f grain = nx + 4 <= SW_NOISE_SIZE
+                ? v4f_load(noise + nx)
+                : (v4f){ noise[nx], noise[(nx + 1) % SW_NOISE_SIZE],
+                         noise[(nx + 2) % SW_NOISE_SIZE], noise[(nx + 3) % SW_NOISE_SIZE] };
+            grain += v4f_load(sw->col_b + x);
+
+            v4f vig = v4f_min(v4f_load(sw->col_a + x) * vy, v4f_set1(1.0f));
+            v4f k = flicker * (0.5f + 0.5f * vig);
+            v4f amount = (1.0f - lum) * 0.15f;
+
+            c.r = (c.r + grain) * k;
+            c.g = (c.g + grain) * k;
+            c.b = (c.b + grain) * k;
+            c.r += (1.2f * lum - c.r) * amount;
+            c.g += (lum - c.g) * amount;
+            c.b += (0.8f * lum - c.b) * amount;
+            rgb4_store(dst + x, c, sw->width - x);
+        }
+    }
+}
+
+static const SoftKernel sw_kernels[] = {
+    { "nightlight", false, sw_setup_none,      NULL,               sw_rows_nightlight },
+    { "amber",      false, sw_setup_amber,     NULL,               sw_rows_amber },
+    { "green",      false, sw_setup_green,     NULL,               sw_rows_green },
+    { "pixelate",   false, sw_setup_pixelate,  NULL,               sw_rows_pixelate },
+    { "filmgrain",  true,  sw_setup_filmgrain, sw_frame_filmgrain, sw_rows_filmgrain },
+};
+
+static const SoftKernel *sw_find_kernel(const char *shader_path) {
+    char *copy = strdup(shader_path);
+    if (!copy) return NULL;
+    char *name = basename(copy);
+    char *dot = strrchr(name, '.');
+    if (dot) *dot = '\0';
+
+    const SoftKernel *k = NULL;
+    for (size_t i = 0; i < sizeof(sw_kernels) / sizeof(sw_kernels[0]); i++) {
+        if (strcmp(sw_kernels[i].name, name) == 0) k = &sw_kernels[i];
+    }
+    free(copy);
+    return k;
+}
+
+/* --- Capture and presentation ---------------------------------------------- */
 
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    float elapsed = (float)(now.tv_sec - comp->start_time.tv_sec)
-                  + (float)(now.tv_nsec - comp->start_time.tv_nsec) / 1e9f;
+static Visual *sw_visual_for_depth(Compositor *comp, int depth) {
+    if (DefaultDepth(comp->dpy, comp->screen) == depth)
+        return DefaultVisual(comp->dpy, comp->screen);
+    XVisualInfo vi;
+    if (XMatchVisualInfo(comp->dpy, comp->screen, depth, TrueColor, &vi))
+        return vi.visual;
+    return NULL;
+}
 
-    glUniform2f(comp->u_resolution,
-                (float)comp->root_width, (float)comp->root_height);
-    glUniform1f(comp->u_time, elapsed);
+/* ZPixmap image, backed by a SysV shm segment when MIT-SHM is usable */
+static XImage *sw_create_image(Compositor *comp, Visual *visual, int depth,
+                               int width, int height, XShmSegmentInfo *shm) {
+    XImage *img;
+    if (comp->sw.use_shm) {
+        img = XShmCreateImage(comp->dpy, visual, depth, ZPixmap, NULL, shm,
+                              width, height);
+        if (!img) return NULL;
+        shm->shmid = shmget(IPC_PRIVATE, (size_t)img->bytes_per_line * height,
+                            IPC_CREAT | 0600);
+        if (shm->shmid < 0) { XDestroyImage(img); return NULL; }
+        shm->shmaddr = img->data = shmat(shm->shmid, NULL, 0);
+        shm->readOnly = False;
+        g_last_xerror = 0;
+        XShmAttach(comp->dpy, shm);
+        XSync(comp->dpy, False);
+        x_round_trip();
+        shmctl(shm->shmid, IPC_RMID, NULL); /* freed once both sides detach */
+        if (shm->shmaddr == (char *)-1 || g_last_xerror) {
+            if (shm->shmaddr != (char *)-1) shmdt(shm->shmaddr);
+            XDestroyImage(img);
+            g_last_xerror = 0;
+            return NULL;
+        }
+    } else {
+        img = XCreateImage(comp->dpy, visual, depth, ZPixmap, 0, NULL,
+                           width, height, 32, 0);
+        if (!img) return NULL;
+        img->data = malloc((size_t)img->bytes_per_line * height);
+        if (!img->data) { XDestroyImage(img); return NULL; }
+    }
+    if (img->bits_per_pixel != 32) {
+        fprintf(stderr, "Software backend: %d bpp images are not supported\n",
+                img->bits_per_pixel);
+        if (comp->sw.use_shm) { XShmDetach(comp->dpy, shm); shmdt(shm->shmaddr); }
+        XDestroyImage(img);
+        return NULL;
+    }
+    return img;
+}
 
-    /* Apply user-controlled shader parameters */
-    apply_params(comp);
+static void sw_destroy_image(Compositor *comp, XImage *img, XShmSegmentInfo *shm) {
+    if (!img) return;
+    if (comp->sw.use_shm) {
+        XShmDetach(comp->dpy, shm);
+        XDestroyImage(img);
+        shmdt(shm->shmaddr);
+    } else {
+        XDestroyImage(img);
+    }
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, comp->fbo_texture);
-    glUniform1i(comp->u_screen_tex, 0);
+static void sw_unbind_window(Compositor *comp, WinEntry *w) {
+    if (!w->pixmap_valid) return;
+    sw_destroy_image(comp, w->sw_image, &w->sw_shm);
+    w->sw_image = NULL;
+    XFreePixmap(comp->dpy, w->pixmap);
+    w->pixmap = 0;
+    w->pixmap_valid = false;
+}
 
-    glBindVertexArray(comp->vao);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+static void sw_bind_window(Compositor *comp, WinEntry *w) {
+    if (w->pixmap_valid) sw_unbind_window(comp, w);
+    if (!w->mapped || w->width <= 0 || w->height <= 0) return;
+    if (w->depth != 24 && w->depth != 32) return;
+
+    Visual *visual = sw_visual_for_depth(comp, w->depth);
+    if (!visual) return;
+
+    g_last_xerror = 0;
+    w->pixmap = XCompositeNameWindowPixmap(comp->dpy, w->xid);
+    XSync(comp->dpy, False);
+    x_round_trip();
+    if (!w->pixmap || g_last_xerror) {
+        if (w->pixmap) XFreePixmap(comp->dpy, w->pixmap);
+        w->pixmap = 0;
+        g_last_xerror = 0;
+        return;
+    }
+
+    /* The composite pixmap includes the border */
+    int pw = w->width + 2 * w->border_width;
+    int ph = w->height + 2 * w->border_width;
+    w->sw_image = sw_create_image(comp, visual, w->depth, pw, ph, &w->sw_shm);
+    if (!w->sw_image) {
+        XFreePixmap(comp->dpy, w->pixmap);
+        w->pixmap = 0;
+        return;
+    }
+
+    w->pixmap_valid = true;
+    w->damaged = true;
+}
+
+static bool sw_capture_window(Compositor *comp, WinEntry *w) {
+    XImage *img = w->sw_image;
+    g_last_xerror = 0;
+    x_round_trip();
+    if (comp->sw.use_shm) {
+        if (!XShmGetImage(comp->dpy, w->pixmap, img, 0, 0, AllPlanes)) return false;
+    } else {
+        XImage *got = XGetSubImage(comp->dpy, w->pixmap, 0, 0,
+                                   (unsigned)img->width, (unsigned)img->height,
+                                   AllPlanes, ZPixmap, img, 0, 0);
+        if (!got) return false;
+    }
+    return g_last_xerror == 0;
+}
+
+/* --- Band jobs ------------------------------------------------------------- */
+
+/* Composite every window clipped to this band's rows, bottom to top.
+ * Depth-24 windows are opaque copies; depth-32 windows carry
+ * premultiplied ARGB and are blended over what is below. */
+static void sw_composite_band(Compositor *comp, int band, int worker) {
+    (void)worker;
+    SoftState *sw = &comp->sw;
+    int y0 = band * SW_BAND_ROWS;
+    int y1 = y0 + SW_BAND_ROWS < sw->height ? y0 + SW_BAND_ROWS : sw->height;
+
+    for (int y = y0; y < y1; y++) {
+        memset(sw->frame + (size_t)y * sw->frame_stride, 0,
+               (size_t)sw->width * sizeof(uint32_t));
+    }
+
+    for (WinEntry *w = comp->win_head; w; w = w->next) {
+        if (!w->mapped || !w->pixmap_valid || !w->sw_image) continue;
+        XImage *img = w->sw_image;
+        int wx0 = w->x > 0 ? w->x : 0;
+        int wx1 = w->x + img->width < sw->width ? w->x + img->width : sw->width;
+        int wy0 = w->y > y0 ? w->y : y0;
+        int wy1 = w->y + img->height < y1 ? w->y + img->height : y1;
+        if (wx0 >= wx1 || wy0 >= wy1) continue;
+
+        for (int y = wy0; y < wy1; y++) {
+            const uint32_t *src = (const uint32_t *)
+                (img->data + (size_t)(y - w->y) * img->bytes_per_line) + (wx0 - w->x);
+            uint32_t *dst = sw->frame + (size_t)y * sw->frame_stride + wx0;
+            int n = wx1 - wx0;
+            if (w->depth != 32) {
+                memcpy(dst, src, (size_t)n * sizeof(uint32_t));
+                continue;
+            }
+            for (int i = 0; i < n; i++) {
+                uint32_t s = src[i], a = s >> 24;
+                if (a == 0xff) { dst[i] = s; continue; }
+                if (a == 0 && (s & 0xffffff) == 0) continue;
+                uint32_t d = dst[i], inv = 255 - a, out = 0;
+                for (int sh = 0; sh < 24; sh += 8) {
+                    uint32_t c = ((s >> sh) & 0xff) + (((d >> sh) & 0xff) * inv + 127) / 255;
+                    out |= (c > 255 ? 255 : c) << sh;
+                }
+                dst[i] = out;
+            }
+        }
+    }
+}
+
+static void sw_shade_band(Compositor *comp, int band, int worker) {
+    SoftState *sw = &comp->sw;
+    int y0 = band * SW_BAND_ROWS;
+    int y1 = y0 + SW_BAND_ROWS < sw->height ? y0 + SW_BAND_ROWS : sw->height;
+    sw->kernel->rows(sw, y0, y1, sw->scratch + (size_t)worker * sw->scratch_stride);
+}
+
+/* --- Setup / teardown ------------------------------------------------------ */
+
+static void sw_free_buffers(Compositor *comp) {
+    SoftState *sw = &comp->sw;
+    sw_destroy_image(comp, sw->out, &sw->out_shm);
+    sw->out = NULL;
+    free(sw->frame);
+    free(sw->col_a);
+    free(sw->col_b);
+    free(sw->row_a);
+    free(sw->row_b);
+    free(sw->scratch);
+    sw->frame = NULL;
+    sw->col_a = sw->col_b = sw->row_a = sw->row_b = sw->scratch = NULL;
+}
+
+/* (Re)allocate everything that depends on the root size */
+static int sw_resize(Compositor *comp) {
+    SoftState *sw = &comp->sw;
+    sw_free_buffers(comp);
+
+    sw->width = comp->root_width;
+    sw->height = comp->root_height;
+    /* Rows are padded so four-pixel loads at the right edge stay in bounds */
+    sw->frame_stride = (sw->width + 4 + 3) & ~3;
+    sw->frame = calloc((size_t)sw->frame_stride * sw->height, sizeof(uint32_t));
+    sw->col_a = calloc((size_t)sw->width + 8, sizeof(float));
+    sw->col_b = calloc((size_t)sw->width + 8, sizeof(float));
+    sw->row_a = calloc((size_t)sw->height, sizeof(float));
+    sw->row_b = calloc((size_t)sw->height, sizeof(float));
+    sw->scratch_stride = 6 * (sw->width + 8);
+    sw->scratch = calloc((size_t)sw->scratch_stride * (sw->pool.nthreads + 1),
+                         sizeof(float));
+    if (!sw->frame || !sw->col_a || !sw->col_b || !sw->row_a || !sw->row_b ||
+        !sw->scratch) {
+        fprintf(stderr, "Software backend: out of memory\n");
+        return -1;
+    }
+
+    sw->out = sw_create_image(comp, sw->visual, sw->depth, sw->width, sw->height,
+                              &sw->out_shm);
+    if (!sw->out) {
+        fprintf(stderr, "Software backend: cannot create %dx%d output image\n",
+                sw->width, sw->height);
+        return -1;
+    }
+
+    sw->kernel->setup(sw);
+    comp->scene_changed = true;
+    return 0;
+}
+
+static int init_software(Compositor *comp) {
+    SoftState *sw = &comp->sw;
+
+    if (!comp->global_effect) {
+        fprintf(stderr, "Software backend needs a global shader\n");
+        return -1;
+    }
+    sw->kernel = sw_find_kernel(comp->shader_path);
+    if (!sw->kernel) {
+        fprintf(stderr, "Software backend has no implementation of %s (available:",
+                comp->shader_path);
+        for (size_t i = 0; i < sizeof(sw_kernels) / sizeof(sw_kernels[0]); i++)
+            fprintf(stderr, " %s", sw_kernels[i].name);
+        fprintf(stderr, ")\n");
+        return -1;
+    }
+    comp->animated = sw->kernel->animated;
+    if (comp->stage_count > 1)
+        fprintf(stderr, "Software backend runs one shader, ignoring all but %s\n",
+                sw->kernel->name);
+    const ExcludeRules *ex = &comp->exclude;
+    if (ex->class_count + ex->window_count + ex->rect_count > 0)
+        fprintf(stderr, "Software backend shades everything, ignoring exclusions\n");
+    if (comp->win_rules.count > 0)
+        fprintf(stderr, "Software backend has no window shaders, ignoring them\n");
+    if (comp->latency.on) {
+        fprintf(stderr, "Software backend has no latency probe, ignoring it\n");
+        comp->latency.on = false;
+    }
+    if (comp->feed.images) {
+        fprintf(stderr, "Software backend has no frame feed, ignoring it\n");
+        comp->feed.images = 0;
+    }
+
+    int major, minor;
+    Bool pixmaps;
+    sw->use_shm = XShmQueryVersion(comp->dpy, &major, &minor, &pixmaps);
+
+    XWindowAttributes attr;
+    if (!XGetWindowAttributes(comp->dpy, comp->overlay, &attr)) return -1;
+    sw->visual = attr.visual;
+    sw->depth = attr.depth;
+    if (attr.visual->class != TrueColor || attr.visual->red_mask != 0xff0000 ||
+        attr.visual->green_mask != 0xff00 || attr.visual->blue_mask != 0xff) {
+        fprintf(stderr, "Software backend needs a 24/32-bit RGB overlay visual\n");
+        return -1;
+    }
+    sw->gc = XCreateGC(comp->dpy, comp->overlay, 0, NULL);
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nworkers = (int)(ncpu > 1 ? ncpu - 1 : 0);
+    if (nworkers > SW_MAX_THREADS) nworkers = SW_MAX_THREADS;
+    if (sw_pool_start(&sw->pool, nworkers) < 0) return -1;
+
+    if (sw_resize(comp) < 0) return -1;
+
+    fprintf(stderr, "Software backend: %s kernel, %d threads, %s\n",
+            sw->kernel->name, sw->pool.nthreads + 1,
+            sw->use_shm ? "MIT-SHM" : "XGetImage/XPutImage");
+    return 0;
+}
+
+static void cleanup_software(Compositor *comp) {
+    SoftState *sw = &comp->sw;
+    if (!comp->software) return;
+    sw_pool_stop(&sw->pool);
+    sw_free_buffers(comp);
+    free(sw->noise);
+    sw->noise = NULL;
+    if (sw->gc) XFreeGC(comp->dpy, sw->gc);
+    sw->gc = NULL;
+}
+
+static void sw_render_frame(Compositor *comp) {
+    SoftState *sw = &comp->sw;
+    bool recomposite = comp->scene_changed;
+    comp->scene_changed = false;
+
+    for (WinEntry *w = comp->win_head; w; w = w->next) {
+        if (!w->damaged || !w->pixmap_valid) continue;
+        w->damaged = false;
+        uint64_t t = trace_begin();
+        if (sw_capture_window(comp, w)) {
+            comp->stats.sw_captures++;
+            recomposite = true;
+        }
+        trace_end(TRACE_RENDER, "window capture", t, "window", w->xid);
+    }
+
+    int nbands = (sw->height + SW_BAND_ROWS - 1) / SW_BAND_ROWS;
+    uint64_t t = trace_begin();
+    if (recomposite) {
+        sw_pool_run(&sw->pool, sw_composite_band, comp, nbands);
+        comp->stats.sw_composites++;
+        trace_end(TRACE_RENDER, "composite", t, NULL, 0);
+    }
+
+    t = trace_begin();
+    sw->time = elapsed_seconds(comp);
+    if (sw->kernel->frame) sw->kernel->frame(sw);
+    sw_pool_run(&sw->pool, sw_shade_band, comp, nbands);
+    trace_end(TRACE_RENDER, "shade", t, NULL, 0);
+
+    t = trace_begin();
+    if (sw->use_shm) {
+        XShmPutImage(comp->dpy, comp->overlay, sw->gc, sw->out, 0, 0, 0, 0,
+                     (unsigned)sw->width, (unsigned)sw->height, False);
+    } else {
+        XPutImage(comp->dpy, comp->overlay, sw->gc, sw->out, 0, 0, 0, 0,
+                  (unsigned)sw->width, (unsigned)sw->height);
+    }
+    /* The server reads the shared segment asynchronously; don't let the
+     * next frame overwrite it before the put has been processed. */
+    XSync(comp->dpy, False);
+    x_round_trip();
+    trace_end(TRACE_RENDER, "put image", t, NULL, 0);
 }
 
 /* ========================================================================== */
-/* Shader hot-reload                                                          */
+/* Post-process program (build + hot-reload)                                  */
 /* ========================================================================== */
 
-static void reload_postproc_shader(Compositor *comp) {
-    fprintf(stderr, "Reloading shader: %s\n", comp->shader_path);
+/* Offscreen output for the compute tile path and interleaved shading,
+ * created on first use */
+static int init_compute_target(Compositor *comp) {
+    if (comp->cs_texture) return 0;
 
-    char *frag_src = load_file(comp->shader_path);
-    if (!frag_src) return;
+    glGenTextures(1, &comp->cs_texture);
+    glBindTexture(GL_TEXTURE_2D, comp->cs_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
+                 comp->root_width, comp->root_height, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-    GLuint frag = compile_shader(GL_FRAGMENT_SHADER, frag_src, comp->shader_path);
-    free(frag_src);
-    if (!frag) {
-        fprintf(stderr, "Hot-reload failed (compile error), keeping current shader\n");
-        return;
+    glGenFramebuffers(1, &comp->cs_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, comp->cs_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, comp->cs_texture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Compute output FBO incomplete: 0x%x\n", status);
+        return -1;
     }
+    return 0;
+}
 
-    GLuint new_prog = link_program(comp->vert_shader, frag);
+/* Pass 2 output where an exclusion mask keeps the shader off: the
+ * composite as it is */
+static const char *COPY_FRAG_SRC =
+    "#version 330 core\n"
+    "in vec2 v_texcoord;\n"
+    "out vec4 frag_color;\n"
+    "uniform sampler2D u_texture;\n"
+    "void main() {\n"
+    "    frag_color = vec4(texture(u_texture, v_texcoord).rgb, 1.0);\n"
+    "}\n";
+
+/* Stencil and copy program for exclusion masks. The stencil is attached to
+ * whichever offscreen target pass 2 renders into, cs_fbo by default, so
+ * check that such a target is complete. */
+static int init_mask(Compositor *comp) {
+    if (init_compute_target(comp) < 0) return -1;
+
+    GLuint frag = compile_shader(GL_FRAGMENT_SHADER, COPY_FRAG_SRC, "copy.frag");
+    if (!frag) return -1;
+    comp->copy_prog = link_program(comp->vert_shader, frag);
     glDeleteShader(frag);
-    if (!new_prog) {
-        fprintf(stderr, "Hot-reload failed (link error), keeping current shader\n");
-        return;
+    if (!comp->copy_prog) return -1;
+    comp->ucopy_texture = glGetUniformLocation(comp->copy_prog, "u_texture");
+
+    glGenRenderbuffers(1, &comp->mask_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, comp->mask_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8,
+                          comp->root_width, comp->root_height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, comp->cs_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, comp->mask_rb);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Exclusion mask FBO incomplete: 0x%x\n", status);
+        return -1;
+    }
+    return 0;
+}
+
+/* Bake program for a shader's `lut` stage; 0 if it cannot be built, and
+ * the stage is then evaluated in the shader as written */
+static GLuint build_lut_program(Compositor *comp, const char *bake_src) {
+    GLuint vert = compile_shader(GL_VERTEX_SHADER, SS_LUT_VERT_SRC, "lut.vert");
+    GLuint frag = vert ? compile_shader(GL_FRAGMENT_SHADER, bake_src, comp->shader_path) : 0;
+    GLuint prog = frag ? link_program(vert, frag) : 0;
+    if (vert) glDeleteShader(vert);
+    if (frag) glDeleteShader(frag);
+    return prog;
+}
+
+/* Ping-pong targets for the passes of an effect stack, created on first
+ * use */
+static int init_stack_targets(Compositor *comp) {
+    if (comp->stack_tex[0]) return 0;
+
+    glGenTextures(2, comp->stack_tex);
+    glGenFramebuffers(2, comp->stack_fbo);
+    for (int i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D, comp->stack_tex[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, comp->fbo_format,
+                     comp->root_width, comp->root_height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, comp->stack_fbo[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, comp->stack_tex[i], 0);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "Effect stack FBO incomplete: 0x%x\n", status);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            return -1;
+        }
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return 0;
+}
+
+static void free_stack_passes(StackPass *passes, int count) {
+    for (int i = 0; i < count; i++) glDeleteProgram(passes[i].prog);
+}
+
+/* One pass of an effect stack: stages [first, first + count) fused into a
+ * fragment program. Returns 0 on failure. */
+static int build_stack_pass(Compositor *comp, const char *prelude, char **srcs,
+                            int first, int count, StackPass *pass) {
+    char *src = ss_build_stack_source(prelude, count, srcs + first,
+                                      (const char *const *)comp->stage_paths + first,
+                                      first == 0 ? SS_STACK_FIRST : 0);
+    if (!src) return 0;
+    GLuint frag = compile_shader(GL_FRAGMENT_SHADER, src, comp->stage_paths[first]);
+    ss_parse_directives(src, &pass->dir);
+    free(src);
+    if (!frag) return 0;
+    pass->prog = link_program(comp->vert_shader, frag);
+    glDeleteShader(frag);
+    if (!pass->prog) return 0;
+
+    pass->u_screen     = glGetUniformLocation(pass->prog, "u_screen");
+    pass->u_resolution = glGetUniformLocation(pass->prog, "u_resolution");
+    pass->u_time       = glGetUniformLocation(pass->prog, "u_time");
+    pass->first_stage  = first;
+    ss_resolve_aux_textures(&comp->aux_cache, pass->prog, &pass->dir,
+                            comp->stage_paths[first], &pass->aux);
+    pass->margin = ss_stage_is_local(srcs[first], &pass->dir) ? 0 :
+                   pass->dir.kernel_radius > 0 ? pass->dir.kernel_radius :
+                   SS_MAX_KERNEL_RADIUS;
+    /* The prelude points an unset u_prev at unit 0, the pass's input */
+    if (glGetUniformLocation(pass->prog, "u_prev") >= 0)
+        fprintf(stderr, "%s: u_prev is only kept for the last pass of a stack, "
+                "it reads the stage's input here\n", comp->stage_paths[first]);
+    return 1;
+}
+
+/*
+ * Source of the post-process program (the last pass), malloc'd, or NULL on
+ * failure. A single shader gets the prelude as usual. An effect stack is
+ * cut into passes: a stage joins the pass before it if it only reads its
+ * own pixel of the screen and the stage before does not read u_prev (a
+ * pass has one previous frame). The passes before the last are built into
+ * passes[0 .. *npasses); *last_stage is the first stage of the last pass.
+ */
+static char *load_postproc_source(Compositor *comp, StackPass *passes, int *npasses,
+                                  int *last_stage) {
+    *npasses = 0;
+    *last_stage = 0;
+    char *srcs[SS_MAX_STAGES] = { NULL };
+    for (int i = 0; i < comp->stage_count; i++) {
+        srcs[i] = load_file(comp->stage_paths[i]);
+        if (!srcs[i]) {
+            for (int j = 0; j < i; j++) free(srcs[j]);
+            return NULL;
+        }
+    }
+
+    char *prelude_path = ss_prelude_path(comp->shader_path);
+    char *prelude = prelude_path ? load_file(prelude_path) : NULL;
+    free(prelude_path);
+
+    char *src = NULL;
+    if (comp->stage_count == 1) {
+        src = ss_apply_prelude(srcs[0], prelude, comp->shader_path);
+    } else {
+        int first = 0;
+        bool ok = true;
+        for (int i = 1; i <= comp->stage_count && ok; i++) {
+            ShaderDirectives dir;
+            if (i < comp->stage_count) {
+                ss_parse_directives(srcs[i], &dir);
+                if (ss_stage_is_local(srcs[i], &dir) && !ss_uses_ident(srcs[i - 1], "u_prev"))
+                    continue;
+            }
+            if (i == comp->stage_count) {
+                src = ss_build_stack_source(prelude, i - first, srcs + first,
+                                            (const char *const *)comp->stage_paths + first,
+                                            (first == 0 ? SS_STACK_FIRST : 0) | SS_STACK_LAST);
+                *last_stage = first;
+            } else {
+                ok = init_stack_targets(comp) == 0 &&
+                     build_stack_pass(comp, prelude, srcs, first, i - first,
+                                      &passes[*npasses]);
+                if (ok) (*npasses)++;
+            }
+            first = i;
+        }
+        if (!src) {
+            free_stack_passes(passes, *npasses);
+            *npasses = 0;
+        } else {
+            fprintf(stderr, "Effect stack: %d stages in %d passes\n",
+                    comp->stage_count, *npasses + 1);
+        }
+    }
+    free(prelude);
+    for (int i = 0; i < comp->stage_count; i++) free(srcs[i]);
+    return src;
+}
+
+/* Build the post-process program from `src` (freed here): the single-pass
+ * composite variant when the shader declares itself pointwise, the compute
+ * tile variant when it declares a kernel radius and GL 4.3 is there,
+ * otherwise the fragment program. Fills *dir with the shader's directives,
+ * and *lut_prog with the bake program if it declares a colour LUT stage.
+ * Returns 0 on failure. */
+static GLuint build_postproc_program(Compositor *comp, char *src, bool *compute, bool *single,
+                                     ShaderDirectives *dir, GLuint *lut_prog) {
+    ss_parse_directives(src, dir);
+
+    *lut_prog = 0;
+    char *bake_src, *apply_src;
+    if (dir->lut_func[0] && ss_build_lut_sources(src, dir, &bake_src, &apply_src) == 0) {
+        *lut_prog = build_lut_program(comp, bake_src);
+        if (*lut_prog && ss_lut_resize(&comp->lut, dir->lut_size) < 0) {
+            glDeleteProgram(*lut_prog);
+            *lut_prog = 0;
+        }
+        if (*lut_prog) {
+            free(src);
+            src = apply_src;
+        } else {
+            fprintf(stderr, "Colour LUT unavailable, evaluating %s per pixel\n",
+                    dir->lut_func);
+            free(apply_src);
+        }
+        free(bake_src);
+    }
+
+    GLuint prog = 0;
+    *compute = false;
+    *single = false;
+    /* Excluded windows can skip the effect in a single pass, excluded
+     * rectangles cannot */
+    if (dir->pointwise && comp->exclude.rect_count > 0)
+        fprintf(stderr, "Single pass unavailable with excluded rectangles, using two passes\n");
+    /* Window shaders must see the composite before the global effect */
+    if (dir->pointwise && comp->win_rules.count > 0)
+        fprintf(stderr, "Single pass unavailable with window shaders, using two passes\n");
+    /* ... and so must the feed's composited image */
+    bool feed_composite = comp->feed.images & SS_FEED_COMPOSITED;
+    if (dir->pointwise && feed_composite)
+        fprintf(stderr, "Single pass unavailable with a composited feed, using two passes\n");
+    if (dir->pointwise && comp->exclude.rect_count == 0 && comp->win_rules.count == 0 &&
+        !feed_composite) {
+        char *sp_src = ss_build_single_pass_source(src);
+        GLuint frag = sp_src ? compile_shader(GL_FRAGMENT_SHADER, sp_src, comp->shader_path) : 0;
+        free(sp_src);
+        if (frag) {
+            prog = link_program(comp->vert_shader, frag);
+            glDeleteShader(frag);
+        }
+        /* Feedback needs the output in a texture of its own */
+        if (prog && glGetUniformLocation(prog, "u_prev") >= 0) {
+            glDeleteProgram(prog);
+            prog = 0;
+        }
+        if (prog) *single = true;
+        else fprintf(stderr, "Single pass unavailable, using two passes\n");
+    }
+
+    if (!prog && dir->kernel_radius > 0 && comp->compute_available &&
+        init_compute_target(comp) == 0) {
+        char *cs_src = ss_build_compute_source(src, dir->kernel_radius);
+        if (cs_src) {
+            GLuint cs = compile_shader(GL_COMPUTE_SHADER, cs_src, comp->shader_path);
+            free(cs_src);
+            if (cs) {
+                prog = link_program(0, cs);
+                glDeleteShader(cs);
+            }
+        }
+        if (prog) *compute = true;
+        else fprintf(stderr, "Compute tile path unavailable, using fragment shader\n");
+    }
+
+    if (!prog) {
+        GLuint frag = compile_shader(GL_FRAGMENT_SHADER, src, comp->shader_path);
+        if (frag) {
+            prog = link_program(comp->vert_shader, frag);
+            glDeleteShader(frag);
+        }
     }
+    free(src);
+    if (!prog && *lut_prog) {
+        glDeleteProgram(*lut_prog);
+        *lut_prog = 0;
+        comp->lut_dirty = comp->lut.prog != 0;   /* may have been resized */
+    }
+    return prog;
+}
+
+/* Replace the passes before the last one; call before use_postproc_program */
+static void use_stack(Compositor *comp, const StackPass *passes, int npasses, int last_stage) {
+    free_stack_passes(comp->stack, comp->stack_passes);
+    if (npasses > 0) memcpy(comp->stack, passes, sizeof(*passes) * (size_t)npasses);
+    comp->stack_passes = npasses;
+    comp->postproc_stage = last_stage;
+}
 
-    glDeleteProgram(comp->postproc_prog);
-    comp->postproc_prog = new_prog;
+static void use_postproc_program(Compositor *comp, GLuint prog, bool compute, bool single,
+                                 const ShaderDirectives *dir, GLuint lut_prog) {
+    if (comp->postproc_prog) glDeleteProgram(comp->postproc_prog);
+    comp->postproc_prog = prog;
+    comp->postproc_compute = compute;
+    comp->postproc_single = single;
+
+    comp->u_screen_tex = glGetUniformLocation(prog, "u_screen");
+    comp->u_resolution = glGetUniformLocation(prog, "u_resolution");
+    comp->u_time       = glGetUniformLocation(prog, "u_time");
+    comp->u_prev       = glGetUniformLocation(prog, "u_prev");
+    comp->u_lut        = glGetUniformLocation(prog, "ss_lut");
+    comp->u_window_tex = glGetUniformLocation(prog, "u_texture");
+    comp->u_window_rect = glGetUniformLocation(prog, "ss_window_rect");
+    /* Feedback effects keep evolving on a static screen (trails decay) */
+    comp->animated     = comp->u_time >= 0 || comp->u_prev >= 0;
+    for (int i = 0; i < comp->stack_passes; i++)
+        comp->animated |= comp->stack[i].u_time >= 0;
+    comp->animated |= comp->win_animated;
+
+    if (comp->u_prev >= 0 &&
+        ss_feedback_resize(&comp->feedback, comp->root_width, comp->root_height) < 0) {
+        fprintf(stderr, "Frame feedback unavailable, u_prev is the screen\n");
+        comp->u_prev = -1;
+    }
 
-    comp->u_screen_tex = glGetUniformLocation(new_prog, "u_screen");
-    comp->u_resolution = glGetUniformLocation(new_prog, "u_resolution");
-    comp->u_time       = glGetUniformLocation(new_prog, "u_time");
+    /* Interleaving needs the previous output to stay in place, which the
+     * feedback pair does not do */
+    comp->u_interleave  = glGetUniformLocation(prog, "ss_interleave");
+    comp->u_phase       = glGetUniformLocation(prog, "ss_phase");
+    comp->u_tile_offset = glGetUniformLocation(prog, "ss_tile_offset");
+    comp->damage_margin = dir->kernel_radius > 0 ? dir->kernel_radius : SS_MAX_KERNEL_RADIUS;
+    for (int i = 0; i < comp->stack_passes; i++)
+        comp->damage_margin += comp->stack[i].margin;
+    int n = comp->interleave_opt >= 0 ? comp->interleave_opt : dir->interleave;
+    if (n == 0 && comp->interleave_opt < 0 && !comp->animated)
+        n = comp->profile->interleave;   /* animated ones get the frame cap instead */
+    if (n > SS_MAX_INTERLEAVE) n = SS_MAX_INTERLEAVE;
+    if (n > 1 && comp->u_prev >= 0) {
+        fprintf(stderr, "Interleaved shading off: the shader reads u_prev\n");
+        n = 1;
+    }
+    if (n > 1 && single) {
+        fprintf(stderr, "Interleaved shading off: the shader runs in a single pass\n");
+        n = 1;
+    }
+    if (n > 1 && init_compute_target(comp) < 0) n = 1;
+    comp->interleave = n > 1 ? n : 1;
+    atomic_store_explicit(&comp->events.damage_rects, comp->interleave > 1,
+                          memory_order_relaxed);
+    comp->phase = 0;
+    comp->settle_frames = 0;
+    comp->output_valid = false;
+    comp->damage_count = 0;
+    comp->damage_full = false;
+    if (comp->interleave > 1)
+        fprintf(stderr, "Interleaved shading: 1/%d of the screen per frame\n",
+                comp->interleave);
 
     /* Re-resolve param uniform locations for new program */
     for (int i = 0; i < comp->param_count; i++) {
-        comp->params[i].location = glGetUniformLocation(new_prog, comp->params[i].name);
+        comp->params[i].location = glGetUniformLocation(prog, comp->params[i].name);
+        for (int p = 0; p < comp->stack_passes; p++)
+            comp->params[i].stack_location[p] =
+                glGetUniformLocation(comp->stack[p].prog, comp->params[i].name);
+    }
+
+    ss_resolve_aux_textures(&comp->aux_cache, prog, dir,
+                            comp->stage_paths[comp->postproc_stage], &comp->postproc_aux);
+
+    if (comp->lut.prog) glDeleteProgram(comp->lut.prog);
+    comp->lut.prog = lut_prog;
+    comp->lut_dirty = lut_prog != 0;
+    if (lut_prog)
+        fprintf(stderr, "Colour LUT: %s baked at %d^3\n", dir->lut_func, comp->lut.size);
+
+    fprintf(stderr, "Post-process: %s path\n",
+            compute ? "compute tile" : single ? "single pass" : "fragment");
+}
+
+/* Build the program of each per-window shader rule. A rule whose shader
+ * fails keeps its previous program, or draws its windows plainly. */
+static void build_window_programs(Compositor *comp) {
+    comp->win_animated = false;
+    for (int i = 0; i < comp->win_rules.count; i++) {
+        const char *path = comp->win_rules.rules[i].shader;
+        WinProgram *wp = &comp->win_progs[i];
+        char *src = load_file(path);
+        char *prelude_path = src ? ss_prelude_path(path) : NULL;
+        char *prelude = prelude_path ? load_file(prelude_path) : NULL;
+        free(prelude_path);
+        char *full = src ? ss_apply_prelude(src, prelude, path) : NULL;
+        free(prelude);
+        free(src);
+
+        char *win_src = full ? ss_build_window_source(full) : NULL;
+        GLuint frag = win_src ? compile_shader(GL_FRAGMENT_SHADER, win_src, path) : 0;
+        GLuint prog = frag ? link_program(comp->vert_shader, frag) : 0;
+        if (frag) glDeleteShader(frag);
+        free(win_src);
+        if (!prog) {
+            fprintf(stderr, "Window shader %s unavailable%s\n", path,
+                    wp->prog ? ", keeping the previous one" : "");
+            free(full);
+            comp->win_animated |= wp->animated;
+            continue;
+        }
+
+        if (wp->prog) glDeleteProgram(wp->prog);
+        wp->prog = prog;
+        wp->u_resolution = glGetUniformLocation(prog, "u_resolution");
+        wp->u_time       = glGetUniformLocation(prog, "u_time");
+        wp->u_screen     = glGetUniformLocation(prog, "u_screen");
+        wp->u_window_tex = glGetUniformLocation(prog, "ss_window_tex");
+        wp->u_rect       = glGetUniformLocation(prog, "ss_window_rect");
+        wp->animated     = wp->u_time >= 0;
+        ShaderDirectives dir;
+        ss_parse_directives(full, &dir);
+        ss_resolve_aux_textures(&comp->aux_cache, prog, &dir, path, &wp->aux);
+        free(full);
+        comp->win_animated |= wp->animated;
+        for (int j = 0; j < comp->param_count; j++)
+            comp->params[j].win_location[i] = glGetUniformLocation(prog, comp->params[j].name);
+        fprintf(stderr, "Window shader: %s for %s \"%s\"\n", path,
+                comp->win_rules.rules[i].by_title ? "title" : "class",
+                comp->win_rules.rules[i].match);
+    }
+}
+
+static void reload_postproc_shader(Compositor *comp) {
+    if (comp->software) {
+        fprintf(stderr, "Software backend: kernels are built in, nothing to reload\n");
+        return;
+    }
+    build_window_programs(comp);
+    if (!comp->global_effect) {
+        comp->animated = comp->win_animated;
+        fprintf(stderr, "Window shaders reloaded\n");
+        return;
+    }
+    fprintf(stderr, "Reloading shader: %s\n", comp->shader_path);
+
+    bool compute, single;
+    ShaderDirectives dir;
+    GLuint lut_prog;
+    StackPass passes[SS_MAX_STAGES - 1];
+    int npasses, last_stage;
+    char *src = load_postproc_source(comp, passes, &npasses, &last_stage);
+    GLuint prog = src ? build_postproc_program(comp, src, &compute, &single, &dir, &lut_prog) : 0;
+    if (!prog) {
+        free_stack_passes(passes, npasses);
+        fprintf(stderr, "Hot-reload failed, keeping current shader\n");
+        return;
     }
+    use_stack(comp, passes, npasses, last_stage);
+    use_postproc_program(comp, prog, compute, single, &dir, lut_prog);
 
     fprintf(stderr, "Shader hot-reloaded successfully\n");
 }
@@ -679,9 +4123,11 @@ static void reload_postproc_shader(Compositor *comp) {
 static void read_params(Compositor *comp) {
     struct stat st;
     if (stat(PARAM_FILE, &st) != 0) return;
-    if (st.st_mtime == comp->param_mtime) return; /* unchanged */
-    comp->param_mtime = st.st_mtime;
+    if (st.st_mtim.tv_sec == comp->param_mtime.tv_sec &&
+        st.st_mtim.tv_nsec == comp->param_mtime.tv_nsec) return; /* unchanged */
+    comp->param_mtime = st.st_mtim;
 
+    uint64_t t = trace_begin();
     FILE *f = fopen(PARAM_FILE, "r");
     if (!f) return;
 
@@ -695,21 +4141,304 @@ static void read_params(Compositor *comp) {
             strncpy(comp->params[idx].name, name, sizeof(comp->params[idx].name) - 1);
             comp->params[idx].name[sizeof(comp->params[idx].name) - 1] = '\0';
             comp->params[idx].value = value;
-            comp->params[idx].location = glGetUniformLocation(comp->postproc_prog, name);
+            comp->params[idx].location = comp->software || !comp->postproc_prog ? -1 :
+                glGetUniformLocation(comp->postproc_prog, name);
+            for (int p = 0; p < comp->stack_passes; p++)
+                comp->params[idx].stack_location[p] =
+                    glGetUniformLocation(comp->stack[p].prog, name);
+            for (int w = 0; w < comp->win_rules.count; w++)
+                comp->params[idx].win_location[w] = comp->win_progs[w].prog ?
+                    glGetUniformLocation(comp->win_progs[w].prog, name) : -1;
+        }
+    }
+    fclose(f);
+
+    trace_end(TRACE_RENDER, "read params", t, "params", (uint64_t)comp->param_count);
+    fprintf(stderr, "Loaded %d params from %s\n", comp->param_count, PARAM_FILE);
+    if (comp->software && comp->param_count > 0)
+        fprintf(stderr, "Software backend: params are ignored by the built-in kernels\n");
+    comp->needs_redraw = true;
+    comp->output_valid = false;   /* every pixel sees the new values */
+    comp->lut_dirty = comp->lut.prog != 0;
+}
+
+static void apply_params(Compositor *comp) {
+    for (int i = 0; i < comp->param_count; i++) {
+        if (comp->params[i].location >= 0) {
+            glUniform1f(comp->params[i].location, comp->params[i].value);
+        }
+    }
+}
+
+/* Re-render the colour LUT with the current params. Only on a new shader
+ * or params file, so the locations are looked up each time. */
+static void bake_lut(Compositor *comp) {
+    GLuint prog = comp->lut.prog;
+    glUseProgram(prog);
+    glUniform2f(glGetUniformLocation(prog, "u_resolution"),
+                (float)comp->root_width, (float)comp->root_height);
+    for (int i = 0; i < comp->param_count; i++) {
+        GLint loc = glGetUniformLocation(prog, comp->params[i].name);
+        if (loc >= 0) glUniform1f(loc, comp->params[i].value);
+    }
+    ss_lut_bake(&comp->lut);
+    comp->lut_dirty = false;
+}
+
+/* ========================================================================== */
+/* Event loop sources                                                         */
+/* ========================================================================== */
+
+static int add_epoll_source(Compositor *comp, int fd, uint32_t tag) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = tag };
+    if (epoll_ctl(comp->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        fprintf(stderr, "epoll_ctl(fd %d): %s\n", fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Arm the frame timer while the shader animates; disarm it otherwise so
+ * a static shader only redraws when X tells us something changed. */
+static void set_frame_timer(Compositor *comp, bool on) {
+    if (on == comp->timer_armed) return;
+    /* Readers take a feed that stops changing while this is idle as
+     * current, and one that does while it is busy as stale */
+    if (!on && comp->feed.shm)
+        atomic_store_explicit(&comp->feed.shm->busy_ns, 0, memory_order_release);
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (on) {
+        its.it_interval.tv_sec  = comp->frame_interval_ns / 1000000000L;
+        its.it_interval.tv_nsec = comp->frame_interval_ns % 1000000000L;
+        its.it_value = its.it_interval;
+    }
+    timerfd_settime(comp->timer_fd, 0, &its, NULL);
+    comp->timer_armed = on;
+}
+
+static int init_event_loop(Compositor *comp) {
+    comp->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (comp->epoll_fd < 0) {
+        fprintf(stderr, "epoll_create1: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* Signals are blocked in main(); pick them up synchronously here */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    comp->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (comp->signal_fd < 0) {
+        fprintf(stderr, "signalfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    comp->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (comp->timer_fd < 0) {
+        fprintf(stderr, "timerfd_create: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (add_epoll_source(comp, ConnectionNumber(comp->dpy), SRC_X) < 0 ||
+        add_epoll_source(comp, comp->events.wake_fd, SRC_DELTAS) < 0 ||
+        add_epoll_source(comp, comp->signal_fd, SRC_SIGNAL) < 0 ||
+        add_epoll_source(comp, comp->timer_fd, SRC_TIMER) < 0) {
+        return -1;
+    }
+
+    /* Watch the directory rather than the file: the launcher rewrites the
+     * params file with sed -i, which replaces the inode. */
+    comp->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (comp->inotify_fd < 0 ||
+        inotify_add_watch(comp->inotify_fd, PARAM_DIR,
+                          IN_CLOSE_WRITE | IN_MOVED_TO) < 0 ||
+        add_epoll_source(comp, comp->inotify_fd, SRC_INOTIFY) < 0) {
+        fprintf(stderr, "inotify on %s unavailable (%s), params will not "
+                "update at runtime\n", PARAM_DIR, strerror(errno));
+        if (comp->inotify_fd >= 0) close(comp->inotify_fd);
+        comp->inotify_fd = -1;
+    }
+
+    set_frame_timer(comp, comp->animated);
+    return 0;
+}
+
+/* Totals over both connections */
+static void x_traffic_totals(Compositor *comp, uint64_t *requests, uint64_t *round_trips,
+                             uint64_t *events, uint64_t *errors) {
+    x_traffic_update(&comp->xtraffic, comp->dpy);
+    *requests = atomic_load(&comp->xtraffic.requests) + atomic_load(&comp->events.traffic.requests);
+    *round_trips = atomic_load(&comp->xtraffic.round_trips) +
+                   atomic_load(&comp->events.traffic.round_trips);
+    *events = 0;
+    for (int i = 0; i < 128; i++) *events += atomic_load(&g_x_events_by_type[i]);
+    *errors = 0;
+    for (int i = 0; i < 256; i++) *errors += atomic_load(&g_x_errors_by_opcode[i]);
+}
+
+/* X traffic since the end of the previous frame */
+static void account_x_traffic(Compositor *comp) {
+    uint64_t requests, round_trips, events, errors;
+    x_traffic_totals(comp, &requests, &round_trips, &events, &errors);
+    comp->x_frame.requests = requests - comp->x_frame_end.requests;
+    comp->x_frame.round_trips = round_trips - comp->x_frame_end.round_trips;
+    comp->x_frame.events = events - comp->x_frame_end.events;
+    comp->x_frame_end.requests = requests;
+    comp->x_frame_end.round_trips = round_trips;
+    comp->x_frame_end.events = events;
+    if (comp->x_frame.requests > comp->x_frame_max.requests)
+        comp->x_frame_max.requests = comp->x_frame.requests;
+    if (comp->x_frame.round_trips > comp->x_frame_max.round_trips)
+        comp->x_frame_max.round_trips = comp->x_frame.round_trips;
+    if (comp->x_frame.events > comp->x_frame_max.events)
+        comp->x_frame_max.events = comp->x_frame.events;
+}
+
+/* Written to a temporary file and renamed into place, so readers never
+ * see a partial dump. The busiest-frame counters restart at each dump. */
+static void write_stats(Compositor *comp) {
+    FILE *f = fopen(STATS_TMP, "w");
+    if (!f) {
+        fprintf(stderr, "Cannot write %s: %s\n", STATS_TMP, strerror(errno));
+        return;
+    }
+    fprintf(f, "frames %" PRIu64 "\n", comp->stats.frames);
+    fprintf(f, "x_events %" PRIu64 "\n",
+            (uint64_t)atomic_load(&comp->events.x_events));
+    fprintf(f, "deltas %" PRIu64 "\n", comp->stats.deltas);
+    fprintf(f, "delta_queue_full %" PRIu64 "\n",
+            (uint64_t)atomic_load(&comp->events.queue_full));
+    fprintf(f, "wakeups_x %" PRIu64 "\n", comp->stats.wakeups_x);
+    fprintf(f, "wakeups_deltas %" PRIu64 "\n", comp->stats.wakeups_deltas);
+    fprintf(f, "wakeups_signal %" PRIu64 "\n", comp->stats.wakeups_signal);
+    fprintf(f, "wakeups_timer %" PRIu64 "\n", comp->stats.wakeups_timer);
+    fprintf(f, "wakeups_inotify %" PRIu64 "\n", comp->stats.wakeups_inotify);
+    fprintf(f, "timer_overruns %" PRIu64 "\n", comp->stats.timer_overruns);
+    fprintf(f, "fence_syncs %" PRIu64 "\n", comp->stats.fence_syncs);
+    fprintf(f, "fence_busy %" PRIu64 "\n", comp->stats.fence_busy);
+    fprintf(f, "sw_captures %" PRIu64 "\n", comp->stats.sw_captures);
+    fprintf(f, "sw_composites %" PRIu64 "\n", comp->stats.sw_composites);
+    fprintf(f, "masked_frames %" PRIu64 "\n", comp->stats.masked_frames);
+    fprintf(f, "window_shades %" PRIu64 "\n", comp->stats.window_shades);
+    fprintf(f, "window_preps %" PRIu64 "\n", comp->stats.window_preps);
+    fprintf(f, "frames_in_flight_limit %d\n", comp->max_frames);
+    fprintf(f, "frames_in_flight_max %d\n", comp->stats.queue_depth_max);
+    fprintf(f, "frames_in_flight_avg %.2f\n", comp->stats.frames ?
+            (double)comp->stats.queue_depth_sum / (double)comp->stats.frames : 0.0);
+    fprintf(f, "frames_in_flight_waits %" PRIu64 "\n", comp->stats.queue_waits);
+    fprintf(f, "frames_in_flight_wait_ms %.2f\n", (double)comp->stats.queue_wait_ns / 1e6);
+    if (comp->feed.shm) {
+        fprintf(f, "feed_published %" PRIu64 "\n", comp->feed.published);
+        fprintf(f, "feed_dropped %" PRIu64 "\n", comp->feed.dropped);
+    }
+    fprintf(f, "software %d\n", comp->software ? 1 : 0);
+    fprintf(f, "postproc_compute %d\n", comp->postproc_compute ? 1 : 0);
+    fprintf(f, "postproc_single %d\n", comp->postproc_single ? 1 : 0);
+    fprintf(f, "postproc_passes %d\n", comp->software ? 1 :
+            comp->global_effect ? comp->stack_passes + 1 : 0);
+    fprintf(f, "animated %d\n", comp->animated ? 1 : 0);
+    fprintf(f, "interleave %d\n", comp->interleave);
+    if (comp->profile) {
+        fprintf(f, "profile %s\n", comp->profile->name);
+        fprintf(f, "profile_fill_gpix_s %.2f\n", comp->tune_fill);
+        fprintf(f, "profile_fetch_gtex_s %.2f\n", comp->tune_fetch);
+        fprintf(f, "frame_hz %ld\n", 1000000000L / comp->frame_interval_ns);
+        fprintf(f, "fbo_float %d\n", comp->fbo_format == GL_RGBA16F ? 1 : 0);
+    }
+    if (comp->latency.on) write_latency_stats(comp, f);
+
+    uint64_t requests, round_trips, events, errors;
+    x_traffic_totals(comp, &requests, &round_trips, &events, &errors);
+    fprintf(f, "x_requests %" PRIu64 "\n", requests);
+    fprintf(f, "x_requests_render %" PRIu64 "\n", (uint64_t)atomic_load(&comp->xtraffic.requests));
+    fprintf(f, "x_requests_events %" PRIu64 "\n",
+            (uint64_t)atomic_load(&comp->events.traffic.requests));
+    fprintf(f, "x_round_trips %" PRIu64 "\n", round_trips);
+    fprintf(f, "x_round_trips_render %" PRIu64 "\n",
+            (uint64_t)atomic_load(&comp->xtraffic.round_trips));
+    fprintf(f, "x_round_trips_events %" PRIu64 "\n",
+            (uint64_t)atomic_load(&comp->events.traffic.round_trips));
+    fprintf(f, "x_events_received %" PRIu64 "\n", events);
+    fprintf(f, "x_errors %" PRIu64 "\n", errors);
+    fprintf(f, "x_frame_requests %" PRIu64 "\n", comp->x_frame.requests);
+    fprintf(f, "x_frame_requests_max %" PRIu64 "\n", comp->x_frame_max.requests);
+    fprintf(f, "x_frame_round_trips %" PRIu64 "\n", comp->x_frame.round_trips);
+    fprintf(f, "x_frame_round_trips_max %" PRIu64 "\n", comp->x_frame_max.round_trips);
+    fprintf(f, "x_frame_events %" PRIu64 "\n", comp->x_frame.events);
+    fprintf(f, "x_frame_events_max %" PRIu64 "\n", comp->x_frame_max.events);
+    for (int i = 0; i < 128; i++) {
+        uint64_t n = atomic_load(&g_x_events_by_type[i]);
+        if (n == 0) continue;
+        const char *name = x_event_type_name(i, comp->damage_event);
+        if (name) fprintf(f, "x_events_%s %" PRIu64 "\n", name, n);
+        else fprintf(f, "x_events_type%d %" PRIu64 "\n", i, n);
+    }
+    for (int i = 0; i < 256; i++) {
+        uint64_t n = atomic_load(&g_x_errors_by_opcode[i]);
+        if (n > 0) fprintf(f, "x_errors_opcode%d %" PRIu64 "\n", i, n);
+    }
+    memset(&comp->x_frame_max, 0, sizeof(comp->x_frame_max));
+    if (fclose(f) != 0 || rename(STATS_TMP, STATS_FILE) != 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", STATS_FILE, strerror(errno));
+        unlink(STATS_TMP);
+    }
+}
+
+static void handle_signalfd(Compositor *comp) {
+    struct signalfd_siginfo si;
+    while (read(comp->signal_fd, &si, sizeof(si)) == sizeof(si)) {
+        switch (si.ssi_signo) {
+        case SIGUSR1: {
+            uint64_t t = trace_begin();
+            reload_postproc_shader(comp);
+            trace_end(TRACE_RENDER, "shader reload", t, NULL, 0);
+            set_frame_timer(comp, comp->animated);
+            comp->needs_redraw = true;
+            break;
+        }
+        case SIGUSR2:
+            write_stats(comp);
+            write_trace(&comp->start_time);
+            break;
+        default:
+            comp->running = false;
+            break;
         }
     }
-    fclose(f);
+}
 
-    fprintf(stderr, "Loaded %d params from %s\n", comp->param_count, PARAM_FILE);
-    comp->needs_redraw = true;
+static void handle_timerfd(Compositor *comp) {
+    uint64_t expirations;
+    if (read(comp->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+    if (expirations > 1) comp->stats.timer_overruns += expirations - 1;
+    if (comp->animated || comp->settle_frames > 0 || !comp->feed.shm) {
+        comp->needs_redraw = true;
+        return;
+    }
+    /* Only the feed is behind: publish what has landed, and redraw only
+     * once the frame it missed can be captured */
+    feed_publish(comp);
+    if (comp->feed.stale && mono_ns() >= comp->feed.next_ns) comp->needs_redraw = true;
+    set_frame_timer(comp, feed_pending(comp));
 }
 
-static void apply_params(Compositor *comp) {
-    for (int i = 0; i < comp->param_count; i++) {
-        if (comp->params[i].location >= 0) {
-            glUniform1f(comp->params[i].location, comp->params[i].value);
+static void handle_inotify(Compositor *comp) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool params_changed = false;
+    ssize_t len;
+    while ((len = read(comp->inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *ie = (const struct inotify_event *)p;
+            if (ie->len && strcmp(ie->name, PARAM_NAME) == 0) params_changed = true;
+            p += sizeof(struct inotify_event) + ie->len;
         }
     }
+    if (params_changed) read_params(comp);
 }
 
 /* ========================================================================== */
@@ -792,92 +4521,270 @@ static void find_tfp_fbconfigs(Compositor *comp) {
 }
 
 /* ========================================================================== */
-/* Initialization                                                             */
+/* Tuning profiles                                                            */
 /* ========================================================================== */
 
-static int init_compositor(Compositor *comp, const char *shader_path_input) {
-    memset(comp, 0, sizeof(*comp));
-    comp->running = true;
-    clock_gettime(CLOCK_MONOTONIC, &comp->start_time);
+/*
+ * The renderer's class sets defaults that trade quality for speed. At
+ * startup a short benchmark measures fill rate and texture fetch rate
+ * into an offscreen target; with the renderer string, the maximum texture
+ * size and the GL version it picks a profile. The choice is cached per
+ * GL_RENDERER in TUNE_CACHE, so later starts skip the benchmark.
+ * --profile NAME forces a profile, --profile probe ignores the cache.
+ * --interleave and shader directives still win over the profile.
+ */
 
-    /* Resolve paths */
-    comp->shader_dir = get_exe_dir();
-    comp->shader_path = resolve_shader_path(comp->shader_dir, shader_path_input);
-    fprintf(stderr, "Using shader: %s\n", comp->shader_path);
+#define TUNE_CACHE     "screenshader/tuning"   /* under $XDG_CACHE_HOME */
+#define TUNE_SIZE      1024        /* benchmark target, square */
+#define TUNE_FETCHES   8           /* texture reads per pixel */
+#define TUNE_MIN_NS    20000000    /* time a batch of draws for at least this */
+#define TUNE_MAX_DRAWS 1024
+
+static const TuneProfile tune_profiles[] = {
+    /* CPU rasterizers (llvmpipe, softpipe): shade a quarter of the screen
+     * per frame, animate at 30 Hz, and skip trilinear filtering, which
+     * doubles their texel fetches */
+    { "software", 4,  30, GL_RGBA8,   false },
+    { "igpu",     2,  60, GL_RGBA8,   true  },
+    /* Enough bandwidth for half floats between passes */
+    { "dgpu",     1, 120, GL_RGBA16F, true  },
+};
+#define TUNE_PROFILES (int)(sizeof(tune_profiles) / sizeof(tune_profiles[0]))
+
+static const TuneProfile *find_profile(const char *name) {
+    for (int i = 0; i < TUNE_PROFILES; i++)
+        if (strcmp(tune_profiles[i].name, name) == 0) return &tune_profiles[i];
+    return NULL;
+}
 
-    /* Open display */
-    comp->dpy = XOpenDisplay(NULL);
-    if (!comp->dpy) {
-        fprintf(stderr, "Cannot open X display\n");
-        return -1;
+static const char *TUNE_VERT =
+    "#version 330 core\n"
+    "out vec2 v_texcoord;\n"
+    "void main() {\n"
+    "    vec2 p = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+    "    v_texcoord = p;\n"
+    "    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);\n"
+    "}\n";
+
+static const char *TUNE_FILL_FRAG =
+    "#version 330 core\n"
+    "in vec2 v_texcoord;\n"
+    "out vec4 frag_color;\n"
+    "void main() { frag_color = vec4(v_texcoord, 0.5, 1.0); }\n";
+
+/* Scattered enough that the reads are not all in one cache line */
+static const char *TUNE_FETCH_FRAG =
+    "#version 330 core\n"
+    "in vec2 v_texcoord;\n"
+    "out vec4 frag_color;\n"
+    "uniform sampler2D u_texture;\n"
+    "void main() {\n"
+    "    vec4 c = vec4(0.0);\n"
+    "    for (int i = 0; i < 8; i++)\n"
+    "        c += texture(u_texture, v_texcoord * 1.7 + vec2(i) * 0.013);\n"
+    "    frag_color = c * 0.125;\n"
+    "}\n";
+
+/* Work units (pixels * per_pixel) per nanosecond, i.e. G/s. Draw batches
+ * grow until one takes long enough to time with glFinish. */
+static double tune_rate(GLuint prog, int per_pixel) {
+    glUseProgram(prog);
+    for (int draws = 1; ; draws *= 4) {
+        glFinish();
+        uint64_t t = mono_ns();
+        for (int i = 0; i < draws; i++) glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glFinish();
+        uint64_t ns = mono_ns() - t;
+        if (ns >= TUNE_MIN_NS || draws >= TUNE_MAX_DRAWS)
+            return (double)draws * TUNE_SIZE * TUNE_SIZE * per_pixel / (double)(ns ? ns : 1);
     }
+}
 
-    XSetErrorHandler(x_error_handler);
-
-    comp->screen = DefaultScreen(comp->dpy);
-    comp->root = RootWindow(comp->dpy, comp->screen);
-    comp->root_width = DisplayWidth(comp->dpy, comp->screen);
-    comp->root_height = DisplayHeight(comp->dpy, comp->screen);
+/* Fill and fetch rate; false if the benchmark could not run */
+static bool tune_benchmark(double *fill, double *fetch) {
+    GLuint vert = compile_shader(GL_VERTEX_SHADER, TUNE_VERT, "tune.vert");
+    GLuint fill_frag = compile_shader(GL_FRAGMENT_SHADER, TUNE_FILL_FRAG, "tune-fill.frag");
+    GLuint fetch_frag = compile_shader(GL_FRAGMENT_SHADER, TUNE_FETCH_FRAG, "tune-fetch.frag");
+    GLuint fill_prog = vert && fill_frag ? link_program(vert, fill_frag) : 0;
+    GLuint fetch_prog = vert && fetch_frag ? link_program(vert, fetch_frag) : 0;
+    if (vert) glDeleteShader(vert);
+    if (fill_frag) glDeleteShader(fill_frag);
+    if (fetch_frag) glDeleteShader(fetch_frag);
+
+    /* Noise, so no driver can take a shortcut on uniform texels */
+    uint32_t *noise = malloc(sizeof(uint32_t) * (TUNE_SIZE / 2) * (TUNE_SIZE / 2));
+    uint32_t rng = 0x9e3779b9u;
+    for (int i = 0; noise && i < (TUNE_SIZE / 2) * (TUNE_SIZE / 2); i++)
+        noise[i] = ss_xorshift(&rng);
+
+    GLuint tex[2], fbo, vao;
+    glGenTextures(2, tex);
+    glBindTexture(GL_TEXTURE_2D, tex[0]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, TUNE_SIZE, TUNE_SIZE, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, tex[1]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, TUNE_SIZE / 2, TUNE_SIZE / 2, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, noise);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    free(noise);
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex[0], 0);
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    bool ok = fill_prog && fetch_prog &&
+              glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    if (ok) {
+        glViewport(0, 0, TUNE_SIZE, TUNE_SIZE);
+        glDisable(GL_BLEND);
+        glUniform1i(glGetUniformLocation(fetch_prog, "u_texture"), 0);
+        *fill = tune_rate(fill_prog, 1);
+        *fetch = tune_rate(fetch_prog, TUNE_FETCHES);
+    }
 
-    fprintf(stderr, "Screen: %dx%d\n", comp->root_width, comp->root_height);
+    glBindVertexArray(0);
+    glDeleteVertexArrays(1, &vao);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDeleteTextures(2, tex);
+    glUseProgram(0);
+    if (fill_prog) glDeleteProgram(fill_prog);
+    if (fetch_prog) glDeleteProgram(fetch_prog);
+    return ok;
+}
 
-    /* --- Check extensions --- */
-    int ev_base, err_base;
+/*
+ * Profile for what the probe saw. CPU rasterizers say so in their
+ * renderer string; otherwise texture fetch rate separates integrated
+ * from discrete parts, and a GPU without GL 4.3 or 16k textures is old
+ * enough to count as integrated whatever it measures.
+ */
+static const TuneProfile *tune_classify(const char *renderer, double fetch) {
+    static const char *software[] = { "llvmpipe", "softpipe", "Software Rasterizer", "SWR" };
+    for (size_t i = 0; i < sizeof(software) / sizeof(software[0]); i++)
+        if (strstr(renderer, software[i])) return find_profile("software");
+    if (fetch > 0.0 && fetch < 4.0) return find_profile("software");
+
+    GLint max_tex = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_tex);
+    if (fetch < 60.0 || max_tex < 16384 || !ss_gl_has_compute())
+        return find_profile("igpu");
+    return find_profile("dgpu");
+}
 
-    if (!XCompositeQueryExtension(comp->dpy, &ev_base, &err_base)) {
-        fprintf(stderr, "XComposite extension not available\n");
-        return -1;
-    }
-    int major = 0, minor = 0;
-    XCompositeQueryVersion(comp->dpy, &major, &minor);
-    if (major == 0 && minor < 2) {
-        fprintf(stderr, "XComposite >= 0.2 required (have %d.%d)\n", major, minor);
-        return -1;
+/* Cache file path; false without a home */
+static bool tune_cache_path(char *path, size_t size, bool create) {
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char dir[PATH_MAX];
+    int len;
+    if (xdg && xdg[0]) len = snprintf(dir, sizeof(dir), "%s", xdg);
+    else if (home && home[0]) len = snprintf(dir, sizeof(dir), "%s/.cache", home);
+    else return false;
+    if (len < 0 || (size_t)len >= sizeof(dir)) return false;
+    len = snprintf(path, size, "%s/%s", dir, TUNE_CACHE);
+    if (len < 0 || (size_t)len >= size) return false;
+    if (create) {
+        mkdir(dir, 0755);
+        char *slash = strrchr(path, '/');
+        *slash = '\0';           /* dir/screenshader */
+        mkdir(path, 0755);
+        *slash = '/';
     }
+    return true;
+}
 
-    if (!XDamageQueryExtension(comp->dpy, &comp->damage_event, &comp->damage_error)) {
-        fprintf(stderr, "XDamage extension not available\n");
-        return -1;
+/* Lines are `profile fill fetch renderer`, the renderer last since it
+ * has spaces. NULL if this renderer has no entry. */
+static const TuneProfile *tune_cache_lookup(const char *renderer, double *fill, double *fetch) {
+    char path[PATH_MAX], line[512], name[32];
+    if (!tune_cache_path(path, sizeof(path), false)) return NULL;
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+    const TuneProfile *found = NULL;
+    while (!found && fgets(line, sizeof(line), f)) {
+        int end = 0;
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%31s %lf %lf %n", name, fill, fetch, &end) == 3 && end > 0 &&
+            strcmp(line + end, renderer) == 0)
+            found = find_profile(name);
     }
+    fclose(f);
+    return found;
+}
 
-    int xfixes_ev, xfixes_err;
-    if (!XFixesQueryExtension(comp->dpy, &xfixes_ev, &xfixes_err)) {
-        fprintf(stderr, "XFixes extension not available\n");
-        return -1;
+/* Replace this renderer's entry, keeping the others */
+static void tune_cache_store(const char *renderer, const TuneProfile *p,
+                             double fill, double fetch) {
+    char path[PATH_MAX], tmp[PATH_MAX + 8], line[512];
+    if (!tune_cache_path(path, sizeof(path), true)) return;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *out = fopen(tmp, "w");
+    if (!out) {
+        fprintf(stderr, "Cannot write %s: %s\n", tmp, strerror(errno));
+        return;
     }
-
-    /* --- Redirect subwindows --- */
-    /*
-     * Use CompositeRedirectAutomatic so the X server continues to draw
-     * windows normally (preserving correct input routing / stacking).
-     * We still get off-screen pixmaps via XCompositeNameWindowPixmap.
-     * Our overlay window covers the root, showing the shaded output.
-     */
-    XCompositeRedirectSubwindows(comp->dpy, comp->root, CompositeRedirectAutomatic);
-    XSync(comp->dpy, False);
-
-    /* --- Get overlay window --- */
-    comp->overlay = XCompositeGetOverlayWindow(comp->dpy, comp->root);
-    if (!comp->overlay) {
-        fprintf(stderr, "Failed to get composite overlay window\n");
-        return -1;
+    FILE *in = fopen(path, "r");
+    while (in && fgets(line, sizeof(line), in)) {
+        char name[32];
+        double a, b;
+        int end = 0;
+        char copy[512];
+        snprintf(copy, sizeof(copy), "%s", line);
+        copy[strcspn(copy, "\n")] = '\0';
+        if (sscanf(copy, "%31s %lf %lf %n", name, &a, &b, &end) == 3 && end > 0 &&
+            strcmp(copy + end, renderer) == 0)
+            continue;
+        fputs(line, out);
     }
+    if (in) fclose(in);
+    fprintf(out, "%s %.2f %.2f %s\n", p->name, fill, fetch, renderer);
+    fclose(out);
+    if (rename(tmp, path) < 0) fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+}
 
-    /* Make overlay completely transparent to input */
-    XserverRegion region = XFixesCreateRegion(comp->dpy, NULL, 0);
-    XFixesSetWindowShapeRegion(comp->dpy, comp->overlay, ShapeInput, 0, 0, region);
-    XFixesDestroyRegion(comp->dpy, region);
+/* Pick the profile; needs the context current */
+static void select_profile(Compositor *comp) {
+    const char *renderer = (const char *)glGetString(GL_RENDERER);
+    if (!renderer) renderer = "unknown";
+    const char *opt = comp->profile_opt;
+    const TuneProfile *p = NULL;
+
+    if (opt && strcmp(opt, "probe") != 0) {
+        p = find_profile(opt);   /* checked by main */
+        fprintf(stderr, "Tuning profile: %s (forced)\n", p->name);
+    } else if (!opt && (p = tune_cache_lookup(renderer, &comp->tune_fill, &comp->tune_fetch))) {
+        fprintf(stderr, "Tuning profile: %s (cached)\n", p->name);
+    } else {
+        uint64_t t = mono_ns();
+        if (!tune_benchmark(&comp->tune_fill, &comp->tune_fetch))
+            comp->tune_fill = comp->tune_fetch = 0.0;
+        p = tune_classify(renderer, comp->tune_fetch);
+        fprintf(stderr, "Tuning profile: %s (fill %.2f Gpixel/s, fetch %.2f Gtexel/s, "
+                "probed in %.0f ms)\n", p->name, comp->tune_fill, comp->tune_fetch,
+                (double)(mono_ns() - t) / 1e6);
+        if (comp->tune_fetch > 0.0)
+            tune_cache_store(renderer, p, comp->tune_fill, comp->tune_fetch);
+    }
 
-    /* Ensure no event selection or grabs on overlay */
-    XSelectInput(comp->dpy, comp->overlay, 0);
+    comp->profile = p;
+    comp->fbo_format = p->fbo_format;
+    comp->frame_interval_ns = 1000000000L / p->frame_hz;
+    comp->aux_cache.mipmaps = p->mipmaps;
+}
 
-    /* --- Select events on root --- */
-    XSelectInput(comp->dpy, comp->root,
-                 SubstructureNotifyMask |
-                 StructureNotifyMask |
-                 ExposureMask);
+/* ========================================================================== */
+/* Initialization                                                             */
+/* ========================================================================== */
 
-    /* --- GLX setup --- */
+/* Choose FBConfigs, create the context on the overlay and load the
+ * texture_from_pixmap entry points. Any failure here means the GL path
+ * cannot work on this server. */
+static int init_glx(Compositor *comp) {
     int fbconfig_attrs[] = {
         GLX_DRAWABLE_TYPE,  GLX_WINDOW_BIT,
         GLX_RENDER_TYPE,    GLX_RGBA_BIT,
@@ -951,6 +4858,8 @@ static int init_compositor(Compositor *comp, const char *shader_path_input) {
         return -1;
     }
 
+    init_xsync(comp);
+
     /* Enable vsync */
     PFNGLXSWAPINTERVALEXTPROC glXSwapIntervalEXT =
         (PFNGLXSWAPINTERVALEXTPROC)
@@ -958,13 +4867,27 @@ static int init_compositor(Compositor *comp, const char *shader_path_input) {
     if (glXSwapIntervalEXT) {
         glXSwapIntervalEXT(comp->dpy, comp->glx_win, 1);
     }
+    return 0;
+}
+
+static void destroy_glx(Compositor *comp) {
+    if (comp->glx_ctx) {
+        glXMakeCurrent(comp->dpy, None, NULL);
+        glXDestroyContext(comp->dpy, comp->glx_ctx);
+    }
+    if (comp->glx_win) glXDestroyWindow(comp->dpy, comp->glx_win);
+    comp->glx_ctx = NULL;
+    comp->glx_win = 0;
+}
 
-    /* --- Create OpenGL resources --- */
+/* FBO, fullscreen quad and shader programs */
+static int init_gl_resources(Compositor *comp) {
+    select_profile(comp);
 
     /* FBO */
     glGenTextures(1, &comp->fbo_texture);
     glBindTexture(GL_TEXTURE_2D, comp->fbo_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
+    glTexImage2D(GL_TEXTURE_2D, 0, comp->fbo_format,
                  comp->root_width, comp->root_height, 0,
                  GL_RGBA, GL_UNSIGNED_BYTE, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -978,6 +4901,16 @@ static int init_compositor(Compositor *comp, const char *shader_path_input) {
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
                            GL_TEXTURE_2D, comp->fbo_texture, 0);
     GLenum fbo_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (fbo_status != GL_FRAMEBUFFER_COMPLETE && comp->fbo_format != GL_RGBA8) {
+        fprintf(stderr, "Float FBO incomplete, using RGBA8\n");
+        comp->fbo_format = GL_RGBA8;
+        glBindTexture(GL_TEXTURE_2D, comp->fbo_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
+                     comp->root_width, comp->root_height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        fbo_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    }
     if (fbo_status != GL_FRAMEBUFFER_COMPLETE) {
         fprintf(stderr, "FBO incomplete: 0x%x\n", fbo_status);
         return -1;
@@ -1033,57 +4966,180 @@ static int init_compositor(Compositor *comp, const char *shader_path_input) {
 
     comp->uc_texture = glGetUniformLocation(comp->composite_prog, "u_texture");
 
+    /* GPU timestamps for the trace, with the GPU clock mapped onto ours */
+    if (g_trace.on) {
+        glGenQueries(2 * TRACE_GPU_SLOTS, &comp->gpu_trace.queries[0][0]);
+        GLint64 gpu_now = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+        comp->gpu_trace.offset_ns = (int64_t)mono_ns() - gpu_now;
+    }
+
+    if (comp->latency.on) init_latency(comp);
+    if (comp->feed.images && init_feed(comp) < 0) comp->feed.images = 0;
+
+    /* Per-window shaders; their animation feeds use_postproc_program's */
+    build_window_programs(comp);
+    if (!comp->global_effect) {
+        comp->animated = comp->win_animated;
+        comp->interleave = 1;
+        fprintf(stderr, "No global shader: windows go straight to the overlay\n");
+        return 0;
+    }
+
+    /* Exclusion masks */
+    const ExcludeRules *ex = &comp->exclude;
+    if (ex->class_count + ex->window_count + ex->rect_count > 0 && init_mask(comp) < 0) {
+        fprintf(stderr, "Exclusion masks unavailable, shading everything\n");
+        comp->mask_failed = true;
+    }
+
     /* Post-process shader */
-    char *pp_src = load_file(comp->shader_path);
-    if (!pp_src) return -1;
+    comp->compute_available = ss_gl_has_compute();
+    bool compute, single;
+    ShaderDirectives dir;
+    GLuint lut_prog;
+    StackPass passes[SS_MAX_STAGES - 1];
+    int npasses, last_stage;
+    char *src = load_postproc_source(comp, passes, &npasses, &last_stage);
+    GLuint pp_prog = src ? build_postproc_program(comp, src, &compute, &single, &dir,
+                                                  &lut_prog) : 0;
+    if (!pp_prog) {
+        free_stack_passes(passes, npasses);
+        return -1;
+    }
+    use_stack(comp, passes, npasses, last_stage);
+    use_postproc_program(comp, pp_prog, compute, single, &dir, lut_prog);
+    return 0;
+}
 
-    GLuint pp_frag = compile_shader(GL_FRAGMENT_SHADER, pp_src, comp->shader_path);
-    free(pp_src);
-    if (!pp_frag) return -1;
+static int init_compositor(Compositor *comp, const Options *opts) {
+    memset(comp, 0, sizeof(*comp));
+    comp->running = true;
+    comp->epoll_fd = comp->signal_fd = comp->timer_fd = comp->inotify_fd = -1;
+    comp->events.wake_fd = comp->events.quit_fd = -1;
+    comp->frame_interval_ns = 1000000000L / 60;
+    comp->software = opts->software;
+    comp->interleave_opt = opts->interleave;
+    comp->profile_opt = opts->profile;
+    comp->max_frames = opts->max_frames;
+    comp->feed.images = opts->feed;
+    comp->feed.width = opts->feed_width;
+    comp->feed.height = opts->feed_height;
+    comp->feed.interval_ns = 1000000000L / opts->feed_hz;
+    comp->exclude = opts->exclude;
+    comp->latency.on = opts->latency;
+    comp->latency.x = opts->latency_x;
+    comp->latency.y = opts->latency_y;
+    clock_gettime(CLOCK_MONOTONIC, &comp->start_time);
 
-    comp->postproc_prog = link_program(comp->vert_shader, pp_frag);
-    glDeleteShader(pp_frag);
-    if (!comp->postproc_prog) return -1;
+    /* Before the event thread starts recording */
+    if (opts->trace) {
+        g_trace.ring = calloc(TRACE_RING_SIZE, sizeof(TraceSpan));
+        g_trace.on = g_trace.ring != NULL;
+        if (g_trace.on)
+            fprintf(stderr, "Tracing: last %d spans go to %s with the stats\n",
+                    TRACE_RING_SIZE, TRACE_FILE);
+    }
 
-    comp->u_screen_tex = glGetUniformLocation(comp->postproc_prog, "u_screen");
-    comp->u_resolution = glGetUniformLocation(comp->postproc_prog, "u_resolution");
-    comp->u_time       = glGetUniformLocation(comp->postproc_prog, "u_time");
+    /* Resolve paths */
+    comp->shader_dir = get_exe_dir();
+    for (int i = 0; i < opts->shader_count; i++) {
+        comp->stage_paths[i] = resolve_shader_path(comp->shader_dir, opts->shaders[i]);
+        fprintf(stderr, "Using shader: %s\n", comp->stage_paths[i]);
+    }
+    comp->stage_count = opts->shader_count;
+    comp->shader_path = comp->stage_paths[0];
+    comp->global_effect = comp->stage_count > 0;
+    comp->win_rules = opts->win_rules;
+    for (int i = 0; i < comp->win_rules.count; i++)
+        comp->win_rules.rules[i].shader =
+            resolve_shader_path(comp->shader_dir, opts->win_rules.rules[i].shader);
 
-    /* --- Enumerate existing windows --- */
-    Window root_ret, parent_ret;
-    Window *children = NULL;
-    unsigned int nchildren = 0;
+    /* Open display */
+    comp->dpy = XOpenDisplay(NULL);
+    if (!comp->dpy) {
+        fprintf(stderr, "Cannot open X display\n");
+        return -1;
+    }
 
-    if (XQueryTree(comp->dpy, comp->root, &root_ret, &parent_ret,
-                   &children, &nchildren)) {
-        for (unsigned int i = 0; i < nchildren; i++) {
-            XWindowAttributes attr;
-            if (!XGetWindowAttributes(comp->dpy, children[i], &attr)) continue;
-            if (attr.map_state != IsViewable) continue;
-            if (children[i] == comp->overlay) continue;
-
-            WinEntry *w = add_win(comp, children[i]);
-            if (!w) continue;
-
-            w->x = attr.x;
-            w->y = attr.y;
-            w->width = attr.width;
-            w->height = attr.height;
-            w->border_width = attr.border_width;
-            w->override_redirect = attr.override_redirect;
-            w->mapped = true;
+    XSetErrorHandler(x_error_handler);
+    x_traffic_attach(&comp->xtraffic, comp->dpy);
 
-            g_last_xerror = 0;
-            w->damage = XDamageCreate(comp->dpy, w->xid, XDamageReportNonEmpty);
-            XSync(comp->dpy, False);
-            if (g_last_xerror) {
-                w->damage = 0;
-                g_last_xerror = 0;
-            }
-            bind_window_pixmap(comp, w);
-        }
-        if (children) XFree(children);
+    comp->screen = DefaultScreen(comp->dpy);
+    comp->root = RootWindow(comp->dpy, comp->screen);
+    comp->root_width = DisplayWidth(comp->dpy, comp->screen);
+    comp->root_height = DisplayHeight(comp->dpy, comp->screen);
+
+    fprintf(stderr, "Screen: %dx%d\n", comp->root_width, comp->root_height);
+
+    /* --- Check extensions --- */
+    int ev_base, err_base;
+
+    if (!XCompositeQueryExtension(comp->dpy, &ev_base, &err_base)) {
+        fprintf(stderr, "XComposite extension not available\n");
+        return -1;
+    }
+    int major = 0, minor = 0;
+    XCompositeQueryVersion(comp->dpy, &major, &minor);
+    if (major == 0 && minor < 2) {
+        fprintf(stderr, "XComposite >= 0.2 required (have %d.%d)\n", major, minor);
+        return -1;
+    }
+
+    if (!XDamageQueryExtension(comp->dpy, &comp->damage_event, &comp->damage_error)) {
+        fprintf(stderr, "XDamage extension not available\n");
+        return -1;
+    }
+
+    int xfixes_ev, xfixes_err;
+    if (!XFixesQueryExtension(comp->dpy, &xfixes_ev, &xfixes_err)) {
+        fprintf(stderr, "XFixes extension not available\n");
+        return -1;
+    }
+
+    /* --- Redirect subwindows --- */
+    /*
+     * Use CompositeRedirectAutomatic so the X server continues to draw
+     * windows normally (preserving correct input routing / stacking).
+     * We still get off-screen pixmaps via XCompositeNameWindowPixmap.
+     * Our overlay window covers the root, showing the shaded output.
+     */
+    XCompositeRedirectSubwindows(comp->dpy, comp->root, CompositeRedirectAutomatic);
+    XSync(comp->dpy, False);
+
+    /* --- Get overlay window --- */
+    comp->overlay = XCompositeGetOverlayWindow(comp->dpy, comp->root);
+    if (!comp->overlay) {
+        fprintf(stderr, "Failed to get composite overlay window\n");
+        return -1;
+    }
+
+    /* Make overlay completely transparent to input */
+    XserverRegion region = XFixesCreateRegion(comp->dpy, NULL, 0);
+    XFixesSetWindowShapeRegion(comp->dpy, comp->overlay, ShapeInput, 0, 0, region);
+    XFixesDestroyRegion(comp->dpy, region);
+
+    /* Ensure no event selection or grabs on overlay. Root events are
+     * selected by the event thread on its own connection. */
+    XSelectInput(comp->dpy, comp->overlay, 0);
+
+    /* --- Rendering backend: GLX, or the CPU when GLX cannot do TFP --- */
+    if (!comp->software && init_glx(comp) < 0) {
+        fprintf(stderr, "GLX compositing unavailable, falling back to software rendering\n");
+        destroy_glx(comp);
+        comp->software = true;
     }
+    if (comp->software) {
+        if (init_software(comp) < 0) return -1;
+    } else if (init_gl_resources(comp) < 0) {
+        return -1;
+    }
+
+    /* --- Start the X event thread; it enumerates existing windows --- */
+    if (start_event_thread(comp) < 0) return -1;
+
+    read_params(comp);
+    if (init_event_loop(comp) < 0) return -1;
 
     comp->needs_redraw = true;
     fprintf(stderr, "Compositor initialized, entering main loop\n");
@@ -1097,32 +5153,54 @@ static int init_compositor(Compositor *comp, const char *shader_path_input) {
 static void cleanup_compositor(Compositor *comp) {
     fprintf(stderr, "Cleaning up...\n");
 
+    stop_event_thread(comp);
+
     /* Remove all windows */
     WinEntry *w = comp->win_head;
     while (w) {
         WinEntry *next = w->next;
-        if (w->damage) XDamageDestroy(comp->dpy, w->damage);
         unbind_window_pixmap(comp, w);
+        free_window_shade(w);
         free(w);
         w = next;
     }
     comp->win_head = comp->win_tail = NULL;
 
     /* Delete GL resources */
+    if (comp->glx_ctx) cleanup_xsync(comp);
     if (comp->composite_prog) glDeleteProgram(comp->composite_prog);
+    if (comp->gpu_trace.queries[0][0])
+        glDeleteQueries(2 * TRACE_GPU_SLOTS, &comp->gpu_trace.queries[0][0]);
+    for (int i = 0; i < LATENCY_SLOTS; i++)
+        if (comp->latency.fence[i]) glDeleteSync(comp->latency.fence[i]);
+    if (comp->latency.pbo[0]) glDeleteBuffers(LATENCY_SLOTS, comp->latency.pbo);
+    free_feed(comp);
+    for (int i = 0; i < comp->frames_queued; i++) glDeleteSync(comp->frame_fences[i]);
+    comp->frames_queued = 0;
+    if (comp->copy_prog) glDeleteProgram(comp->copy_prog);
+    if (comp->mask_rb) glDeleteRenderbuffers(1, &comp->mask_rb);
     if (comp->postproc_prog) glDeleteProgram(comp->postproc_prog);
+    for (int i = 0; i < comp->win_rules.count; i++)
+        if (comp->win_progs[i].prog) glDeleteProgram(comp->win_progs[i].prog);
+    free_stack_passes(comp->stack, comp->stack_passes);
+    ss_aux_cache_free(&comp->aux_cache);
     if (comp->vert_shader) glDeleteShader(comp->vert_shader);
     if (comp->fbo) glDeleteFramebuffers(1, &comp->fbo);
     if (comp->fbo_texture) glDeleteTextures(1, &comp->fbo_texture);
+    if (comp->cs_fbo) glDeleteFramebuffers(1, &comp->cs_fbo);
+    if (comp->cs_texture) glDeleteTextures(1, &comp->cs_texture);
+    if (comp->stack_fbo[0]) glDeleteFramebuffers(2, comp->stack_fbo);
+    if (comp->stack_tex[0]) glDeleteTextures(2, comp->stack_tex);
+    ss_feedback_free(&comp->feedback);
+    ss_lut_free(&comp->lut);
+    if (comp->band_vbo) glDeleteBuffers(1, &comp->band_vbo);
+    if (comp->band_vao) glDeleteVertexArrays(1, &comp->band_vao);
     if (comp->vbo) glDeleteBuffers(1, &comp->vbo);
     if (comp->vao) glDeleteVertexArrays(1, &comp->vao);
 
     /* Destroy GLX */
-    if (comp->glx_ctx) {
-        glXMakeCurrent(comp->dpy, None, NULL);
-        if (comp->glx_win) glXDestroyWindow(comp->dpy, comp->glx_win);
-        glXDestroyContext(comp->dpy, comp->glx_ctx);
-    }
+    destroy_glx(comp);
+    cleanup_software(comp);
 
     /* Release compositor resources */
     if (comp->dpy) {
@@ -1132,8 +5210,17 @@ static void cleanup_compositor(Compositor *comp) {
         XCloseDisplay(comp->dpy);
     }
 
-    free(comp->shader_path);
+    if (comp->epoll_fd >= 0) close(comp->epoll_fd);
+    if (comp->signal_fd >= 0) close(comp->signal_fd);
+    if (comp->timer_fd >= 0) close(comp->timer_fd);
+    if (comp->inotify_fd >= 0) close(comp->inotify_fd);
+
+    for (int i = 0; i < comp->stage_count; i++) free(comp->stage_paths[i]);
+    for (int i = 0; i < comp->win_rules.count; i++) free(comp->win_rules.rules[i].shader);
     free(comp->shader_dir);
+    g_trace.on = false;
+    free(g_trace.ring);
+    g_trace.ring = NULL;
 
     fprintf(stderr, "Cleanup complete\n");
 }
@@ -1142,81 +5229,294 @@ static void cleanup_compositor(Compositor *comp) {
 /* Main                                                                       */
 /* ========================================================================== */
 
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [--software] [--trace] [--latency X,Y] [--interleave N]\n"
+        "          [--frames-in-flight N] [--profile NAME] [--feed WHAT]\n"
+        "          [--feed-size WxH] [--feed-hz N] [--exclude-class NAME]\n"
+        "          [--exclude-window XID] [--exclude-rect WxH+X+Y]\n"
+        "          [--window-class NAME=SHADER] [--window-title TEXT=SHADER] [shader.frag ...]\n"
+        "  Default shader: shaders/crt.frag (none when there are window shaders)\n"
+        "  Several shaders are applied in order, each to the output of the one\n"
+        "  before (up to %d)\n"
+        "  --software  Render on the CPU (automatic without GLX texture_from_pixmap);\n"
+        "              params and SIGUSR1 reloads have no effect\n"
+        "  --trace     Record a timeline of the last frames, written to\n"
+        "              " TRACE_FILE " with the stats (Chrome trace JSON)\n"
+        "  --latency X,Y  Measure damage-to-photon latency with the marker of\n"
+        "              screenshader-workload --latency-probe centred at X,Y\n"
+        "  --interleave N  Shade 1/N of the screen per frame plus what changed\n"
+        "                  (1-4; default: what the shader declares, else for\n"
+        "                  static shaders what the profile sets)\n"
+        "  --frames-in-flight N  Frames queued on the GPU before rendering\n"
+        "                  waits for the oldest (1-%d, default 1)\n"
+        "  --feed WHAT  Publish downscaled frames for screenshader-preview --live\n"
+        "              in shared memory (" SS_FEED_PREFIX "-UID-DISPLAY): composited, shaded\n"
+        "              or both; --feed-size WxH (default 480x270) and --feed-hz N\n"
+        "              (default 10) set their size and rate\n"
+        "  --profile NAME  Tuning for the renderer: auto (default: benchmarked\n"
+        "                  once per GL_RENDERER, then cached), probe (benchmark\n"
+        "                  again), software, igpu or dgpu\n"
+        "  --exclude-class NAME  Leave windows with this WM_CLASS unshaded\n"
+        "  --exclude-window XID  Leave this window unshaded\n"
+        "  --exclude-rect WxH+X+Y  Leave this screen area unshaded\n"
+        "                  (each can be given up to %d times)\n"
+        "  --window-class NAME=SHADER  Shade windows with this WM_CLASS with SHADER\n"
+        "  --window-title TEXT=SHADER  ... windows whose title contains TEXT\n"
+        "                  (up to %d rules, the first match wins, checked on map)\n"
+        "  Send SIGUSR1 to hot-reload the shader.\n"
+        "  Send SIGUSR2 to write stats to " STATS_FILE ".\n"
+        "  Send SIGINT/SIGTERM to stop.\n",
+        argv0, SS_MAX_STAGES, MAX_FRAMES_IN_FLIGHT, MAX_EXCLUDE, MAX_WIN_SHADERS);
+}
+
+/* One --exclude-<kind> <arg> rule. Returns -1 (with a message) if it is
+ * malformed or there are too many. */
+static int parse_exclude(ExcludeRules *r, const char *kind, const char *arg) {
+    if (strcmp(kind, "class") == 0 && r->class_count < MAX_EXCLUDE) {
+        r->classes[r->class_count++] = arg;
+        return 0;
+    }
+    if (strcmp(kind, "window") == 0 && r->window_count < MAX_EXCLUDE) {
+        char *end;
+        unsigned long xid = strtoul(arg, &end, 0);
+        if (*end || xid == 0) {
+            fprintf(stderr, "Bad window id: %s\n", arg);
+            return -1;
+        }
+        r->windows[r->window_count++] = (Window)xid;
+        return 0;
+    }
+    if (strcmp(kind, "rect") == 0 && r->rect_count < MAX_EXCLUDE) {
+        DamageRect *d = &r->rects[r->rect_count];
+        char tail;
+        if (sscanf(arg, "%dx%d+%d+%d%c", &d->width, &d->height, &d->x, &d->y, &tail) != 4 ||
+            d->width <= 0 || d->height <= 0) {
+            fprintf(stderr, "Bad rectangle (want WxH+X+Y): %s\n", arg);
+            return -1;
+        }
+        r->rect_count++;
+        return 0;
+    }
+    fprintf(stderr, "Unknown or too many exclusions: --exclude-%s\n", kind);
+    return -1;
+}
+
+/* One --window-<kind> MATCH=SHADER rule. Returns -1 (with a message) if
+ * it is malformed or there are too many. */
+static int parse_window_shader(WinShaderRules *r, const char *kind, const char *arg) {
+    bool by_title = strcmp(kind, "title") == 0;
+    if ((!by_title && strcmp(kind, "class") != 0) || r->count == MAX_WIN_SHADERS) {
+        fprintf(stderr, "Unknown or too many window shaders: --window-%s\n", kind);
+        return -1;
+    }
+    char *copy = strdup(arg);   /* lives as long as the process */
+    char *eq = copy ? strrchr(copy, '=') : NULL;
+    if (!eq || eq == copy || !eq[1]) {
+        fprintf(stderr, "Bad window shader (want MATCH=SHADER): %s\n", arg);
+        free(copy);
+        return -1;
+    }
+    *eq = '\0';
+    r->rules[r->count++] = (WinShaderRule){ .match = copy, .by_title = by_title,
+                                            .shader = eq + 1 };
+    r->any_title |= by_title;
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
-    const char *shader_input = "shaders/crt.frag";
-    if (argc > 1) {
-        if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
-            fprintf(stderr,
-                "Usage: %s [shader.frag]\n"
-                "  Default shader: shaders/crt.frag\n"
-                "  Send SIGUSR1 to hot-reload the shader.\n"
-                "  Send SIGINT/SIGTERM to stop.\n",
-                argv[0]);
+    Options opts = { .shader_count = 0, .software = false, .interleave = -1,
+                     .max_frames = 1, .feed_width = 480, .feed_height = 270,
+                     .feed_hz = 10 };
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
             return 0;
+        } else if (strcmp(argv[i], "--software") == 0) {
+            opts.software = true;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            opts.trace = true;
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            opts.profile = argv[++i];
+            if (strcmp(opts.profile, "auto") == 0) {
+                opts.profile = NULL;
+            } else if (strcmp(opts.profile, "probe") != 0 && !find_profile(opts.profile)) {
+                fprintf(stderr, "Unknown profile: %s\n", opts.profile);
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d,%d", &opts.latency_x, &opts.latency_y) != 2) {
+                fprintf(stderr, "Bad latency probe position (want X,Y): %s\n", argv[i]);
+                return 1;
+            }
+            opts.latency = true;
+        } else if (strcmp(argv[i], "--interleave") == 0 && i + 1 < argc) {
+            opts.interleave = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--feed") == 0 && i + 1 < argc) {
+            const char *what = argv[++i];
+            opts.feed = strcmp(what, "composited") == 0 ? SS_FEED_COMPOSITED :
+                        strcmp(what, "shaded") == 0 ? SS_FEED_SHADED :
+                        strcmp(what, "both") == 0 ? SS_FEED_COMPOSITED | SS_FEED_SHADED : 0;
+            if (!opts.feed) {
+                fprintf(stderr, "Bad feed (want composited, shaded or both): %s\n", what);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--feed-size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &opts.feed_width, &opts.feed_height) != 2 ||
+                opts.feed_width < 1 || opts.feed_height < 1 ||
+                opts.feed_width > 4096 || opts.feed_height > 4096) {
+                fprintf(stderr, "Bad feed size (want WxH, up to 4096): %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--feed-hz") == 0 && i + 1 < argc) {
+            opts.feed_hz = atoi(argv[++i]);
+            if (opts.feed_hz < 1 || opts.feed_hz > 60) {
+                fprintf(stderr, "Feed rate must be 1-60\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+            opts.max_frames = atoi(argv[++i]);
+            if (opts.max_frames < 1 || opts.max_frames > MAX_FRAMES_IN_FLIGHT) {
+                fprintf(stderr, "Frames in flight must be 1-%d\n", MAX_FRAMES_IN_FLIGHT);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--exclude-", 10) == 0 && i + 1 < argc) {
+            if (parse_exclude(&opts.exclude, argv[i] + 10, argv[i + 1]) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            i++;
+        } else if (strncmp(argv[i], "--window-", 9) == 0 && i + 1 < argc) {
+            if (parse_window_shader(&opts.win_rules, argv[i] + 9, argv[i + 1]) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            i++;
+        } else if (argv[i][0] != '-') {
+            if (opts.shader_count == SS_MAX_STAGES) {
+                fprintf(stderr, "At most %d shaders can be stacked\n", SS_MAX_STAGES);
+                return 1;
+            }
+            opts.shaders[opts.shader_count++] = argv[i];
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            usage(argv[0]);
+            return 1;
         }
-        shader_input = argv[1];
     }
 
-    /* Install signal handlers */
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
+    if (opts.shader_count == 0 && opts.win_rules.count == 0)
+        opts.shaders[opts.shader_count++] = "shaders/crt.frag";
 
-    sa.sa_handler = handle_signal;
-    sa.sa_flags = SA_RESTART;
-    sigaction(SIGINT, &sa, NULL);
-    sigaction(SIGTERM, &sa, NULL);
+    /* Two threads use Xlib (each with its own Display) */
+    XInitThreads();
 
-    sa.sa_handler = handle_sigusr1;
-    sigaction(SIGUSR1, &sa, NULL);
+    /* Block the signals we care about; they are read from a signalfd in the
+     * main loop instead of interrupting it asynchronously. The X event
+     * thread inherits this mask. */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
 
     /* Initialize compositor */
     Compositor comp;
-    if (init_compositor(&comp, shader_input) != 0) {
+    if (init_compositor(&comp, &opts) != 0) {
         fprintf(stderr, "Failed to initialize compositor\n");
         cleanup_compositor(&comp);
         return 1;
     }
 
     /* Main loop */
-    while (g_running) {
-        /* Process all pending X events */
+    struct epoll_event events[8];
+    while (comp.running) {
+        /* The render connection selects no events; drain whatever GLX or
+         * the server sends so it cannot pile up in Xlib's queue. */
         while (XPending(comp.dpy) > 0) {
             XEvent ev;
             XNextEvent(comp.dpy, &ev);
-            handle_event(&comp, &ev);
-        }
-
-        /* Check for shader reload */
-        if (g_reload) {
-            g_reload = 0;
-            reload_postproc_shader(&comp);
-            comp.needs_redraw = true;
+            x_count_event(&ev);
         }
 
-        /* Check for param file changes (~every 30 frames / 0.5s) */
-        if (++comp.param_check_ctr >= 30) {
-            comp.param_check_ctr = 0;
-            read_params(&comp);
-        }
+        /* Frame start: apply window-state changes from the event thread */
+        if (apply_deltas(&comp) > 0) comp.needs_redraw = true;
 
         /* Render */
         if (comp.needs_redraw) {
-            render_frame(&comp);
-            glXSwapBuffers(comp.dpy, comp.glx_win);
+            uint64_t frame_start = trace_begin();
+            if (comp.software) {
+                sw_render_frame(&comp);
+            } else {
+                /* Take in what arrived while waiting, it goes out no later */
+                wait_frames_in_flight(&comp);
+                apply_deltas(&comp);
+                render_frame(&comp);
+                if (comp.latency.on) latency_readback(&comp);
+                if (comp.feed.shm) feed_capture(&comp);
+                uint64_t t = trace_begin();
+                glXSwapBuffers(comp.dpy, comp.glx_win);
+                trace_end(TRACE_RENDER, "glXSwapBuffers", t, NULL, 0);
+                if (comp.latency.on) latency_swapped(&comp);
+                queue_frame(&comp);
+                /* Interleaving finishes a change on the frames after it,
+                 * and the feed publishes the last one of a burst */
+                set_frame_timer(&comp, comp.animated || comp.settle_frames > 0 ||
+                                       feed_pending(&comp));
+            }
             comp.needs_redraw = false;
+            comp.stats.frames++;
+            account_x_traffic(&comp);
+            trace_end(TRACE_RENDER, "frame", frame_start, "frame", comp.stats.frames);
         }
 
-        /* Poll for next event or timeout (16ms for ~60fps animation) */
-        struct pollfd pfd = {
-            .fd = ConnectionNumber(comp.dpy),
-            .events = POLLIN
-        };
-        poll(&pfd, 1, 16);
+        /* GLX calls may have pulled events into Xlib's queue without the
+         * socket becoming readable again, so don't block if any are queued. */
+        XFlush(comp.dpy);
+        int timeout = XEventsQueued(comp.dpy, QueuedAlready) > 0 ? 0 : -1;
+
+        int n = epoll_wait(comp.epoll_fd, events, 8, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
+            break;
+        }
 
-        /* Always mark redraw for animated shaders */
-        comp.needs_redraw = true;
+        for (int i = 0; i < n; i++) {
+            switch (events[i].data.u32) {
+            case SRC_X:
+                comp.stats.wakeups_x++; /* drained at the top of the loop */
+                break;
+            case SRC_DELTAS: {
+                uint64_t count;
+                comp.stats.wakeups_deltas++;
+                if (read(comp.events.wake_fd, &count, sizeof(count)) < 0 &&
+                    errno != EAGAIN) {
+                    fprintf(stderr, "delta wakeup: %s\n", strerror(errno));
+                }
+                break;
+            }
+            case SRC_SIGNAL:
+                comp.stats.wakeups_signal++;
+                handle_signalfd(&comp);
+                break;
+            case SRC_TIMER:
+                comp.stats.wakeups_timer++;
+                handle_timerfd(&comp);
+                break;
+            case SRC_INOTIFY:
+                comp.stats.wakeups_inotify++;
+                handle_inotify(&comp);
+                break;
+            }
+        }
     }
 
+    write_stats(&comp);
+    write_trace(&comp.start_time);
     cleanup_compositor(&comp);
     return 0;
 }
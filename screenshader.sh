@@ -6,14 +6,17 @@
 #
 # Usage:
 #   screenshader.sh [shader.frag]   Start with a shader (default: shaders/crt.frag)
+#   screenshader.sh crt+amber       Stack shaders, applied left to right (X11)
 #   screenshader.sh --stop          Stop the running compositor
 #   screenshader.sh --reload        Hot-reload the current shader
 #   screenshader.sh --list          List available shaders
+#   screenshader.sh --stats         Show compositor stats (X11)
 #
 
 SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
 PIDFILE="/tmp/screenshader.pid"
 PARAM_FILE="/tmp/screenshader.params"
+STATS_FILE="/tmp/screenshader.stats"
 
 # ---------------------------------------------------------------------------
 # Platform detection
@@ -35,8 +38,30 @@ PLATFORM="$(detect_platform)"
 # ---------------------------------------------------------------------------
 # Hyprland: convert GLSL 330 core → Hyprland's GLSL ES dialect
 # ---------------------------------------------------------------------------
+# Shaders without a #version line are written against shaders/prelude.glsl
+# (looked up next to the shader first, like the X11 backend does); its
+# SS_PORTABLE path avoids the luma-in-alpha gathers Hyprland can't provide.
+find_prelude() {
+    local dir
+    dir="$(dirname "$1")"
+    if [ -f "$dir/prelude.glsl" ]; then
+        echo "$dir/prelude.glsl"
+    else
+        echo "$SCRIPT_DIR/shaders/prelude.glsl"
+    fi
+}
+
 convert_hyprland() {
-    sed -e '/#version/d' \
+    {
+        if ! grep -q '^[[:space:]]*#version' "$1"; then
+            echo '#define SS_PORTABLE 1'
+            cat "$(find_prelude "$1")"
+        fi
+        cat "$1"
+    } | sed -e '/#version/d' \
+        -e '/^#extension/d' \
+        -e '/^#line/d' \
+        -e '/^#pragma screenshader/d' \
         -e 's/^in vec2 v_texcoord;/varying vec2 v_texcoord;/' \
         -e 's/^out vec4 frag_color;//' \
         -e 's/uniform sampler2D u_screen;/uniform sampler2D tex;/' \
@@ -47,7 +72,7 @@ convert_hyprland() {
         -e 's/u_screen/tex/g' \
         -e 's/u_time/time/g' \
         -e 's/u_resolution/screenSize/g' \
-        "$1" | sed '1i precision highp float;'
+        | sed '1i precision highp float;'
 }
 
 # ---------------------------------------------------------------------------
@@ -86,7 +111,8 @@ stop_x11() {
 }
 
 start_x11() {
-    local shader="${1:-shaders/crt.frag}"
+    local shaders=("$@")
+    [ "${#shaders[@]}" -eq 0 ] && shaders=("shaders/crt.frag")
 
     if [ ! -x "$BINARY_X11" ]; then
         echo "Error: $BINARY_X11 not found. Run 'make' first."
@@ -105,8 +131,8 @@ start_x11() {
     # Wait for xfwm4 to release the composite extension
     sleep 0.5
 
-    echo "Starting screenshader with: $shader"
-    "$BINARY_X11" "$shader" &
+    echo "Starting screenshader with: ${shaders[*]}"
+    "$BINARY_X11" "${shaders[@]}" &
     local pid=$!
     echo "$pid" > "$PIDFILE"
 
@@ -169,6 +195,24 @@ reload_x11() {
     fi
 }
 
+stats_x11() {
+    if [ -f "$PIDFILE" ] && kill -0 "$(cat "$PIDFILE")" 2>/dev/null; then
+        rm -f "$STATS_FILE"
+        kill -USR2 "$(cat "$PIDFILE")"
+        # The dump is renamed into place once complete, so it is whole
+        # as soon as it exists
+        for _ in $(seq 1 20); do
+            [ -f "$STATS_FILE" ] && break
+            sleep 0.05
+        done
+    fi
+    if [ -f "$STATS_FILE" ]; then
+        cat "$STATS_FILE"
+    else
+        echo "screenshader is not running"
+    fi
+}
+
 # ---------------------------------------------------------------------------
 # Hyprland backend
 # ---------------------------------------------------------------------------
@@ -352,7 +396,7 @@ do_stop() {
 
 do_start() {
     case "$PLATFORM" in
-        x11)       start_x11 "$1" ;;
+        x11)       start_x11 "$@" ;;
         hyprland)  start_hyprland "$1" ;;
         macos)     start_macos "$1" ;;
         *)
@@ -392,6 +436,13 @@ case "${1:-}" in
     --get)
         get_params
         ;;
+    --stats)
+        if [ "$PLATFORM" = "x11" ]; then
+            stats_x11
+        else
+            echo "Stats are only available on X11."
+        fi
+        ;;
     --help|-h)
         echo "Usage: $(basename "$0") [OPTIONS] [shader.frag]"
         echo ""
@@ -401,11 +452,13 @@ case "${1:-}" in
         echo "  (no args)       Start with CRT shader"
         echo "  NAME            Start with a built-in shader by name (e.g. crt, amber)"
         echo "  shader.frag     Start with a shader file path"
+        echo "  A+B             Stack shaders, B applied to A's output (X11)"
         echo "  --stop, -s      Stop the running compositor"
         echo "  --reload, -r    Hot-reload the current shader"
         echo "  --list, -l      List available shaders"
         echo "  --set NAME VAL  Set a shader parameter at runtime"
         echo "  --get           Show current parameters"
+        echo "  --stats         Show compositor stats (X11)"
         echo "  --help, -h      Show this help"
         echo ""
         echo "Supported platforms:"
@@ -422,22 +475,37 @@ case "${1:-}" in
         echo "  $(basename "$0")                           # CRT effect"
         echo "  $(basename "$0") amber                     # Amber terminal (by name)"
         echo "  $(basename "$0") shaders/amber.frag        # Amber terminal (by path)"
+        echo "  $(basename "$0") crt+nightlight            # CRT, then warm it up"
         echo "  $(basename "$0") --set u_curvature 0.15    # Crank up curvature"
         echo "  $(basename "$0") --set u_curvature 0       # Flat (no curve)"
         echo "  $(basename "$0") --stop                    # Restore normal desktop"
         ;;
     *)
-        shader="$1"
-        if [ -n "$shader" ] && [ ! -f "$shader" ]; then
-            # Try resolving as a bare shader name (e.g. "crt" → "shaders/crt.frag")
-            if [ -f "$SCRIPT_DIR/shaders/${shader}.frag" ]; then
-                shader="$SCRIPT_DIR/shaders/${shader}.frag"
-            else
-                echo "Error: shader not found: $shader"
-                echo "Run '$(basename "$0") --list' to see available shaders."
-                exit 1
+        # "crt+amber" is an effect stack, unless a file has that name
+        stages=()
+        if [ -f "${1:-}" ]; then
+            stages=("$1")
+        elif [ -n "${1:-}" ]; then
+            IFS='+' read -r -a stages <<< "$1"
+        fi
+        shaders=()
+        for shader in "${stages[@]}"; do
+            if [ ! -f "$shader" ]; then
+                # Try resolving as a bare shader name (e.g. "crt" → "shaders/crt.frag")
+                if [ -f "$SCRIPT_DIR/shaders/${shader}.frag" ]; then
+                    shader="$SCRIPT_DIR/shaders/${shader}.frag"
+                else
+                    echo "Error: shader not found: $shader"
+                    echo "Run '$(basename "$0") --list' to see available shaders."
+                    exit 1
+                fi
             fi
+            shaders+=("$shader")
+        done
+        if [ "${#shaders[@]}" -gt 1 ] && [ "$PLATFORM" != "x11" ]; then
+            echo "Error: effect stacks are only supported on X11."
+            exit 1
         fi
-        do_start "$shader"
+        do_start "${shaders[@]}"
         ;;
 esac
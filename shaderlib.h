@@ -0,0 +1,1647 @@
+/*
+ * shaderlib.h - GLSL source handling shared by screenshader and
+ * screenshader-preview
+ *
+ * Shaders can carry engine directives as pragma lines, which GLSL
+ * compilers ignore:
+ *
+ *   #pragma screenshader kernel_radius N
+ *       The shader samples u_screen at most N texels away from the pixel
+ *       being shaded. Enables the compute tile path below when GL 4.3 is
+ *       available.
+ *
+ *   #pragma screenshader prelude N
+ *       The shader needs at least version N of shaders/prelude.glsl.
+ *
+ *   #pragma screenshader interleave N
+ *       The compositor may shade only 1/N of the screen per frame and keep
+ *       the rest from earlier frames, shading damaged areas in full. For
+ *       heavy shaders whose output changes slowly. N is 2..4.
+ *
+ *   #pragma screenshader pointwise
+ *       Each output pixel depends only on the screen pixel under it, and
+ *       linearly: f(a * x + b * y) = a * f(x) + b * f(y) for colours x, y
+ *       (tints, channel gains, luma, vignettes and other masks). The
+ *       compositor may then apply the shader to each window as it is
+ *       composited, with no second pass.
+ *
+ *   #pragma screenshader lut <function> [N]
+ *       `vec3 <function>(vec3)` is a pure colour transform: its result
+ *       depends only on its argument (in 0..1) and on uniforms that change
+ *       through the params file, not on position or u_time. It is baked
+ *       into an N x N x N 3D texture (default 33) and every call becomes
+ *       one texture fetch.
+ *
+ *   #pragma screenshader texture <sampler> <source>
+ *       Bind an auxiliary texture to `uniform sampler2D <sampler>`. Sources:
+ *       `whitenoise N` and `bluenoise N` (generated N x N RGBA tiles, four
+ *       independent channels, repeat-wrapped, nearest filtering) or
+ *       `image <file.ppm>` (relative to the shader's directory). Textures
+ *       are made the first time a program uses them and cached for the life
+ *       of the process, so hot reloads and other shaders share them.
+ *
+ * Prelude: a shader without a #version line is compiled with
+ * shaders/prelude.glsl in front of it, which declares the standard inputs
+ * and uniforms and the luma/gather helpers. Shaders that carry their own
+ * #version are compiled as they are.
+ *
+ * Compute tile path: the fragment shader is rewritten into a compute
+ * shader that runs on 16x16 tiles. Each work group loads its tile plus an
+ * N-texel halo from u_screen into shared memory once, and every
+ * texture(u_screen, uv) in the shader reads from there (with the same
+ * bilinear filtering and edge clamping as the sampler) instead of
+ * refetching overlapping neighbourhoods from the texture. Samples that
+ * land outside the halo still go to the texture, so an underestimated
+ * radius costs speed, not correctness. For interleaved shading the tiles
+ * themselves take turns: with ss_interleave N > 1 only tiles whose
+ * (x + y) mod N equals ss_phase are shaded, and ss_tile_offset lets a
+ * dispatch cover just a sub-rectangle of tiles.
+ *
+ * Frame feedback: a shader that samples `u_prev` gets the previous
+ * frame's post-processed output. The output is rendered into one of a
+ * ping-pong pair of textures and the other one is bound as u_prev, so
+ * nothing is copied. Until a frame has been rendered (at startup, after a
+ * resize or a reload) u_prev is the unprocessed screen.
+ *
+ * Single pass: a pointwise shader is rewritten into a variant of
+ * composite.frag. Each window's pixel goes through the shader's main and
+ * is then blended into the overlay as usual. Linearity is what makes
+ * this exact: blending is a weighted sum of window colours, and the
+ * premultiplied colour of a translucent window is a scaled one.
+ *
+ * Colour LUT: for a `lut` stage the shader is compiled twice. The bake
+ * program renders the function over an identity lattice, one layer of
+ * the 3D texture per draw; the runtime program has every call to the
+ * function replaced by a trilinear fetch from that texture. The caller
+ * re-bakes when the params change. If either program fails to build the
+ * shader runs unmodified.
+ *
+ * Per-window shaders: a shader applied to one window as it is composited
+ * is rewritten to run at the window's own size. Its u_screen is a
+ * window-sized copy of the window (premultiplied, luma in alpha, like the
+ * composited screen), v_texcoord and u_resolution are relative to the
+ * window, and the result is blended with the window's coverage like any
+ * other window.
+ *
+ * Effect stacks: several shaders applied in order, each to the output of
+ * the one before. A stage that only reads u_screen at its own pixel (or
+ * declares itself pointwise) joins the pass before it: the stages are
+ * compiled into one program with their global names prefixed apart, so a
+ * run of colour stages costs one pass and no intermediate texture.
+ *
+ * Frame feed: the compositor can publish downscaled copies of its frames
+ * (composited, shaded, or both) to a POSIX shared-memory object, one per
+ * user and display (ss_feed_name), for the preview and other readers. The
+ * header names the publishing process, so a feed left behind by one that
+ * died is not mistaken for a live one, and says when it is busy, so a
+ * reader can tell a publisher that stopped from one waiting for the
+ * screen to change. Each of SS_FEED_SLOTS
+ * slots holds one frame; a slot's sequence number is 0 while it is being
+ * written, so a reader that sees the same non-zero number before and
+ * after copying a slot has a whole frame.
+ *
+ * Header-only: both binaries are single translation units.
+ */
+
+#ifndef SCREENSHADER_SHADERLIB_H
+#define SCREENSHADER_SHADERLIB_H
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+/* For helpers only one of the binaries calls */
+#define SS_UNUSED __attribute__((unused))
+
+/* ========================================================================== */
+/* Directives                                                                 */
+/* ========================================================================== */
+
+#define SS_MAX_KERNEL_RADIUS 8   /* keeps the tile within 32 KB of shared memory */
+#define SS_MAX_AUX           8   /* auxiliary textures per shader */
+#define SS_MAX_INTERLEAVE    4
+#define SS_LUT_DEFAULT_SIZE  33
+#define SS_MAX_LUT_SIZE      64
+
+typedef struct {
+    char name[64];       /* sampler uniform */
+    char kind[16];       /* whitenoise, bluenoise, image */
+    char arg[256];       /* size, or image path */
+} SsAuxDecl;
+
+typedef struct {
+    int       kernel_radius;   /* 0 = not declared */
+    int       prelude;         /* minimum prelude version, 0 = any */
+    int       interleave;      /* 0 = not declared */
+    bool      pointwise;
+    char      lut_func[64];    /* pointwise colour stage, "" = none */
+    int       lut_size;
+    SsAuxDecl aux[SS_MAX_AUX];
+    int       aux_count;
+} ShaderDirectives;
+
+static void ss_parse_directives(const char *src, ShaderDirectives *d) {
+    memset(d, 0, sizeof(*d));
+    for (const char *line = src; line && *line; ) {
+        const char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        char key[64];
+        int value;
+        SsAuxDecl aux;
+        int n;
+        if (sscanf(p, "#pragma screenshader lut %63s %n", d->lut_func, &n) == 1) {
+            if (sscanf(p + n, "%d", &value) != 1) value = SS_LUT_DEFAULT_SIZE;
+            if (value < 2) value = 2;
+            if (value > SS_MAX_LUT_SIZE) value = SS_MAX_LUT_SIZE;
+            d->lut_size = value;
+        } else if (sscanf(p, "#pragma screenshader texture %63s %15s %255s",
+                   aux.name, aux.kind, aux.arg) == 3) {
+            bool dup = false;
+            for (int i = 0; i < d->aux_count; i++)
+                dup |= strcmp(d->aux[i].name, aux.name) == 0;
+            if (!dup && d->aux_count < SS_MAX_AUX) d->aux[d->aux_count++] = aux;
+        } else if ((n = sscanf(p, "#pragma screenshader %63s %d", key, &value)) >= 1) {
+            if (n == 1) {   /* a flag */
+                if (strcmp(key, "pointwise") == 0) d->pointwise = true;
+            } else if (strcmp(key, "kernel_radius") == 0) {
+                if (value < 0) value = 0;
+                if (value > SS_MAX_KERNEL_RADIUS) value = SS_MAX_KERNEL_RADIUS;
+                d->kernel_radius = value;
+            } else if (strcmp(key, "prelude") == 0) {
+                d->prelude = value;
+            } else if (strcmp(key, "interleave") == 0) {
+                if (value < 1) value = 1;
+                if (value > SS_MAX_INTERLEAVE) value = SS_MAX_INTERLEAVE;
+                d->interleave = value;
+            }
+        }
+        line = strchr(line, '\n');
+        if (line) line++;
+    }
+}
+
+/* ========================================================================== */
+/* Growable string                                                            */
+/* ========================================================================== */
+
+typedef struct {
+    char   *buf;
+    size_t  len, cap;
+    bool    oom;
+} SsBuf;
+
+static void ss_buf_append(SsBuf *b, const char *s, size_t n) {
+    if (b->oom) return;
+    if (b->len + n + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (b->len + n + 1 > cap) cap *= 2;
+        char *buf = realloc(b->buf, cap);
+        if (!buf) { b->oom = true; return; }
+        b->buf = buf;
+        b->cap = cap;
+    }
+    memcpy(b->buf + b->len, s, n);
+    b->len += n;
+    b->buf[b->len] = '\0';
+}
+
+static void ss_buf_puts(SsBuf *b, const char *s) {
+    ss_buf_append(b, s, strlen(s));
+}
+
+static void ss_buf_printf(SsBuf *b, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n <= 0) return;
+    char *tmp = malloc((size_t)n + 1);
+    if (!tmp) { b->oom = true; return; }
+    va_start(ap, fmt);
+    vsnprintf(tmp, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    ss_buf_append(b, tmp, (size_t)n);
+    free(tmp);
+}
+
+/* Take ownership of the buffer; NULL on allocation failure */
+static char *ss_buf_finish(SsBuf *b) {
+    if (b->oom) {
+        free(b->buf);
+        return NULL;
+    }
+    return b->buf;
+}
+
+/* ========================================================================== */
+/* Tokens                                                                     */
+/* ========================================================================== */
+
+static bool ss_is_ident_start(char c) { return isalpha((unsigned char)c) || c == '_'; }
+static bool ss_is_ident_char(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+/* Skip whitespace, then match `tok` as a whole token. Returns the position
+ * after it, or NULL. */
+static const char *ss_expect(const char *p, const char *tok) {
+    while (isspace((unsigned char)*p)) p++;
+    size_t n = strlen(tok);
+    if (strncmp(p, tok, n) != 0) return NULL;
+    if (ss_is_ident_char(tok[n - 1]) && ss_is_ident_char(p[n])) return NULL;
+    return p + n;
+}
+
+typedef struct {
+    const char *s;
+    int         n;
+    bool        pp;      /* on a preprocessor line */
+} SsTok;
+
+static bool ss_tok_is(const SsTok *t, const char *str) {
+    return (size_t)t->n == strlen(str) && strncmp(t->s, str, (size_t)t->n) == 0;
+}
+
+static bool ss_tok_is_ident(const SsTok *t) { return ss_is_ident_start(t->s[0]); }
+
+/* Split GLSL source into identifiers, numbers, two-character operators
+ * and single characters, skipping comments. Returns the count and a
+ * malloc'd array in *out, or -1 on allocation failure. */
+static int ss_tokenize(const char *src, SsTok **out) {
+    static const char *const ops[] = {
+        "==", "!=", "<=", ">=", "+=", "-=", "*=", "/=", "++", "--", "&&", "||", NULL
+    };
+    int count = 0, cap = 256;
+    SsTok *toks = malloc(sizeof(*toks) * cap);
+    if (!toks) return -1;
+    bool bol = true, pp = false;
+    for (const char *p = src; *p; ) {
+        if (p[0] == '/' && p[1] == '/') {
+            while (*p && *p != '\n') p++;
+            continue;
+        }
+        if (p[0] == '/' && p[1] == '*') {
+            const char *q = strstr(p + 2, "*/");
+            p = q ? q + 2 : p + strlen(p);
+            continue;
+        }
+        if (*p == '\n') {
+            bol = true;
+            pp = false;
+        }
+        if (isspace((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+        if (*p == '#' && bol) pp = true;
+        bol = false;
+
+        const char *q = p + 1;
+        if (ss_is_ident_char(*p) || (*p == '.' && isdigit((unsigned char)p[1]))) {
+            bool number = !ss_is_ident_start(*p);
+            while (ss_is_ident_char(*q) || (number && (*q == '.' ||
+                   ((*q == '+' || *q == '-') && (q[-1] == 'e' || q[-1] == 'E')))))
+                q++;
+        } else {
+            for (int i = 0; ops[i]; i++)
+                if (p[0] == ops[i][0] && p[1] == ops[i][1]) q = p + 2;
+        }
+        if (count == cap) {
+            SsTok *grown = realloc(toks, sizeof(*toks) * (cap *= 2));
+            if (!grown) {
+                free(toks);
+                return -1;
+            }
+            toks = grown;
+        }
+        toks[count++] = (SsTok){ p, (int)(q - p), pp };
+        p = q;
+    }
+    *out = toks;
+    return count;
+}
+
+/* ========================================================================== */
+/* Prelude                                                                    */
+/* ========================================================================== */
+
+#define SS_PRELUDE_FILE "prelude.glsl"
+
+/* True if a line of `src` starts with #version */
+static bool ss_has_version(const char *src) {
+    for (const char *line = src; line && *line; ) {
+        const char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (strncmp(p, "#version", 8) == 0) return true;
+        line = strchr(line, '\n');
+        if (line) line++;
+    }
+    return false;
+}
+
+/* Path of the prelude for a shader: next to the shader, else in the
+ * shaders/ directory beside the executable. malloc'd, or NULL if neither
+ * exists. */
+static char *ss_prelude_path(const char *shader_path) {
+    char *path = malloc(PATH_MAX);
+    if (!path) return NULL;
+
+    const char *slash = strrchr(shader_path, '/');
+    int dir_len = slash ? (int)(slash - shader_path) : 1;
+    snprintf(path, PATH_MAX, "%.*s/%s", dir_len, slash ? shader_path : ".",
+             SS_PRELUDE_FILE);
+    if (access(path, R_OK) == 0) return path;
+
+    char exe[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len > 0) {
+        exe[len] = '\0';
+        char *exe_slash = strrchr(exe, '/');
+        if (exe_slash) *exe_slash = '\0';
+        if (snprintf(path, PATH_MAX, "%s/shaders/%s", exe, SS_PRELUDE_FILE) < PATH_MAX &&
+            access(path, R_OK) == 0) return path;
+    }
+    free(path);
+    return NULL;
+}
+
+/*
+ * Source to compile for a shader, malloc'd: `src` itself when it has a
+ * #version line, otherwise `prelude` + "#line 1" + `src` so compile errors
+ * keep the shader's own line numbers. NULL (with a message naming `name`)
+ * if the prelude is needed but missing or older than the shader requires.
+ */
+static char *ss_apply_prelude(const char *src, const char *prelude, const char *name) {
+    if (ss_has_version(src)) return strdup(src);
+
+    if (!prelude) {
+        fprintf(stderr, "%s: no #version line and no %s found\n", name, SS_PRELUDE_FILE);
+        return NULL;
+    }
+    ShaderDirectives dir;
+    ss_parse_directives(src, &dir);
+    const char *v = strstr(prelude, "#define SS_PRELUDE_VERSION");
+    int version = v ? atoi(v + strlen("#define SS_PRELUDE_VERSION")) : 0;
+    if (dir.prelude > version) {
+        fprintf(stderr, "%s: needs prelude version %d, %s is version %d\n",
+                name, dir.prelude, SS_PRELUDE_FILE, version);
+        return NULL;
+    }
+
+    SsBuf out = {0};
+    ss_buf_puts(&out, prelude);
+    ss_buf_puts(&out, "\n#line 1\n");
+    ss_buf_puts(&out, src);
+    return ss_buf_finish(&out);
+}
+
+/* ========================================================================== */
+/* Compute tile path                                                          */
+/* ========================================================================== */
+
+#define SS_TILE 16
+
+static bool ss_gl_has_compute(void) {
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    return major > 4 || (major == 4 && minor >= 3);
+}
+
+static const char *SS_COMPUTE_HEADER =
+    "#version 430 core\n"
+    "layout(local_size_x = %d, local_size_y = %d) in;\n"
+    "layout(rgba8, binding = 0) uniform writeonly image2D ss_out;\n"
+    "uniform bool ss_flip_y;   /* v_texcoord.y runs top-down (preview) */\n"
+    "uniform int ss_interleave;\n"
+    "uniform int ss_phase;\n"
+    "uniform ivec2 ss_tile_offset;\n"
+    "#define SS_TILE %d\n"
+    "#define SS_RADIUS %d\n"
+    "#define SS_SPAN (SS_TILE + 2 * SS_RADIUS + 1)\n"
+    "shared vec4 ss_tile[SS_SPAN * SS_SPAN];\n"
+    "ivec2 ss_origin;          /* texel coordinate of ss_tile[0] */\n"
+    "ivec2 ss_size;\n"
+    "vec2 v_texcoord;\n"
+    "vec4 frag_color;\n"
+    "vec4 ss_fetch(vec2 uv);\n"
+    "vec4 ss_gather_tile(vec2 uv);\n"
+    "#line 1\n";
+
+static const char *SS_COMPUTE_TRAILER =
+    "\n"
+    "vec4 ss_fetch(vec2 uv) {\n"
+    "    vec2 p = uv * vec2(ss_size) - 0.5 - vec2(ss_origin);\n"
+    "    vec2 f = floor(p);\n"
+    "    ivec2 i = ivec2(f);\n"
+    "    if (any(lessThan(i, ivec2(0))) || any(greaterThanEqual(i, ivec2(SS_SPAN - 1))))\n"
+    "        return textureLod(u_screen, uv, 0.0);\n"
+    "    vec2 w = p - f;\n"
+    "    int k = i.y * SS_SPAN + i.x;\n"
+    "    return mix(mix(ss_tile[k], ss_tile[k + 1], w.x),\n"
+    "               mix(ss_tile[k + SS_SPAN], ss_tile[k + SS_SPAN + 1], w.x), w.y);\n"
+    "}\n"
+    "\n"
+    "#ifdef SS_PRELUDE_VERSION\n"
+    "vec4 ss_gather_tile(vec2 uv) {   /* textureGather of the luma channel */\n"
+    "    ivec2 i = ivec2(floor(uv * vec2(ss_size) - 0.5)) - ss_origin;\n"
+    "    if (any(lessThan(i, ivec2(0))) || any(greaterThanEqual(i, ivec2(SS_SPAN - 1))))\n"
+    "        return textureGather(u_screen, uv, SS_LUMA);\n"
+    "    int k = i.y * SS_SPAN + i.x;\n"
+    "    return vec4(ss_tile[k + SS_SPAN][SS_LUMA], ss_tile[k + SS_SPAN + 1][SS_LUMA],\n"
+    "                ss_tile[k + 1][SS_LUMA], ss_tile[k][SS_LUMA]);\n"
+    "}\n"
+    "#endif\n"
+    "\n"
+    "void main() {\n"
+    "    ss_size = textureSize(u_screen, 0);\n"
+    "    ivec2 tile = ivec2(gl_WorkGroupID.xy) + ss_tile_offset;\n"
+    "    /* barrier() may not sit in control flow, so an idle tile skips the\n"
+    "     * load and returns after it */\n"
+    "    bool mine = ss_interleave < 2 || (tile.x + tile.y) % ss_interleave == ss_phase;\n"
+    "    ivec2 g0 = tile * SS_TILE;\n"
+    "    ss_origin = ivec2(g0.x, ss_flip_y ? ss_size.y - g0.y - SS_TILE : g0.y)\n"
+    "              - SS_RADIUS;\n"
+    "    for (int i = mine ? int(gl_LocalInvocationIndex) : SS_SPAN * SS_SPAN;\n"
+    "         i < SS_SPAN * SS_SPAN; i += SS_TILE * SS_TILE) {\n"
+    "        ivec2 t = clamp(ss_origin + ivec2(i % SS_SPAN, i / SS_SPAN),\n"
+    "                        ivec2(0), ss_size - 1);\n"
+    "        ss_tile[i] = texelFetch(u_screen, t, 0);\n"
+    "    }\n"
+    "    barrier();\n"
+    "    if (!mine) return;\n"
+    "\n"
+    "    ivec2 gid = g0 + ivec2(gl_LocalInvocationID.xy);\n"
+    "    if (any(greaterThanEqual(gid, ss_size))) return;\n"
+    "    v_texcoord = (vec2(gid) + 0.5) / vec2(ss_size);\n"
+    "    if (ss_flip_y) v_texcoord.y = 1.0 - v_texcoord.y;\n"
+    "    frag_color = vec4(0.0);\n"
+    "    ss_user_main();\n"
+    "    imageStore(ss_out, gid, frag_color);\n"
+    "}\n";
+
+/*
+ * Append a post-process fragment shader to `out` with its engine interface
+ * turned into globals: main() becomes `main_name`, `in vec2 v_texcoord;`
+ * and `out vec4 frag_color;` are dropped for the caller to declare, and
+ * texture(u_screen, ...) calls become `fetch_name`(...). #version and
+ * #extension lines are dropped for the caller's header to provide.
+ * Returns false unless the shader has the shape every bundled shader has
+ * (a main and a frag_color output).
+ */
+static bool ss_rewrite_fragment(const char *src, SsBuf *out,
+                                const char *main_name, const char *fetch_name) {
+    bool saw_main = false, saw_out = false;
+    bool bol = true;   /* only whitespace since the last newline */
+    const char *p = src;
+    while (*p) {
+        const char *q;
+        if (p[0] == '/' && p[1] == '/') {
+            q = strchr(p, '\n');
+            if (!q) q = p + strlen(p);
+            ss_buf_append(out, p, (size_t)(q - p));
+            p = q;
+        } else if (p[0] == '/' && p[1] == '*') {
+            q = strstr(p + 2, "*/");
+            q = q ? q + 2 : p + strlen(p);
+            ss_buf_append(out, p, (size_t)(q - p));
+            p = q;
+        } else if (*p == '#' && bol) {
+            q = strchr(p, '\n');
+            if (!q) q = p + strlen(p);
+            /* #extension may not follow the header's declarations; keep
+             * the line for numbering */
+            if (strncmp(p, "#version", 8) != 0 && strncmp(p, "#extension", 10) != 0)
+                ss_buf_append(out, p, (size_t)(q - p));
+            p = q;
+        } else if (ss_is_ident_start(*p)) {
+            q = p;
+            while (ss_is_ident_char(*q)) q++;
+            size_t n = (size_t)(q - p);
+            const char *r1, *r2, *r3;
+            if (n == 4 && strncmp(p, "main", 4) == 0) {
+                ss_buf_puts(out, main_name);
+                saw_main = true;
+                p = q;
+            } else if (n == 2 && strncmp(p, "in", 2) == 0 &&
+                       (r1 = ss_expect(q, "vec2")) && (r2 = ss_expect(r1, "v_texcoord")) &&
+                       (r3 = ss_expect(r2, ";"))) {
+                p = r3;   /* now a global set per invocation */
+            } else if (n == 3 && strncmp(p, "out", 3) == 0 &&
+                       (r1 = ss_expect(q, "vec4")) && (r2 = ss_expect(r1, "frag_color")) &&
+                       (r3 = ss_expect(r2, ";"))) {
+                saw_out = true;
+                p = r3;
+            } else if (n == 7 && strncmp(p, "texture", 7) == 0 &&
+                       (r1 = ss_expect(q, "(")) && (r2 = ss_expect(r1, "u_screen")) &&
+                       (r3 = ss_expect(r2, ","))) {
+                ss_buf_printf(out, "%s(", fetch_name);
+                p = r3;
+            } else {
+                ss_buf_append(out, p, n);
+                p = q;
+            }
+            bol = false;
+        } else {
+            if (*p == '\n') bol = true;
+            else if (!isspace((unsigned char)*p)) bol = false;
+            ss_buf_append(out, p, 1);
+            p++;
+        }
+    }
+    return saw_main && saw_out;
+}
+
+/*
+ * Rewrite a post-process fragment shader into a compute shader (see top of
+ * file). Returns NULL for shaders ss_rewrite_fragment cannot handle, and
+ * the caller keeps the fragment path.
+ */
+static char *ss_build_compute_source(const char *src, int radius) {
+    SsBuf out = {0};
+    ss_buf_printf(&out, SS_COMPUTE_HEADER, SS_TILE, SS_TILE, SS_TILE, radius);
+    bool ok = ss_rewrite_fragment(src, &out, "ss_user_main", "ss_fetch");
+    ss_buf_puts(&out, SS_COMPUTE_TRAILER);
+    char *result = ss_buf_finish(&out);
+    if (result && !ok) {
+        free(result);
+        return NULL;
+    }
+    return result;
+}
+
+/* ========================================================================== */
+/* Single pass                                                                */
+/* ========================================================================== */
+
+static const char *SS_SINGLE_PASS_HEADER =
+    "#version 330 core\n"
+    "#extension GL_ARB_gpu_shader5 : enable\n"
+    "layout(location = 0, index = 0) out vec4 frag_color;\n"
+    "layout(location = 0, index = 1) out vec4 ss_coverage;\n"
+    "vec2 v_texcoord;\n"
+    "vec4 ss_window_fetch(vec2 uv);\n"
+    "#line 1\n";
+
+/* Like composite.frag, with the effect applied to the window's pixel
+ * before it is blended */
+static const char *SS_SINGLE_PASS_TRAILER =
+    "\n"
+    "uniform sampler2D u_texture;\n"
+    "uniform vec4 ss_window_rect;   /* viewport the window is drawn into */\n"
+    "vec4 ss_window_pixel;\n"
+    "vec4 ss_window_fetch(vec2 uv) { return ss_window_pixel; }\n"
+    "void main() {\n"
+    "    vec2 tc = (gl_FragCoord.xy - ss_window_rect.xy) / ss_window_rect.zw;\n"
+    "    vec4 c = texture(u_texture, vec2(tc.x, 1.0 - tc.y));\n"
+    "    ss_window_pixel = vec4(c.rgb, dot(c.rgb, vec3(0.299, 0.587, 0.114)));\n"
+    "    v_texcoord = gl_FragCoord.xy / u_resolution;\n"
+    "    ss_user_main();\n"
+    "    frag_color.a = c.a;\n"
+    "    ss_coverage = vec4(c.a);\n"
+    "}\n";
+
+/*
+ * Rewrite a pointwise post-process shader into a variant of composite.frag
+ * (see top of file). Every texture(u_screen, ...) returns the pixel of the
+ * window being drawn, premultiplied, with its luma in alpha as in the
+ * composited screen. Returns NULL for shaders ss_rewrite_fragment cannot
+ * handle.
+ */
+SS_UNUSED static char *ss_build_single_pass_source(const char *src) {
+    SsBuf out = {0};
+    ss_buf_puts(&out, SS_SINGLE_PASS_HEADER);
+    bool ok = ss_rewrite_fragment(src, &out, "ss_user_main", "ss_window_fetch");
+    ss_buf_puts(&out, SS_SINGLE_PASS_TRAILER);
+    char *result = ss_buf_finish(&out);
+    if (result && !ok) {
+        free(result);
+        return NULL;
+    }
+    return result;
+}
+
+/* ========================================================================== */
+/* Per-window shaders                                                         */
+/* ========================================================================== */
+
+#define SS_WINDOW_UNIT 3
+
+static const char *SS_WINDOW_HEADER =
+    "#version 330 core\n"
+    "#extension GL_ARB_gpu_shader5 : enable\n"
+    "layout(location = 0, index = 0) out vec4 frag_color;\n"
+    "layout(location = 0, index = 1) out vec4 ss_coverage;\n"
+    "vec2 v_texcoord;\n"
+    "vec4 ss_screen_fetch(vec2 uv);\n"
+    "#line 1\n";
+
+/* Like composite.frag, with u_screen the window's prepared copy; the
+ * pixmap itself is read for coverage only */
+static const char *SS_WINDOW_TRAILER =
+    "\n"
+    "uniform sampler2D ss_window_tex;\n"
+    "uniform vec4 ss_window_rect;   /* viewport the window is drawn into */\n"
+    "vec4 ss_screen_fetch(vec2 uv) { return texture(u_screen, uv); }\n"
+    "void main() {\n"
+    "    v_texcoord = (gl_FragCoord.xy - ss_window_rect.xy) / ss_window_rect.zw;\n"
+    "    float a = texture(ss_window_tex, vec2(v_texcoord.x, 1.0 - v_texcoord.y)).a;\n"
+    "    ss_user_main();\n"
+    "    vec3 c = clamp(frag_color.rgb, 0.0, 1.0);\n"
+    "    frag_color = vec4(c, dot(c, vec3(0.299, 0.587, 0.114)));\n"
+    "    ss_coverage = vec4(a);\n"
+    "}\n";
+
+/*
+ * Rewrite a post-process shader to shade a single window as it is
+ * composited (see top of file). Returns NULL for shaders
+ * ss_rewrite_fragment cannot handle.
+ */
+SS_UNUSED static char *ss_build_window_source(const char *src) {
+    SsBuf out = {0};
+    ss_buf_puts(&out, SS_WINDOW_HEADER);
+    bool ok = ss_rewrite_fragment(src, &out, "ss_user_main", "ss_screen_fetch");
+    ss_buf_puts(&out, SS_WINDOW_TRAILER);
+    char *result = ss_buf_finish(&out);
+    if (result && !ok) {
+        free(result);
+        return NULL;
+    }
+    return result;
+}
+
+/* ========================================================================== */
+/* Effect stacks                                                              */
+/* ========================================================================== */
+
+#define SS_MAX_STAGES 8
+
+/* Prelude helpers that read u_screen around their argument */
+static const char *const SS_SCREEN_HELPERS[] = {
+    "ss_luma_at", "ss_gather_luma", "ss_luma3x3", "ss_luma3x3_rgb", "ss_luma4x4",
+    "ss_text_detect", NULL
+};
+
+static bool ss_is_assign_op(const SsTok *t) {
+    return ss_tok_is(t, "=") || ss_tok_is(t, "+=") || ss_tok_is(t, "-=") ||
+           ss_tok_is(t, "*=") || ss_tok_is(t, "/=") || ss_tok_is(t, "++") ||
+           ss_tok_is(t, "--");
+}
+
+/* True if the shader (without the prelude) reads `name` anywhere */
+SS_UNUSED static bool ss_uses_ident(const char *src, const char *name) {
+    SsTok *t;
+    int n = ss_tokenize(src, &t);
+    bool found = false;
+    for (int i = 0; i < n && !found; i++) found = !t[i].pp && ss_tok_is(&t[i], name);
+    if (n >= 0) free(t);
+    return n < 0 || found;
+}
+
+/*
+ * True if a stage only samples u_screen at its own pixel, so it can run on
+ * the output of the stage before it in the same program. Either it says so
+ * (`pointwise`), or every use of u_screen is texture(u_screen, v_texcoord)
+ * or texture(u_screen, uv) with `vec2 uv = v_texcoord;` never changed
+ * afterwards, it calls none of the neighbourhood helpers, and it does not
+ * read u_prev.
+ */
+SS_UNUSED static bool ss_stage_is_local(const char *src, const ShaderDirectives *dir) {
+    if (dir->pointwise) return true;
+    SsTok *t;
+    int n = ss_tokenize(src, &t);
+    if (n < 0) return false;
+
+    /* Names declared as `vec2 name = v_texcoord;`, unless some other
+     * declaration or a write touches them */
+    const SsTok *alias[16];
+    bool alias_ok[16];
+    int nalias = 0;
+    for (int i = 1; i + 1 < n; i++) {
+        if (t[i].pp || !ss_tok_is_ident(&t[i]) || !ss_tok_is(&t[i - 1], "vec2")) continue;
+        bool is_alias = i + 3 < n && ss_tok_is(&t[i + 1], "=") &&
+                        ss_tok_is(&t[i + 2], "v_texcoord") && ss_tok_is(&t[i + 3], ";");
+        int k = 0;
+        while (k < nalias && !(alias[k]->n == t[i].n &&
+                               strncmp(alias[k]->s, t[i].s, (size_t)t[i].n) == 0)) k++;
+        if (k == nalias) {
+            if (nalias == 16) continue;
+            alias[nalias] = &t[i];
+            alias_ok[nalias++] = is_alias;
+        } else if (!is_alias) {
+            alias_ok[k] = false;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (t[i].pp || !ss_tok_is_ident(&t[i])) continue;
+        for (int k = 0; k < nalias; k++) {
+            if (alias[k]->n != t[i].n || strncmp(alias[k]->s, t[i].s, (size_t)t[i].n) != 0)
+                continue;
+            if (i > 0 && ss_tok_is(&t[i - 1], "vec2")) break;   /* its declaration */
+            bool written = (i + 1 < n && (ss_is_assign_op(&t[i + 1]) ||
+                                          ss_tok_is(&t[i + 1], "["))) ||
+                           (i > 0 && (ss_tok_is(&t[i - 1], "++") || ss_tok_is(&t[i - 1], "--"))) ||
+                           (i + 3 < n && ss_tok_is(&t[i + 1], ".") && ss_is_assign_op(&t[i + 3]));
+            if (written) alias_ok[k] = false;
+        }
+    }
+
+    bool local = true;
+    for (int i = 0; i < n && local; i++) {
+        if (t[i].pp || !ss_tok_is_ident(&t[i])) continue;
+        if (ss_tok_is(&t[i], "u_prev")) local = false;
+        for (int h = 0; SS_SCREEN_HELPERS[h]; h++)
+            if (ss_tok_is(&t[i], SS_SCREEN_HELPERS[h])) local = false;
+        if (!ss_tok_is(&t[i], "u_screen")) continue;
+        local = i >= 2 && i + 3 < n && ss_tok_is(&t[i - 2], "texture") &&
+                ss_tok_is(&t[i - 1], "(") && ss_tok_is(&t[i + 1], ",") &&
+                ss_tok_is(&t[i + 3], ")");
+        if (!local) break;
+        local = ss_tok_is(&t[i + 2], "v_texcoord");
+        for (int k = 0; k < nalias && !local; k++)
+            local = alias_ok[k] && alias[k]->n == t[i + 2].n &&
+                    strncmp(alias[k]->s, t[i + 2].s, (size_t)t[i + 2].n) == 0;
+    }
+    free(t);
+    return local;
+}
+
+/* Index of the identifier token t in names[], or -1 */
+static int ss_find_name(const SsTok *names, int count, const SsTok *t) {
+    for (int i = 0; i < count; i++)
+        if (names[i].n == t->n && strncmp(names[i].s, t->s, (size_t)t->n) == 0) return i;
+    return -1;
+}
+
+/*
+ * Append stage `index` of a fused program to `out`. Its global names
+ * (functions, constants, structs, macros, main) get the prefix ss_s<index>_
+ * so stages cannot collide. Uniforms keep their names, so params reach
+ * every stage, and a uniform an earlier stage already declared is not
+ * declared again (`seen` holds the names so far). screenshader pragmas
+ * are dropped. Unless `first`, texture(u_screen, ...) returns the previous
+ * stage's output. Returns false on allocation failure.
+ */
+static bool ss_append_stage(SsBuf *out, const char *src, int index, bool first,
+                            SsTok *seen, int *nseen, int max_seen) {
+    SsTok *t;
+    int n = ss_tokenize(src, &t);
+    if (n < 0) return false;
+    SsTok *names = malloc(sizeof(*names) * (size_t)(n + 1));
+    bool *drop = calloc((size_t)n + 1, sizeof(*drop));
+    if (!names || !drop) {
+        free(t);
+        free(names);
+        free(drop);
+        return false;
+    }
+
+    /* Global declarations: at depth 0, an identifier after a type and
+     * before ( = ; [ or , -- and #define names */
+    int nnames = 0, depth = 0, stmt = 0;
+    bool uniform = false, precision = false, fresh = true;
+    for (int i = 0; i < n; i++) {
+        if (t[i].pp) {
+            if (ss_tok_is(&t[i], "#") && i + 2 < n && t[i + 2].pp &&
+                ss_tok_is(&t[i + 1], "define") && ss_find_name(names, nnames, &t[i + 2]) < 0)
+                names[nnames++] = t[i + 2];
+            if (ss_tok_is(&t[i], "#") && i + 2 < n && t[i + 2].pp &&
+                ss_tok_is(&t[i + 1], "pragma") && ss_tok_is(&t[i + 2], "screenshader"))
+                for (int j = i; j < n && t[j].pp && (j == i || !ss_tok_is(&t[j], "#")); j++)
+                    drop[j] = true;
+            continue;
+        }
+        if (depth == 0 && fresh) {
+            stmt = i;
+            uniform = precision = fresh = false;
+        }
+        if (ss_tok_is(&t[i], "{") || ss_tok_is(&t[i], "(")) depth++;
+        else if (ss_tok_is(&t[i], "}") || ss_tok_is(&t[i], ")")) depth--;
+        if (depth != 0) continue;
+        if (ss_tok_is(&t[i], "uniform")) uniform = true;
+        if (ss_tok_is(&t[i], "precision")) precision = true;
+        if (ss_tok_is(&t[i], ";") || ss_tok_is(&t[i], "}")) {
+            fresh = true;
+            if (!uniform || !ss_tok_is(&t[i], ";")) continue;
+            /* A uniform declaration: keep it only if it adds a name */
+            bool adds = false;
+            for (int j = stmt + 1; j < i; j++) {
+                if (!ss_tok_is_ident(&t[j]) || !ss_tok_is_ident(&t[j - 1])) continue;
+                if (!ss_tok_is(&t[j + 1], ";") && !ss_tok_is(&t[j + 1], ",") &&
+                    !ss_tok_is(&t[j + 1], "[")) continue;
+                if (ss_find_name(seen, *nseen, &t[j]) < 0 && *nseen < max_seen) {
+                    seen[(*nseen)++] = t[j];
+                    adds = true;
+                }
+            }
+            if (!adds)
+                for (int j = stmt; j <= i; j++) drop[j] = true;
+            continue;
+        }
+        if (uniform || precision || i == 0 || i + 1 >= n) continue;
+        if (!ss_tok_is_ident(&t[i]) || !ss_tok_is_ident(&t[i - 1])) continue;
+        const SsTok *next = &t[i + 1];
+        if (ss_tok_is(next, "(") || ss_tok_is(next, "=") || ss_tok_is(next, ";") ||
+            ss_tok_is(next, "[") || ss_tok_is(next, ",") ||
+            (ss_tok_is(next, "{") && ss_tok_is(&t[i - 1], "struct"))) {
+            if (ss_find_name(names, nnames, &t[i]) < 0) names[nnames++] = t[i];
+        }
+    }
+
+    const char *at = src;
+    for (int i = 0; i < n; i++) {
+        ss_buf_append(out, at, (size_t)(t[i].s - at));
+        at = t[i].s + t[i].n;
+        if (drop[i]) continue;
+        if (!first && i + 3 < n && ss_tok_is(&t[i], "texture") && ss_tok_is(&t[i + 1], "(") &&
+            ss_tok_is(&t[i + 2], "u_screen") && ss_tok_is(&t[i + 3], ",")) {
+            ss_buf_puts(out, "ss_stage_input(");
+            at = t[i + 3].s + 1;
+            i += 3;
+        } else if (ss_tok_is_ident(&t[i]) && ss_find_name(names, nnames, &t[i]) >= 0 &&
+                   (i == 0 || !ss_tok_is(&t[i - 1], "."))) {
+            ss_buf_printf(out, "ss_s%d_%.*s", index, t[i].n, t[i].s);
+        } else {
+            ss_buf_append(out, t[i].s, (size_t)t[i].n);
+        }
+    }
+    ss_buf_puts(out, at);
+    free(t);
+    free(names);
+    free(drop);
+    return true;
+}
+
+#define SS_STACK_FIRST 1   /* the pass reads the composited screen */
+#define SS_STACK_LAST  2   /* the pass writes the final output */
+
+/*
+ * Fuse consecutive stages of an effect stack into the source of one pass:
+ * the prelude once, each stage renamed apart (see ss_append_stage), and a
+ * main that runs them in order, feeding each the previous one's colour.
+ * The first stage's directives apply to the pass, plus every stage's
+ * textures; a `pointwise` pass (all stages pointwise) only if it is the
+ * whole stack, and a colour LUT only in the last pass. A pass that feeds
+ * another stores luma in alpha, as the composited screen does. NULL (with
+ * a message) if a stage has its own #version or needs a newer prelude.
+ */
+SS_UNUSED static char *ss_build_stack_source(const char *prelude, int count, char *const *srcs,
+                                   const char *const *names, int flags) {
+    if (!prelude) {
+        fprintf(stderr, "%s: effect stacks need %s\n", names[0], SS_PRELUDE_FILE);
+        return NULL;
+    }
+    const char *v = strstr(prelude, "#define SS_PRELUDE_VERSION");
+    int version = v ? atoi(v + strlen("#define SS_PRELUDE_VERSION")) : 0;
+
+    SsBuf out = {0};
+    ss_buf_puts(&out, prelude);
+    ss_buf_puts(&out, "\n");
+    bool pointwise = (flags & SS_STACK_FIRST) && (flags & SS_STACK_LAST);
+    bool lut = false;
+    for (int i = 0; i < count; i++) {
+        if (ss_has_version(srcs[i])) {
+            fprintf(stderr, "%s: has its own #version and cannot be stacked\n", names[i]);
+            free(out.buf);
+            return NULL;
+        }
+        ShaderDirectives d;
+        ss_parse_directives(srcs[i], &d);
+        if (d.prelude > version) {
+            fprintf(stderr, "%s: needs prelude version %d, %s is version %d\n",
+                    names[i], d.prelude, SS_PRELUDE_FILE, version);
+            free(out.buf);
+            return NULL;
+        }
+        if (i == 0 && d.kernel_radius > 0)
+            ss_buf_printf(&out, "#pragma screenshader kernel_radius %d\n", d.kernel_radius);
+        if (i == 0 && count == 1 && d.interleave > 0)
+            ss_buf_printf(&out, "#pragma screenshader interleave %d\n", d.interleave);
+        if (d.lut_func[0] && !lut && (flags & SS_STACK_LAST)) {
+            ss_buf_printf(&out, "#pragma screenshader lut ss_s%d_%s %d\n",
+                          i, d.lut_func, d.lut_size);
+            lut = true;
+        }
+        for (int k = 0; k < d.aux_count; k++)
+            ss_buf_printf(&out, "#pragma screenshader texture %s %s %s\n",
+                          d.aux[k].name, d.aux[k].kind, d.aux[k].arg);
+        pointwise &= d.pointwise;
+    }
+    if (pointwise) ss_buf_puts(&out, "#pragma screenshader pointwise\n");
+    if (count > 1)
+        ss_buf_puts(&out, "vec4 ss_stage_in = vec4(0.0);   /* the previous stage's output */\n"
+                          "vec4 ss_stage_input(vec2 uv) { return ss_stage_in; }\n");
+
+    SsTok seen[64];
+    int nseen = 0;
+    for (int i = 0; i < count; i++) {
+        /* Source string i + 1 in compile errors */
+        ss_buf_printf(&out, "#line 1 %d\n", i + 1);
+        if (!ss_append_stage(&out, srcs[i], i, i == 0, seen, &nseen, 64)) out.oom = true;
+        ss_buf_puts(&out, "\n");
+    }
+
+    ss_buf_puts(&out, "void main() {\n");
+    for (int i = 0; i < count; i++) {
+        if (i > 0)
+            ss_buf_puts(&out, "    ss_stage_in.rgb = clamp(frag_color.rgb, 0.0, 1.0);\n"
+                              "    ss_stage_in.a = ss_luma601(ss_stage_in.rgb);\n");
+        ss_buf_printf(&out, "    ss_s%d_main();\n", i);
+    }
+    if (!(flags & SS_STACK_LAST))
+        ss_buf_puts(&out, "    frag_color.a = ss_luma601(frag_color.rgb);\n");
+    ss_buf_puts(&out, "}\n");
+    return ss_buf_finish(&out);
+}
+
+/* ========================================================================== */
+/* Auxiliary textures                                                         */
+/* ========================================================================== */
+
+#define SS_AUX_UNIT        8    /* units 8..15 are reserved for them */
+#define SS_AUX_CACHE_SIZE  16
+#define SS_MAX_WHITE_NOISE 1024
+#define SS_MAX_BLUE_NOISE  64   /* generation is quadratic in N * N */
+
+typedef struct {
+    char  *key;        /* kind + argument (image path resolved) */
+    GLuint tex;
+} SsAuxEntry;
+
+typedef struct {
+    SsAuxEntry entries[SS_AUX_CACHE_SIZE];
+    int        count;
+    bool       mipmaps;    /* trilinear filtering for images */
+} SsAuxCache;
+
+/* A program's auxiliary textures, resolved when it is linked */
+typedef struct {
+    GLuint tex[SS_MAX_AUX];    /* on unit SS_AUX_UNIT + i, 0 = unused */
+} SsAuxBinding;
+
+static uint32_t ss_xorshift(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/* Void-and-cluster state for one blue-noise channel */
+typedef struct {
+    int            n;
+    float         *kernel;   /* toroidal Gaussian, indexed by (dy, dx) mod n */
+    float         *energy;   /* kernel summed over every set texel */
+    unsigned char *bits;
+} SsVoidCluster;
+
+static void ss_vc_set(SsVoidCluster *vc, int p, bool on) {
+    int n = vc->n, px = p % n, py = p / n;
+    /* The kernel is below 1e-3 past 6 texels, so only that window changes */
+    int r = n > 13 ? 6 : n / 2, lo = n > 13 ? -6 : r - n + 1;
+    float sign = on ? 1.0f : -1.0f;
+    vc->bits[p] = on;
+    for (int dy = lo; dy <= r; dy++) {
+        int ky = (dy + n) % n;
+        float *e = vc->energy + ((py + ky) % n) * n;
+        for (int dx = lo; dx <= r; dx++) {
+            int kx = (dx + n) % n;
+            e[(px + kx) % n] += sign * vc->kernel[ky * n + kx];
+        }
+    }
+}
+
+/* Tightest cluster: the set texel with the most energy. Largest void: the
+ * empty texel with the least. */
+static int ss_vc_extreme(const SsVoidCluster *vc, bool cluster) {
+    int best = -1;
+    float best_e = 0.0f;
+    for (int i = 0; i < vc->n * vc->n; i++) {
+        if (vc->bits[i] != cluster) continue;
+        float e = cluster ? vc->energy[i] : -vc->energy[i];
+        if (best < 0 || e > best_e) { best_e = e; best = i; }
+    }
+    return best;
+}
+
+/*
+ * One channel of void-and-cluster blue noise (Ulichney): every texel gets a
+ * distinct rank, placed where the ranks before it leave the largest void,
+ * so any threshold gives an evenly spread dot pattern with no low-frequency
+ * clumps. The kernel wraps around, so the tile repeats seamlessly. Writes
+ * rank * 256 / (n * n) to out[i * stride].
+ */
+static int ss_blue_noise_channel(int n, uint32_t seed, unsigned char *out, int stride) {
+    int N = n * n;
+    SsVoidCluster vc = { n, malloc(sizeof(float) * N), calloc(N, sizeof(float)), calloc(N, 1) };
+    float *initial_energy = malloc(sizeof(float) * N);
+    unsigned char *initial_bits = malloc(N);
+    if (!vc.kernel || !vc.energy || !vc.bits || !initial_energy || !initial_bits) {
+        free(vc.kernel); free(vc.energy); free(vc.bits);
+        free(initial_energy); free(initial_bits);
+        return -1;
+    }
+
+    for (int y = 0; y < n; y++)
+        for (int x = 0; x < n; x++) {
+            int dx = x < n - x ? x : n - x;
+            int dy = y < n - y ? y : n - y;
+            vc.kernel[y * n + x] = expf(-(float)(dx * dx + dy * dy) / (2.0f * 1.5f * 1.5f));
+        }
+
+    /* Initial pattern: 10% random texels, relaxed until moving the tightest
+     * cluster into the largest void no longer changes anything */
+    uint32_t rng = seed ? seed : 1;
+    int ones = N / 10 > 0 ? N / 10 : 1;
+    for (int placed = 0; placed < ones; ) {
+        int p = (int)(ss_xorshift(&rng) % (uint32_t)N);
+        if (!vc.bits[p]) { ss_vc_set(&vc, p, true); placed++; }
+    }
+    for (int iter = 0; iter < N; iter++) {
+        int cluster = ss_vc_extreme(&vc, true);
+        ss_vc_set(&vc, cluster, false);
+        int gap = ss_vc_extreme(&vc, false);
+        ss_vc_set(&vc, gap, true);
+        if (gap == cluster) break;
+    }
+    memcpy(initial_bits, vc.bits, N);
+    memcpy(initial_energy, vc.energy, sizeof(float) * N);
+
+    /* Ranks below the initial pattern: peel off the tightest clusters */
+    for (int r = ones - 1; r >= 0; r--) {
+        int cluster = ss_vc_extreme(&vc, true);
+        ss_vc_set(&vc, cluster, false);
+        out[cluster * stride] = (unsigned char)((long)r * 256 / N);
+    }
+    /* Ranks above it: fill the largest voids */
+    memcpy(vc.bits, initial_bits, N);
+    memcpy(vc.energy, initial_energy, sizeof(float) * N);
+    for (int r = ones; r < N; r++) {
+        int gap = ss_vc_extreme(&vc, false);
+        ss_vc_set(&vc, gap, true);
+        out[gap * stride] = (unsigned char)((long)r * 256 / N);
+    }
+
+    free(vc.kernel); free(vc.energy); free(vc.bits);
+    free(initial_energy); free(initial_bits);
+    return 0;
+}
+
+/* Binary PPM (P6, maxval 255) to a malloc'd RGB buffer */
+static unsigned char *ss_read_ppm(FILE *f, int *out_w, int *out_h) {
+    char magic[3];
+    if (fscanf(f, "%2s", magic) != 1 || strcmp(magic, "P6") != 0) {
+        fprintf(stderr, "Invalid PPM: expected P6 magic\n"); return NULL;
+    }
+    int c;
+    while ((c = fgetc(f)) != EOF) {
+        if (c == '#') { while ((c = fgetc(f)) != EOF && c != '\n'); }
+        else if (c > ' ') { ungetc(c, f); break; }
+    }
+    int w, h, maxval;
+    if (fscanf(f, "%d %d %d", &w, &h, &maxval) != 3 || w <= 0 || h <= 0 || maxval != 255) {
+        fprintf(stderr, "Invalid PPM header\n"); return NULL;
+    }
+    fgetc(f);
+    unsigned char *rgb = malloc((size_t)w * h * 3);
+    if (!rgb) return NULL;
+    size_t n = fread(rgb, 1, (size_t)w * h * 3, f);
+    if (n != (size_t)w * h * 3) { free(rgb); return NULL; }
+    *out_w = w; *out_h = h;
+    return rgb;
+}
+
+/* Generate or load the texture for one declaration. 0 on failure. */
+static GLuint ss_make_aux_texture(const SsAuxDecl *decl, const char *path, bool mipmaps) {
+    int w = 0, h = 0;
+    GLenum format = GL_RGBA;
+    unsigned char *pixels = NULL;
+    bool noise = strcmp(decl->kind, "whitenoise") == 0 || strcmp(decl->kind, "bluenoise") == 0;
+
+    if (noise) {
+        bool blue = decl->kind[0] == 'b';
+        int n = atoi(decl->arg);
+        int max = blue ? SS_MAX_BLUE_NOISE : SS_MAX_WHITE_NOISE;
+        if (n < 1 || n > max) {
+            fprintf(stderr, "%s %s: size must be 1..%d\n", decl->kind, decl->arg, max);
+            return 0;
+        }
+        w = h = n;
+        pixels = malloc((size_t)n * n * 4);
+        if (!pixels) return 0;
+        uint32_t rng = 0x9e3779b9u;
+        for (int ch = 0; ch < 4; ch++) {
+            if (!blue) {
+                for (int i = 0; i < n * n; i++)
+                    pixels[i * 4 + ch] = (unsigned char)(ss_xorshift(&rng) >> 24);
+            } else if (ss_blue_noise_channel(n, 0x2545f491u * (uint32_t)(ch + 1),
+                                             pixels + ch, 4) < 0) {
+                free(pixels);
+                return 0;
+            }
+        }
+    } else if (strcmp(decl->kind, "image") == 0) {
+        FILE *f = fopen(path, "rb");
+        if (!f) {
+            fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+            return 0;
+        }
+        pixels = ss_read_ppm(f, &w, &h);
+        fclose(f);
+        if (!pixels) {
+            fprintf(stderr, "%s: not a readable P6 PPM\n", path);
+            return 0;
+        }
+        format = GL_RGB;
+    } else {
+        fprintf(stderr, "Unknown texture source '%s' for %s\n", decl->kind, decl->name);
+        return 0;
+    }
+
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, format == GL_RGB ? GL_RGB8 : GL_RGBA8, w, h, 0,
+                 format, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    /* Noise is sampled texel for texel; images may be minified */
+    GLint filter = noise ? GL_NEAREST : GL_LINEAR;
+    if (!noise && mipmaps) glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    !noise && mipmaps ? GL_LINEAR_MIPMAP_LINEAR : filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    free(pixels);
+    fprintf(stderr, "Texture %s: %s %s (%dx%d)\n", decl->name, decl->kind,
+            noise ? decl->arg : path, w, h);
+    return tex;
+}
+
+/*
+ * Resolve the auxiliary textures a newly linked program declares: make or
+ * look up each texture, point the program's sampler at unit SS_AUX_UNIT + i
+ * and bind it there. Declarations whose sampler the program does not use
+ * are skipped, so the prelude's noise tiles cost nothing unless a shader
+ * samples them. The textures go to *out (may be NULL) for ss_bind_aux.
+ * Leaves prog in use and unit 0 active.
+ */
+static void ss_resolve_aux_textures(SsAuxCache *cache, GLuint prog,
+                                    const ShaderDirectives *dir, const char *shader_path,
+                                    SsAuxBinding *out) {
+    if (out) memset(out, 0, sizeof(*out));
+    glUseProgram(prog);
+    for (int i = 0; i < dir->aux_count; i++) {
+        const SsAuxDecl *decl = &dir->aux[i];
+        GLint loc = glGetUniformLocation(prog, decl->name);
+        if (loc < 0) continue;
+
+        /* Images are looked up next to the shader */
+        char path[PATH_MAX], key[PATH_MAX + 32];
+        const char *slash = strrchr(shader_path, '/');
+        if (decl->arg[0] == '/' || !slash)
+            snprintf(path, sizeof(path), "%s", decl->arg);
+        else
+            snprintf(path, sizeof(path), "%.*s/%s", (int)(slash - shader_path),
+                     shader_path, decl->arg);
+        snprintf(key, sizeof(key), "%s %s", decl->kind,
+                 strcmp(decl->kind, "image") == 0 ? path : decl->arg);
+
+        /* Textures are made on their own unit so unit 0 is left alone */
+        glActiveTexture(GL_TEXTURE0 + SS_AUX_UNIT + i);
+        GLuint tex = 0;
+        for (int j = 0; j < cache->count && !tex; j++)
+            if (strcmp(cache->entries[j].key, key) == 0) tex = cache->entries[j].tex;
+        if (!tex) {
+            tex = ss_make_aux_texture(decl, path, cache->mipmaps);
+            if (!tex) continue;
+            char *saved = cache->count < SS_AUX_CACHE_SIZE ? strdup(key) : NULL;
+            if (!saved) {
+                fprintf(stderr, "Texture cache full, not binding %s\n", decl->name);
+                glDeleteTextures(1, &tex);
+                continue;
+            }
+            cache->entries[cache->count].key = saved;
+            cache->entries[cache->count++].tex = tex;
+        }
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glUniform1i(loc, SS_AUX_UNIT + i);
+        if (out) out->tex[i] = tex;
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+/* Bind resolved textures for a draw; units are shared between programs.
+ * Leaves unit 0 active. */
+SS_UNUSED static void ss_bind_aux(const SsAuxBinding *b) {
+    bool any = false;
+    for (int i = 0; i < SS_MAX_AUX; i++) {
+        if (!b->tex[i]) continue;
+        glActiveTexture(GL_TEXTURE0 + SS_AUX_UNIT + i);
+        glBindTexture(GL_TEXTURE_2D, b->tex[i]);
+        any = true;
+    }
+    if (any) glActiveTexture(GL_TEXTURE0);
+}
+
+static void ss_aux_cache_free(SsAuxCache *cache) {
+    for (int i = 0; i < cache->count; i++) {
+        glDeleteTextures(1, &cache->entries[i].tex);
+        free(cache->entries[i].key);
+    }
+    cache->count = 0;
+}
+
+/* ========================================================================== */
+/* Frame feedback                                                             */
+/* ========================================================================== */
+
+#define SS_PREV_UNIT 1
+
+typedef struct {
+    GLuint fbo[2];
+    GLuint tex[2];
+    int    cur;      /* tex[cur] holds the last output, tex[!cur] is next */
+    int    width, height;
+    bool   valid;    /* tex[cur] has been rendered since the last reset */
+} SsFeedback;
+
+static void ss_feedback_free(SsFeedback *fb) {
+    if (fb->fbo[0]) glDeleteFramebuffers(2, fb->fbo);
+    if (fb->tex[0]) glDeleteTextures(2, fb->tex);
+    memset(fb, 0, sizeof(*fb));
+}
+
+/* Create the texture pair, or reallocate it at a new size. Either way the
+ * history is dropped. Returns -1 if the framebuffers are incomplete. */
+static int ss_feedback_resize(SsFeedback *fb, int w, int h) {
+    if (!fb->tex[0]) {
+        glGenTextures(2, fb->tex);
+        glGenFramebuffers(2, fb->fbo);
+    }
+    fb->width = w;
+    fb->height = h;
+    fb->valid = false;
+    for (int i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D, fb->tex[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindFramebuffer(GL_FRAMEBUFFER, fb->fbo[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, fb->tex[i], 0);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "Feedback FBO incomplete: 0x%x\n", status);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            return -1;
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return 0;
+}
+
+/* Bind the last output (or `screen` if there is none yet) as u_prev.
+ * Leaves unit 0 active. */
+static void ss_feedback_bind(const SsFeedback *fb, GLint u_prev, GLuint screen) {
+    glActiveTexture(GL_TEXTURE0 + SS_PREV_UNIT);
+    glBindTexture(GL_TEXTURE_2D, fb->valid ? fb->tex[fb->cur] : screen);
+    glUniform1i(u_prev, SS_PREV_UNIT);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+/* The frame just rendered into tex[!cur] becomes u_prev for the next one */
+static void ss_feedback_advance(SsFeedback *fb) {
+    fb->cur ^= 1;
+    fb->valid = true;
+}
+
+/* ========================================================================== */
+/* Colour LUT                                                                 */
+/* ========================================================================== */
+
+#define SS_LUT_UNIT 2
+
+/* Full-screen triangle strip without vertex buffers, for the bake */
+static const char *SS_LUT_VERT_SRC =
+    "#version 330 core\n"
+    "out vec2 v_texcoord;\n"
+    "void main() {\n"
+    "    v_texcoord = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+    "    gl_Position = vec4(v_texcoord * 2.0 - 1.0, 0.0, 1.0);\n"
+    "}\n";
+
+/* Layer z, texel (x, y) of the LUT holds f(vec3(x, y, z) / (N - 1)) */
+static const char *SS_LUT_BAKE_TRAILER =
+    "\n"
+    "uniform float ss_lut_layer;\n"
+    "void main() {\n"
+    "    vec3 c = vec3(floor(gl_FragCoord.xy), ss_lut_layer) / %d.0;\n"
+    "    frag_color = vec4(%s(c), 1.0);\n"
+    "}\n";
+
+/* Declared in front of the function's definition, on the same line so
+ * compile errors keep the shader's line numbers */
+static const char *SS_LUT_APPLY_DECL =
+    "uniform sampler3D ss_lut; "
+    "vec3 ss_lut_apply(vec3 c) { "
+    "return texture(ss_lut, clamp(c, 0.0, 1.0) * %.9g + %.9g).rgb; } ";
+
+/*
+ * Split a shader with a `lut` directive into the fragment source of its
+ * bake program (main renamed away, a main that evaluates the function
+ * over the lattice appended) and its runtime source (calls to the function
+ * replaced by ss_lut_apply). A definition or prototype is an occurrence
+ * right after `vec3` and is kept as is. Returns -1 if the function is
+ * never defined.
+ */
+static int ss_build_lut_sources(const char *src, const ShaderDirectives *dir,
+                                char **bake, char **apply) {
+    const char *func = dir->lut_func;
+    size_t func_len = strlen(func);
+    SsBuf b = {0}, a = {0};
+    size_t decl_at = 0, type_at = 0;
+    bool defined = false, after_vec3 = false;
+    bool bol = true;
+    const char *p = src;
+    while (*p) {
+        const char *q;
+        if ((p[0] == '/' && p[1] == '/') || (*p == '#' && bol)) {
+            q = strchr(p, '\n');
+            if (!q) q = p + strlen(p);
+        } else if (p[0] == '/' && p[1] == '*') {
+            q = strstr(p + 2, "*/");
+            q = q ? q + 2 : p + strlen(p);
+        } else if (ss_is_ident_start(*p)) {
+            q = p;
+            while (ss_is_ident_char(*q)) q++;
+            size_t n = (size_t)(q - p);
+            bool is_func = n == func_len && strncmp(p, func, n) == 0;
+            if (n == 4 && strncmp(p, "main", 4) == 0) ss_buf_puts(&b, "ss_user_main");
+            else ss_buf_append(&b, p, n);
+            if (is_func && !after_vec3) {
+                ss_buf_puts(&a, "ss_lut_apply");
+            } else {
+                if (is_func && !defined) {
+                    decl_at = type_at;
+                    defined = true;
+                }
+                if (n == 4 && strncmp(p, "vec3", 4) == 0) type_at = a.len;
+                ss_buf_append(&a, p, n);
+            }
+            after_vec3 = n == 4 && strncmp(p, "vec3", 4) == 0;
+            bol = false;
+            p = q;
+            continue;
+        } else {
+            if (*p == '\n') bol = true;
+            else if (!isspace((unsigned char)*p)) bol = after_vec3 = false;
+            q = p + 1;
+        }
+        ss_buf_append(&b, p, (size_t)(q - p));
+        ss_buf_append(&a, p, (size_t)(q - p));
+        p = q;
+    }
+    ss_buf_printf(&b, SS_LUT_BAKE_TRAILER, dir->lut_size - 1, func);
+
+    char *bake_src = ss_buf_finish(&b);
+    char *apply_src = ss_buf_finish(&a);
+    SsBuf out = {0};
+    if (bake_src && apply_src && defined) {
+        int n = dir->lut_size;
+        ss_buf_append(&out, apply_src, decl_at);
+        ss_buf_printf(&out, SS_LUT_APPLY_DECL, (n - 1) / (double)n, 0.5 / n);
+        ss_buf_puts(&out, apply_src + decl_at);
+    }
+    free(apply_src);
+    *apply = defined ? ss_buf_finish(&out) : NULL;
+    *bake = bake_src;
+    if (!*apply || !*bake) {
+        if (!defined) fprintf(stderr, "lut: no definition of vec3 %s(vec3)\n", func);
+        free(*apply);
+        free(*bake);
+        *apply = *bake = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    GLuint prog;     /* bake program */
+    GLuint tex;      /* GL_TEXTURE_3D, RGBA16F */
+    GLuint fbo;
+    GLuint vao;      /* empty; the bake's vertex shader needs no inputs */
+    int    size;
+} SsLut;
+
+static void ss_lut_free(SsLut *lut) {
+    if (lut->prog) glDeleteProgram(lut->prog);
+    if (lut->tex) glDeleteTextures(1, &lut->tex);
+    if (lut->fbo) glDeleteFramebuffers(1, &lut->fbo);
+    if (lut->vao) glDeleteVertexArrays(1, &lut->vao);
+    memset(lut, 0, sizeof(*lut));
+}
+
+/* Allocate the N x N x N texture, keeping it if the size is unchanged.
+ * Returns -1 if it cannot be rendered to. */
+static int ss_lut_resize(SsLut *lut, int size) {
+    if (lut->tex && lut->size == size) return 0;
+    if (!lut->tex) {
+        glGenTextures(1, &lut->tex);
+        glGenFramebuffers(1, &lut->fbo);
+        glGenVertexArrays(1, &lut->vao);
+    }
+    lut->size = size;
+    glActiveTexture(GL_TEXTURE0 + SS_LUT_UNIT);
+    glBindTexture(GL_TEXTURE_3D, lut->tex);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, size, size, size, 0,
+                 GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glActiveTexture(GL_TEXTURE0);
+
+    GLint prev;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev);
+    glBindFramebuffer(GL_FRAMEBUFFER, lut->fbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, lut->tex, 0, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)prev);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "LUT FBO incomplete: 0x%x\n", status);
+        return -1;
+    }
+    return 0;
+}
+
+/* Render the bake program into every layer. The caller has made lut->prog
+ * current and set its uniforms; framebuffer, viewport and vertex array
+ * bindings are restored. */
+static void ss_lut_bake(const SsLut *lut) {
+    GLint prev_fbo, prev_vao, vp[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_fbo);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prev_vao);
+    glGetIntegerv(GL_VIEWPORT, vp);
+
+    GLint layer = glGetUniformLocation(lut->prog, "ss_lut_layer");
+    glBindFramebuffer(GL_FRAMEBUFFER, lut->fbo);
+    glBindVertexArray(lut->vao);
+    glViewport(0, 0, lut->size, lut->size);
+    for (int z = 0; z < lut->size; z++) {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, lut->tex, 0, z);
+        glUniform1f(layer, (float)z);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)prev_fbo);
+    glBindVertexArray((GLuint)prev_vao);
+    glViewport(vp[0], vp[1], vp[2], vp[3]);
+}
+
+/* Bind the LUT for the runtime program's ss_lut sampler. Leaves unit 0
+ * active. */
+static void ss_lut_bind(const SsLut *lut, GLint loc) {
+    glActiveTexture(GL_TEXTURE0 + SS_LUT_UNIT);
+    glBindTexture(GL_TEXTURE_3D, lut->tex);
+    glUniform1i(loc, SS_LUT_UNIT);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+/* ========================================================================== */
+/* Frame feed                                                                 */
+/* ========================================================================== */
+
+#define SS_FEED_PREFIX      "/screenshader-feed"
+#define SS_FEED_NAME_MAX    128
+#define SS_FEED_MAGIC       0x44465353u   /* "SSFD" */
+#define SS_FEED_VERSION     2
+#define SS_FEED_SLOTS       3
+#define SS_FEED_COMPOSITED  1u            /* windows composited, before shading */
+#define SS_FEED_SHADED      2u            /* what is on screen */
+
+typedef struct {
+    uint32_t         magic;           /* written last by the publisher */
+    uint32_t         version;
+    uint32_t         width, height;   /* every image: RGBA8, rows top-down */
+    uint32_t         screen_width, screen_height;
+    uint32_t         images;          /* SS_FEED_* bits; composited comes first */
+    uint32_t         data_offset;     /* of slot 0, from the start of the object */
+    int32_t          pid;             /* publisher */
+    uint64_t         interval_ns;     /* between captures while the screen changes */
+    _Atomic uint64_t busy_ns;         /* CLOCK_MONOTONIC since it is, 0 while idle */
+    _Atomic uint64_t seq;             /* newest complete frame, 0 = none yet */
+    struct {
+        _Atomic uint64_t seq;         /* frame in the slot, 0 while written */
+        uint64_t         time_ns;     /* CLOCK_MONOTONIC when it was captured */
+    } slot[SS_FEED_SLOTS];
+} SsFeedHeader;
+
+static size_t ss_feed_image_size(uint32_t width, uint32_t height) {
+    return (size_t)width * height * 4;
+}
+
+static int ss_feed_image_count(uint32_t images) {
+    return (images & SS_FEED_COMPOSITED ? 1 : 0) + (images & SS_FEED_SHADED ? 1 : 0);
+}
+
+/* Size of the whole object */
+static size_t ss_feed_size(uint32_t width, uint32_t height, uint32_t images) {
+    size_t data = (sizeof(SsFeedHeader) + 63) & ~(size_t)63;
+    return data + SS_FEED_SLOTS * (size_t)ss_feed_image_count(images) *
+                  ss_feed_image_size(width, height);
+}
+
+/* Start of one image in a slot, NULL if the feed does not carry it */
+static unsigned char *ss_feed_image(const SsFeedHeader *h, int slot, uint32_t image) {
+    if (!(h->images & image)) return NULL;
+    int index = image == SS_FEED_SHADED && (h->images & SS_FEED_COMPOSITED) ? 1 : 0;
+    size_t size = ss_feed_image_size(h->width, h->height);
+    return (unsigned char *)h + h->data_offset +
+           ((size_t)slot * ss_feed_image_count(h->images) + index) * size;
+}
+
+/* The feed's name for this user on `display` (DisplayString): ":0.1"
+ * and ":0" share one compositor, so the screen number is dropped */
+static void ss_feed_name(char *buf, size_t n, const char *display) {
+    snprintf(buf, n, SS_FEED_PREFIX "-%u-%s", (unsigned)getuid(), display ? display : "");
+    char *colon = strrchr(buf, ':');
+    char *dot = colon ? strchr(colon, '.') : NULL;
+    if (dot) *dot = '\0';
+    for (char *p = buf + 1; *p; p++)
+        if (*p == '/') *p = '_';
+}
+
+/* True while the process that published h may still be running */
+static bool ss_feed_writer_alive(const SsFeedHeader *h) {
+    return h->pid > 0 && (kill(h->pid, 0) == 0 || errno == EPERM);
+}
+
+/* Map a feed read-only, if a compositor publishes one under `name`.
+ * *size is for munmap. */
+SS_UNUSED static const SsFeedHeader *ss_feed_attach(const char *name, size_t *size) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+    off_t end = lseek(fd, 0, SEEK_END);
+    const SsFeedHeader *h = NULL;
+    if (end >= (off_t)sizeof(SsFeedHeader)) {
+        void *p = mmap(NULL, (size_t)end, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) h = p;
+    }
+    close(fd);
+    if (!h) return NULL;
+    if (h->magic != SS_FEED_MAGIC || h->version != SS_FEED_VERSION ||
+        ss_feed_size(h->width, h->height, h->images) > (size_t)end) {
+        munmap((void *)h, (size_t)end);
+        return NULL;
+    }
+    *size = (size_t)end;
+    return h;
+}
+
+/* Newest frame after *seq: returns its image and sets *seq, or NULL if
+ * there is none. Copy the image, then check ss_feed_unchanged. */
+SS_UNUSED static const unsigned char *ss_feed_latest(const SsFeedHeader *h, uint32_t image,
+                                                     uint64_t *seq) {
+    uint64_t newest = atomic_load_explicit(&h->seq, memory_order_acquire);
+    if (newest == 0 || newest == *seq) return NULL;
+    int slot = (int)(newest % SS_FEED_SLOTS);
+    if (atomic_load_explicit(&h->slot[slot].seq, memory_order_acquire) != newest) return NULL;
+    *seq = newest;
+    return ss_feed_image(h, slot, image);
+}
+
+/* True if the publisher is busy but its newest frame is older than a
+ * few capture intervals: it hung, or stopped publishing */
+#define SS_FEED_STALE_INTERVALS 4
+#define SS_FEED_STALE_MIN_NS    500000000ull
+SS_UNUSED static bool ss_feed_stale(const SsFeedHeader *h, uint64_t now_ns) {
+    uint64_t newest = atomic_load_explicit(&h->busy_ns, memory_order_acquire);
+    if (newest == 0) return false;
+    uint64_t seq = atomic_load_explicit(&h->seq, memory_order_acquire);
+    if (seq && h->slot[seq % SS_FEED_SLOTS].time_ns > newest)
+        newest = h->slot[seq % SS_FEED_SLOTS].time_ns;
+    uint64_t limit = SS_FEED_STALE_INTERVALS * h->interval_ns;
+    if (limit < SS_FEED_STALE_MIN_NS) limit = SS_FEED_STALE_MIN_NS;
+    return now_ns > newest + limit;
+}
+
+/* True if frame seq was not overwritten while it was being copied */
+SS_UNUSED static bool ss_feed_unchanged(const SsFeedHeader *h, uint64_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&h->slot[seq % SS_FEED_SLOTS].seq,
+                                memory_order_relaxed) == seq;
+}
+
+#endif /* SCREENSHADER_SHADERLIB_H */
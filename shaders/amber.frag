@@ -1,13 +1,4 @@
-#version 330 core
-
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
-const float PI = 3.14159265359;
+#pragma screenshader pointwise
 
 void main() {
     vec2 uv = v_texcoord;
@@ -1,11 +1,19 @@
 #version 330 core
 
 in vec2 v_texcoord;
-out vec4 frag_color;
+
+// Dual-source blending: the colour output carries premultiplied RGB and,
+// in alpha, its Rec. 601 luma; the second output carries the window's coverage. The
+// FBO's alpha channel ends up holding the luma of the composited screen,
+// which the post-process prelude reads with textureGather.
+layout(location = 0, index = 0) out vec4 frag_color;
+layout(location = 0, index = 1) out vec4 frag_coverage;
 
 uniform sampler2D u_texture;
 
 void main() {
     vec2 tc = vec2(v_texcoord.x, 1.0 - v_texcoord.y);
-    frag_color = texture(u_texture, tc);
+    vec4 c = texture(u_texture, tc);
+    frag_color = vec4(c.rgb, dot(c.rgb, vec3(0.299, 0.587, 0.114)));
+    frag_coverage = vec4(c.a);
 }
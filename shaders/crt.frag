@@ -1,17 +1,6 @@
-#version 330 core
-
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
 // Controllable at runtime via: screenshader.sh --set u_curvature 0.1
 uniform float u_curvature;
 
-const float PI = 3.14159265359;
-
 // --- Barrel distortion (CRT curvature) ---
 vec2 barrel_distort(vec2 uv, float amount) {
     vec2 cc = uv - 0.5;
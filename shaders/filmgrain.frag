@@ -1,15 +1,4 @@
-#version 330 core
-
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
-float hash(vec2 p) {
-    return fract(sin(dot(p, vec2(127.1, 311.7))) * 43758.5453);
-}
+#pragma screenshader prelude 2
 
 void main() {
     vec2 uv = v_texcoord;
@@ -27,19 +16,24 @@ void main() {
     // Lift shadows, compress highlights (low contrast vintage feel)
     color = color * 0.85 + 0.06;
 
+    // Per-frame random values (24 fps film): scratch position, scratch
+    // visibility, flicker, and where in the noise tile this frame's grain starts
+    vec4 frame = ss_hash4(vec2(floor(u_time * 24.0), 0.0));
+
     // Film grain
-    float grain = hash(uv * u_resolution + fract(u_time * 13.37)) * 2.0 - 1.0;
+    vec2 grain_at = uv * u_resolution + floor(frame.w * 256.0) * vec2(1.0, 7.0);
+    float grain = ss_white_noise(grain_at).r * 2.0 - 1.0;
     color += grain * 0.08;
 
     // Film scratches (vertical lines that appear briefly)
-    float scratch_x = hash(vec2(floor(u_time * 24.0), 0.0));
+    float scratch_x = frame.x;
     float scratch_width = 0.001;
     float scratch = smoothstep(scratch_width, 0.0, abs(uv.x - scratch_x)) * 0.15;
-    float scratch_visible = step(0.92, hash(vec2(floor(u_time * 24.0), 1.0)));
+    float scratch_visible = step(0.92, frame.y);
     color += scratch * scratch_visible;
 
     // Frame flicker
-    float flicker = 1.0 + (hash(vec2(floor(u_time * 24.0), 2.0)) - 0.5) * 0.03;
+    float flicker = 1.0 + (frame.z - 0.5) * 0.03;
     color *= flicker;
 
     // Vignette (strong, like old film)
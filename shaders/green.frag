@@ -1,14 +1,3 @@
-#version 330 core
-
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
-const float PI = 3.14159265359;
-
 void main() {
     vec2 uv = v_texcoord;
     vec3 color = texture(u_screen, uv).rgb;
@@ -23,10 +12,10 @@ void main() {
     float px = 1.0 / u_resolution.x;
     float py = 1.0 / u_resolution.y;
     float bloom = 0.0;
-    bloom += dot(texture(u_screen, uv + vec2(-px, 0.0)).rgb, vec3(0.2126, 0.7152, 0.0722));
-    bloom += dot(texture(u_screen, uv + vec2( px, 0.0)).rgb, vec3(0.2126, 0.7152, 0.0722));
-    bloom += dot(texture(u_screen, uv + vec2(0.0, -py)).rgb, vec3(0.2126, 0.7152, 0.0722));
-    bloom += dot(texture(u_screen, uv + vec2(0.0,  py)).rgb, vec3(0.2126, 0.7152, 0.0722));
+    bloom += ss_luma(texture(u_screen, uv + vec2(-px, 0.0)).rgb);
+    bloom += ss_luma(texture(u_screen, uv + vec2( px, 0.0)).rgb);
+    bloom += ss_luma(texture(u_screen, uv + vec2(0.0, -py)).rgb);
+    bloom += ss_luma(texture(u_screen, uv + vec2(0.0,  py)).rgb);
     bloom *= 0.25;
     green += vec3(0.0, 0.15, 0.05) * bloom;
 
@@ -1,29 +1,8 @@
-#version 330 core
+#pragma screenshader kernel_radius 1
 
 // Cel-shaded / Marvel animated art style:
 // Flat shading bands, bold ink outlines, saturated colors
 
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
-// Detect high-detail regions (text) via local edge density
-float textDetect(vec2 tc, vec2 texel) {
-    vec3 W = vec3(0.299, 0.587, 0.114);
-    float c = dot(texture(u_screen, tc).rgb, W);
-    float e = 0.0;
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0,  texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x,  texel.y)).rgb, W));
-    return smoothstep(0.15, 0.6, e);
-}
-
 void main() {
     vec2 uv = v_texcoord;
     vec2 px = 1.0 / u_resolution;
@@ -72,7 +51,7 @@ void main() {
     color = mix(color, vec3(0.0), edge * 0.92);
 
     // Text preservation: keep original in high-detail areas
-    float detail = textDetect(uv, px);
+    float detail = ss_text_detect(uv);
     color = mix(color, c, detail * 0.65);
 
     frag_color = vec4(clamp(color, 0.0, 1.0), 1.0);
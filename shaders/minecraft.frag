@@ -1,29 +1,6 @@
-#version 330 core
-
 // Minecraft: blocky pixels, dirt-palette color quantization,
 // block grid outlines, subtle ambient occlusion, and a dither pattern
 
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
-// Detect high-detail regions (text) via local edge density
-float textDetect(vec2 tc, vec2 texel) {
-    vec3 W = vec3(0.299, 0.587, 0.114);
-    float c = dot(texture(u_screen, tc).rgb, W);
-    float e = 0.0;
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0,  texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x,  texel.y)).rgb, W));
-    return smoothstep(0.15, 0.6, e);
-}
-
 // Find nearest Minecraft palette color
 vec3 quantize(vec3 color) {
     vec3 best = vec3(0.0);
@@ -75,7 +52,6 @@ float bayer4(vec2 pos) {
 }
 
 void main() {
-    vec2 texel = 1.0 / u_resolution;
     vec3 orig = texture(u_screen, v_texcoord).rgb;
 
     // --- Pixelation ---
@@ -118,7 +94,7 @@ void main() {
     color *= vec3(1.04, 1.0, 0.93);
 
     // --- Text preservation: keep original in high-detail areas ---
-    float detail = textDetect(v_texcoord, texel);
+    float detail = ss_text_detect(v_texcoord);
     color = mix(color, orig, detail * 0.85);
 
     frag_color = vec4(color, 1.0);
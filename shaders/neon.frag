@@ -1,49 +1,15 @@
-#version 330 core
+#pragma screenshader kernel_radius 6
 
 // Neon edge glow / cyberpunk wireframe:
 // Dark background with glowing neon-colored edges
 
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
-const float PI = 3.14159265359;
-
-// Detect high-detail regions (text) via local edge density
-float textDetect(vec2 tc, vec2 texel) {
-    vec3 W = vec3(0.299, 0.587, 0.114);
-    float c = dot(texture(u_screen, tc).rgb, W);
-    float e = 0.0;
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0,  texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x,  texel.y)).rgb, W));
-    return smoothstep(0.15, 0.6, e);
-}
-
 void main() {
     vec2 uv = v_texcoord;
     vec2 px = 1.0 / u_resolution;
 
     // --- Sobel edge detection ---
-    float samples[9];
-    int idx = 0;
-    for (int y = -1; y <= 1; y++) {
-        for (int x = -1; x <= 1; x++) {
-            vec3 s = texture(u_screen, uv + vec2(float(x), float(y)) * px).rgb;
-            samples[idx++] = dot(s, vec3(0.2126, 0.7152, 0.0722));
-        }
-    }
-
-    float gx = -samples[0] - 2.0*samples[3] - samples[6]
-              + samples[2] + 2.0*samples[5] + samples[8];
-    float gy = -samples[0] - 2.0*samples[1] - samples[2]
-              + samples[6] + 2.0*samples[7] + samples[8];
+    vec2 g = ss_sobel(ss_luma3x3_rgb(uv, SS_REC709));
+    float gx = g.x, gy = g.y;
     float edge = sqrt(gx*gx + gy*gy);
     float edge_sharp = smoothstep(0.05, 0.3, edge);
 
@@ -69,15 +35,10 @@ void main() {
     float glow = 0.0;
     for (int i = 1; i <= 4; i++) {
         float r = float(i) * 1.5;
-        vec3 s;
-        s = texture(u_screen, uv + vec2(r, 0.0) * px).rgb;
-        glow += dot(s, vec3(0.2126, 0.7152, 0.0722));
-        s = texture(u_screen, uv - vec2(r, 0.0) * px).rgb;
-        glow += dot(s, vec3(0.2126, 0.7152, 0.0722));
-        s = texture(u_screen, uv + vec2(0.0, r) * px).rgb;
-        glow += dot(s, vec3(0.2126, 0.7152, 0.0722));
-        s = texture(u_screen, uv - vec2(0.0, r) * px).rgb;
-        glow += dot(s, vec3(0.2126, 0.7152, 0.0722));
+        glow += ss_luma(texture(u_screen, uv + vec2(r, 0.0) * px).rgb);
+        glow += ss_luma(texture(u_screen, uv - vec2(r, 0.0) * px).rgb);
+        glow += ss_luma(texture(u_screen, uv + vec2(0.0, r) * px).rgb);
+        glow += ss_luma(texture(u_screen, uv - vec2(0.0, r) * px).rgb);
     }
     glow /= 16.0;
     float glow_edge = smoothstep(0.03, 0.2, edge) * 0.3;
@@ -99,7 +60,7 @@ void main() {
     color += screen * smoothstep(0.8, 1.0, screen_lum) * 0.3;
 
     // Text preservation: keep original in high-detail areas
-    float detail = textDetect(uv, px);
+    float detail = ss_text_detect(uv);
     color = mix(color, screen, detail * 0.75);
 
     frag_color = vec4(color, 1.0);
@@ -1,11 +1,4 @@
-#version 330 core
-
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
+#pragma screenshader pointwise
 
 void main() {
     vec3 color = texture(u_screen, v_texcoord).rgb;
@@ -1,29 +1,7 @@
-#version 330 core
-
+#pragma screenshader interleave 2
 // Oil painting effect:
 // Kuwahara filter for painterly brush strokes + color quantization
 
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
-// Detect high-detail regions (text) via local edge density
-float textDetect(vec2 tc, vec2 texel) {
-    vec3 W = vec3(0.299, 0.587, 0.114);
-    float c = dot(texture(u_screen, tc).rgb, W);
-    float e = 0.0;
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0,  texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x,  texel.y)).rgb, W));
-    return smoothstep(0.15, 0.6, e);
-}
-
 void main() {
     vec2 uv = v_texcoord;
     vec2 px = 1.0 / u_resolution;
@@ -98,7 +76,7 @@ void main() {
     color = mix(vec3(lum), color, 1.25);
 
     // Text preservation: keep original in high-detail areas
-    float detail = textDetect(uv, px);
+    float detail = ss_text_detect(uv);
     color = mix(color, orig, detail * 0.75);
 
     frag_color = vec4(color, 1.0);
@@ -0,0 +1,21 @@
+#pragma screenshader prelude 3
+
+// Phosphor persistence: bright pixels fade out over a few frames instead of
+// switching off at once, so moving windows and the cursor leave short
+// afterglow trails, like a slow-phosphor CRT
+
+void main() {
+    vec3 color = texture(u_screen, v_texcoord).rgb;
+    vec3 prev = texture(u_prev, v_texcoord).rgb;
+
+    // Afterglow keeps this much of its brightness per frame; green and
+    // blue phosphors decay slower than red. The small constant lets it
+    // reach zero, which 8-bit rounding would otherwise hold it just above.
+    vec3 glow = prev * vec3(0.70, 0.82, 0.85) - 2.0 / 255.0;
+
+    // Text preservation: less glow over detail, where trails smear glyphs
+    float detail = ss_text_detect(v_texcoord);
+    glow *= 1.0 - detail * 0.7;
+
+    frag_color = vec4(max(color, glow), 1.0);
+}
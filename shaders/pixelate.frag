@@ -1,28 +1,4 @@
-#version 330 core
-
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
-// Detect high-detail regions (text) via local edge density
-float textDetect(vec2 tc, vec2 texel) {
-    vec3 W = vec3(0.299, 0.587, 0.114);
-    float c = dot(texture(u_screen, tc).rgb, W);
-    float e = 0.0;
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0,  texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x,  texel.y)).rgb, W));
-    return smoothstep(0.15, 0.6, e);
-}
-
 void main() {
-    vec2 texel = 1.0 / u_resolution;
     vec3 orig = texture(u_screen, v_texcoord).rgb;
 
     // Pixel block size (bigger = more pixelated, like Minecraft)
@@ -46,7 +22,7 @@ void main() {
     color *= mix(0.85, 1.0, grid);
 
     // Text preservation: keep original in high-detail areas
-    float detail = textDetect(v_texcoord, texel);
+    float detail = ss_text_detect(v_texcoord);
     color = mix(color, orig, detail * 0.85);
 
     frag_color = vec4(color, 1.0);
@@ -0,0 +1,189 @@
+#version 330 core
+#extension GL_ARB_gpu_shader5 : enable
+
+// Standard prelude, prepended to every post-process shader that has no
+// #version line of its own. Declares the engine inputs and outputs and the
+// shared helpers below. Bump SS_PRELUDE_VERSION whenever a helper is added
+// or changes meaning; shaders can require a minimum with
+// `#pragma screenshader prelude N`.
+//
+// The compositor and the preview store each pixel's Rec. 601 luma (the
+// built-in text mask's weights) in the alpha channel of u_screen, so one
+// textureGather returns the lumas of a whole 2x2 block. It is 8-bit:
+// effects that amplify small luma steps read rgb instead. The Hyprland and macOS converters define SS_PORTABLE: there
+// alpha is just alpha, and the helpers fall back to per-texel fetches.
+
+#define SS_PRELUDE_VERSION 4
+
+#pragma screenshader texture ss_white_noise_tex whitenoise 256
+#pragma screenshader texture ss_blue_noise_tex bluenoise 64
+
+in vec2 v_texcoord;
+out vec4 frag_color;
+
+uniform sampler2D u_screen;
+uniform vec2 u_resolution;
+uniform float u_time;
+
+// The previous frame's output, for temporal effects. Sampling it is what
+// turns frame feedback on; until there is a previous frame it is the
+// screen. The portable builds have no feedback and alias it to the screen.
+#ifdef SS_PORTABLE
+#define u_prev u_screen
+#else
+uniform sampler2D u_prev;
+#endif
+
+const float PI = 3.14159265359;
+
+// u_screen channel that holds luma
+#define SS_LUMA 3
+
+#ifndef SS_PORTABLE
+#if defined(SS_TILE) || __VERSION__ >= 400 || defined(GL_ARB_gpu_shader5)
+#define SS_HAS_GATHER 1
+#endif
+#endif
+
+// Luma weights
+const vec3 SS_REC709 = vec3(0.2126, 0.7152, 0.0722);
+const vec3 SS_REC601 = vec3(0.299, 0.587, 0.114);
+const vec3 SS_AVG = vec3(1.0 / 3.0);
+
+// Rec. 709 luma of a colour
+float ss_luma(vec3 c) {
+    return dot(c, SS_REC709);
+}
+
+// Rec. 601 luma, what u_screen carries in alpha
+float ss_luma601(vec3 c) {
+    return dot(c, SS_REC601);
+}
+
+// Unweighted mean of the channels
+float ss_luma_avg(vec3 c) {
+    return dot(c, SS_AVG);
+}
+
+// Rec. 601 luma of u_screen at uv
+float ss_luma_at(vec2 uv) {
+#ifdef SS_PORTABLE
+    return ss_luma601(texture(u_screen, uv).rgb);
+#else
+    return texture(u_screen, uv).a;
+#endif
+}
+
+// Lumas of the 2x2 texels around the texel corner nearest uv, in
+// textureGather order: (-,+) (+,+) (+,-) (-,-)
+vec4 ss_gather_luma(vec2 uv) {
+#if defined(SS_TILE)
+    return ss_gather_tile(uv);
+#elif defined(SS_HAS_GATHER)
+    return textureGather(u_screen, uv, SS_LUMA);
+#else
+    vec2 h = 0.5 / u_resolution;
+    return vec4(ss_luma_at(uv + vec2(-h.x, h.y)), ss_luma_at(uv + h),
+                ss_luma_at(uv + vec2(h.x, -h.y)), ss_luma_at(uv - h));
+#endif
+}
+
+// 3x3 luma neighbourhood of the texel at uv, indexed l[dx + 1][dy + 1]
+mat3 ss_luma3x3(vec2 uv) {
+    vec2 px = 1.0 / u_resolution;
+#ifdef SS_HAS_GATHER
+    vec4 a = ss_gather_luma(uv + vec2(-0.5, -0.5) * px);
+    vec4 b = ss_gather_luma(uv + vec2( 0.5,  0.5) * px);
+    vec4 c = ss_gather_luma(uv + vec2( 0.5, -0.5) * px);
+    vec4 d = ss_gather_luma(uv + vec2(-0.5,  0.5) * px);
+    return mat3(vec3(a.w, a.x, d.x), vec3(a.z, a.y, b.x), vec3(c.z, b.z, b.y));
+#else
+    return mat3(
+        vec3(ss_luma_at(uv + vec2(-px.x, -px.y)), ss_luma_at(uv + vec2(-px.x, 0.0)),
+             ss_luma_at(uv + vec2(-px.x,  px.y))),
+        vec3(ss_luma_at(uv + vec2(0.0, -px.y)), ss_luma_at(uv),
+             ss_luma_at(uv + vec2(0.0,  px.y))),
+        vec3(ss_luma_at(uv + vec2( px.x, -px.y)), ss_luma_at(uv + vec2( px.x, 0.0)),
+             ss_luma_at(uv + px)));
+#endif
+}
+
+// 3x3 neighbourhood like ss_luma3x3, with weights w (e.g. SS_REC709)
+// applied to full-precision rgb: nine fetches instead of four gathers
+mat3 ss_luma3x3_rgb(vec2 uv, vec3 w) {
+    vec2 px = 1.0 / u_resolution;
+    mat3 l;
+    for (int x = 0; x < 3; x++)
+        for (int y = 0; y < 3; y++)
+            l[x][y] = dot(texture(u_screen, uv + vec2(x - 1, y - 1) * px).rgb, w);
+    return l;
+}
+
+// 4x4 luma neighbourhood, offsets -1..2 from the texel at uv, indexed
+// l[dx + 1][dy + 1]
+mat4 ss_luma4x4(vec2 uv) {
+    vec2 px = 1.0 / u_resolution;
+    vec4 a = ss_gather_luma(uv + vec2(-0.5, -0.5) * px);
+    vec4 b = ss_gather_luma(uv + vec2( 1.5, -0.5) * px);
+    vec4 c = ss_gather_luma(uv + vec2(-0.5,  1.5) * px);
+    vec4 d = ss_gather_luma(uv + vec2( 1.5,  1.5) * px);
+    return mat4(vec4(a.w, a.x, c.w, c.x), vec4(a.z, a.y, c.z, c.y),
+                vec4(b.w, b.x, d.w, d.x), vec4(b.z, b.y, d.z, d.y));
+}
+
+// Sobel gradient (gx, gy) of a 3x3 luma neighbourhood
+vec2 ss_sobel(mat3 l) {
+    float gx = -l[0][0] - 2.0 * l[0][1] - l[0][2]
+             +  l[2][0] + 2.0 * l[2][1] + l[2][2];
+    float gy = -l[0][0] - 2.0 * l[1][0] - l[2][0]
+             +  l[0][2] + 2.0 * l[1][2] + l[2][2];
+    return vec2(gx, gy);
+}
+
+// Detect high-detail regions (text) via local edge density: luma
+// differences to the 4-neighbours and the two main diagonals, which two
+// gathers cover
+float ss_text_detect(vec2 uv) {
+    vec2 h = 0.5 / u_resolution;
+    vec4 a = ss_gather_luma(uv - h);   // (-1,0) (0,0) (0,-1) (-1,-1)
+    vec4 b = ss_gather_luma(uv + h);   // (0,1) (1,1) (1,0) (0,0)
+    float c = a.y;
+    float e = dot(abs(vec4(a.x, a.z, a.w, b.x) - c), vec4(1.0))
+            + abs(b.y - c) + abs(b.z - c);
+    return smoothstep(0.15, 0.6, e);
+}
+
+// Per-pixel noise. p is a pixel position (e.g. floor(uv * u_resolution)),
+// not gl_FragCoord, which the compute tile path does not have. Each
+// channel is independent and uniform in [0, 1); the tiles repeat every
+// 256 and 64 pixels, so offset p by a per-frame amount for animated noise.
+// The portable build has no tiles and hashes instead.
+#ifndef SS_PORTABLE
+uniform sampler2D ss_white_noise_tex;
+uniform sampler2D ss_blue_noise_tex;
+#endif
+
+vec4 ss_hash4(vec2 p) {
+    vec4 q = vec4(dot(p, vec2(127.1, 311.7)), dot(p, vec2(269.5, 183.3)),
+                  dot(p, vec2(419.2, 371.9)), dot(p, vec2(113.5, 271.9)));
+    return fract(sin(q) * 43758.5453);
+}
+
+// Uncorrelated noise, for grain and random picks
+vec4 ss_white_noise(vec2 p) {
+#ifdef SS_PORTABLE
+    return ss_hash4(floor(p));
+#else
+    return texelFetch(ss_white_noise_tex, ivec2(floor(p)) & 255, 0);
+#endif
+}
+
+// Blue noise: no low-frequency clumps, so dithering and stochastic
+// effects look even at one sample per pixel
+vec4 ss_blue_noise(vec2 p) {
+#ifdef SS_PORTABLE
+    return ss_hash4(floor(p));
+#else
+    return texelFetch(ss_blue_noise_tex, ivec2(floor(p)) & 63, 0);
+#endif
+}
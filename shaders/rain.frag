@@ -1,48 +1,36 @@
-#version 330 core
+#pragma screenshader prelude 2
 
 // Rain overlay: animated falling raindrops, water streaks, and slight fog
-
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
-// Hash functions for pseudo-random values
-float hash(float n) {
-    return fract(sin(n) * 43758.5453);
-}
-
-float hash2(vec2 p) {
-    return fract(sin(dot(p, vec2(127.1, 311.7))) * 43758.5453);
-}
+//
+// Random values come from the white-noise tile: row 0 and 1 hold the two
+// rain layers' drops, row 2 the glass droplets, rows 8+ the fog noise.
 
 // Smooth noise
 float noise(vec2 p) {
-    vec2 i = floor(p);
+    vec2 i = floor(p) + vec2(0.0, 8.0);
     vec2 f = fract(p);
     f = f * f * (3.0 - 2.0 * f);
-    float a = hash2(i);
-    float b = hash2(i + vec2(1.0, 0.0));
-    float c = hash2(i + vec2(0.0, 1.0));
-    float d = hash2(i + vec2(1.0, 1.0));
+    float a = ss_white_noise(i).r;
+    float b = ss_white_noise(i + vec2(1.0, 0.0)).r;
+    float c = ss_white_noise(i + vec2(0.0, 1.0)).r;
+    float d = ss_white_noise(i + vec2(1.0, 1.0)).r;
     return mix(mix(a, b, f.x), mix(c, d, f.x), f.y);
 }
 
-// Single raindrop streak — returns intensity
-float raindrop(vec2 uv, float seed, float time) {
-    float x_pos = hash(seed * 1.73);
-    float speed = 0.6 + hash(seed * 3.17) * 0.8;
-    float len = 0.02 + hash(seed * 7.13) * 0.04;
-    float width = 0.0008 + hash(seed * 2.31) * 0.0006;
+// Single raindrop streak — returns intensity. r holds the drop's random
+// values: x position, speed, length, width.
+float raindrop(vec2 uv, vec4 r, float seed, float time) {
+    float x_pos = r.x;
+    float speed = 0.6 + r.y * 0.8;
+    float len = 0.02 + r.z * 0.04;
+    float width = 0.0008 + r.w * 0.0006;
 
     // Horizontal position with slight wind sway
     float wind = sin(time * 0.5 + seed) * 0.02;
     float x = x_pos + wind;
 
     // Vertical: falling with time, wrapping
-    float y = fract(time * speed + hash(seed * 5.91));
+    float y = fract(time * speed + fract(seed * 0.618));
 
     // Distance from the streak line
     float dx = abs(uv.x - x);
@@ -60,10 +48,11 @@ float raindrop(vec2 uv, float seed, float time) {
 }
 
 // Layer of many raindrops
-float rain_layer(vec2 uv, float layer_seed, int count, float time) {
+float rain_layer(vec2 uv, float layer, int count, float time) {
     float r = 0.0;
     for (int i = 0; i < count; i++) {
-        r += raindrop(uv, float(i) * 1.7 + layer_seed, time);
+        vec4 drop = ss_white_noise(vec2(float(i), layer));
+        r += raindrop(uv, drop, float(i) * 1.7 + layer * 100.0, time);
     }
     return r;
 }
@@ -82,16 +71,15 @@ vec2 droplet_offset(vec2 uv, vec2 center, float radius, float strength) {
 
 void main() {
     vec2 uv = v_texcoord;
-    vec2 texel = 1.0 / u_resolution;
 
     // --- Glass droplets: stationary water beads that distort ---
     vec2 offset = vec2(0.0);
     for (int i = 0; i < 12; i++) {
-        float seed = float(i);
-        vec2 center = vec2(hash(seed * 3.1), hash(seed * 7.9));
+        vec4 r = ss_white_noise(vec2(float(i), 2.0));
+        vec2 center = r.xy;
         // Slowly drift downward
-        center.y = fract(center.y - u_time * 0.01 * (0.5 + hash(seed * 2.3)));
-        float radius = 0.008 + hash(seed * 5.3) * 0.015;
+        center.y = fract(center.y - u_time * 0.01 * (0.5 + r.z));
+        float radius = 0.008 + r.w * 0.015;
         offset += droplet_offset(uv, center, radius, 0.015);
     }
 
@@ -100,7 +88,7 @@ void main() {
     // --- Falling rain streaks (two layers for depth) ---
     float rain = 0.0;
     rain += rain_layer(uv, 0.0, 40, u_time) * 0.7;   // foreground: brighter, fewer
-    rain += rain_layer(uv, 100.0, 60, u_time) * 0.3;  // background: dimmer, more
+    rain += rain_layer(uv, 1.0, 60, u_time) * 0.3;   // background: dimmer, more
 
     // Rain color: pale blue-white
     vec3 rain_color = vec3(0.7, 0.75, 0.85);
@@ -1,17 +1,8 @@
-#version 330 core
+#pragma screenshader kernel_radius 1
 
 // Pencil sketch / crosshatch effect:
 // Edge detection + crosshatch pattern based on luminance
 
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
-const float PI = 3.14159265359;
-
 float hash(vec2 p) {
     return fract(sin(dot(p, vec2(127.1, 311.7))) * 43758.5453);
 }
@@ -24,23 +15,8 @@ float hatch(vec2 uv, float angle, float density) {
     return smoothstep(0.3, 0.5, abs(sin(rotated.x * density)));
 }
 
-// Detect high-detail regions (text) via local edge density
-float textDetect(vec2 tc, vec2 texel) {
-    vec3 W = vec3(0.299, 0.587, 0.114);
-    float c = dot(texture(u_screen, tc).rgb, W);
-    float e = 0.0;
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0,  texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x,  texel.y)).rgb, W));
-    return smoothstep(0.15, 0.6, e);
-}
-
 void main() {
     vec2 uv = v_texcoord;
-    vec2 px = 1.0 / u_resolution;
     vec3 orig = texture(u_screen, uv).rgb;
     vec2 pixel = uv * u_resolution;
 
@@ -50,17 +26,8 @@ void main() {
     float darkness = 1.0 - lum;
 
     // --- Sobel edge detection ---
-    float tl = dot(texture(u_screen, uv + vec2(-px.x, -px.y)).rgb, vec3(0.333));
-    float t  = dot(texture(u_screen, uv + vec2(0.0, -px.y)).rgb, vec3(0.333));
-    float tr = dot(texture(u_screen, uv + vec2(px.x, -px.y)).rgb, vec3(0.333));
-    float l  = dot(texture(u_screen, uv + vec2(-px.x, 0.0)).rgb, vec3(0.333));
-    float r  = dot(texture(u_screen, uv + vec2(px.x, 0.0)).rgb, vec3(0.333));
-    float bl = dot(texture(u_screen, uv + vec2(-px.x, px.y)).rgb, vec3(0.333));
-    float b  = dot(texture(u_screen, uv + vec2(0.0, px.y)).rgb, vec3(0.333));
-    float br = dot(texture(u_screen, uv + vec2(px.x, px.y)).rgb, vec3(0.333));
-
-    float gx = -tl - 2.0*l - bl + tr + 2.0*r + br;
-    float gy = -tl - 2.0*t - tr + bl + 2.0*b + br;
+    vec2 g = ss_sobel(ss_luma3x3_rgb(uv, SS_AVG));
+    float gx = g.x, gy = g.y;
     float edge = sqrt(gx*gx + gy*gy);
     edge = smoothstep(0.05, 0.35, edge);
 
@@ -94,7 +61,7 @@ void main() {
     color += grain - 0.015;
 
     // Text preservation: keep original in high-detail areas
-    float detail = textDetect(uv, px);
+    float detail = ss_text_detect(uv);
     color = mix(color, orig, detail * 0.8);
 
     frag_color = vec4(color, 1.0);
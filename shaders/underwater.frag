@@ -1,17 +1,6 @@
-#version 330 core
-
 // Underwater / aquatic effect:
 // Caustic light patterns, blue-green tint, wave distortion, light rays
 
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
-const float PI = 3.14159265359;
-
 // Simple caustic pattern
 float caustic(vec2 uv, float t) {
     float c = 0.0;
@@ -21,23 +10,8 @@ float caustic(vec2 uv, float t) {
     return c * 0.5 + 0.5;
 }
 
-// Detect high-detail regions (text) via local edge density
-float textDetect(vec2 tc, vec2 texel) {
-    vec3 W = vec3(0.299, 0.587, 0.114);
-    float c = dot(texture(u_screen, tc).rgb, W);
-    float e = 0.0;
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0,  texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x,  texel.y)).rgb, W));
-    return smoothstep(0.15, 0.6, e);
-}
-
 void main() {
     vec2 uv = v_texcoord;
-    vec2 texel = 1.0 / u_resolution;
     vec3 orig = texture(u_screen, uv).rgb;
 
     // --- Wave distortion ---
@@ -81,7 +55,7 @@ void main() {
     color *= mix(0.6, 1.0, vignette);
 
     // Text preservation: keep original in high-detail areas
-    float detail = textDetect(uv, texel);
+    float detail = ss_text_detect(uv);
     color = mix(color, orig, detail * 0.65);
 
     frag_color = vec4(color, 1.0);
@@ -1,41 +1,18 @@
-#version 330 core
-
-in vec2 v_texcoord;
-out vec4 frag_color;
-
-uniform sampler2D u_screen;
-uniform vec2 u_resolution;
-uniform float u_time;
-
-const float PI = 3.14159265359;
-
-// Simple hash for noise
-float hash(vec2 p) {
-    return fract(sin(dot(p, vec2(127.1, 311.7))) * 43758.5453123);
-}
-
-// Detect high-detail regions (text) via local edge density
-float textDetect(vec2 tc, vec2 texel) {
-    vec3 W = vec3(0.299, 0.587, 0.114);
-    float c = dot(texture(u_screen, tc).rgb, W);
-    float e = 0.0;
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x, 0.0)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(0.0,  texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2(-texel.x, -texel.y)).rgb, W));
-    e += abs(c - dot(texture(u_screen, tc + vec2( texel.x,  texel.y)).rgb, W));
-    return smoothstep(0.15, 0.6, e);
-}
+#pragma screenshader kernel_radius 8
+#pragma screenshader prelude 2
 
 void main() {
     vec2 uv = v_texcoord;
-    vec2 texel = 1.0 / u_resolution;
     vec3 orig = texture(u_screen, v_texcoord).rgb;
 
-    // Horizontal jitter (per-scanline random offset)
+    // Per-frame offset into the noise tiles, so each frame gets fresh noise
+    vec2 frame = floor(ss_hash4(vec2(floor(u_time * 30.0), 0.0)).xy * 256.0);
+
+    // Horizontal jitter (per-scanline random offset): up to 0.15% of the
+    // width, 6 px at 3840 wide; with the 2 px bleed that is kernel_radius 8.
+    // Wider screens still render right, through ss_fetch's fallback reads.
     float line = floor(uv.y * u_resolution.y);
-    float jitter_seed = hash(vec2(line, floor(u_time * 30.0)));
+    float jitter_seed = ss_white_noise(vec2(0.0, line) + frame).r;
     float jitter = (jitter_seed - 0.5) * 0.003;
     uv.x += jitter;
 
@@ -65,7 +42,7 @@ void main() {
     color += tracking2;
 
     // Noise overlay
-    float noise = hash(uv * u_resolution + u_time * 100.0);
+    float noise = ss_blue_noise(uv * u_resolution + frame).r;
     color += (noise - 0.5) * 0.04;
 
     // Slight desaturation
@@ -79,7 +56,7 @@ void main() {
     color *= mix(1.0, vignette, 0.3);
 
     // Text preservation: keep original in high-detail areas
-    float detail = textDetect(v_texcoord, texel);
+    float detail = ss_text_detect(v_texcoord);
     color = mix(color, orig, detail * 0.6);
 
     frag_color = vec4(color, 1.0);
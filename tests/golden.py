@@ -0,0 +1,400 @@
+#!/usr/bin/env python3
+"""
+golden.py - Golden-image and timing regression check for the shaders
+
+Renders every shader in shaders/ through `screenshader-preview --input-ppm`
+on a fixed set of synthetic reference images at fixed u_time values, and
+compares each result with the stored reference in tests/golden/ using a
+perceptual (CIELAB delta-E) tolerance. GPU time for every render is
+recorded next to the result, so an optimization can show both that it still
+looks the same and that it got faster.
+
+Run through tests/run-golden.sh, which selects llvmpipe so results do not
+depend on the host GPU, and provides Xvfb when rendering through GLX.
+
+  golden.py                    compare against references
+  golden.py --update           (re)write references and reference timings
+  golden.py --shader crt ...   restrict to some shaders
+  golden.py --no-compute       render on the fragment path only (record
+                               references with this to check the compute
+                               tile path against them)
+  golden.py --batch            render each input's frames as one sequence
+                               through the preview's batch mode
+  golden.py --glx              render through a GLX pbuffer on $DISPLAY
+                               instead of headless EGL
+
+Results go to tests/out/: one PPM per render, a diff heat-map for every
+failure, and results.tsv with timings, speedup and error metrics.
+"""
+
+import argparse
+import gzip
+import math
+import os
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SHADER_DIR = os.path.join(ROOT, "shaders")
+GOLDEN_DIR = os.path.join(ROOT, "tests", "golden")
+OUT_DIR = os.path.join(ROOT, "tests", "out")
+PREVIEW = os.path.join(ROOT, "screenshader-preview")
+
+WIDTH, HEIGHT = 256, 160
+TIMES = (0.5, 2.25)
+SKIP = {"composite.frag"}   # compositor-internal, not a post-process shader
+
+
+# ---------------------------------------------------------------------------
+# PPM I/O
+# ---------------------------------------------------------------------------
+
+def encode_ppm(w, h, rgb):
+    return b"P6\n%d %d\n255\n" % (w, h) + bytes(rgb)
+
+
+def decode_ppm(data):
+    # P6 header: magic, width, height, maxval separated by whitespace
+    fields, pos = [], 0
+    while len(fields) < 4:
+        while data[pos:pos + 1].isspace():
+            pos += 1
+        if data[pos:pos + 1] == b"#":
+            pos = data.index(b"\n", pos) + 1
+            continue
+        end = pos
+        while not data[end:end + 1].isspace():
+            end += 1
+        fields.append(data[pos:end])
+        pos = end
+    if fields[0] != b"P6" or fields[3] != b"255":
+        raise ValueError("not an 8-bit P6 PPM")
+    w, h = int(fields[1]), int(fields[2])
+    pixels = data[pos + 1:pos + 1 + w * h * 3]
+    if len(pixels) != w * h * 3:
+        raise ValueError("truncated PPM")
+    return w, h, pixels
+
+
+def read_ref(path):
+    with gzip.open(path, "rb") as f:
+        return decode_ppm(f.read())
+
+
+def write_ref(path, w, h, rgb):
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    # mtime=0 keeps regenerated references byte-identical
+    with open(path, "wb") as raw, gzip.GzipFile(fileobj=raw, mode="wb", mtime=0) as f:
+        f.write(encode_ppm(w, h, rgb))
+
+
+# ---------------------------------------------------------------------------
+# Reference inputs (synthetic, deterministic)
+# ---------------------------------------------------------------------------
+
+def _clamp8(v):
+    return 0 if v < 0 else 255 if v > 255 else int(v + 0.5)
+
+
+def input_gradients():
+    """Hue sweep across, luma ramp down: exercises colour grading and LUTs."""
+    rgb = bytearray()
+    for y in range(HEIGHT):
+        v = y / (HEIGHT - 1)
+        for x in range(WIDTH):
+            h = x / WIDTH * 6.0
+            i, f = int(h), h - int(h)
+            rgbf = [(1, f, 0), (1 - f, 1, 0), (0, 1, f),
+                    (0, 1 - f, 1), (f, 0, 1), (1, 0, 1 - f)][i % 6]
+            # top half: saturated hue darkening, bottom half: toward grey
+            s = 1.0 if v < 0.5 else 1.0 - (v - 0.5) * 2.0
+            l = 1.0 - v * 0.6
+            rgb += bytes(_clamp8((c * s + 0.5 * (1 - s)) * l * 255) for c in rgbf)
+    return rgb
+
+
+def input_desktop():
+    """Flat panels, title bars, hairlines and text-like glyph rows:
+    exercises edge detection and neighbourhood kernels."""
+    rgb = bytearray(b"\x30\x38\x48" * WIDTH * HEIGHT)
+
+    def rect(x0, y0, x1, y1, c):
+        for y in range(max(y0, 0), min(y1, HEIGHT)):
+            row = y * WIDTH * 3
+            for x in range(max(x0, 0), min(x1, WIDTH)):
+                rgb[row + x * 3:row + x * 3 + 3] = c
+
+    rect(0, HEIGHT - 12, WIDTH, HEIGHT, b"\x20\x20\x20")          # panel
+    rect(14, 10, 150, 120, b"\xf0\xf0\xf0")                       # window
+    rect(14, 10, 150, 24, b"\x3a\x6e\xc8")                        # title bar
+    rect(110, 40, 240, 140, b"\x28\x28\x28")                      # terminal
+    rect(110, 40, 240, 52, b"\x60\x60\x60")
+    # Glyph rows: 5x7 cells driven by a fixed bit pattern
+    seed = 0x2545F491
+    for base_x, base_y, c, x_end in ((20, 30, b"\x10\x10\x10", 104),
+                                     (116, 58, b"\x50\xf0\x50", 234)):
+        for line in range(8):
+            for cell in range((x_end - base_x) // 6):
+                seed = (seed * 1103515245 + 12345) & 0x7FFFFFFF
+                for gy in range(7):
+                    for gx in range(5):
+                        if (seed >> (gy * 4 + gx)) & 1:
+                            rect(base_x + cell * 6 + gx, base_y + line * 10 + gy,
+                                 base_x + cell * 6 + gx + 1,
+                                 base_y + line * 10 + gy + 1, c)
+    for x in range(0, WIDTH, 16):                                  # hairlines
+        rect(x, HEIGHT - 12, x + 1, HEIGHT, b"\x80\x80\x80")
+    return rgb
+
+
+def input_photo():
+    """Smooth, photo-like colour field with soft highlights."""
+    rgb = bytearray()
+    for y in range(HEIGHT):
+        for x in range(WIDTH):
+            u, v = x / WIDTH, y / HEIGHT
+            r = 0.5 + 0.35 * math.sin(6.1 * u + 2.3 * v) + 0.1 * math.sin(23 * u * v)
+            g = 0.45 + 0.3 * math.sin(4.2 * v - 1.7 * u + 1.0)
+            b = 0.4 + 0.3 * math.cos(5.3 * u * u + 3.1 * v)
+            spot = math.exp(-((u - 0.7) ** 2 + (v - 0.3) ** 2) * 40.0) * 0.6
+            rgb += bytes(_clamp8((c + spot) * 255) for c in (r, g, b))
+    return rgb
+
+
+INPUTS = {
+    "gradients": input_gradients,
+    "desktop": input_desktop,
+    "photo": input_photo,
+}
+
+
+# ---------------------------------------------------------------------------
+# Perceptual comparison (CIE76 delta-E in CIELAB, D65)
+# ---------------------------------------------------------------------------
+
+_LINEAR = [((c / 255) / 12.92) if c <= 10 else (((c / 255) + 0.055) / 1.055) ** 2.4
+           for c in range(256)]
+
+
+def _f(t):
+    return t ** (1.0 / 3.0) if t > 216 / 24389 else (24389 / 27 * t + 16) / 116
+
+
+def _to_lab(rgb):
+    lab = []
+    cache = {}
+    for i in range(0, len(rgb), 3):
+        key = (rgb[i] << 16) | (rgb[i + 1] << 8) | rgb[i + 2]
+        v = cache.get(key)
+        if v is None:
+            r, g, b = _LINEAR[rgb[i]], _LINEAR[rgb[i + 1]], _LINEAR[rgb[i + 2]]
+            x = (0.4124 * r + 0.3576 * g + 0.1805 * b) / 0.95047
+            y = 0.2126 * r + 0.7152 * g + 0.0722 * b
+            z = (0.0193 * r + 0.1192 * g + 0.9505 * b) / 1.08883
+            fx, fy, fz = _f(x), _f(y), _f(z)
+            v = (116 * fy - 16, 500 * (fx - fy), 200 * (fy - fz))
+            cache[key] = v
+        lab.append(v)
+    return lab
+
+
+def compare(ref, out):
+    """Return (mean dE, p99 dE, per-pixel dE list)."""
+    a, b = _to_lab(ref), _to_lab(out)
+    de = [math.sqrt((p[0] - q[0]) ** 2 + (p[1] - q[1]) ** 2 + (p[2] - q[2]) ** 2)
+          for p, q in zip(a, b)]
+    ranked = sorted(de)
+    return sum(de) / len(de), ranked[int(len(ranked) * 0.99)], de
+
+
+def heatmap(de):
+    """Diff image: black = identical, red = delta-E 10 or more."""
+    rgb = bytearray()
+    for d in de:
+        t = min(d / 10.0, 1.0)
+        rgb += bytes((_clamp8(t * 255), _clamp8(t * 64), 0))
+    return rgb
+
+
+# ---------------------------------------------------------------------------
+# Rendering
+# ---------------------------------------------------------------------------
+
+def render(shader, input_ppm, t, bench, extra_args=()):
+    cmd = [PREVIEW, shader, "--input-ppm", "--time", repr(t), "--bench", str(bench)]
+    cmd += list(extra_args)
+    proc = subprocess.run(cmd, input=input_ppm, capture_output=True)
+    if proc.returncode != 0:
+        raise RuntimeError(proc.stderr.decode(errors="replace").strip())
+    ms = None
+    for line in proc.stderr.decode(errors="replace").splitlines():
+        if line.startswith("render_ms "):
+            ms = float(line.split()[1])
+    w, h, rgb = decode_ppm(proc.stdout)
+    return w, h, rgb, ms
+
+
+def render_batch(shader, input_ppm, extra_args=()):
+    """One batch run with the input once per entry of TIMES; u_time steps
+    from TIMES[0] by the spacing of TIMES."""
+    rate = 1.0 / (TIMES[1] - TIMES[0])
+    cmd = [PREVIEW, shader, "--batch", "-", "--time", repr(TIMES[0]), "--rate", repr(rate)]
+    cmd += list(extra_args)
+    proc = subprocess.run(cmd, input=input_ppm * len(TIMES), capture_output=True)
+    if proc.returncode != 0:
+        raise RuntimeError(proc.stderr.decode(errors="replace").strip())
+    frames, data = [], proc.stdout
+    for _ in TIMES:
+        w, h, rgb = decode_ppm(data)
+        frames.append((w, h, rgb))
+        data = data[data.index(b"255\n") + 4 + w * h * 3:]
+    return frames
+
+
+def load_timings(path):
+    timings = {}
+    if os.path.exists(path):
+        with open(path) as f:
+            for line in f:
+                if line.startswith("#") or not line.strip():
+                    continue
+                key, ms = line.rsplit("\t", 1)
+                timings[key] = float(ms)
+    return timings
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("--update", action="store_true",
+                    help="write references instead of comparing")
+    ap.add_argument("--shader", action="append", default=[],
+                    help="only run this shader (name or file, repeatable)")
+    ap.add_argument("--no-compute", action="store_true",
+                    help="force the fragment path (e.g. to record references "
+                         "that the compute tile path is checked against)")
+    ap.add_argument("--batch", action="store_true",
+                    help="render through batch mode (no timings)")
+    ap.add_argument("--glx", action="store_true",
+                    help="render through GLX on $DISPLAY, not headless EGL")
+    ap.add_argument("--bench", type=int, default=20,
+                    help="timed draws per render (default 20)")
+    ap.add_argument("--max-mean", type=float, default=1.0,
+                    help="max mean delta-E (default 1.0)")
+    ap.add_argument("--max-p99", type=float, default=5.0,
+                    help="max 99th-percentile delta-E (default 5.0)")
+    ap.add_argument("--max-slowdown", type=float, default=0.0,
+                    help="fail if render time exceeds reference by this "
+                         "factor (default: report only)")
+    args = ap.parse_args()
+
+    if not os.access(PREVIEW, os.X_OK):
+        sys.exit("golden: %s not built, run 'make' first" % PREVIEW)
+
+    shaders = sorted(f for f in os.listdir(SHADER_DIR)
+                     if f.endswith(".frag") and f not in SKIP)
+    if args.shader:
+        wanted = {os.path.basename(s) if s.endswith(".frag") else s + ".frag"
+                  for s in args.shader}
+        shaders = [s for s in shaders if s in wanted]
+
+    inputs = {name: encode_ppm(WIDTH, HEIGHT, make()) for name, make in INPUTS.items()}
+
+    timings_path = os.path.join(GOLDEN_DIR, "timings.tsv")
+    ref_ms = load_timings(timings_path)
+    os.makedirs(OUT_DIR, exist_ok=True)
+    results = open(os.path.join(OUT_DIR, "results.tsv"), "w")
+    results.write("shader\tinput\ttime\trender_ms\tref_ms\tspeedup\tmean_de\tp99_de\tstatus\n")
+
+    failures = 0
+    for shader in shaders:
+        name = shader[:-len(".frag")]
+        for input_name, input_ppm in inputs.items():
+            extra = (["--no-compute"] if args.no_compute else []) + \
+                    (["--glx"] if args.glx else [])
+            frames, batch_error = None, None
+            if args.batch:
+                try:
+                    frames = render_batch(os.path.join(SHADER_DIR, shader), input_ppm, extra)
+                except (RuntimeError, ValueError) as e:
+                    batch_error = str(e)
+            for i, t in enumerate(TIMES):
+                key = "%s/%s@%g" % (name, input_name, t)
+                ref_path = os.path.join(GOLDEN_DIR, name, "%s@%g.ppm.gz" % (input_name, t))
+                try:
+                    if batch_error:
+                        raise RuntimeError(batch_error)
+                    if frames:
+                        (w, h, rgb), ms = frames[i], None
+                    else:
+                        w, h, rgb, ms = render(os.path.join(SHADER_DIR, shader),
+                                               input_ppm, t, args.bench, extra)
+                except RuntimeError as e:
+                    print("FAIL  %-28s render error: %s" % (key, e))
+                    results.write("%s\t%s\t%g\t\t\t\t\t\terror\n" % (name, input_name, t))
+                    failures += 1
+                    continue
+
+                out_base = os.path.join(OUT_DIR, name, "%s@%g" % (input_name, t))
+                os.makedirs(os.path.dirname(out_base), exist_ok=True)
+                with open(out_base + ".ppm", "wb") as f:
+                    f.write(encode_ppm(w, h, rgb))
+
+                if args.update:
+                    write_ref(ref_path, w, h, rgb)
+                    if ms is not None:
+                        ref_ms[key] = ms
+                    print("ref   %-28s %8.3f ms" % (key, ms or 0.0))
+                    results.write("%s\t%s\t%g\t%s\t\t\t\t\tupdated\n" %
+                                  (name, input_name, t, "" if ms is None else "%.4f" % ms))
+                    continue
+
+                if not os.path.exists(ref_path):
+                    print("MISS  %-28s no reference (run 'make golden')" % key)
+                    results.write("%s\t%s\t%g\t%.4f\t\t\t\t\tmissing\n" %
+                                  (name, input_name, t, ms or 0.0))
+                    failures += 1
+                    continue
+
+                rw, rh, ref = read_ref(ref_path)
+                if (rw, rh) != (w, h):
+                    mean, p99, de = float("inf"), float("inf"), None
+                else:
+                    mean, p99, de = compare(ref, rgb)
+
+                base = ref_ms.get(key)
+                speedup = base / ms if base and ms else None
+                ok = mean <= args.max_mean and p99 <= args.max_p99
+                if ok and args.max_slowdown > 0 and speedup is not None:
+                    ok = speedup >= 1.0 / args.max_slowdown
+                if not ok:
+                    failures += 1
+                    if de is not None:
+                        with open(out_base + ".diff.ppm", "wb") as f:
+                            f.write(encode_ppm(w, h, heatmap(de)))
+
+                print("%-5s %-28s dE mean %5.2f p99 %5.2f  %8.3f ms%s" % (
+                    "ok" if ok else "FAIL", key, mean, p99, ms or 0.0,
+                    "  (%.2fx)" % speedup if speedup else ""))
+                results.write("%s\t%s\t%g\t%.4f\t%s\t%s\t%.3f\t%.3f\t%s\n" % (
+                    name, input_name, t, ms or 0.0,
+                    "" if base is None else "%.4f" % base,
+                    "" if speedup is None else "%.3f" % speedup,
+                    mean, p99, "ok" if ok else "fail"))
+
+    results.close()
+
+    if args.update:
+        os.makedirs(GOLDEN_DIR, exist_ok=True)
+        with open(timings_path, "w") as f:
+            f.write("# shader/input@time\trender_ms (median GPU time, llvmpipe)\n")
+            for key in sorted(ref_ms):
+                f.write("%s\t%.4f\n" % (key, ref_ms[key]))
+        print("References written to %s" % GOLDEN_DIR)
+        return 0
+
+    print("%d failure(s); results in %s" % (failures, os.path.join(OUT_DIR, "results.tsv")))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
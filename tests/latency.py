@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+"""
+latency.py - Damage-to-photon latency of the compositor
+
+Runs screenshader --latency against screenshader-workload --latency-probe:
+the probe flips a marker square between black and white, and the
+compositor times each flip from the moment the X server drew it to the
+swap of the first frame that shows it. Each shader is measured with the
+desktop otherwise idle and again under background load, so a regression
+in either the pipeline or the event path shows up as a shifted
+distribution. Every shader and load gets a compositor of its own, so no
+row's percentiles include another's samples.
+
+Run through tests/run-latency.sh, which provides Xvfb + llvmpipe.
+
+  latency.py                       default shaders, idle and loaded
+  latency.py --shader crt          one shader, name or file (repeatable)
+  latency.py --load idle           one load (repeatable)
+  latency.py --duration 20         seconds per run (default 10)
+
+Results go to tests/out/latency.tsv.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import time
+
+from workload import (COMPOSITOR, OUT_DIR, ROOT, WORKLOAD, read_stats,
+                      start_compositor, stop_compositor)
+
+# Marker centre, clear of the corner a panel would take
+PROBE = "80,80"
+
+SHADERS = ("nightlight", "crt", "vhs")
+
+# Background windows and what they do while the probe flips
+LOADS = {
+    "idle":   [],
+    "loaded": ["--windows", "90", "--override", "10", "--damage", "600",
+               "--move", "60", "--restack", "30", "--argb", "25"],
+}
+
+COLUMNS = ("samples", "unmatched", "min", "mean", "p50", "p90", "p99", "max")
+
+
+def run_load(comp, load, args):
+    cmd = [WORKLOAD, "--latency-probe", PROBE, "--duration", str(args.duration),
+           "--seed", str(args.seed)]
+    cmd += LOADS[load] or ["--windows", "0"]
+    gen = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+    if gen.stdout.readline().strip() != "ready":
+        gen.wait()
+        raise RuntimeError("workload: " + gen.stderr.read().strip())
+    # The compositor is this run's own, so its percentiles cover this run
+    # alone; counts from before the probe started are subtracted
+    before = read_stats(comp.pid)
+    flips = 0
+    for line in gen.stdout:
+        key, _, value = line.partition(" ")
+        if key == "probe_flips":
+            flips = int(value)
+    gen.wait()
+    if gen.returncode != 0:
+        raise RuntimeError("workload: " + gen.stderr.read().strip())
+    time.sleep(0.2)   # frames still in flight
+    after = read_stats(comp.pid)
+
+    row = {"flips": flips}
+    row["samples"] = after.get("latency_samples", 0) - before.get("latency_samples", 0)
+    row["unmatched"] = after.get("latency_unmatched", 0) - before.get("latency_unmatched", 0)
+    for key in COLUMNS[2:]:
+        row[key] = after.get("latency_ms_" + key, 0)
+    return row
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("--shader", action="append", default=[],
+                    help="compositor shader (repeatable; default %s)" % ", ".join(SHADERS))
+    ap.add_argument("--load", action="append", default=[], choices=sorted(LOADS),
+                    help="background load (repeatable; default all)")
+    ap.add_argument("--duration", type=float, default=10.0,
+                    help="seconds per run (default 10)")
+    ap.add_argument("--seed", type=int, default=1, help="workload PRNG seed")
+    args = ap.parse_args()
+
+    for path in (COMPOSITOR, WORKLOAD):
+        if not os.access(path, os.X_OK):
+            sys.exit("%s not found, run make first" % path)
+
+    os.makedirs(OUT_DIR, exist_ok=True)
+    tsv = open(os.path.join(OUT_DIR, "latency.tsv"), "w")
+    tsv.write("shader\tload\tflips\t" + "\t".join(COLUMNS) + "\n")
+    print("%-12s %-7s %6s %6s %7s %7s %7s %7s" % ("shader", "load", "flips", "seen",
+                                                 "p50", "p90", "p99", "max"))
+
+    failed = False
+    for name in args.shader or list(SHADERS):
+        shader = name
+        if not os.path.exists(shader):
+            shader = os.path.join(ROOT, "shaders", name + ".frag")
+        for load in args.load or list(LOADS):
+            # A fresh compositor per shader and load: its latency
+            # percentiles cover every sample since it started, so each
+            # distribution is its own
+            try:
+                comp = start_compositor(shader, False, ["--latency", PROBE])
+            except RuntimeError as e:
+                print("%-12s %-7s FAILED: %s" % (name, load, e))
+                failed = True
+                continue
+            try:
+                row = run_load(comp, load, args)
+            except RuntimeError as e:
+                print("%-12s %-7s FAILED: %s" % (name, load, e))
+                failed = True
+                continue
+            finally:
+                stop_compositor(comp)
+            # A flip the compositor never showed is a dropped frame or a
+            # shader that hides the marker; either way the run is suspect
+            if row["samples"] == 0:
+                failed = True
+            tsv.write("%s\t%s\t%d\t" % (name, load, row["flips"]) +
+                      "\t".join("%.2f" % row[c] for c in COLUMNS) + "\n")
+            tsv.flush()
+            print("%-12s %-7s %6d %6d %7.2f %7.2f %7.2f %7.2f" % (
+                name, load, row["flips"], row["samples"], row["p50"],
+                row["p90"], row["p99"], row["max"]))
+    tsv.close()
+    print("Results: %s" % os.path.relpath(os.path.join(OUT_DIR, "latency.tsv"), ROOT))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
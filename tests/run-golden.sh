@@ -0,0 +1,35 @@
+#!/usr/bin/env bash
+#
+# run-golden.sh - Run tests/golden.py with Mesa's llvmpipe
+#
+# Renders go through the llvmpipe software rasterizer so references and
+# timings are reproducible across machines. The preview renders headless
+# through EGL when libegl is installed; otherwise, or with --glx, it runs
+# under a private Xvfb server.
+# Arguments are passed through to golden.py (e.g. --update, --shader crt).
+
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+
+export LIBGL_ALWAYS_SOFTWARE=1
+export GALLIUM_DRIVER=llvmpipe
+# One rasterizer thread keeps timings comparable between machines
+export LP_NUM_THREADS="${LP_NUM_THREADS:-1}"
+
+glx=false
+for arg in "$@"; do
+    [ "$arg" = "--glx" ] && glx=true
+done
+# Same test as the Makefile's for building the preview with EGL
+if ! $glx && pkg-config --exists egl 2>/dev/null; then
+    exec python3 tests/golden.py "$@"
+fi
+
+if ! command -v xvfb-run &>/dev/null; then
+    echo "Error: xvfb-run not found (install xvfb, or libegl to render headless)"
+    exit 1
+fi
+
+exec xvfb-run -a -s "-screen 0 1024x768x24 +extension GLX" \
+    python3 tests/golden.py "$@"
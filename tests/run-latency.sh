@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+#
+# run-latency.sh - Run tests/latency.py under Xvfb with Mesa's llvmpipe
+#
+# The compositor and the latency probe share a private Xvfb server, with
+# the same screen as run-workload.sh. Arguments are passed through to
+# latency.py (e.g. --shader crt, --load idle).
+
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+
+if ! command -v xvfb-run &>/dev/null; then
+    echo "Error: xvfb-run not found (install xvfb)"
+    exit 1
+fi
+
+export LIBGL_ALWAYS_SOFTWARE=1
+export GALLIUM_DRIVER=llvmpipe
+
+exec xvfb-run -a -s "-screen 0 1920x1080x24 +extension GLX +extension Composite" \
+    python3 tests/latency.py "$@"
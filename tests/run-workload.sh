@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+#
+# run-workload.sh - Run tests/workload.py under Xvfb with Mesa's llvmpipe
+#
+# The compositor and the workload generator share a private Xvfb server
+# large enough for 1000 windows. Arguments are passed through to
+# workload.py (e.g. --windows 100, --scenario churn).
+
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+
+if ! command -v xvfb-run &>/dev/null; then
+    echo "Error: xvfb-run not found (install xvfb)"
+    exit 1
+fi
+
+export LIBGL_ALWAYS_SOFTWARE=1
+export GALLIUM_DRIVER=llvmpipe
+
+exec xvfb-run -a -s "-screen 0 1920x1080x24 +extension GLX +extension Composite" \
+    python3 tests/workload.py "$@"
@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+"""
+workload.py - Compositor stress benchmark with synthetic window churn
+
+Runs screenshader against screenshader-workload scenarios at several window
+counts and records what the compositor did during each one: frames, deltas
+from the event thread, X traffic and its CPU time. The workload generator
+is seeded, so a scenario sends the same requests on every run, and two
+commits can be compared scenario by scenario.
+
+Run through tests/run-workload.sh, which provides Xvfb + llvmpipe.
+
+  workload.py                      every scenario at 10, 100 and 1000 windows
+  workload.py --windows 100        one window count (repeatable)
+  workload.py --scenario damage    one scenario (repeatable)
+  workload.py --shader crt         shader for the compositor (default nightlight)
+  workload.py --software           run the compositor's software backend
+
+Results go to tests/out/workload.tsv.
+"""
+
+import argparse
+import os
+import signal
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+OUT_DIR = os.path.join(ROOT, "tests", "out")
+COMPOSITOR = os.path.join(ROOT, "screenshader")
+WORKLOAD = os.path.join(ROOT, "screenshader-workload")
+STATS_FILE = "/tmp/screenshader.stats"
+
+WINDOW_COUNTS = (10, 100, 1000)
+
+# Rates are per second over all windows; a tenth of the windows are
+# override-redirect in every scenario
+SCENARIOS = {
+    "idle":    [],
+    "damage":  ["--damage", "600", "--argb", "25"],
+    "move":    ["--move", "300"],
+    "resize":  ["--resize", "120"],
+    "restack": ["--restack", "200"],
+    "churn":   ["--churn", "100"],
+    "mixed":   ["--damage", "300", "--move", "60", "--resize", "30",
+                "--restack", "30", "--churn", "20", "--argb", "25"],
+}
+
+# Compositor stats reported per scenario, as differences over the run
+COUNTERS = ("frames", "deltas", "x_events", "x_requests", "x_round_trips",
+            "fence_syncs", "sw_captures")
+
+
+# ---------------------------------------------------------------------------
+# Compositor
+# ---------------------------------------------------------------------------
+
+def read_stats(pid, timeout=2.0):
+    """Ask the compositor for its stats (SIGUSR2) and parse them."""
+    if os.path.exists(STATS_FILE):
+        os.unlink(STATS_FILE)
+    os.kill(pid, signal.SIGUSR2)
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        try:
+            f = open(STATS_FILE)   # renamed into place once complete
+        except FileNotFoundError:
+            time.sleep(0.01)
+            continue
+        stats = {}
+        with f:
+            for line in f:
+                key, _, value = line.partition(" ")
+                try:
+                    stats[key] = float(value)
+                except ValueError:
+                    pass
+        return stats
+    raise RuntimeError("compositor wrote no stats")
+
+
+def cpu_seconds(pid):
+    """User + system CPU time of a process, from /proc."""
+    with open("/proc/%d/stat" % pid) as f:
+        fields = f.read().rsplit(")", 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def start_compositor(shader, software, extra=()):
+    cmd = [COMPOSITOR] + (["--software"] if software else []) + list(extra) + [shader]
+    proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    # Up once it answers a stats request
+    deadline = time.monotonic() + 10.0
+    while time.monotonic() < deadline:
+        if proc.poll() is not None:
+            raise RuntimeError(proc.stderr.read().decode(errors="replace").strip())
+        try:
+            read_stats(proc.pid, timeout=0.5)
+            return proc
+        except RuntimeError:
+            pass
+    proc.kill()
+    raise RuntimeError("compositor did not start")
+
+
+def stop_compositor(proc):
+    proc.send_signal(signal.SIGTERM)
+    try:
+        proc.wait(timeout=5)
+    except subprocess.TimeoutExpired:
+        proc.kill()
+        proc.wait()
+
+
+# ---------------------------------------------------------------------------
+# Scenarios
+# ---------------------------------------------------------------------------
+
+def run_scenario(comp, windows, name, args):
+    override = windows // 10
+    cmd = [WORKLOAD, "--windows", str(windows - override), "--override", str(override),
+           "--duration", str(args.duration), "--seed", str(args.seed)] + SCENARIOS[name]
+    gen = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+
+    # Snapshot once the windows are up, and again after the run
+    line = gen.stdout.readline()
+    if line.strip() != "ready":
+        gen.wait()
+        raise RuntimeError("workload: " + gen.stderr.read().strip())
+    time.sleep(args.settle)
+    before, cpu_before = read_stats(comp.pid), cpu_seconds(comp.pid)
+
+    report = {}
+    for line in gen.stdout:
+        key, _, value = line.partition(" ")
+        report[key] = float(value)
+        if key == "max_lag_ms":
+            break
+    after, cpu_after = read_stats(comp.pid), cpu_seconds(comp.pid)
+    gen.wait()
+    if gen.returncode != 0:
+        raise RuntimeError("workload: " + gen.stderr.read().strip())
+
+    seconds = report.get("duration_s", args.duration)
+    row = {key: after.get(key, 0) - before.get(key, 0) for key in COUNTERS}
+    row["fps"] = row["frames"] / seconds if seconds > 0 else 0.0
+    row["cpu_pct"] = 100.0 * (cpu_after - cpu_before) / seconds if seconds > 0 else 0.0
+    row["x_frame_requests_max"] = after.get("x_frame_requests_max", 0)   # busiest frame since the `before` dump
+    row["ops"] = sum(report.get(k, 0) for k in ("damage", "moves", "resizes",
+                                                "restacks", "churn"))
+    row["gen_lag_ms"] = report.get("max_lag_ms", 0)
+    row["setup_s"] = report.get("setup_s", 0)
+    return row
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("--windows", type=int, action="append", default=[],
+                    help="window count (repeatable; default 10, 100, 1000)")
+    ap.add_argument("--scenario", action="append", default=[],
+                    choices=sorted(SCENARIOS), help="scenario (repeatable; default all)")
+    ap.add_argument("--shader", default="nightlight",
+                    help="compositor shader, name or file (default nightlight)")
+    ap.add_argument("--software", action="store_true",
+                    help="run the compositor's software backend")
+    ap.add_argument("--duration", type=float, default=5.0,
+                    help="seconds per scenario (default 5)")
+    ap.add_argument("--settle", type=float, default=0.5,
+                    help="seconds between window setup and the first snapshot")
+    ap.add_argument("--seed", type=int, default=1, help="workload PRNG seed")
+    args = ap.parse_args()
+
+    for path in (COMPOSITOR, WORKLOAD):
+        if not os.access(path, os.X_OK):
+            sys.exit("%s not found, run make first" % path)
+    shader = args.shader
+    if not os.path.exists(shader):
+        shader = os.path.join(ROOT, "shaders", shader + ".frag")
+    counts = args.windows or list(WINDOW_COUNTS)
+    names = args.scenario or list(SCENARIOS)
+
+    os.makedirs(OUT_DIR, exist_ok=True)
+    columns = ("fps", "cpu_pct") + COUNTERS + ("x_frame_requests_max", "ops",
+                                               "gen_lag_ms", "setup_s")
+    tsv = open(os.path.join(OUT_DIR, "workload.tsv"), "w")
+    tsv.write("windows\tscenario\t" + "\t".join(columns) + "\n")
+    print("%7s %-8s %7s %6s %8s %9s %8s" % ("windows", "scenario", "fps", "cpu%",
+                                          "deltas", "x_reqs", "x_rtrips"))
+
+    failed = False
+    comp = start_compositor(shader, args.software)
+    try:
+        for windows in counts:
+            for name in names:
+                try:
+                    row = run_scenario(comp, windows, name, args)
+                except RuntimeError as e:
+                    print("%7d %-8s FAILED: %s" % (windows, name, e))
+                    failed = True
+                    if comp.poll() is not None:
+                        comp = start_compositor(shader, args.software)
+                    continue
+                tsv.write("%d\t%s\t" % (windows, name) +
+                          "\t".join("%.2f" % row[c] for c in columns) + "\n")
+                tsv.flush()
+                print("%7d %-8s %7.1f %6.1f %8d %9d %8d" % (
+                    windows, name, row["fps"], row["cpu_pct"], row["deltas"],
+                    row["x_requests"], row["x_round_trips"]))
+    finally:
+        stop_compositor(comp)
+        tsv.close()
+    print("Results: %s" % os.path.relpath(os.path.join(OUT_DIR, "workload.tsv"), ROOT))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())